@@ -0,0 +1,684 @@
+/*
+ *  PKBenchmarks.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+//
+//	PlayerKitBenchmarks measures the throughput of the decode -> convert -> schedule pipeline.
+//
+//	usage: PlayerKitBenchmarks [--seconds <n>] [--iterations <n>] [--bandwidth <bytes/s>] [audio files...]
+//
+//	Every result is written to stdout as a single line JSON object, so runs can be diffed
+//	and plotted. Synthetic fixtures are always generated; any audio files passed in are
+//	benchmarked with every registered decoder that can decode them as well, on one thread and,
+//	for decoders that can, on several at once. Every fixture is also streamed into the audio
+//	player at the given bandwidth to time its first audio.
+//
+//	The engine, task queue and parallel decoder benchmarks use classes PlayerKit.framework
+//	does not export, so their sources are built into this tool as well.
+//
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <AudioToolbox/AudioToolbox.h>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "PKAudioPlayer.h"
+#include "PKAudioPlayerEngine.h"
+#include "PKDecoder.h"
+#include "PKParallelDecoder.h"
+#include "PKTaskQueue.h"
+
+#include "CAHostTimeBase.h"
+#include "CAStreamBasicDescription.h"
+
+#pragma mark Tools
+
+static Float64 SecondsSinceHostTime(UInt64 startHostTime)
+{
+	return CAHostTimeBase::AbsoluteHostDeltaToNanos(startHostTime, CAHostTimeBase::GetTheCurrentTime()) / 1000000000.0;
+}
+
+static void EmitResult(const char *benchmark, const char *subject, const char *metric, Float64 value, const char *unit)
+{
+	printf("{\"benchmark\": \"%s\", \"subject\": \"%s\", \"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}\n",
+		   benchmark, subject, metric, value, unit);
+	fflush(stdout);
+}
+
+static void EmitError(const char *benchmark, const char *subject, CFErrorRef error)
+{
+	char description[512] = "unknown error";
+	if(error)
+	{
+		CFStringRef errorDescription = CFErrorCopyDescription(error);
+		CFStringGetCString(errorDescription, description, sizeof(description), kCFStringEncodingUTF8);
+		CFRelease(errorDescription);
+	}
+	
+	printf("{\"benchmark\": \"%s\", \"subject\": \"%s\", \"error\": \"%s\"}\n", benchmark, subject, description);
+	fflush(stdout);
+}
+
+static AudioBufferList *AllocateCanonicalBuffers(UInt32 numberOfFrames)
+{
+	AudioBufferList *buffers = (AudioBufferList *)calloc(1, offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * 2));
+	buffers->mNumberBuffers = 2;
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+	{
+		buffers->mBuffers[index].mNumberChannels = 1;
+		buffers->mBuffers[index].mDataByteSize = numberOfFrames * sizeof(Float32);
+		buffers->mBuffers[index].mData = calloc(numberOfFrames, sizeof(Float32));
+	}
+	
+	return buffers;
+}
+
+static void ResetCanonicalBuffers(AudioBufferList *buffers, UInt32 numberOfFrames)
+{
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFrames * sizeof(Float32);
+}
+
+static void DeallocateCanonicalBuffers(AudioBufferList *buffers)
+{
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+		free(buffers->mBuffers[index].mData);
+	
+	free(buffers);
+}
+
+#pragma mark -
+#pragma mark Synthetic Audio
+
+/*!
+ @abstract		The PKSyntheticDecoder class produces a sine wave in an arbitrary linear PCM format.
+ @discussion	Synthetic decoders take the file system out of the picture, which makes the
+				cost of the converter and scheduling stages visible on their own.
+ */
+class PKSyntheticDecoder : public PKDecoder
+{
+protected:
+	
+	/* n/a */	CAStreamBasicDescription mStreamFormat;
+	/* n/a */	FrameLocation mTotalNumberOfFrames;
+	/* n/a */	FrameLocation mCurrentFrame;
+
+public:
+	
+	PKSyntheticDecoder(const CAStreamBasicDescription &streamFormat, FrameLocation totalNumberOfFrames) :
+		PKDecoder("PKSyntheticDecoder"),
+		mStreamFormat(streamFormat),
+		mTotalNumberOfFrames(totalNumberOfFrames),
+		mCurrentFrame(0)
+	{
+	}
+	
+	virtual AudioStreamBasicDescription GetStreamFormat() const { return mStreamFormat; }
+	virtual CFURLRef CopyLocation() const { return CFURLCreateWithString(kCFAllocatorDefault, CFSTR("x-playerkit-synthetic:sine"), NULL); }
+	virtual FrameLocation GetTotalNumberOfFrames() const { return mTotalNumberOfFrames; }
+	virtual bool CanSeek() const { return true; }
+	virtual FrameLocation GetCurrentFrame() const { return mCurrentFrame; }
+	virtual void SetCurrentFrame(FrameLocation currentFrame) { mCurrentFrame = std::min(currentFrame, mTotalNumberOfFrames); }
+	
+	virtual UInt32 FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException)
+	{
+		if((mTotalNumberOfFrames - mCurrentFrame) < numberOfFrames)
+			numberOfFrames = UInt32(mTotalNumberOfFrames - mCurrentFrame);
+		
+		bool isFloat = (mStreamFormat.mFormatFlags & kAudioFormatFlagIsFloat) != 0;
+		UInt32 numberOfChannelsPerBuffer = mStreamFormat.IsInterleaved()? mStreamFormat.mChannelsPerFrame : 1;
+		for (UInt32 bufferIndex = 0; bufferIndex < buffers->mNumberBuffers; bufferIndex++)
+		{
+			AudioBuffer &buffer = buffers->mBuffers[bufferIndex];
+			for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+			{
+				Float32 sample = sinf(Float32(2.0 * M_PI * 440.0 * (mCurrentFrame + frame) / mStreamFormat.mSampleRate)) * 0.5f;
+				for (UInt32 channel = 0; channel < numberOfChannelsPerBuffer; channel++)
+				{
+					UInt32 sampleIndex = (frame * numberOfChannelsPerBuffer) + channel;
+					if(isFloat)
+						((Float32 *)buffer.mData)[sampleIndex] = sample;
+					else
+						((SInt16 *)buffer.mData)[sampleIndex] = SInt16(sample * 32767.0f);
+				}
+			}
+			
+			buffer.mDataByteSize = numberOfFrames * mStreamFormat.mBytesPerFrame;
+		}
+		
+		mCurrentFrame += numberOfFrames;
+		
+		return numberOfFrames;
+	}
+};
+
+#pragma mark -
+
+static CAStreamBasicDescription CanonicalFormat()
+{
+	CAStreamBasicDescription format;
+	format.mSampleRate = kPKCanonicalSampleRate;
+	format.SetCanonical(2, false);
+	
+	return format;
+}
+
+static CAStreamBasicDescription SixteenBitInterleavedFormat(Float64 sampleRate)
+{
+	CAStreamBasicDescription format;
+	format.mSampleRate = sampleRate;
+	format.mFormatID = kAudioFormatLinearPCM;
+	format.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked | kAudioFormatFlagsNativeEndian;
+	format.mChannelsPerFrame = 2;
+	format.mBitsPerChannel = 16;
+	format.mFramesPerPacket = 1;
+	format.mBytesPerFrame = format.mBytesPerPacket = 4;
+	
+	return format;
+}
+
+/*!
+ @abstract	Write a sine wave fixture to a specified location in a specified file type and data format.
+ */
+static bool WriteFixture(CFURLRef location, AudioFileTypeID fileType, const CAStreamBasicDescription &fileFormat, Float64 duration)
+{
+	ExtAudioFileRef audioFile = NULL;
+	OSStatus errorCode = ExtAudioFileCreateWithURL(location, fileType, &fileFormat, NULL, kAudioFileFlags_EraseFile, &audioFile);
+	if(errorCode != noErr)
+		return false;
+	
+	CAStreamBasicDescription clientFormat = CanonicalFormat();
+	clientFormat.mSampleRate = fileFormat.mSampleRate;
+	errorCode = ExtAudioFileSetProperty(audioFile, kExtAudioFileProperty_ClientDataFormat, sizeof(clientFormat), &clientFormat);
+	
+	PKSyntheticDecoder *generator = new PKSyntheticDecoder(clientFormat, PKDecoder::FrameLocation(duration * fileFormat.mSampleRate));
+	UInt32 numberOfFramesPerWrite = 4096;
+	AudioBufferList *buffers = AllocateCanonicalBuffers(numberOfFramesPerWrite);
+	while (errorCode == noErr)
+	{
+		ResetCanonicalBuffers(buffers, numberOfFramesPerWrite);
+		
+		UInt32 numberOfFrames = generator->FillBuffers(buffers, numberOfFramesPerWrite);
+		if(numberOfFrames == 0)
+			break;
+		
+		errorCode = ExtAudioFileWrite(audioFile, numberOfFrames, buffers);
+	}
+	
+	DeallocateCanonicalBuffers(buffers);
+	generator->Release();
+	ExtAudioFileDispose(audioFile);
+	
+	return (errorCode == noErr);
+}
+
+#pragma mark -
+#pragma mark Benchmarks
+
+/*!
+ @abstract		Decode a fixture in its entirety with one decoder, optionally wrapped in a parallel decoder.
+ @result		false if the decoder can't decode the fixture in parallel; true otherwise.
+ */
+static bool BenchmarkDecoder(const PKDecoder::Description &decoderDescription, CFURLRef fixture, const char *fixtureName, int iterations, AudioBufferList *buffers, UInt32 numberOfFramesPerRead, bool inParallel)
+{
+	char subject[256];
+	snprintf(subject, sizeof(subject), "%s", fixtureName);
+	
+	try
+	{
+		UInt64 numberOfFramesDecoded = 0;
+		Float64 decodeDuration = 0.0;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			PKDecoder *decoder = decoderDescription.CreateInstance(fixture);
+			if(inParallel)
+			{
+				if(!decoder->CanDecodeInParallel())
+				{
+					decoder->Release();
+					return false;
+				}
+				
+				PKDecoder *parallelDecoder = new PKParallelDecoder(decoder, decoderDescription);
+				snprintf(subject, sizeof(subject), "%s/%s/%s", parallelDecoder->GetClassName(), decoder->GetClassName(), fixtureName);
+				decoder->Release();
+				decoder = parallelDecoder;
+			}
+			else
+			{
+				snprintf(subject, sizeof(subject), "%s/%s", decoder->GetClassName(), fixtureName);
+			}
+			
+			UInt64 startHostTime = CAHostTimeBase::GetTheCurrentTime();
+			for (;;)
+			{
+				ResetCanonicalBuffers(buffers, numberOfFramesPerRead);
+				
+				UInt32 numberOfFrames = decoder->FillBuffers(buffers, numberOfFramesPerRead);
+				if(numberOfFrames == 0)
+					break;
+				
+				numberOfFramesDecoded += numberOfFrames;
+			}
+			decodeDuration += SecondsSinceHostTime(startHostTime);
+			
+			decoder->Release();
+		}
+		
+		EmitResult("decode", subject, "throughput", numberOfFramesDecoded / decodeDuration, "frames/s");
+	}
+	catch (RBException e)
+	{
+		CFErrorRef error = e.CopyError();
+		EmitError("decode", subject, error);
+		CFRelease(error);
+	}
+	
+	return true;
+}
+
+/*!
+ @abstract		Decode a fixture in its entirety with every registered decoder that accepts it.
+ @discussion	Decoders that can decode in parallel are benchmarked a second time wrapped in a parallel decoder.
+ */
+static void BenchmarkDecoders(CFURLRef fixture, const char *fixtureName, int iterations)
+{
+	UInt32 numberOfFramesPerRead = UInt32(kPKCanonicalBaseBufferSize / sizeof(Float32));
+	AudioBufferList *buffers = AllocateCanonicalBuffers(numberOfFramesPerRead);
+	
+	std::vector<PKDecoder::Description> decoders = PKDecoder::GetRegisteredDecoders();
+	for (std::vector<PKDecoder::Description>::const_iterator decoderDescription = decoders.begin(); decoderDescription != decoders.end(); decoderDescription++)
+	{
+		if(!decoderDescription->CanDecode(fixture))
+			continue;
+		
+		BenchmarkDecoder(*decoderDescription, fixture, fixtureName, iterations, buffers, numberOfFramesPerRead, false);
+		BenchmarkDecoder(*decoderDescription, fixture, fixtureName, iterations, buffers, numberOfFramesPerRead, true);
+	}
+	
+	DeallocateCanonicalBuffers(buffers);
+}
+
+/*!
+ @abstract		Render a synthetic decoder through the whole player, offline, as fast as possible.
+ @discussion	A decoder in the canonical format takes the fast path in PKAudioPlayerSetDecoder,
+				any other format goes through the audio converter.
+ */
+static void BenchmarkPipeline(const char *subject, const CAStreamBasicDescription &decoderFormat, Float64 duration, int iterations)
+{
+	Float64 framesPerSecond = 0.0;
+	Float64 realtimeFactor = 0.0;
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		PKSyntheticDecoder *decoder = new PKSyntheticDecoder(decoderFormat, PKDecoder::FrameLocation(duration * decoderFormat.mSampleRate));
+		
+		CFErrorRef error = NULL;
+		if(!PKAudioPlayerSetDecoder(decoder, &error))
+		{
+			EmitError("pipeline", subject, error);
+			if(error) CFRelease(error);
+			
+			decoder->Release();
+			return;
+		}
+		decoder->Release();
+		
+		PKAudioPlayerOfflineRenderResult result;
+		if(!PKAudioPlayerRenderOfflineWithHandler(^(const AudioBufferList *buffers, UInt32 numberOfFrames) { }, 0.0, &result, &error))
+		{
+			EmitError("pipeline", subject, error);
+			if(error) CFRelease(error);
+			
+			return;
+		}
+		
+		framesPerSecond += result.numberOfFramesRendered / result.renderDuration;
+		realtimeFactor += result.realtimeFactor;
+	}
+	
+	EmitResult("pipeline", subject, "throughput", framesPerSecond / iterations, "frames/s");
+	EmitResult("pipeline", subject, "realtime-factor", realtimeFactor / iterations, "x");
+	
+	PKAudioPlayerLatencySummary summary;
+	const PKAudioPlayerLatencyStage stages[] = { kPKAudioPlayerLatencyStageDecode, kPKAudioPlayerLatencyStageConvert, kPKAudioPlayerLatencyStageSchedule };
+	const char *stageNames[] = { "decode", "convert", "schedule" };
+	for (size_t index = 0; index < sizeof(stages) / sizeof(stages[0]); index++)
+	{
+		if(PKAudioPlayerGetLatencySummary(stages[index], &summary) && (summary.numberOfSamples > 0))
+		{
+			char metric[64];
+			snprintf(metric, sizeof(metric), "%s-p99", stageNames[index]);
+			EmitResult("pipeline", subject, metric, summary.ninetyNinthPercentile * 1000000.0, "us");
+		}
+	}
+	
+	PKAudioPlayerResetLatencySummaries();
+	PKAudioPlayerSetDecoder(NULL, NULL);
+}
+
+#pragma mark -
+
+static void NoOperationTask(void *userInfo)
+{
+}
+
+static void CountingTask(void *userInfo)
+{
+	((std::atomic<int32_t> *)userInfo)->fetch_add(1, std::memory_order_relaxed);
+}
+
+/*!
+ @abstract	Measure the round trip of synchronous tasks, and the throughput of asynchronous tasks, through a PKTaskQueue.
+ */
+static void BenchmarkTaskQueue(int iterations)
+{
+	PKTaskQueue *queue = new PKTaskQueue("com.roundabout.playerkit.benchmarks.PKTaskQueue");
+	
+	std::vector<Float64> roundTripTimes;
+	roundTripTimes.reserve(iterations);
+	for (int iteration = 0; iteration < iterations; iteration++)
+	{
+		UInt64 startHostTime = CAHostTimeBase::GetTheCurrentTime();
+		queue->Sync(&NoOperationTask, NULL);
+		roundTripTimes.push_back(SecondsSinceHostTime(startHostTime) * 1000000.0);
+	}
+	
+	std::sort(roundTripTimes.begin(), roundTripTimes.end());
+	EmitResult("task-queue", "Sync", "round-trip-p50", roundTripTimes[roundTripTimes.size() / 2], "us");
+	EmitResult("task-queue", "Sync", "round-trip-p99", roundTripTimes[(roundTripTimes.size() * 99) / 100], "us");
+	EmitResult("task-queue", "Sync", "round-trip-max", roundTripTimes.back(), "us");
+	
+	std::atomic<int32_t> numberOfTasksRun(0);
+	UInt64 startHostTime = CAHostTimeBase::GetTheCurrentTime();
+	for (int iteration = 0; iteration < iterations; iteration++)
+		queue->Async(&CountingTask, (void *)&numberOfTasksRun);
+	
+	//Tasks run in order, so once a synchronous task returns every asynchronous task before it has run.
+	queue->Sync(&NoOperationTask, NULL);
+	Float64 duration = SecondsSinceHostTime(startHostTime);
+	
+	EmitResult("task-queue", "Async", "throughput", numberOfTasksRun.load(std::memory_order_relaxed) / duration, "tasks/s");
+	
+	queue->Release();
+}
+
+#pragma mark -
+
+struct SliceSchedulingState
+{
+	UInt64 mNumberOfFramesRemaining;
+	UInt64 mNumberOfSlicesFilled;
+};
+
+static UInt32 SilenceScheduleSliceFunction(PKAudioPlayerEngine *engine, AudioBufferList *ioBuffers, UInt32 numberOfFrames, CFErrorRef *outError, void *userData)
+{
+	SliceSchedulingState *state = (SliceSchedulingState *)userData;
+	if(state->mNumberOfFramesRemaining < numberOfFrames)
+		numberOfFrames = UInt32(state->mNumberOfFramesRemaining);
+	
+	for (UInt32 index = 0; index < ioBuffers->mNumberBuffers; index++)
+		memset(ioBuffers->mBuffers[index].mData, 0, ioBuffers->mBuffers[index].mDataByteSize);
+	
+	state->mNumberOfFramesRemaining -= numberOfFrames;
+	state->mNumberOfSlicesFilled++;
+	
+	return numberOfFrames;
+}
+
+/*!
+ @abstract		Measure how quickly a bare engine can schedule and render slices.
+ @discussion	Slices are filled with silence, so this is the overhead of the read-ahead,
+				the scheduled audio player and the graph, without any decoding.
+ */
+static void BenchmarkSliceScheduling(Float64 duration)
+{
+	PKAudioPlayerEngine *engine = NULL;
+	try
+	{
+		engine = PKAudioPlayerEngine::New(PKAudioPlayerEngine::kOutputTypeNone);
+		engine->SetErrorHandler(^(CFErrorRef error) { CFRelease(error); });
+		engine->SetEndOfPlaybackHandler(^{ });
+		
+		SliceSchedulingState state = { UInt64(duration * kPKCanonicalSampleRate), 0 };
+		engine->SetScheduleSliceFunctionHandler(&SilenceScheduleSliceFunction);
+		engine->SetScheduleSliceFunctionHandlerUserData(&state);
+		engine->SetStreamFormat(CanonicalFormat());
+		
+		//The engine's largest manual render cycle.
+		UInt32 numberOfFramesPerRender = 512;
+		AudioBufferList *buffers = AllocateCanonicalBuffers(numberOfFramesPerRender);
+		
+		engine->StartGraph();
+		engine->StartProcessing();
+		
+		UInt64 numberOfFramesRendered = 0;
+		UInt64 startHostTime = CAHostTimeBase::GetTheCurrentTime();
+		for (;;)
+		{
+			ResetCanonicalBuffers(buffers, numberOfFramesPerRender);
+			
+			UInt32 numberOfFrames = engine->RenderFrames(buffers, numberOfFramesPerRender);
+			if(numberOfFrames == 0)
+				break;
+			
+			numberOfFramesRendered += numberOfFrames;
+		}
+		Float64 renderDuration = SecondsSinceHostTime(startHostTime);
+		
+		if(engine->IsRunning())
+			engine->StopGraph();
+		
+		engine->StopProcessing();
+		
+		DeallocateCanonicalBuffers(buffers);
+		
+		EmitResult("schedule", "PKAudioPlayerEngine", "throughput", numberOfFramesRendered / renderDuration, "frames/s");
+		EmitResult("schedule", "PKAudioPlayerEngine", "slices", state.mNumberOfSlicesFilled / renderDuration, "slices/s");
+	}
+	catch (RBException e)
+	{
+		CFErrorRef error = e.CopyError();
+		EmitError("schedule", "PKAudioPlayerEngine", error);
+		CFRelease(error);
+	}
+	
+	if(engine)
+		engine->Release();
+}
+
+#pragma mark -
+
+/*!
+ @abstract		Measure how long a stream arriving at a specified bandwidth takes to start playing, and how often it stalls.
+ @discussion	The fixture is handed to the audio player in small chunks from a background queue, paced to
+				the bandwidth, to stand in for a download. Playback is requested as soon as the stream is begun,
+				and rendered in real time until the whole stream has arrived or `duration` seconds pass.
+ */
+static void BenchmarkStreaming(const char *path, const char *subject, UInt32 bandwidth, Float64 duration)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file)
+	{
+		EmitError("stream", subject, NULL);
+		return;
+	}
+	
+	std::vector<UInt8> contents;
+	UInt8 chunk[64 * 1024];
+	size_t amountRead = 0;
+	while ((amountRead = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		contents.insert(contents.end(), chunk, chunk + amountRead);
+	fclose(file);
+	
+	const char *extension = strrchr(path, '.');
+	CFStringRef pathExtension = extension? CFStringCreateWithCString(kCFAllocatorDefault, extension + 1, kCFStringEncodingUTF8) : NULL;
+	
+	CFErrorRef error = NULL;
+	Boolean didBeginStream = PKAudioPlayerBeginStream(pathExtension, contents.size(), &error);
+	if(pathExtension)
+		CFRelease(pathExtension);
+	
+	if(!didBeginStream)
+	{
+		EmitError("stream", subject, error);
+		if(error) CFRelease(error);
+		return;
+	}
+	
+	//The stream is handed over every 10 milliseconds, so the bandwidth is in bytes per second.
+	//Blocks can't copy atomics, so the feeder is handed pointers to them.
+	std::atomic<bool> isFeeding(true), shouldStopFeeding(false);
+	std::atomic<bool> *isFeedingPointer = &isFeeding, *shouldStopFeedingPointer = &shouldStopFeeding;
+	const UInt8 *bytes = &contents[0];
+	size_t length = contents.size();
+	size_t numberOfBytesPerTick = std::max<size_t>(bandwidth / 100, 1);
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		for (size_t offset = 0; (offset < length) && !shouldStopFeedingPointer->load(std::memory_order_acquire); offset += numberOfBytesPerTick)
+		{
+			if(!PKAudioPlayerAppendStreamData(bytes + offset, std::min(numberOfBytesPerTick, length - offset), NULL))
+				break;
+			
+			usleep(10000);
+		}
+		
+		PKAudioPlayerFinishStream(NULL);
+		isFeedingPointer->store(false, std::memory_order_release);
+	});
+	
+	if(PKAudioPlayerPlay(&error))
+	{
+		UInt32 numberOfFramesPerTick = UInt32(kPKCanonicalSampleRate / 100.0);
+		AudioBufferList *buffers = AllocateCanonicalBuffers(numberOfFramesPerTick);
+		
+		UInt64 startHostTime = CAHostTimeBase::GetTheCurrentTime();
+		while (isFeeding.load(std::memory_order_acquire) && (SecondsSinceHostTime(startHostTime) < duration))
+		{
+			ResetCanonicalBuffers(buffers, numberOfFramesPerTick);
+			PKAudioPlayerRender(buffers, numberOfFramesPerTick, NULL, NULL);
+			
+			usleep(10000);
+		}
+		
+		DeallocateCanonicalBuffers(buffers);
+		
+		PKAudioPlayerStreamStatistics statistics = PKAudioPlayerGetStreamStatistics();
+		if(statistics.timeToFirstAudio > 0.0)
+			EmitResult("stream", subject, "time-to-first-audio", statistics.timeToFirstAudio * 1000.0, "ms");
+		else
+			EmitError("stream", subject, NULL);
+		
+		EmitResult("stream", subject, "stalls", statistics.numberOfStalls, "stalls");
+		EmitResult("stream", subject, "stalled-duration", statistics.stalledDuration, "s");
+	}
+	else
+	{
+		EmitError("stream", subject, error);
+		if(error) CFRelease(error);
+	}
+	
+	//The feeder reads out of `contents`, so it has to be finished before it goes away.
+	shouldStopFeeding.store(true, std::memory_order_release);
+	while (isFeeding.load(std::memory_order_acquire))
+		usleep(1000);
+	
+	PKAudioPlayerSetDecoder(NULL, NULL);
+}
+
+#pragma mark -
+#pragma mark Main
+
+int main(int argc, const char *argv[])
+{
+	Float64 duration = 30.0;
+	int iterations = 3;
+	UInt32 bandwidth = 1024 * 1024;
+	std::vector<const char *> fixturePaths;
+	for (int index = 1; index < argc; index++)
+	{
+		if((strcmp(argv[index], "--seconds") == 0) && (index + 1 < argc))
+			duration = atof(argv[++index]);
+		else if((strcmp(argv[index], "--iterations") == 0) && (index + 1 < argc))
+			iterations = atoi(argv[++index]);
+		else if((strcmp(argv[index], "--bandwidth") == 0) && (index + 1 < argc))
+			bandwidth = UInt32(atoi(argv[++index]));
+		else
+			fixturePaths.push_back(argv[index]);
+	}
+	
+	if((duration <= 0.0) || (iterations <= 0) || (bandwidth == 0))
+	{
+		fprintf(stderr, "usage: %s [--seconds <n>] [--iterations <n>] [--bandwidth <bytes/s>] [audio files...]\n", argv[0]);
+		return 1;
+	}
+	
+	CFErrorRef error = NULL;
+	if(!PKAudioPlayerInitWithOptions(kPKAudioPlayerInitOptionHeadless, &error))
+	{
+		EmitError("init", "PKAudioPlayer", error);
+		return 1;
+	}
+	
+	//Synthetic fixtures.
+	char temporaryDirectory[PATH_MAX] = "/tmp/";
+	confstr(_CS_DARWIN_USER_TEMP_DIR, temporaryDirectory, sizeof(temporaryDirectory));
+	
+	struct { const char *name; AudioFileTypeID fileType; CAStreamBasicDescription format; } fixtures[] = {
+		{ "sine-44100-f32.caf", kAudioFileCAFType, CanonicalFormat() },
+		{ "sine-48000-s16.wav", kAudioFileWAVEType, SixteenBitInterleavedFormat(48000.0) },
+	};
+	fixtures[0].format.mFormatFlags &= ~kAudioFormatFlagIsNonInterleaved;
+	fixtures[0].format.mBytesPerFrame = fixtures[0].format.mBytesPerPacket = sizeof(Float32) * 2;
+	
+	for (size_t index = 0; index < sizeof(fixtures) / sizeof(fixtures[0]); index++)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%sPlayerKitBenchmarks-%d-%s", temporaryDirectory, getpid(), fixtures[index].name);
+		
+		CFURLRef location = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)path, strlen(path), false);
+		if(WriteFixture(location, fixtures[index].fileType, fixtures[index].format, duration))
+		{
+			BenchmarkDecoders(location, fixtures[index].name, iterations);
+			BenchmarkStreaming(path, fixtures[index].name, bandwidth, duration);
+		}
+		else
+			EmitError("decode", fixtures[index].name, NULL);
+		
+		CFRelease(location);
+		unlink(path);
+	}
+	
+	//Fixtures from the command line.
+	for (std::vector<const char *>::const_iterator path = fixturePaths.begin(); path != fixturePaths.end(); path++)
+	{
+		CFURLRef location = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8 *)*path, strlen(*path), false);
+		
+		const char *name = strrchr(*path, '/');
+		BenchmarkDecoders(location, name? name + 1 : *path, iterations);
+		BenchmarkStreaming(*path, name? name + 1 : *path, bandwidth, duration);
+		
+		CFRelease(location);
+	}
+	
+	//The canonical fast path, versus the converter path.
+	BenchmarkPipeline("canonical", CanonicalFormat(), duration, iterations);
+	BenchmarkPipeline("converter-s16-48000", SixteenBitInterleavedFormat(48000.0), duration, iterations);
+	
+	BenchmarkTaskQueue(10000);
+	BenchmarkSliceScheduling(duration);
+	
+	PKAudioPlayerTeardown(NULL);
+	
+	return 0;
+}
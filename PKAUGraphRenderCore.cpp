@@ -0,0 +1,123 @@
+/*
+ *  PKAUGraphRenderCore.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKAUGraphRenderCore.h"
+
+#pragma mark Lifecycle
+
+PKAUGraphRenderCore::PKAUGraphRenderCore(AUGraph graph, AUNode outputNode, AudioUnit scheduledAudioPlayerUnit) :
+	PKRenderCore("PKAUGraphRenderCore"),
+	mGraph(graph),
+	mOutputNode(outputNode),
+	mScheduledAudioPlayerUnit(scheduledAudioPlayerUnit)
+{
+	
+}
+
+PKAUGraphRenderCore::~PKAUGraphRenderCore()
+{
+	
+}
+
+#pragma mark -
+#pragma mark Scheduling
+
+OSStatus PKAUGraphRenderCore::ScheduleSlice(ScheduledAudioSlice *slice) throw()
+{
+	if(!slice)
+		return paramErr;
+	
+	//I don't know why this is done through a property.
+	return AudioUnitSetProperty(mScheduledAudioPlayerUnit, //in audioUnit
+								kAudioUnitProperty_ScheduleAudioSlice, //in propertyID
+								kAudioUnitScope_Global, //in scope
+								0, //in element
+								slice, //io data
+								sizeof(ScheduledAudioSlice)); //in dataSize
+}
+
+OSStatus PKAUGraphRenderCore::SetStartSampleTime(Float64 sampleTime) throw()
+{
+	AudioTimeStamp startTimeStamp;
+	FillOutAudioTimeStampWithSampleTime(startTimeStamp, sampleTime);
+	
+	return AudioUnitSetProperty(mScheduledAudioPlayerUnit, //in audioUnit
+								kAudioUnitProperty_ScheduleStartTimeStamp, //in propertyID
+								kAudioUnitScope_Global, //in scope
+								0, //in element
+								&startTimeStamp, //in data
+								sizeof(startTimeStamp)); //in dataSize
+}
+
+OSStatus PKAUGraphRenderCore::GetCurrentPlayTime(AudioTimeStamp *outTimeStamp) const throw()
+{
+	if(!outTimeStamp)
+		return paramErr;
+	
+	UInt32 size = sizeof(AudioTimeStamp);
+	return AudioUnitGetProperty(mScheduledAudioPlayerUnit, //in audioUnit
+								kAudioUnitProperty_CurrentPlayTime, //in propertyID
+								kAudioUnitScope_Global, //in scope
+								0, //in element
+								outTimeStamp, //out data
+								&size); //inout dataSize
+}
+
+OSStatus PKAUGraphRenderCore::Reset() throw()
+{
+	return AudioUnitReset(mScheduledAudioPlayerUnit, kAudioUnitScope_Global, 0);
+}
+
+#pragma mark -
+#pragma mark Rendering
+
+OSStatus PKAUGraphRenderCore::GetRenderUnit(AudioUnit *outRenderUnit) const throw()
+{
+	UInt32 numberOfInteractions = 0;
+	OSStatus errorCode = AUGraphCountNodeInteractions(mGraph, mOutputNode, &numberOfInteractions);
+	if(errorCode != noErr)
+		return errorCode;
+	
+	AUNodeInteraction interactions[numberOfInteractions]; //This is _not_ Std C++.
+	errorCode = AUGraphGetNodeInteractions(mGraph, mOutputNode, &numberOfInteractions, interactions);
+	if(errorCode != noErr)
+		return errorCode;
+	
+	for (UInt32 index = 0; index < numberOfInteractions; index++)
+	{
+		AUNodeInteraction interaction = interactions[index];
+		if((interaction.nodeInteractionType == kAUNodeInteraction_Connection) && 
+		   (interaction.nodeInteraction.connection.destNode == mOutputNode))
+		{
+			return AUGraphNodeInfo(mGraph, interaction.nodeInteraction.connection.sourceNode, NULL, outRenderUnit);
+		}
+	}
+	
+	return kAUGraphErr_NodeNotFound;
+}
+
+OSStatus PKAUGraphRenderCore::Render(AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *timeStamp, UInt32 numberOfFrames, AudioBufferList *ioData) throw()
+{
+	//
+	//	We pull on the node feeding the output unit rather than the output unit itself. This
+	//	renders the scheduled audio player and every effect, and works for the default output
+	//	unit (which cannot be rendered into a client buffer) as well as the generic one.
+	//
+	AudioUnit renderUnit = NULL;
+	OSStatus errorCode = this->GetRenderUnit(&renderUnit);
+	if(errorCode != noErr)
+		return errorCode;
+	
+	return AudioUnitRender(renderUnit, //in audioUnit
+						   ioActionFlags, //io actionFlags
+						   timeStamp, //in timeStamp
+						   0, //in outputBusNumber
+						   numberOfFrames, //in numberOfFrames
+						   ioData); //io data
+}
@@ -0,0 +1,60 @@
+/*
+ *  PKAUGraphRenderCore.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKAUGraphRenderCore_h
+#define PKAUGraphRenderCore_h 1
+
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "PKRenderCore.h"
+
+/*!
+ @class
+ @abstract		The PKAUGraphRenderCore class is the render core of PKAudioPlayerEngine on Mac OS X.
+ @discussion	Slices are scheduled in the scheduled sound player audio unit of the engine's graph, and
+				Render pulls on whichever node feeds the output node, so every effect in the graph is
+				rendered. The graph itself, its nodes and their formats, remain the engine's to manage.
+ */
+class PK_VISIBILITY_HIDDEN PKAUGraphRenderCore : public PKRenderCore
+{
+protected:
+	
+	/* weak */	AUGraph mGraph;
+	/* weak */	AUNode mOutputNode;
+	/* weak */	AudioUnit mScheduledAudioPlayerUnit;
+	
+	/*!
+	 @abstract	Look up the audio unit of the node connected to the input of the output node.
+	 */
+	OSStatus GetRenderUnit(AudioUnit *outRenderUnit) const throw();
+	
+public:
+	
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a render core for an open graph.
+	 @param		graph						The graph. It must outlive the render core.
+	 @param		outputNode					The output node of the graph.
+	 @param		scheduledAudioPlayerUnit	The scheduled sound player audio unit of the graph.
+	 */
+	PKAUGraphRenderCore(AUGraph graph, AUNode outputNode, AudioUnit scheduledAudioPlayerUnit);
+	virtual ~PKAUGraphRenderCore();
+	
+#pragma mark -
+#pragma mark PKRenderCore
+	
+	virtual OSStatus ScheduleSlice(ScheduledAudioSlice *slice) throw();
+	virtual OSStatus SetStartSampleTime(Float64 sampleTime) throw();
+	virtual OSStatus GetCurrentPlayTime(AudioTimeStamp *outTimeStamp) const throw();
+	virtual OSStatus Reset() throw();
+	virtual OSStatus Render(AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *timeStamp, UInt32 numberOfFrames, AudioBufferList *ioData) throw();
+};
+
+#endif /* PKAUGraphRenderCore_h */
@@ -246,3 +246,23 @@ PK_EXTERN OSStatus PKAudioEffectCopyParameterInfo(PKAudioEffectRef effect, Audio
 	UInt32 outInfoSize = sizeof(*outInfo);
 	return PKAudioEffectCopyProperty(effect, (void **)outInfo, &outInfoSize, kAudioUnitProperty_ParameterInfo, kAudioUnitScope_Global, inPropertyID);
 }
+
+#pragma mark -
+#pragma mark Latency
+
+PK_EXTERN Boolean PKAudioEffectGetLatencySummary(PKAudioEffectRef effect, PKAudioPlayerLatencySummary *outSummary)
+{
+	if(!effect || !outSummary)
+		return false;
+	
+	try
+	{
+		PKAudioPlayerFillOutLatencySummary(effect->engine->GetLatencySummaryForNode(effect->node), outSummary);
+	}
+	catch (RBException e)
+	{
+		return false;
+	}
+	
+	return true;
+}
@@ -72,4 +72,13 @@ PK_EXTERN OSStatus PKAudioEffectCopyParameter(PKAudioEffectRef effect, AudioUnit
 ///Copy a parameter's info.
 PK_EXTERN OSStatus PKAudioEffectCopyParameterInfo(PKAudioEffectRef effect, AudioUnitParameterID inPropertyID, AudioUnitParameterInfo *outInfo);
 
+#pragma mark -
+#pragma mark Latency
+
+///Get the latency summary of the audio effect, excluding the time spent rendering the effect's input.
+///	\param	effect		The effect to summarize.
+///	\param	outSummary	On return, the summary of the effect. Required.
+///	\result	true if the summary could be produced; false otherwise.
+PK_EXTERN Boolean PKAudioEffectGetLatencySummary(PKAudioEffectRef effect, PKAudioPlayerLatencySummary *outSummary);
+
 #endif /* PKAudioEffect_h */
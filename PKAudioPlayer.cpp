@@ -9,18 +9,27 @@
 
 #import "PKAudioPlayer.h"
 #import "PKAudioPlayerInternal.h"
-#import <libKern/OSAtomic.h>
 #import "CoreAudioErrors.h"
 
 #import "CAAudioBufferList.h"
 #import "CAStreamBasicDescription.h"
 
 #import "RBLockableObject.h"
+#import "PKRenderSink.h"
+#import "PKDecoderCache.h"
+#import "PKSeekIndex.h"
+#import "PKParallelDecoder.h"
+#import "PKTaskExecutor.h"
+#import "PKTaskQueue.h"
+#import "PKByteSource.h"
+#import "CAHostTimeBase.h"
 
 ///The singleton instance of the audio player state.
 PK_VISIBILITY_HIDDEN RBLockableObject AudioPlayerStateLock;
+PK_VISIBILITY_HIDDEN RBLockableObject AudioPlayerTrackLock; //Guards tracks, which are swapped on the engine's scheduler queue.
+PK_VISIBILITY_HIDDEN RBLockableObject AudioPlayerStreamLock; //Guards the stream being received, which is appended to from any thread.
 PK_VISIBILITY_HIDDEN PKAudioPlayer AudioPlayerState = { /* Initialized in PKAudioPlayerInit */ };
-PK_VISIBILITY_HIDDEN volatile int32_t AudioPlayerStateInitCount = 0;
+PK_VISIBILITY_HIDDEN std::atomic<int32_t> AudioPlayerStateInitCount(0);
 
 #pragma mark Constants
 
@@ -28,6 +37,8 @@ PK_EXTERN CFStringRef const PKAudioPlayerDidEncounterErrorNotification = CFSTR("
 PK_EXTERN CFStringRef const PKAudioPlayerDidFinishPlayingNotification = CFSTR("PKAudioPlayerDidFinishPlayingNotification");
 PK_EXTERN CFStringRef const PKAudioPlayerDidChangeOutputDeviceNotification = CFSTR("PKAudioPlayerDidChangeOutputDeviceNotification");
 PK_EXTERN CFStringRef const PKAudioPlayerDidEncounterOtherPlayerNotification = CFSTR("PKAudioPlayerDidEncounterOtherPlayerNotification");
+PK_EXTERN CFStringRef const PKAudioPlayerDidAdvanceToNextTrackNotification = CFSTR("PKAudioPlayerDidAdvanceToNextTrackNotification");
+PK_EXTERN CFStringRef const PKAudioPlayerDidChangeBufferingStateNotification = CFSTR("PKAudioPlayerDidChangeBufferingStateNotification");
 
 #pragma mark -
 
@@ -39,6 +50,13 @@ static void PKAudioPlayerDidBroadcastPresence(CFNotificationCenterRef center,
 											  const void *object, 
 											  CFDictionaryRef userInfo);
 
+static Boolean __PKAudioPlayerPlayNextTrackAfterEndOfPlayback();
+static void __PKAudioPlayerDiscardNextTrack();
+static void __PKAudioPlayerCancelCrossfade();
+static void __PKAudioPlayerRetireFadingInTrack(PKAudioPlayerTrack *fadingInTrack);
+static void __PKAudioPlayerTrackTeardown(PKAudioPlayerTrack *track);
+static void __PKAudioPlayerDiscardStream();
+
 #pragma mark -
 #pragma mark Utilities
 
@@ -55,14 +73,104 @@ Boolean PKAudioPlayerCanPlayFileAtLocation(CFURLRef location)
 	return false;
 }
 
+void PKAudioPlayerCanPlayFilesAtLocations(CFArrayRef locations, Boolean *outResults)
+{
+	CFIndex numberOfLocations = locations? CFArrayGetCount(locations) : 0;
+	if(numberOfLocations == 0)
+		return;
+	
+	bool *results = new bool[numberOfLocations];
+	try
+	{
+		PKDecoder::CanDecodeURLs(locations, results);
+		
+		for (CFIndex index = 0; index < numberOfLocations; index++)
+			outResults[index] = results[index];
+	}
+	catch (RBException e)
+	{
+		for (CFIndex index = 0; index < numberOfLocations; index++)
+			outResults[index] = false;
+	}
+	
+	delete[] results;
+}
+
+#pragma mark -
+#pragma mark Decoder Cache
+
+PKAudioPlayerDecoderCacheStatistics PKAudioPlayerGetDecoderCacheStatistics()
+{
+	PKDecoderCache::Statistics cacheStatistics = PKDecoderCache::SharedCache()->GetStatistics();
+	PKAudioPlayerDecoderCacheStatistics statistics = {
+		cacheStatistics.numberOfHits,
+		cacheStatistics.numberOfMisses,
+		cacheStatistics.numberOfEvictions,
+		cacheStatistics.numberOfRecords,
+		cacheStatistics.capacity,
+	};
+	
+	return statistics;
+}
+
+void PKAudioPlayerResetDecoderCacheStatistics()
+{
+	PKDecoderCache::SharedCache()->ResetStatistics();
+}
+
+void PKAudioPlayerSetDecoderCacheCapacity(UInt32 capacity)
+{
+	PKDecoderCache::SharedCache()->SetCapacity(capacity);
+}
+
+#pragma mark -
+#pragma mark Seek Indexes
+
+void PKAudioPlayerSetSeekIndexesEnabled(Boolean enabled)
+{
+	PKSeekIndex::SetEnabled(enabled);
+}
+
+Boolean PKAudioPlayerGetSeekIndexesEnabled()
+{
+	return PKSeekIndex::IsEnabled();
+}
+
+#pragma mark -
+#pragma mark Parallel Decoding
+
+void PKAudioPlayerSetParallelDecodingEnabled(Boolean enabled)
+{
+	PKParallelDecoder::SetEnabled(enabled);
+}
+
+Boolean PKAudioPlayerGetParallelDecodingEnabled()
+{
+	return PKParallelDecoder::IsEnabled();
+}
+
+#pragma mark -
+#pragma mark Worker Threads
+
+void PKAudioPlayerSetNumberOfWorkerThreads(UInt32 numberOfWorkerThreads, UInt32 numberOfHighPriorityWorkerThreads)
+{
+	PKTaskExecutor::SetDefaultNumberOfWorkers(PKTaskExecutor::kLaneNormal, numberOfWorkerThreads);
+	PKTaskExecutor::SetDefaultNumberOfWorkers(PKTaskExecutor::kLaneHighPriority, numberOfHighPriorityWorkerThreads);
+}
+
 #pragma mark -
 #pragma mark Lifecycle
 
 PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError)
 {
-	if(OSMemoryBarrier(), AudioPlayerStateInitCount > 0)
+	return PKAudioPlayerInitWithOptions(kPKAudioPlayerInitOptionNone, outError);
+}
+
+PK_EXTERN Boolean PKAudioPlayerInitWithOptions(PKAudioPlayerInitOptions options, CFErrorRef *outError)
+{
+	if(AudioPlayerStateInitCount.load(std::memory_order_acquire) > 0)
 	{
-		OSAtomicIncrement32Barrier(&AudioPlayerStateInitCount);
+		AudioPlayerStateInitCount.fetch_add(1, std::memory_order_acq_rel);
 		return true;
 	}
 	
@@ -70,7 +178,19 @@ PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError)
 	
 	try
 	{
-		AudioPlayerState.engine = PKAudioPlayerEngine::New();
+		if((options & kPKAudioPlayerInitOptionHeadless) == kPKAudioPlayerInitOptionHeadless)
+			AudioPlayerState.engine = PKAudioPlayerEngine::New(PKAudioPlayerEngine::kOutputTypeNone);
+		else
+			AudioPlayerState.engine = PKAudioPlayerEngine::New(PKAudioPlayerEngine::kOutputTypeDefaultDevice);
+		
+		AudioPlayerState.decodeLatencyHistogram = new PKLatencyHistogram("decode");
+		AudioPlayerState.convertLatencyHistogram = new PKLatencyHistogram("convert");
+		
+		AudioPlayerState.nextTrackQueue = new PKTaskQueue("com.roundabout.playerkit.PKAudioPlayer.nextTrackQueue");
+		AudioPlayerState.openQueue = new PKTaskQueue("com.roundabout.playerkit.PKAudioPlayer.openQueue");
+		
+		AudioPlayerState.streamQueue = new PKTaskQueue("com.roundabout.playerkit.PKAudioPlayer.streamQueue");
+		AudioPlayerState.streamingPolicy = PKAudioPlayerGetDefaultStreamingPolicy();
 		
 		AudioPlayerState.engine->SetErrorHandler(^(CFErrorRef error) {
 			
@@ -81,7 +201,8 @@ PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError)
 				
 				AudioPlayerState.engine->StopProcessing();
 				
-				AudioPlayerState.isPaused = false;
+				AudioPlayerState.isPaused.store(false, std::memory_order_release);
+				AudioPlayerState.isStalled.store(false, std::memory_order_release);
 				PKAudioPlayerSetCurrentTime(0.0, NULL);
 			}
 			catch (RBException e)
@@ -111,6 +232,10 @@ PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError)
 		AudioPlayerState.engine->SetEndOfPlaybackHandler(^{
 			
 			dispatch_async(dispatch_get_main_queue(), ^{
+				//A queued track that could not be spliced onto the end of the current one is started now instead.
+				if(__PKAudioPlayerPlayNextTrackAfterEndOfPlayback())
+					return;
+				
 				CFDictionaryRef userInfo = CFDICT({ CFSTR("DidFinish") }, { kCFBooleanTrue });
 				
 				CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
@@ -161,19 +286,35 @@ PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError)
 		return false;
 	}
 	
-	OSAtomicIncrement32Barrier(&AudioPlayerStateInitCount);
+	AudioPlayerStateInitCount.fetch_add(1, std::memory_order_acq_rel);
 	
 	return true;
 }
 
+///Wait for the files and streams being opened in the background, and the stream work queued with them, to finish.
+static void __PKAudioPlayerWaitForBackgroundWork()
+{
+	AudioPlayerState.openQueue->Sync(^{});
+	AudioPlayerState.streamQueue->Sync(^{});
+}
+
 PK_EXTERN Boolean PKAudioPlayerTeardown(CFErrorRef *outError)
 {
-	if(OSMemoryBarrier(), AudioPlayerStateInitCount > 0)
+	if(AudioPlayerStateInitCount.load(std::memory_order_acquire) > 0)
 	{
-		if(OSAtomicDecrement32(&AudioPlayerStateInitCount) != 0)
+		if(AudioPlayerStateInitCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
 			return true;
 	}
 	
+	//Files and streams still being opened in the background need the state lock to finish, so they are cancelled and waited on first.
+	if(AudioPlayerState.openQueue)
+	{
+		AudioPlayerState.openGeneration.fetch_add(1, std::memory_order_acq_rel);
+		__PKAudioPlayerDiscardStream();
+		
+		__PKAudioPlayerWaitForBackgroundWork();
+	}
+	
 	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
 	
 	try
@@ -184,34 +325,49 @@ PK_EXTERN Boolean PKAudioPlayerTeardown(CFErrorRef *outError)
 		if(AudioPlayerState.engine)
 			delete AudioPlayerState.engine;
 		
-		if(AudioPlayerState.decoderConverter)
-		{
-			AudioConverterDispose(AudioPlayerState.decoderConverter);
-			AudioPlayerState.decoderConverter = NULL;
-		}
+		AudioPlayerState.engineHasTrackStreamFormat = false;
 		
-		if(AudioPlayerState.decoderConverterBuffers)
+		//Playback stalling while it was stopped may have queued work, which gives up without the lock now that we're torn down.
+		if(AudioPlayerState.openQueue)
 		{
-			for (int index = 0; index < AudioPlayerState.decoderConverterBuffers->mNumberBuffers; index++)
-			{
-				free(AudioPlayerState.decoderConverterBuffers->mBuffers[index].mData);
-			}
+			__PKAudioPlayerWaitForBackgroundWork();
 			
-			CAAudioBufferList::Destroy(AudioPlayerState.decoderConverterBuffers);
-			AudioPlayerState.decoderConverterBuffers = NULL;
+			AudioPlayerState.openQueue->Release();
+			AudioPlayerState.openQueue = NULL;
+			
+			AudioPlayerState.streamQueue->Release();
+			AudioPlayerState.streamQueue = NULL;
 		}
 		
-		if(AudioPlayerState.decoder)
+		if(AudioPlayerState.nextTrackQueue)
 		{
-			AudioPlayerState.decoder->Release();
-			AudioPlayerState.decoder = NULL;
+			//The engine is gone, so nothing is left decoding the track fading in.
+			__PKAudioPlayerCancelCrossfade();
+			__PKAudioPlayerDiscardNextTrack();
+			
+			AudioPlayerState.nextTrackQueue->Release();
+			AudioPlayerState.nextTrackQueue = NULL;
 		}
 		
+		__PKAudioPlayerTrackTeardown(&AudioPlayerState.track);
+		
 		if(AudioPlayerState.sessionID)
 		{
 			CFRelease(AudioPlayerState.sessionID);
 			AudioPlayerState.sessionID = NULL;
 		}
+		
+		if(AudioPlayerState.decodeLatencyHistogram)
+		{
+			AudioPlayerState.decodeLatencyHistogram->Release();
+			AudioPlayerState.decodeLatencyHistogram = NULL;
+		}
+		
+		if(AudioPlayerState.convertLatencyHistogram)
+		{
+			AudioPlayerState.convertLatencyHistogram->Release();
+			AudioPlayerState.convertLatencyHistogram = NULL;
+		}
 	}
 	catch (RBException e)
 	{
@@ -247,435 +403,2047 @@ static void PKAudioPlayerDidBroadcastPresence(CFNotificationCenterRef center,
 }
 
 #pragma mark -
-#pragma mark Playback Callbacks
-
-static UInt32 PKAudioPlayerScheduleSlice(PKAudioPlayerEngine *graph, AudioBufferList *ioBuffer, UInt32 numberOfFramesToRead, CFErrorRef *error, void *userData)
-{
-	try
-	{
-		return AudioPlayerState.decoder->FillBuffers(ioBuffer, numberOfFramesToRead);
-	}
-	catch (RBException e)
-	{
-		if(error) *error = e.CopyError();
-		
-		return 0;
-	}
-}
-
-struct PKAudioPlayerConverterState
-{
-	CFErrorRef mError;
-};
-
-static OSStatus PKAudioPlayerConverterCallback(AudioConverterRef inAudioConverter, UInt32 *ioNumberDataPackets, AudioBufferList *ioData, AudioStreamPacketDescription **outDataPacketDescription, void *inUserData)
-{
-	PKAudioPlayerConverterState *sharedState = (PKAudioPlayerConverterState *)inUserData;
-	
-	for (int index = 0; index < AudioPlayerState.decoderConverterBuffers->mNumberBuffers; index++)
-		ioData->mBuffers[index] = AudioPlayerState.decoderConverterBuffers->mBuffers[index];
-	
-	try
-	{
-		*ioNumberDataPackets = AudioPlayerState.decoder->FillBuffers(ioData, *ioNumberDataPackets);
-		
-		if(*ioNumberDataPackets == 0)
-		{
-			//This is necessary or AudioConverter will continue to call this function
-			//producing garbage that the user then has to hear. We don't want that to happen.
-			for (int index = 0; index < AudioPlayerState.decoderConverterBuffers->mNumberBuffers; index++)
-				ioData->mBuffers[index].mDataByteSize = 0;
-		}
-	}
-	catch (RBException e)
-	{
-		sharedState->mError = e.CopyError();
-		
-		return CFErrorGetCode(sharedState->mError);
-	}
-	
-	return noErr;
-}
+#pragma mark Tracks
 
-static UInt32 PKAudioPlayerScheduleSliceWithConverter(PKAudioPlayerEngine *graph, AudioBufferList *ioBuffer, UInt32 numberOfFramesToRead, CFErrorRef *error, void *userData)
+static void __PKAudioPlayerDestroyBuffers(AudioBufferList *buffers)
 {
-	UInt32 ioNumberOfFramesForConverter = numberOfFramesToRead;
-	PKAudioPlayerConverterState converterState = { .mError = NULL };
-	OSStatus errorCode = AudioConverterFillComplexBuffer(AudioPlayerState.decoderConverter, //in audioConverter
-														 PKAudioPlayerConverterCallback, //in inputDataProc
-														 &converterState, //in userData
-														 &ioNumberOfFramesForConverter, //io dataPacketSize
-														 ioBuffer, //out outputData
-														 NULL); //out packetDescription
-	if(ioNumberOfFramesForConverter == 0)
+	for (int index = 0; index < buffers->mNumberBuffers; index++)
 	{
-		if(errorCode != noErr)
-			if(error) *error = converterState.mError;
-		
-		return 0;
+		free(buffers->mBuffers[index].mData);
 	}
 	
-	return ioNumberOfFramesForConverter;
+	CAAudioBufferList::Destroy(buffers);
 }
 
-#pragma mark -
-#pragma mark Controlling Playback
-
-static void __PKAudioPlayerSetupAudioConverter(CAStreamBasicDescription *sourceFormat, CAStreamBasicDescription *resultFormat) throw(RBException)
+static void __PKAudioPlayerSetupAudioConverter(PKAudioPlayerTrack *track, CAStreamBasicDescription *sourceFormat, CAStreamBasicDescription *resultFormat) throw(RBException)
 {
 	resultFormat->mSampleRate = kPKCanonicalSampleRate;
 	resultFormat->SetCanonical(2, false);
 	
-	OSStatus errorCode = AudioConverterNew(sourceFormat, resultFormat, &AudioPlayerState.decoderConverter);
+	OSStatus errorCode = AudioConverterNew(sourceFormat, resultFormat, &track->decoderConverter);
 	RBAssert((errorCode == noErr), CFSTR("AudioConverterNew failed. Error: %d."), errorCode);
 	
 	UInt32 baseBufferSize = kPKCanonicalBaseBufferSize;
 	if(sourceFormat->IsInterleaved())
 	{
 		UInt32 bufferSize = (baseBufferSize * sourceFormat->SampleWordSize());
-		AudioPlayerState.decoderConverterBuffers = CAAudioBufferList::Create(1);
-		AudioPlayerState.decoderConverterBuffers->mBuffers[0].mData = malloc(bufferSize);
-		AudioPlayerState.decoderConverterBuffers->mBuffers[0].mDataByteSize = bufferSize;
-		AudioPlayerState.decoderConverterBuffers->mBuffers[0].mNumberChannels = bufferSize;
+		track->decoderConverterBuffers = CAAudioBufferList::Create(1);
+		track->decoderConverterBuffers->mBuffers[0].mData = malloc(bufferSize);
+		track->decoderConverterBuffers->mBuffers[0].mDataByteSize = bufferSize;
+		track->decoderConverterBuffers->mBuffers[0].mNumberChannels = bufferSize;
 	}
 	else
 	{
-		AudioPlayerState.decoderConverterBuffers = CAAudioBufferList::Create(sourceFormat->mChannelsPerFrame);
+		track->decoderConverterBuffers = CAAudioBufferList::Create(sourceFormat->mChannelsPerFrame);
 		UInt32 bufferSize = (baseBufferSize * sourceFormat->mBytesPerPacket) / sourceFormat->mChannelsPerFrame;
 		
-		for (int index = 0; index < AudioPlayerState.decoderConverterBuffers->mNumberBuffers; index++)
+		for (int index = 0; index < track->decoderConverterBuffers->mNumberBuffers; index++)
 		{
-			AudioBuffer &buffer = AudioPlayerState.decoderConverterBuffers->mBuffers[index];
+			AudioBuffer &buffer = track->decoderConverterBuffers->mBuffers[index];
 			buffer.mData = malloc(bufferSize);
 			buffer.mDataByteSize = bufferSize;
 			buffer.mNumberChannels = 1;
 		}
 	}
+	
+	track->decoderConverterBuffersNumberOfFrames = track->decoderConverterBuffers->mBuffers[0].mDataByteSize / sourceFormat->mBytesPerFrame;
 }
 
-PK_EXTERN Boolean PKAudioPlayerSetDecoder(PKDecoder *decoder, CFErrorRef *outError)
+///Set up a track to play a specified decoder. The track takes ownership of the decoder.
+static void __PKAudioPlayerTrackSetup(PKAudioPlayerTrack *track, PKDecoder *decoder) throw(RBException)
 {
-	CHECK_STATE_INITIALIZED();
-	
-	if(decoder == AudioPlayerState.decoder)
-		return true;
+	memset(track, 0, sizeof(PKAudioPlayerTrack));
+	track->decoder = decoder;
 	
-	if((PKAudioPlayerIsPlaying() || PKAudioPlayerIsPaused()) && !PKAudioPlayerStop(false, outError))
-		return false;
+	CAStreamBasicDescription nativeFormat = decoder->GetStreamFormat();
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	//
+	//	If the data being given to us is already canonical,
+	//	we use the data as is. This is an attempt at efficiency.
+	//
+	if(PKStreamFormatIsCanonical(nativeFormat))
+	{
+		track->streamFormat = nativeFormat;
+	}
+	else
+	{
+		CAStreamBasicDescription streamFormat;
+		__PKAudioPlayerSetupAudioConverter(track, &nativeFormat, &streamFormat);
+		track->streamFormat = streamFormat;
+	}
+}
+
+///Tear down a track, releasing its decoder.
+static void __PKAudioPlayerTrackTeardown(PKAudioPlayerTrack *track)
+{
+	if(track->decoderConverter)
+	{
+		AudioConverterDispose(track->decoderConverter);
+		track->decoderConverter = NULL;
+	}
 	
-	if(AudioPlayerState.decoder)
+	if(track->decoderConverterBuffers)
 	{
-		AudioPlayerState.decoder->Release();
-		AudioPlayerState.decoder = NULL;
+		__PKAudioPlayerDestroyBuffers(track->decoderConverterBuffers);
+		track->decoderConverterBuffers = NULL;
 	}
 	
-	if(AudioPlayerState.decoderConverter)
+	if(track->prerollBuffers)
 	{
-		AudioConverterDispose(AudioPlayerState.decoderConverter);
-		AudioPlayerState.decoderConverter = NULL;
+		__PKAudioPlayerDestroyBuffers(track->prerollBuffers);
+		track->prerollBuffers = NULL;
 	}
 	
-	if(AudioPlayerState.decoderConverterBuffers)
+	if(track->decoder)
 	{
-		for (int index = 0; index < AudioPlayerState.decoderConverterBuffers->mNumberBuffers; index++)
-		{
-			free(AudioPlayerState.decoderConverterBuffers->mBuffers[index].mData);
-		}
-		
-		CAAudioBufferList::Destroy(AudioPlayerState.decoderConverterBuffers);
-		AudioPlayerState.decoderConverterBuffers = NULL;
+		track->decoder->Release();
+		track->decoder = NULL;
 	}
 	
-	if(decoder)
+	if(track->stream)
 	{
-		CAStreamBasicDescription nativeFormat = decoder->GetStreamFormat();
+		track->stream->Release();
+		track->stream = NULL;
+	}
+	
+	memset(track, 0, sizeof(PKAudioPlayerTrack));
+}
+
+#pragma mark -
+#pragma mark Streaming
+
+///Post PKAudioPlayerDidEncounterErrorNotification on the main thread. Takes ownership of the error.
+static void __PKAudioPlayerPostError(CFErrorRef error)
+{
+	dispatch_async(dispatch_get_main_queue(), ^{
+		CFDictionaryRef userInfo = CFDICT({ CFSTR("Error") }, { error });
 		
-		//
-		//	If the data being given to us is already canonical,
-		//	we use the data as is. This is an attempt at efficiency.
-		//
-		CAStreamBasicDescription audioFormat;
-		if(PKStreamFormatIsCanonical(nativeFormat))
-		{
-			audioFormat = nativeFormat;
-			
-			AudioPlayerState.decoderConverter = nil;
-			AudioPlayerState.decoderConverterBuffers = nil;
-			
-			AudioPlayerState.engine->SetScheduleSliceFunctionHandler(PKAudioPlayerScheduleSlice);
-		}
-		else
-		{
-			__PKAudioPlayerSetupAudioConverter(&nativeFormat, &audioFormat);
-			AudioPlayerState.engine->SetScheduleSliceFunctionHandler(PKAudioPlayerScheduleSliceWithConverter);
-		}
+		CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+											 PKAudioPlayerDidEncounterErrorNotification, 
+											 NULL, 
+											 userInfo, 
+											 true);
 		
-		AudioPlayerState.decoder = decoder;
+		CFRelease(userInfo);
+		CFRelease(error);
+	});
+}
+
+///Change the buffering state of the stream if it is in a specified state, posting PKAudioPlayerDidChangeBufferingStateNotification if it was.
+static bool __PKAudioPlayerChangeBufferingState(PKAudioPlayerBufferingState fromState, PKAudioPlayerBufferingState toState)
+{
+	int32_t currentState = fromState;
+	if(!AudioPlayerState.bufferingState.compare_exchange_strong(currentState, toState, std::memory_order_acq_rel, std::memory_order_acquire))
+		return false;
+	
+	{
+		RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
 		
-		try
+		if(toState == kPKAudioPlayerBufferingStateStalled)
 		{
-			AudioPlayerState.engine->SetStreamFormat(audioFormat);
+			AudioPlayerState.streamStatistics.numberOfStalls++;
+			AudioPlayerState.streamStallHostTime = CAHostTimeBase::GetTheCurrentTime();
 		}
-		catch (RBException e)
+		else if(fromState == kPKAudioPlayerBufferingStateStalled)
 		{
-			AudioPlayerState.decoder = NULL;
-			
-			if(outError)
-			{
-				CFErrorRef underlyingError = e.CopyError();
-				
-				CFDictionaryRef userInfo = CFDICT({ kCFErrorUnderlyingErrorKey }, { underlyingError });
-				CFRelease(underlyingError);
-				
-				CFURLRef decoderLocation = decoder->CopyLocation();
-				*outError = PKCopyError(PKPlaybackErrorDomain, 
-										kPKPlaybackErrorIncompatibleStreamFormat, 
-										userInfo, 
-										CFSTR("The stream format of the file %@ cannot be decoded."), decoderLocation);
-				CFRelease(decoderLocation);
-				CFRelease(userInfo);
-			}
-			
-			return false;
+			UInt64 stalledNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(AudioPlayerState.streamStallHostTime, CAHostTimeBase::GetTheCurrentTime());
+			AudioPlayerState.streamStatistics.stalledDuration += stalledNanoseconds / 1000000000.0;
 		}
 	}
 	
+	dispatch_async(dispatch_get_main_queue(), ^{
+		SInt32 bufferingState = toState;
+		CFNumberRef bufferingStateNumber = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt32Type, &bufferingState);
+		CFDictionaryRef userInfo = CFDICT({ CFSTR("BufferingState") }, { bufferingStateNumber });
+		CFRelease(bufferingStateNumber);
+		
+		CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+											 PKAudioPlayerDidChangeBufferingStateNotification, 
+											 NULL, 
+											 userInfo, 
+											 true);
+		
+		CFRelease(userInfo);
+	});
+	
 	return true;
 }
 
-PK_EXTERN PKDecoder *PKAudioPlayerGetDecoder()
+///Change the buffering state of the stream from whatever state it is in.
+static void __PKAudioPlayerSetBufferingState(PKAudioPlayerBufferingState state)
 {
-	CHECK_STATE_INITIALIZED();
-	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
-	
-	return AudioPlayerState.decoder;
+	for (;;)
+	{
+		PKAudioPlayerBufferingState currentState = PKAudioPlayerBufferingState(AudioPlayerState.bufferingState.load(std::memory_order_acquire));
+		if((currentState == state) || __PKAudioPlayerChangeBufferingState(currentState, state))
+			return;
+	}
 }
 
-#pragma mark -
-
-PK_EXTERN Boolean PKAudioPlayerSetURL(CFURLRef location, CFErrorRef *outError)
+///Returns the stream being received, retained, or NULL if there isn't one.
+static PKStreamByteSource *__PKAudioPlayerCopyStream()
 {
-	CHECK_STATE_INITIALIZED();
+	RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	PKStreamByteSource *stream = AudioPlayerState.stream;
+	if(stream)
+		stream->Retain();
 	
-	try
+	return stream;
+}
+
+///Stop receiving the current stream, if there is one. Reads of it waiting for data fail.
+static void __PKAudioPlayerDiscardStream()
+{
+	PKStreamByteSource *stream = NULL;
 	{
-		if(location)
-		{
-			PKDecoder *decoder = PKDecoder::DecoderForURL(location);
-			RBAssert((decoder != NULL), CFSTR("Could not find decoder for {%@}."), location);
-			
-			return PKAudioPlayerSetDecoder(decoder, outError);
-		}
-		else
-		{
-			return PKAudioPlayerSetDecoder(NULL, outError);
-		}
+		RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+		
+		stream = AudioPlayerState.stream;
+		AudioPlayerState.stream = NULL;
 	}
-	catch (RBException e)
+	
+	if(stream)
 	{
-		if(outError) *outError = e.CopyError();
-		
-		return false;
+		stream->Cancel();
+		stream->Release();
 	}
 	
-	return true;
+	AudioPlayerState.playWhenStreamIsReady.store(false, std::memory_order_release);
+	__PKAudioPlayerSetBufferingState(kPKAudioPlayerBufferingStateNone);
 }
 
-PK_EXTERN CFURLRef PKAudioPlayerCopyURL()
+///Returns whether or not a track reads from a stream that playback has caught up with.
+static bool __PKAudioPlayerTrackIsStarved(PKAudioPlayerTrack *track)
 {
-	CHECK_STATE_INITIALIZED();
-	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	if(!track->stream || (track->prerollOffset < track->prerollNumberOfFrames))
+		return false;
 	
-	return AudioPlayerState.decoder->CopyLocation();
+	return !track->stream->HasDataAhead(AudioPlayerState.streamingPolicy.stallingNumberOfBytes);
 }
 
-#pragma mark -
-
-PK_EXTERN Boolean PKAudioPlayerPlay(CFErrorRef *outError)
+///Pause processing while the current stream is stalled, and resume it once enough of the stream has arrived.
+static void __PKAudioPlayerReconcileStall()
 {
-	CHECK_STATE_INITIALIZED();
+	AudioPlayerState.stallReconcileIsPending.store(false, std::memory_order_release);
 	
-	if(PKAudioPlayerIsPlaying())
-		return true;
+	//The audio player is being torn down, and is waiting on us without the lock.
+	if(AudioPlayerStateInitCount.load(std::memory_order_acquire) == 0)
+		return;
 	
-	if(PKAudioPlayerIsPaused())
-		return PKAudioPlayerResume(outError);
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
+	
+	PKStreamByteSource *stream = NULL;
+	{
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		
+		stream = AudioPlayerState.track.stream;
+		if(stream) stream->Retain();
+	}
+	
+	//The data may have arrived between playback stalling and us getting here.
+	if(stream && stream->HasDataAhead(AudioPlayerState.streamingPolicy.resumingNumberOfBytes))
+		__PKAudioPlayerChangeBufferingState(kPKAudioPlayerBufferingStateStalled, kPKAudioPlayerBufferingStateReady);
+	
+	bool shouldBeStalled = (stream != NULL) && (AudioPlayerState.bufferingState.load(std::memory_order_acquire) == kPKAudioPlayerBufferingStateStalled);
+	
+	if(stream)
+		stream->Release();
+	
+	try
+	{
+		bool isStalled = AudioPlayerState.isStalled.load(std::memory_order_acquire);
+		if(shouldBeStalled && !isStalled && engine->IsRunning())
+		{
+			engine->StopGraph();
+			engine->PauseProcessing();
+			
+			AudioPlayerState.preserveExistingBuffersOnResume.store(true, std::memory_order_release);
+			AudioPlayerState.isStalled.store(true, std::memory_order_release);
+		}
+		else if(!shouldBeStalled && isStalled)
+		{
+			AudioPlayerState.isStalled.store(false, std::memory_order_release);
+			
+			engine->ResumeProcessing(AudioPlayerState.preserveExistingBuffersOnResume.load(std::memory_order_acquire));
+			engine->StartGraph();
+		}
+	}
+	catch (RBException e)
+	{
+		__PKAudioPlayerPostError(e.CopyError());
+	}
+}
+
+///Ask for the stall of the current stream to be reconciled with whether or not processing is paused.
+static void __PKAudioPlayerRequestStallReconcile()
+{
+	if(!AudioPlayerState.stallReconcileIsPending.exchange(true, std::memory_order_acq_rel))
+		AudioPlayerState.streamQueue->Async(^{ __PKAudioPlayerReconcileStall(); });
+}
+
+///Note that playback has caught up with the current stream. Called on the engine's scheduler queue.
+static void __PKAudioPlayerStreamDidStall()
+{
+	__PKAudioPlayerChangeBufferingState(kPKAudioPlayerBufferingStateReady, kPKAudioPlayerBufferingStateStalled);
+	
+	if(!AudioPlayerState.isStalled.load(std::memory_order_acquire))
+		__PKAudioPlayerRequestStallReconcile();
+}
+
+///Note that playback of the current stream has been asked for, returning whether it has to wait for the stream to be opened.
+static bool __PKAudioPlayerStreamWillPlay()
+{
+	RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+	
+	if(!AudioPlayerState.stream)
+		return false;
+	
+	if(AudioPlayerState.streamPlayRequestHostTime == 0)
+		AudioPlayerState.streamPlayRequestHostTime = CAHostTimeBase::GetTheCurrentTime();
+	
+	if(AudioPlayerState.bufferingState.load(std::memory_order_acquire) == kPKAudioPlayerBufferingStateBuffering)
+	{
+		AudioPlayerState.playWhenStreamIsReady.store(true, std::memory_order_release);
+		return true;
+	}
+	
+	return false;
+}
+
+///Note that playback has started, recording the time to first audio of the current stream if it is the first time.
+static void __PKAudioPlayerStreamDidStartPlaying()
+{
+	RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+	
+	if(!AudioPlayerState.stream || (AudioPlayerState.streamPlayRequestHostTime == 0) || (AudioPlayerState.streamStatistics.timeToFirstAudio > 0.0))
+		return;
+	
+	UInt64 nanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(AudioPlayerState.streamPlayRequestHostTime, CAHostTimeBase::GetTheCurrentTime());
+	AudioPlayerState.streamStatistics.timeToFirstAudio = nanoseconds / 1000000000.0;
+}
+
+#pragma mark -
+#pragma mark Playback Callbacks
+
+struct PKAudioPlayerConverterState
+{
+	PKAudioPlayerTrack *mTrack;
+	CFErrorRef mError;
+	UInt64 mDecodeNanoseconds;
+};
+
+static OSStatus PKAudioPlayerConverterCallback(AudioConverterRef inAudioConverter, UInt32 *ioNumberDataPackets, AudioBufferList *ioData, AudioStreamPacketDescription **outDataPacketDescription, void *inUserData)
+{
+	PKAudioPlayerConverterState *sharedState = (PKAudioPlayerConverterState *)inUserData;
+	PKAudioPlayerTrack *track = sharedState->mTrack;
+	
+	for (int index = 0; index < track->decoderConverterBuffers->mNumberBuffers; index++)
+		ioData->mBuffers[index] = track->decoderConverterBuffers->mBuffers[index];
+	
+	//Slices may be larger than the converter buffers, in which case the converter just calls us again.
+	if(*ioNumberDataPackets > track->decoderConverterBuffersNumberOfFrames)
+		*ioNumberDataPackets = track->decoderConverterBuffersNumberOfFrames;
+	
+	try
+	{
+		UInt64 decodeStartHostTime = CAHostTimeBase::GetTheCurrentTime();
+		*ioNumberDataPackets = track->decoder->FillBuffers(ioData, *ioNumberDataPackets);
+		
+		UInt64 decodeNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(decodeStartHostTime, CAHostTimeBase::GetTheCurrentTime());
+		AudioPlayerState.decodeLatencyHistogram->Record(decodeNanoseconds);
+		sharedState->mDecodeNanoseconds += decodeNanoseconds;
+		
+		if(*ioNumberDataPackets == 0)
+		{
+			//This is necessary or AudioConverter will continue to call this function
+			//producing garbage that the user then has to hear. We don't want that to happen.
+			for (int index = 0; index < track->decoderConverterBuffers->mNumberBuffers; index++)
+				ioData->mBuffers[index].mDataByteSize = 0;
+		}
+	}
+	catch (RBException e)
+	{
+		sharedState->mError = e.CopyError();
+		
+		return CFErrorGetCode(sharedState->mError);
+	}
+	
+	return noErr;
+}
+
+///Fill buffers in a track's stream format with audio from the track, returning the number of frames read.
+static UInt32 __PKAudioPlayerTrackFillBuffers(PKAudioPlayerTrack *track, AudioBufferList *ioBuffer, UInt32 numberOfFramesToRead, CFErrorRef *error)
+{
+	//Audio decoded before the track started playing is handed out before anything new is decoded.
+	if(track->prerollOffset < track->prerollNumberOfFrames)
+	{
+		UInt32 bytesPerFrame = track->streamFormat.mBytesPerFrame;
+		UInt32 numberOfFramesRead = track->prerollNumberOfFrames - track->prerollOffset;
+		if(numberOfFramesRead > numberOfFramesToRead)
+			numberOfFramesRead = numberOfFramesToRead;
+		for (int index = 0; index < ioBuffer->mNumberBuffers; index++)
+		{
+			memcpy(ioBuffer->mBuffers[index].mData, 
+				   (UInt8 *)(track->prerollBuffers->mBuffers[index].mData) + (track->prerollOffset * bytesPerFrame), 
+				   numberOfFramesRead * bytesPerFrame);
+			ioBuffer->mBuffers[index].mDataByteSize = numberOfFramesRead * bytesPerFrame;
+		}
+		
+		track->prerollOffset += numberOfFramesRead;
+		
+		return numberOfFramesRead;
+	}
+	
+	if(!track->decoderConverter)
+	{
+		try
+		{
+			UInt64 decodeStartHostTime = CAHostTimeBase::GetTheCurrentTime();
+			UInt32 numberOfFramesRead = track->decoder->FillBuffers(ioBuffer, numberOfFramesToRead);
+			AudioPlayerState.decodeLatencyHistogram->RecordHostTimeInterval(decodeStartHostTime, CAHostTimeBase::GetTheCurrentTime());
+			
+			return numberOfFramesRead;
+		}
+		catch (RBException e)
+		{
+			if(error) *error = e.CopyError();
+			
+			return 0;
+		}
+	}
+	
+	UInt32 ioNumberOfFramesForConverter = numberOfFramesToRead;
+	PKAudioPlayerConverterState converterState = { .mTrack = track, .mError = NULL, .mDecodeNanoseconds = 0 };
+	
+	UInt64 convertStartHostTime = CAHostTimeBase::GetTheCurrentTime();
+	OSStatus errorCode = AudioConverterFillComplexBuffer(track->decoderConverter, //in audioConverter
+														 PKAudioPlayerConverterCallback, //in inputDataProc
+														 &converterState, //in userData
+														 &ioNumberOfFramesForConverter, //io dataPacketSize
+														 ioBuffer, //out outputData
+														 NULL); //out packetDescription
+	
+	//The decoder is called from within the converter, so its time is taken back out.
+	UInt64 convertNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(convertStartHostTime, CAHostTimeBase::GetTheCurrentTime());
+	if(convertNanoseconds > converterState.mDecodeNanoseconds)
+		AudioPlayerState.convertLatencyHistogram->Record(convertNanoseconds - converterState.mDecodeNanoseconds);
+	else
+		AudioPlayerState.convertLatencyHistogram->Record(0);
+	if(ioNumberOfFramesForConverter == 0)
+	{
+		if(errorCode != noErr)
+			if(error) *error = converterState.mError;
+		
+		return 0;
+	}
+	
+	return ioNumberOfFramesForConverter;
+}
+
+#pragma mark -
+#pragma mark Crossfading
+
+///Start fading the next track in if the current track is within the crossfade duration of its end.
+static void __PKAudioPlayerBeginCrossfadeIfNeeded(UInt32 numberOfFramesPerMix)
+{
+	PKAudioPlayerTrack *track = &AudioPlayerState.track;
+	
+	CFTimeInterval crossfadeDuration = AudioPlayerState.crossfadeDuration.load(std::memory_order_acquire);
+	if((crossfadeDuration <= 0.0) || !track->decoder || AudioPlayerState.nextTrackIsPending.load(std::memory_order_acquire) || !AudioPlayerState.nextTrack)
+		return;
+	
+	//Decoders that don't know how long they are can't be faded out of.
+	PKDecoder::FrameLocation totalNumberOfFrames = track->decoder->GetTotalNumberOfFrames();
+	PKDecoder::FrameLocation currentFrame = track->decoder->GetCurrentFrame();
+	if((totalNumberOfFrames == 0) || (currentFrame > totalNumberOfFrames))
+		return;
+	
+	//The decoder counts frames at its own sample rate, the crossfade is counted at the track's.
+	Float64 sampleRateRatio = track->streamFormat.mSampleRate / track->decoder->GetStreamFormat().mSampleRate;
+	UInt64 numberOfFramesRemaining = UInt64((totalNumberOfFrames - currentFrame) * sampleRateRatio) + (track->prerollNumberOfFrames - track->prerollOffset);
+	if(numberOfFramesRemaining > UInt64(crossfadeDuration * track->streamFormat.mSampleRate))
+		return;
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	PKAudioPlayerTrack *nextTrack = AudioPlayerState.nextTrack;
+	if(!nextTrack || !(nextTrack->streamFormat == track->streamFormat))
+		return;
+	
+	try
+	{
+		AudioPlayerState.crossfadeMixer = new PKCrossfadeMixer(track->streamFormat, 
+															   numberOfFramesPerMix, 
+															   PKCrossfadeMixer::Curve(AudioPlayerState.crossfadeCurve), 
+															   numberOfFramesRemaining);
+	}
+	catch (RBException e)
+	{
+		//The next track is still spliced onto the end of the current one, just without a crossfade.
+		return;
+	}
+	
+	AudioPlayerState.fadingInTrack = nextTrack;
+	AudioPlayerState.nextTrack = NULL;
+}
+
+///Mix audio from the track fading in into audio from the current track.
+///The track lock is only held to check the track out and back in, never while decoding.
+static void __PKAudioPlayerMixInFadingTrack(AudioBufferList *ioBuffer, UInt32 numberOfFrames)
+{
+	PKAudioPlayerTrack *fadingInTrack = NULL;
+	PKCrossfadeMixer *mixer = NULL;
+	{
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		
+		fadingInTrack = AudioPlayerState.fadingInTrack;
+		mixer = AudioPlayerState.crossfadeMixer;
+		if(!fadingInTrack || !mixer)
+			return;
+		
+		//A crossfade cancelled from here on leaves the track to us, and the mixer is ours until we let go of it.
+		mixer->Retain();
+		AudioPlayerState.fadingInTrackIsBeingMixed = true;
+	}
+	
+	UInt32 frameOffset = 0;
+	while (frameOffset < numberOfFrames)
+	{
+		UInt32 numberOfFramesToMix = numberOfFrames - frameOffset;
+		if(numberOfFramesToMix > mixer->GetMaximumNumberOfFramesPerMix())
+			numberOfFramesToMix = mixer->GetMaximumNumberOfFramesPerMix();
+		
+		//Decoders may hand back fewer frames than asked for. Whatever is missing is mixed in as silence.
+		UInt32 numberOfFramesDecoded = 0;
+		while (numberOfFramesDecoded < numberOfFramesToMix)
+		{
+			UInt32 numberOfFramesToDecode = numberOfFramesToMix - numberOfFramesDecoded;
+			AudioBufferList *incomingBuffers = mixer->GetIncomingBuffers(numberOfFramesDecoded, numberOfFramesToDecode);
+			
+			//An error is reported once the track fading in becomes the current track and fails again.
+			CFErrorRef error = NULL;
+			UInt32 numberOfFramesRead = __PKAudioPlayerTrackFillBuffers(fadingInTrack, incomingBuffers, numberOfFramesToDecode, &error);
+			if(error)
+				CFRelease(error);
+			
+			if(numberOfFramesRead == 0)
+				break;
+			
+			numberOfFramesDecoded += numberOfFramesRead;
+		}
+		
+		mixer->Mix(ioBuffer, frameOffset, numberOfFramesToMix);
+		frameOffset += numberOfFramesToMix;
+	}
+	
+	{
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		
+		AudioPlayerState.fadingInTrackIsBeingMixed = false;
+		
+		//The crossfade was cancelled while we were decoding, so finishing the cancel falls to us.
+		if(AudioPlayerState.fadingInTrack != fadingInTrack)
+			__PKAudioPlayerRetireFadingInTrack(fadingInTrack);
+	}
+	
+	mixer->Release();
+}
+
+///Stop crossfading, putting the track that was fading in back in the queue if it can be rewound.
+static void __PKAudioPlayerCancelCrossfade()
+{
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	if(AudioPlayerState.crossfadeMixer)
+	{
+		AudioPlayerState.crossfadeMixer->Release();
+		AudioPlayerState.crossfadeMixer = NULL;
+	}
+	
+	PKAudioPlayerTrack *fadingInTrack = AudioPlayerState.fadingInTrack;
+	if(!fadingInTrack)
+		return;
+	
+	AudioPlayerState.fadingInTrack = NULL;
+	
+	//The scheduler is decoding the track outside of the lock, it finishes the cancel once it is done.
+	if(AudioPlayerState.fadingInTrackIsBeingMixed)
+		return;
+	
+	__PKAudioPlayerRetireFadingInTrack(fadingInTrack);
+}
+
+///Put a track that is no longer fading in back in the queue if it can be rewound, tearing it down otherwise. The track lock must be held.
+static void __PKAudioPlayerRetireFadingInTrack(PKAudioPlayerTrack *fadingInTrack)
+{
+	if(fadingInTrack->decoder->CanSeek() && !AudioPlayerState.nextTrack)
+	{
+		try
+		{
+			fadingInTrack->decoder->SetCurrentFrame(0);
+			fadingInTrack->prerollNumberOfFrames = 0;
+			
+			if(fadingInTrack->decoderConverter)
+				AudioConverterReset(fadingInTrack->decoderConverter);
+			
+			AudioPlayerState.nextTrack = fadingInTrack;
+			
+			return;
+		}
+		catch (RBException e)
+		{
+			//Fall through and discard the track.
+		}
+	}
+	
+	__PKAudioPlayerTrackTeardown(fadingInTrack);
+	free(fadingInTrack);
+}
+
+#pragma mark -
+
+///Replace the current track with the next track if it can be played without reconfiguring the engine.
+static bool __PKAudioPlayerAdvanceToNextTrack()
+{
+	//
+	//	A track queued moments before the current one ends may still be being opened. The scheduler
+	//	can't wait on that, so the current track ends normally and the next one is started after it.
+	//
+	if(AudioPlayerState.nextTrackIsPending.load(std::memory_order_acquire))
+		return false;
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	//A track being crossfaded into has been decoding alongside the current one, and simply carries on.
+	PKAudioPlayerTrack *nextTrack = AudioPlayerState.fadingInTrack ?: AudioPlayerState.nextTrack;
+	if(!nextTrack || !(nextTrack->streamFormat == AudioPlayerState.track.streamFormat))
+		return false;
+	
+	if(nextTrack == AudioPlayerState.fadingInTrack)
+	{
+		AudioPlayerState.fadingInTrack = NULL;
+		
+		AudioPlayerState.crossfadeMixer->Release();
+		AudioPlayerState.crossfadeMixer = NULL;
+	}
+	else
+	{
+		AudioPlayerState.nextTrack = NULL;
+	}
+	
+	__PKAudioPlayerTrackTeardown(&AudioPlayerState.track);
+	AudioPlayerState.track = *nextTrack;
+	free(nextTrack);
+	
+	//The new track is only heard once the read-ahead in front of it has played out.
+	AudioPlayerState.engine->SetPlaybackMarker(^{
+		dispatch_async(dispatch_get_main_queue(), ^{
+			CFDictionaryRef userInfo = CFDICT({ CFSTR("Gapless") }, { kCFBooleanTrue });
+			
+			CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+												 PKAudioPlayerDidAdvanceToNextTrackNotification, 
+												 NULL, 
+												 userInfo, 
+												 true);
+			
+			CFRelease(userInfo);
+		});
+	});
+	
+	return true;
+}
+
+static UInt32 PKAudioPlayerScheduleSlice(PKAudioPlayerEngine *graph, AudioBufferList *ioBuffer, UInt32 numberOfFramesToRead, CFErrorRef *error, void *userData)
+{
+	//A stream that playback has caught up with stalls until more of it arrives, rather than ending.
+	if(__PKAudioPlayerTrackIsStarved(&AudioPlayerState.track))
+	{
+		graph->NoteScheduleSliceStalled();
+		__PKAudioPlayerStreamDidStall();
+		
+		return 0;
+	}
+	
+	if(!AudioPlayerState.fadingInTrack)
+		__PKAudioPlayerBeginCrossfadeIfNeeded(numberOfFramesToRead);
+	
+	UInt32 numberOfFramesRead = __PKAudioPlayerTrackFillBuffers(&AudioPlayerState.track, ioBuffer, numberOfFramesToRead, error);
+	
+	//Outside of a crossfade only the current track is decoded. A crossfade can be cancelled from
+	//other threads, which the mix checks for under the track lock before and after it decodes.
+	if((numberOfFramesRead > 0) && AudioPlayerState.fadingInTrack)
+		__PKAudioPlayerMixInFadingTrack(ioBuffer, numberOfFramesRead);
+	
+	//
+	//	The next track is spliced in at the exact frame the current one ends, so
+	//	the read-ahead carries on into it without the engine ever seeing a gap.
+	//
+	if((numberOfFramesRead == 0) && !(error && *error) && __PKAudioPlayerAdvanceToNextTrack())
+	{
+		for (int index = 0; index < ioBuffer->mNumberBuffers; index++)
+			ioBuffer->mBuffers[index].mDataByteSize = numberOfFramesToRead * AudioPlayerState.track.streamFormat.mBytesPerFrame;
+		
+		numberOfFramesRead = __PKAudioPlayerTrackFillBuffers(&AudioPlayerState.track, ioBuffer, numberOfFramesToRead, error);
+	}
+	
+	return numberOfFramesRead;
+}
+
+#pragma mark -
+#pragma mark Controlling Playback
+
+///Make a track the current track, reconfiguring the engine for its stream format if necessary. The engine must be stopped.
+static void __PKAudioPlayerUseTrack(PKAudioPlayerTrack *track) throw(RBException)
+{
+	AudioPlayerState.engine->SetScheduleSliceFunctionHandler(PKAudioPlayerScheduleSlice);
+	
+	//Reconfiguring the graph is audible, so consecutive songs in the same format leave it alone.
+	if(!AudioPlayerState.engineHasTrackStreamFormat || !(AudioPlayerState.engine->GetStreamFormat() == track->streamFormat))
+	{
+		AudioPlayerState.engineHasTrackStreamFormat = false;
+		AudioPlayerState.engine->SetStreamFormat(track->streamFormat);
+		AudioPlayerState.engineHasTrackStreamFormat = true;
+	}
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	AudioPlayerState.track = *track;
+}
+
+///Stop playback and tear down the current and queued tracks.
+static Boolean __PKAudioPlayerClearTracks(CFErrorRef *outError)
+{
+	if((PKAudioPlayerIsPlaying() || PKAudioPlayerIsPaused()) && !PKAudioPlayerStop(false, outError))
+		return false;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//A queued track is only ever queued behind the track it was queued after.
+	//Playback is stopped, so a track that was fading in can be torn down along with it.
+	__PKAudioPlayerCancelCrossfade();
+	__PKAudioPlayerDiscardNextTrack();
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	__PKAudioPlayerTrackTeardown(&AudioPlayerState.track);
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerSetDecoder(PKDecoder *decoder, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	//Files still being opened by PKAudioPlayerSetURLAsync, and streams, are superseded by this decoder.
+	AudioPlayerState.openGeneration.fetch_add(1, std::memory_order_acq_rel);
+	__PKAudioPlayerDiscardStream();
+	
+	if(decoder == AudioPlayerState.track.decoder)
+		return true;
+	
+	if(!__PKAudioPlayerClearTracks(outError))
+		return false;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	if(decoder)
+	{
+		PKAudioPlayerTrack track;
+		
+		try
+		{
+			__PKAudioPlayerTrackSetup(&track, decoder);
+			__PKAudioPlayerUseTrack(&track);
+		}
+		catch (RBException e)
+		{
+			//The caller keeps ownership of the decoder when it cannot be used.
+			track.decoder = NULL;
+			__PKAudioPlayerTrackTeardown(&track);
+			
+			if(outError)
+			{
+				CFErrorRef underlyingError = e.CopyError();
+				
+				CFDictionaryRef userInfo = CFDICT({ kCFErrorUnderlyingErrorKey }, { underlyingError });
+				CFRelease(underlyingError);
+				
+				CFURLRef decoderLocation = decoder->CopyLocation();
+				*outError = PKCopyError(PKPlaybackErrorDomain, 
+										kPKPlaybackErrorIncompatibleStreamFormat, 
+										userInfo, 
+										CFSTR("The stream format of the file %@ cannot be decoded."), decoderLocation);
+				if(decoderLocation)
+					CFRelease(decoderLocation);
+				CFRelease(userInfo);
+			}
+			
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+PK_EXTERN PKDecoder *PKAudioPlayerGetDecoder()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerTrackLock);
+	
+	return AudioPlayerState.track.decoder;
+}
+
+#pragma mark -
+
+///Decode the beginning of a track ahead of time so that it can start playing without waiting on its decoder.
+static void __PKAudioPlayerTrackPreroll(PKAudioPlayerTrack *track)
+{
+	CAStreamBasicDescription streamFormat(track->streamFormat);
+	UInt32 numberOfFrames = kPKCanonicalBaseBufferSize / streamFormat.mBytesPerFrame;
+	UInt32 bufferSize = numberOfFrames * streamFormat.mBytesPerFrame;
+	
+	track->prerollBuffers = CAAudioBufferList::Create(streamFormat.IsInterleaved()? 1 : streamFormat.mChannelsPerFrame);
+	for (int index = 0; index < track->prerollBuffers->mNumberBuffers; index++)
+	{
+		AudioBuffer &buffer = track->prerollBuffers->mBuffers[index];
+		buffer.mData = malloc(bufferSize);
+		buffer.mDataByteSize = bufferSize;
+		buffer.mNumberChannels = streamFormat.IsInterleaved()? streamFormat.mChannelsPerFrame : 1;
+	}
+	
+	//A decoder that fails here will fail again once the track is playing, which is where the error is reported.
+	CFErrorRef error = NULL;
+	track->prerollNumberOfFrames = __PKAudioPlayerTrackFillBuffers(track, track->prerollBuffers, numberOfFrames, &error);
+	track->prerollOffset = 0;
+	
+	if(error)
+		CFRelease(error);
+}
+
+///Discard the queued next track, waiting for it to finish being prepared if necessary.
+static void __PKAudioPlayerDiscardNextTrack()
+{
+	if(AudioPlayerState.nextTrackIsPending.load(std::memory_order_acquire))
+		AudioPlayerState.nextTrackQueue->Sync(^{});
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	if(AudioPlayerState.nextTrack)
+	{
+		__PKAudioPlayerTrackTeardown(AudioPlayerState.nextTrack);
+		free(AudioPlayerState.nextTrack);
+		AudioPlayerState.nextTrack = NULL;
+	}
+}
+
+///Start playing the queued next track after the current track has finished playing, if there is one.
+static Boolean __PKAudioPlayerPlayNextTrackAfterEndOfPlayback()
+{
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	if(AudioPlayerState.nextTrackIsPending.load(std::memory_order_acquire))
+		AudioPlayerState.nextTrackQueue->Sync(^{});
+	
+	PKAudioPlayerTrack track;
+	{
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		
+		if(!AudioPlayerState.nextTrack)
+			return false;
+		
+		track = *AudioPlayerState.nextTrack;
+		free(AudioPlayerState.nextTrack);
+		AudioPlayerState.nextTrack = NULL;
+		
+		__PKAudioPlayerTrackTeardown(&AudioPlayerState.track);
+	}
+	
+	CFErrorRef error = NULL;
+	try
+	{
+		__PKAudioPlayerUseTrack(&track);
+	}
+	catch (RBException e)
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		error = e.CopyError();
+	}
+	
+	if(error || !PKAudioPlayerPlay(&error))
+	{
+		if(error)
+		{
+			CFDictionaryRef userInfo = CFDICT({ CFSTR("Error") }, { error });
+			
+			CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+												 PKAudioPlayerDidEncounterErrorNotification, 
+												 NULL, 
+												 userInfo, 
+												 true);
+			
+			CFRelease(userInfo);
+			CFRelease(error);
+		}
+		
+		return false;
+	}
+	
+	CFDictionaryRef userInfo = CFDICT({ CFSTR("Gapless") }, { kCFBooleanFalse });
+	
+	CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+										 PKAudioPlayerDidAdvanceToNextTrackNotification, 
+										 NULL, 
+										 userInfo, 
+										 true);
+	
+	CFRelease(userInfo);
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerQueueNextDecoder(PKDecoder *decoder, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	__PKAudioPlayerDiscardNextTrack();
+	
+	if(!decoder)
+		return true;
+	
+	PKAudioPlayerTrack *nextTrack = (PKAudioPlayerTrack *)calloc(1, sizeof(PKAudioPlayerTrack));
+	try
+	{
+		__PKAudioPlayerTrackSetup(nextTrack, decoder);
+	}
+	catch (RBException e)
+	{
+		//The caller keeps ownership of the decoder when it cannot be used.
+		nextTrack->decoder = NULL;
+		__PKAudioPlayerTrackTeardown(nextTrack);
+		free(nextTrack);
+		
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	AudioPlayerState.nextTrackIsPending.fetch_add(1, std::memory_order_acq_rel);
+	AudioPlayerState.nextTrackQueue->Async(^{
+		
+		__PKAudioPlayerTrackPreroll(nextTrack);
+		
+		{
+			RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+			AudioPlayerState.nextTrack = nextTrack;
+		}
+		
+		AudioPlayerState.nextTrackIsPending.fetch_sub(1, std::memory_order_acq_rel);
+		
+	});
+	
+	return true;
+}
+
+PK_EXTERN PKDecoder *PKAudioPlayerGetQueuedDecoder()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	if(AudioPlayerState.nextTrackIsPending.load(std::memory_order_acquire))
+		AudioPlayerState.nextTrackQueue->Sync(^{});
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerTrackLock);
+	
+	return AudioPlayerState.nextTrack? AudioPlayerState.nextTrack->decoder : NULL;
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerSetURL(CFURLRef location, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	try
+	{
+		if(location)
+		{
+			PKDecoder *decoder = PKDecoder::DecoderForURL(location);
+			RBAssert((decoder != NULL), CFSTR("Could not find decoder for {%@}."), location);
+			
+			return PKAudioPlayerSetDecoder(decoder, outError);
+		}
+		else
+		{
+			return PKAudioPlayerSetDecoder(NULL, outError);
+		}
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	return true;
+}
+
+PK_EXTERN CFURLRef PKAudioPlayerCopyURL()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	return AudioPlayerState.track.decoder->CopyLocation();
+}
+
+PK_EXTERN Boolean PKAudioPlayerSetByteSource(const PKAudioPlayerByteSourceCallbacks *callbacks, void *info, CFStringRef pathExtension, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	PKCallbackByteSource *source = NULL;
+	try
+	{
+		RBParameterAssert(callbacks);
+		RBParameterAssert(callbacks->read);
+		
+		PKCallbackByteSource::Callbacks sourceCallbacks = {
+			callbacks->read,
+			callbacks->seek,
+			callbacks->getLength,
+			callbacks->release,
+		};
+		
+		source = new PKCallbackByteSource(sourceCallbacks, info, pathExtension);
+		
+		PKDecoder *decoder = PKDecoder::DecoderForByteSource(source);
+		source->Release();
+		source = NULL;
+		
+		RBAssert((decoder != NULL), CFSTR("Could not find decoder for byte source with extension %@."), pathExtension);
+		
+		return PKAudioPlayerSetDecoder(decoder, outError);
+	}
+	catch (RBException e)
+	{
+		if(source)
+			source->Release();
+		
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	return true;
+}
+
+///Returns whether or not a file being opened by PKAudioPlayerSetURLAsync is still the most recently set source file.
+static bool __PKAudioPlayerOpenIsCurrent(int32_t generation)
+{
+	return (AudioPlayerState.openGeneration.load(std::memory_order_acquire) == generation);
+}
+
+///Open a file, decode its beginning, and make it the current track, unless it is superseded along the way.
+static PKAudioPlayerSetURLResult __PKAudioPlayerOpenURL(CFURLRef location, int32_t generation, CFErrorRef *outError)
+{
+	if(!__PKAudioPlayerOpenIsCurrent(generation))
+		return kPKAudioPlayerSetURLResultCancelled;
+	
+	PKAudioPlayerTrack track;
+	memset(&track, 0, sizeof(track));
+	
+	if(location)
+	{
+		try
+		{
+			PKDecoder *decoder = PKDecoder::DecoderForURL(location);
+			RBAssert((decoder != NULL), CFSTR("Could not find decoder for {%@}."), location);
+			
+			//The track owns the decoder from here on, even when it cannot be set up.
+			track.decoder = decoder;
+			if(!__PKAudioPlayerOpenIsCurrent(generation))
+			{
+				__PKAudioPlayerTrackTeardown(&track);
+				return kPKAudioPlayerSetURLResultCancelled;
+			}
+			
+			__PKAudioPlayerTrackSetup(&track, decoder);
+		}
+		catch (RBException e)
+		{
+			__PKAudioPlayerTrackTeardown(&track);
+			
+			if(outError) *outError = e.CopyError();
+			
+			return kPKAudioPlayerSetURLResultFailed;
+		}
+		
+		//Decoding the first slices here keeps the first render after playback starts from waiting on the disk.
+		__PKAudioPlayerTrackPreroll(&track);
+	}
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//Checked again under the lock, since PKAudioPlayerSetDecoder supersedes files before taking it.
+	if(!__PKAudioPlayerOpenIsCurrent(generation))
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		return kPKAudioPlayerSetURLResultCancelled;
+	}
+	
+	__PKAudioPlayerDiscardStream();
+	
+	if(!__PKAudioPlayerClearTracks(outError))
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		return kPKAudioPlayerSetURLResultFailed;
+	}
+	
+	if(track.decoder)
+	{
+		try
+		{
+			__PKAudioPlayerUseTrack(&track);
+		}
+		catch (RBException e)
+		{
+			__PKAudioPlayerTrackTeardown(&track);
+			
+			if(outError) *outError = e.CopyError();
+			
+			return kPKAudioPlayerSetURLResultFailed;
+		}
+	}
+	
+	return kPKAudioPlayerSetURLResultSucceeded;
+}
+
+PK_EXTERN void PKAudioPlayerSetURLAsync(CFURLRef location, dispatch_queue_t completionQueue, PKAudioPlayerSetURLCompletionHandler completionHandler)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	int32_t generation = AudioPlayerState.openGeneration.fetch_add(1, std::memory_order_acq_rel) + 1;
+	
+	if(location)
+		CFRetain(location);
+	
+	if(!completionQueue)
+		completionQueue = dispatch_get_main_queue();
+	dispatch_retain(completionQueue);
+	
+	AudioPlayerState.openQueue->Async(^{
+		
+		CFErrorRef error = NULL;
+		PKAudioPlayerSetURLResult result = __PKAudioPlayerOpenURL(location, generation, &error);
+		
+		if(location)
+			CFRelease(location);
+		
+		if(completionHandler)
+		{
+			dispatch_async(completionQueue, ^{
+				completionHandler(result, error);
+				
+				if(error)
+					CFRelease(error);
+			});
+		}
+		else if(error)
+		{
+			CFRelease(error);
+		}
+		
+		dispatch_release(completionQueue);
+		
+	});
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerQueueNextURL(CFURLRef location, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	if(!location)
+		return PKAudioPlayerQueueNextDecoder(NULL, outError);
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//
+	//	Opening the file and creating its converter can take a while, so the whole track is prepared
+	//	on the next track queue. The track queued before it is replaced there too, once it is ready.
+	//
+	CFRetain(location);
+	AudioPlayerState.nextTrackIsPending.fetch_add(1, std::memory_order_acq_rel);
+	AudioPlayerState.nextTrackQueue->Async(^{
+		
+		{
+			RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+			
+			if(AudioPlayerState.nextTrack)
+			{
+				__PKAudioPlayerTrackTeardown(AudioPlayerState.nextTrack);
+				free(AudioPlayerState.nextTrack);
+				AudioPlayerState.nextTrack = NULL;
+			}
+		}
+		
+		PKAudioPlayerTrack *nextTrack = (PKAudioPlayerTrack *)calloc(1, sizeof(PKAudioPlayerTrack));
+		try
+		{
+			PKDecoder *decoder = PKDecoder::DecoderForURL(location);
+			RBAssert((decoder != NULL), CFSTR("Could not find decoder for {%@}."), location);
+			
+			//The track owns the decoder from here on, even if it can't be set up.
+			nextTrack->decoder = decoder;
+			__PKAudioPlayerTrackSetup(nextTrack, decoder);
+			__PKAudioPlayerTrackPreroll(nextTrack);
+			
+			RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+			AudioPlayerState.nextTrack = nextTrack;
+		}
+		catch (RBException e)
+		{
+			__PKAudioPlayerTrackTeardown(nextTrack);
+			free(nextTrack);
+			
+			__PKAudioPlayerPostError(e.CopyError());
+		}
+		
+		CFRelease(location);
+		
+		AudioPlayerState.nextTrackIsPending.fetch_sub(1, std::memory_order_acq_rel);
+		
+	});
+	
+	return true;
+}
+
+PK_EXTERN CFURLRef PKAudioPlayerCopyNextURL()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	PKDecoder *decoder = PKAudioPlayerGetQueuedDecoder();
+	if(decoder)
+		return decoder->CopyLocation();
+	
+	return NULL;
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerPlay(CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	if(PKAudioPlayerIsPlaying())
+		return true;
+	
+	if(PKAudioPlayerIsPaused())
+		return PKAudioPlayerResume(outError);
+	
+	//A stream that is still buffering starts playing as soon as enough of it has arrived to open it.
+	if(__PKAudioPlayerStreamWillPlay())
+		return true;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	if(!AudioPlayerState.hasBroadcastedPresence.load(std::memory_order_acquire))
+	{
+		CFNotificationCenterPostNotification(CFNotificationCenterGetDistributedCenter(), 
+											 PKAudioPlayerDidBroadcastPresenceNotification, 
+											 AudioPlayerState.sessionID, 
+											 NULL, 
+											 true);
+		
+		AudioPlayerState.hasBroadcastedPresence.store(true, std::memory_order_release);
+	}
+	
+	try
+	{
+		if(!AudioPlayerState.engine->IsRunning())
+		{
+			AudioPlayerState.engine->StartGraph();
+			AudioPlayerState.engine->StartProcessing();
+			
+			__PKAudioPlayerStreamDidStartPlaying();
+		}
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		return false;
+	}
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerStop(Boolean postNotification, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	AudioPlayerState.playWhenStreamIsReady.store(false, std::memory_order_release);
+	
+	if(!PKAudioPlayerIsPlaying() && !PKAudioPlayerIsPaused())
+		return true;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	try
+	{
+		if(AudioPlayerState.engine->IsRunning())
+			AudioPlayerState.engine->StopGraph();
+		
+		AudioPlayerState.engine->StopProcessing();
+		
+		AudioPlayerState.isPaused.store(false, std::memory_order_release);
+		AudioPlayerState.isStalled.store(false, std::memory_order_release);
+		PKAudioPlayerSetCurrentTime(0.0, NULL);
+		
+		if(postNotification)
+		{
+			dispatch_async(dispatch_get_main_queue(), ^{
+				CFDictionaryRef userInfo = CFDICT({ CFSTR("DidFinish") }, { kCFBooleanFalse });
+				
+				CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
+													 PKAudioPlayerDidFinishPlayingNotification, 
+													 NULL, 
+													 userInfo, 
+													 true);
+				
+				CFRelease(userInfo);
+			});
+		}
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+	}
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerIsPlaying()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//A stream that has stalled is still playing as far as clients are concerned, it's only waiting for data.
+	return AudioPlayerState.engine->IsRunning() || AudioPlayerState.isStalled.load(std::memory_order_acquire);
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerPause(CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
+	
+	AudioPlayerState.playWhenStreamIsReady.store(false, std::memory_order_release);
+	
+	if(AudioPlayerState.isPaused.load(std::memory_order_acquire))
+		return true;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//Processing is already paused while a stream is stalled, so the stall just becomes a pause.
+	if(AudioPlayerState.isStalled.exchange(false, std::memory_order_acq_rel))
+	{
+		AudioPlayerState.isPaused.store(true, std::memory_order_release);
+		return true;
+	}
+	
+	//
+	//	If we're not playing, we do nothing. Why? Because attempting to
+	//	resume processing when we aren't paused will cause some problems.
+	//
+	if(PKAudioPlayerIsPlaying())
+	{
+		try
+		{
+			engine->StopGraph();
+			engine->PauseProcessing();
+		}
+		catch (RBException e)
+		{
+			if(outError) *outError = e.CopyError();
+			
+			return false;
+		}
+		
+		AudioPlayerState.preserveExistingBuffersOnResume.store(true, std::memory_order_release);
+		AudioPlayerState.isPaused.store(true, std::memory_order_release);
+	}
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerResume(CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	if(AudioPlayerState.isPaused.exchange(false, std::memory_order_acq_rel))
+	{
+		try
+		{
+			engine->ResumeProcessing(AudioPlayerState.preserveExistingBuffersOnResume.load(std::memory_order_acquire));
+			engine->StartGraph();
+		}
+		catch (RBException e)
+		{
+			if(outError) *outError = e.CopyError();
+			
+			return false;
+		}
+	}
+	else
+	{
+		return PKAudioPlayerPlay(outError);
+	}
+	
+	return true;
+}
+
+PK_EXTERN Boolean PKAudioPlayerIsPaused()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return AudioPlayerState.isPaused.load(std::memory_order_acquire);
+}
+
+#pragma mark -
+#pragma mark Crossfading
+
+PK_EXTERN Boolean PKAudioPlayerSetCrossfade(CFTimeInterval duration, PKAudioPlayerCrossfadeCurve curve, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	try
+	{
+		RBParameterAssert(duration >= 0.0);
+		RBParameterAssert((curve == kPKAudioPlayerCrossfadeCurveLinear) || (curve == kPKAudioPlayerCrossfadeCurveEqualPower));
+		
+		//A crossfade that is already under way finishes with the settings it started with.
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		AudioPlayerState.crossfadeCurve = curve;
+		AudioPlayerState.crossfadeDuration.store(duration, std::memory_order_release);
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	return true;
+}
+
+PK_EXTERN CFTimeInterval PKAudioPlayerGetCrossfadeDuration()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return AudioPlayerState.crossfadeDuration.load(std::memory_order_acquire);
+}
+
+PK_EXTERN PKAudioPlayerCrossfadeCurve PKAudioPlayerGetCrossfadeCurve()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+	
+	return AudioPlayerState.crossfadeCurve;
+}
+
+#pragma mark -
+#pragma mark Properties
+
+PK_EXTERN Boolean PKAudioPlayerSetVolume(Float32 volume, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	try
+	{
+		AudioPlayerState.engine->SetVolume(volume);
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	return true;
+}
+
+PK_EXTERN Float32 PKAudioPlayerGetVolume()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	try
+	{
+		return AudioPlayerState.engine->GetVolume();
+	}
+	catch (RBException e)
+	{
+		std::cerr << "***Warning: Could not get volume for PKAudioPlayer." << std::endl;
+	}
+	
+	return 1.0;
+}
+
+PK_EXTERN Float32 PKAudioPlayerGetAverageCPUUsage()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return AudioPlayerState.engine->GetAverageCPUUsage();
+}
+
+#pragma mark -
+
+PK_EXTERN CFTimeInterval PKAudioPlayerGetDuration()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerTrackLock);
+	
+	PKDecoder *decoder = AudioPlayerState.track.decoder;
+	if(decoder)
+		return decoder->GetTotalNumberOfFrames() / decoder->GetStreamFormat().mSampleRate;
+	
+	return 0.0;
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerSetCurrentTime(CFTimeInterval currentTime, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	//The decoder can be replaced by the next track on the engine's scheduler queue until processing is paused.
+	PKDecoder *decoder = NULL;
+	{
+		RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+		
+		decoder = AudioPlayerState.track.decoder;
+		if(decoder) decoder->Retain();
+	}
 	
-	if(OSMemoryBarrier(), !AudioPlayerState.hasBroadcastedPresence)
+	if(decoder && decoder->CanSeek())
 	{
-		CFNotificationCenterPostNotification(CFNotificationCenterGetDistributedCenter(), 
-											 PKAudioPlayerDidBroadcastPresenceNotification, 
-											 AudioPlayerState.sessionID, 
+		PKDecoder::FrameLocation currentFrame = PKDecoder::FrameLocation(currentTime * decoder->GetStreamFormat().mSampleRate);
+		try
+		{
+			PKAudioPlayerEngine::RepositionHandler repositionDecoder = ^{
+				decoder->SetCurrentFrame(currentFrame);
+				
+				//Audio decoded ahead of time no longer follows on from the decoder's position.
+				RBLockableObject::Acquisitor trackLock(&AudioPlayerTrackLock);
+				if(AudioPlayerState.track.decoder == decoder)
+					AudioPlayerState.track.prerollNumberOfFrames = 0;
+				
+				//Nor is the current track still about to end.
+				__PKAudioPlayerCancelCrossfade();
+			};
+			
+			//
+			//	While playing, the engine swaps the new audio in under the running graph. This keeps
+			//	scrubbing, which can fire dozens of seeks a second, from clicking on every seek.
+			//
+			if(engine->IsRunning())
+				engine->SeekProcessing(repositionDecoder);
+			else
+				repositionDecoder();
+			
+			AudioPlayerState.preserveExistingBuffersOnResume.store(false, std::memory_order_release);
+		}
+		catch (RBException e)
+		{
+			decoder->Release();
+			
+			if(outError) *outError = e.CopyError();
+			
+			return false;
+		}
+		
+		decoder->Release();
+		
+		return true;
+	}
+	
+	if(decoder)
+		decoder->Release();
+	
+	return false;
+}
+
+PK_EXTERN CFTimeInterval PKAudioPlayerGetCurrentTime()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerTrackLock);
+	
+	PKDecoder *decoder = AudioPlayerState.track.decoder;
+	if(decoder)
+		return decoder->GetCurrentFrame() / decoder->GetStreamFormat().mSampleRate;
+	
+	return 0.0;
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerIsHeadless()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return (AudioPlayerState.engine->GetOutputType() == PKAudioPlayerEngine::kOutputTypeNone);
+}
+
+//Derived From <http://vgable.com/blog/2008/09/11/detecting-if-headphones-are-plugged-in/>
+PK_EXTERN PKAudioPlayerOutputDestination PKAudioPlayerGetAudioOutputDestination(CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	OSStatus error = noErr;
+	UInt32 dataSize = 0;
+	
+	
+	//Get the default output device
+	AudioObjectPropertyAddress outputDeviceAddress = {kAudioHardwarePropertyDefaultOutputDevice, kAudioObjectPropertyScopeGlobal};
+	AudioDeviceID outputDevice = NULL;
+	dataSize = sizeof(outputDevice);
+	error = AudioObjectGetPropertyData(/*inObjectID:*/ kAudioObjectSystemObject, 
+									   /*inAddress:*/ &outputDeviceAddress, 
+									   /*inQualifierDataSize:*/ 0, 
+									   /*inQualifierData:*/ NULL, 
+									   /*ioDataSize:*/ &dataSize, 
+									   /*outData:*/ &outputDevice);
+	if(error != noErr)
+	{
+		if(outError) *outError = PKCopyError(PKPlaybackErrorDomain, 
+											 error, 
 											 NULL, 
-											 true);
+											 CFSTR("Could not find system output device. Error %s (%d)"), CoreAudioGetErrorName(error), error);
+		
+		return kPKAudioPlayerOutputDestinationUnknown;
+	}
+	
+	
+	//Get the data source for the output device
+	AudioObjectPropertyAddress dataSourceAddress = {kAudioDevicePropertyDataSource, kAudioDevicePropertyScopeOutput};
+	UInt32 dataSource = NULL;
+	dataSize = sizeof(dataSource);
+	error = AudioObjectGetPropertyData(/*inObjectID:*/ outputDevice, 
+									   /*inAddress:*/ &dataSourceAddress, 
+									   /*inQualifierDataSize:*/ 0, 
+									   /*inQualifierData:*/ NULL, 
+									   /*ioDataSize:*/ &dataSize, 
+									   /*outData:*/ &dataSource);
+	if(error != noErr)
+	{
+		if(outError) *outError = PKCopyError(PKPlaybackErrorDomain, 
+											 error, 
+											 NULL, 
+											 CFSTR("Could not copy system output device's output destination (data source). Error %s (%d)"), CoreAudioGetErrorName(error), error);
 		
-		OSAtomicCompareAndSwap32Barrier(AudioPlayerState.hasBroadcastedPresence, 1, &AudioPlayerState.hasBroadcastedPresence);
+		return kPKAudioPlayerOutputDestinationUnknown;
 	}
 	
+	return PKAudioPlayerOutputDestination(dataSource);
+}
+
+#pragma mark -
+
+PK_EXTERN Boolean PKAudioPlayerSetPulseHandler(dispatch_block_t handler, dispatch_queue_t pulseHandlerQueue, CFErrorRef *outError)
+{
 	try
 	{
-		if(!AudioPlayerState.engine->IsRunning())
+		RBParameterAssert(handler);
+		
+		if(AudioPlayerState.mPulseHandlerQueue)
 		{
-			AudioPlayerState.engine->StartGraph();
-			AudioPlayerState.engine->StartProcessing();
+			dispatch_release(AudioPlayerState.mPulseHandlerQueue);
+			AudioPlayerState.mPulseHandlerQueue = NULL;
+		}
+		
+		AudioPlayerState.mPulseHandlerQueue = pulseHandlerQueue ?: dispatch_get_main_queue();
+		
+		
+		if(AudioPlayerState.mPulseHandler)
+		{
+			Block_release(AudioPlayerState.mPulseHandler);
+			AudioPlayerState.mPulseHandler = NULL;
 		}
+		
+		AudioPlayerState.mPulseHandler = Block_copy(handler);
 	}
 	catch (RBException e)
 	{
 		if(outError) *outError = e.CopyError();
+		
 		return false;
 	}
 	
 	return true;
 }
 
-PK_EXTERN Boolean PKAudioPlayerStop(Boolean postNotification, CFErrorRef *outError)
+PK_EXTERN dispatch_block_t PKAudioPlayerGetPulseHandler(dispatch_queue_t *outPulseHandlerQueue)
+{
+	if(outPulseHandlerQueue)
+		*outPulseHandlerQueue = AudioPlayerState.mPulseHandlerQueue;
+	
+	return Block_copy(AudioPlayerState.mPulseHandler);
+}
+
+#pragma mark -
+#pragma mark Buffering
+
+static PKAudioPlayerBufferingPolicy __PKAudioPlayerBufferingPolicyFromEngine(const PKAudioPlayerEngine::BufferingPolicy &enginePolicy)
+{
+	PKAudioPlayerBufferingPolicy policy = {
+		.targetBufferedMilliseconds = enginePolicy.targetBufferedMilliseconds,
+		.minimumNumberOfSlices = enginePolicy.minimumNumberOfSlices,
+		.maximumNumberOfSlices = enginePolicy.maximumNumberOfSlices,
+		.numberOfFramesPerSlice = enginePolicy.numberOfFramesPerSlice,
+		.isAdaptive = enginePolicy.isAdaptive,
+	};
+	
+	return policy;
+}
+
+PK_EXTERN PKAudioPlayerBufferingPolicy PKAudioPlayerGetDefaultBufferingPolicy()
+{
+	return __PKAudioPlayerBufferingPolicyFromEngine(PKAudioPlayerEngine::GetDefaultBufferingPolicy());
+}
+
+PK_EXTERN Boolean PKAudioPlayerSetBufferingPolicy(const PKAudioPlayerBufferingPolicy *policy, CFErrorRef *outError)
 {
 	CHECK_STATE_INITIALIZED();
 	
-	if(!PKAudioPlayerIsPlaying() && !PKAudioPlayerIsPaused())
-		return true;
+	try
+	{
+		RBParameterAssert(policy);
+		
+		PKAudioPlayerEngine::BufferingPolicy enginePolicy;
+		enginePolicy.targetBufferedMilliseconds = policy->targetBufferedMilliseconds;
+		enginePolicy.minimumNumberOfSlices = policy->minimumNumberOfSlices;
+		enginePolicy.maximumNumberOfSlices = policy->maximumNumberOfSlices;
+		enginePolicy.numberOfFramesPerSlice = policy->numberOfFramesPerSlice;
+		enginePolicy.isAdaptive = policy->isAdaptive;
+		
+		AudioPlayerState.engine->SetBufferingPolicy(enginePolicy);
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	return true;
+}
+
+PK_EXTERN PKAudioPlayerBufferingPolicy PKAudioPlayerGetBufferingPolicy()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return __PKAudioPlayerBufferingPolicyFromEngine(AudioPlayerState.engine->GetBufferingPolicy());
+}
+
+PK_EXTERN UInt32 PKAudioPlayerGetBufferedMilliseconds()
+{
+	CHECK_STATE_INITIALIZED();
+	
+	return AudioPlayerState.engine->GetBufferedMilliseconds();
+}
+
+#pragma mark -
+#pragma mark Streaming
+
+static void __PKAudioPlayerStreamDidReceiveData(PKStreamByteSource *stream);
+
+///Open a stream that enough of has arrived, decode its beginning, and make it the current track, unless it is superseded along the way.
+static void __PKAudioPlayerOpenStream(PKStreamByteSource *stream, int32_t generation)
+{
+	//The audio player is being torn down, and is waiting on us without the lock.
+	if((AudioPlayerStateInitCount.load(std::memory_order_acquire) == 0) || !__PKAudioPlayerOpenIsCurrent(generation))
+		return;
 	
+	PKAudioPlayerTrack track;
+	memset(&track, 0, sizeof(track));
+	
+	bool wasComplete = stream->IsComplete();
 	try
 	{
-		if(AudioPlayerState.engine->IsRunning())
-			AudioPlayerState.engine->StopGraph();
+		//Reads of data that hasn't arrived fail while opening, so a stream too short to open is tried again later instead of waited on.
+		stream->SetWaitsForData(false);
 		
-		AudioPlayerState.engine->StopProcessing();
+		PKDecoder *decoder = PKDecoder::DecoderForByteSource(stream);
+		RBAssert((decoder != NULL), CFSTR("Could not find decoder for stream."));
 		
-		AudioPlayerState.isPaused = false;
-		PKAudioPlayerSetCurrentTime(0.0, NULL);
+		track.decoder = decoder;
+		__PKAudioPlayerTrackSetup(&track, decoder);
 		
-		if(postNotification)
+		stream->SetWaitsForData(true);
+	}
+	catch (RBException e)
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		stream->SetWaitsForData(true);
+		
+		if(!__PKAudioPlayerOpenIsCurrent(generation))
+			return;
+		
+		if(!wasComplete)
 		{
-			dispatch_async(dispatch_get_main_queue(), ^{
-				CFDictionaryRef userInfo = CFDICT({ CFSTR("DidFinish") }, { kCFBooleanFalse });
-				
-				CFNotificationCenterPostNotification(CFNotificationCenterGetLocalCenter(), 
-													 PKAudioPlayerDidFinishPlayingNotification, 
-													 NULL, 
-													 userInfo, 
-													 true);
-				
-				CFRelease(userInfo);
-			});
+			{
+				RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+				AudioPlayerState.streamNumberOfBytesToOpen = stream->GetAvailableLength() * 2;
+			}
+			
+			AudioPlayerState.streamIsOpening.store(false, std::memory_order_release);
+			__PKAudioPlayerStreamDidReceiveData(stream);
+		}
+		else
+		{
+			__PKAudioPlayerDiscardStream();
+			__PKAudioPlayerPostError(e.CopyError());
+		}
+		
+		return;
+	}
+	
+	stream->Retain();
+	track.stream = stream;
+	
+	__PKAudioPlayerTrackPreroll(&track);
+	
+	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	
+	//Checked again under the lock, since PKAudioPlayerSetDecoder supersedes streams before taking it.
+	if(!__PKAudioPlayerOpenIsCurrent(generation))
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		return;
+	}
+	
+	try
+	{
+		__PKAudioPlayerUseTrack(&track);
+	}
+	catch (RBException e)
+	{
+		__PKAudioPlayerTrackTeardown(&track);
+		__PKAudioPlayerDiscardStream();
+		__PKAudioPlayerPostError(e.CopyError());
+		
+		return;
+	}
+	
+	//PKAudioPlayerPlay decides whether to wait for the stream under the stream lock, so it can't miss the stream becoming ready.
+	bool shouldPlay = false;
+	{
+		RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+		
+		__PKAudioPlayerChangeBufferingState(kPKAudioPlayerBufferingStateBuffering, kPKAudioPlayerBufferingStateReady);
+		shouldPlay = AudioPlayerState.playWhenStreamIsReady.exchange(false, std::memory_order_acq_rel);
+	}
+	
+	CFErrorRef error = NULL;
+	if(shouldPlay && !PKAudioPlayerPlay(&error) && error)
+		__PKAudioPlayerPostError(error);
+}
+
+///Open the stream if enough of it has arrived to try, or resume playback of it if it has stalled and enough has arrived to carry on.
+static void __PKAudioPlayerStreamDidReceiveData(PKStreamByteSource *stream)
+{
+	PKAudioPlayerBufferingState bufferingState = PKAudioPlayerBufferingState(AudioPlayerState.bufferingState.load(std::memory_order_acquire));
+	if(bufferingState == kPKAudioPlayerBufferingStateBuffering)
+	{
+		int32_t generation = 0;
+		UInt64 numberOfBytesToOpen = 0;
+		{
+			RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+			
+			if(AudioPlayerState.stream != stream)
+				return;
+			
+			generation = AudioPlayerState.streamGeneration;
+			numberOfBytesToOpen = AudioPlayerState.streamNumberOfBytesToOpen;
 		}
+		
+		if(!stream->IsComplete() && (stream->GetAvailableLength() < numberOfBytesToOpen))
+			return;
+		
+		if(AudioPlayerState.streamIsOpening.exchange(true, std::memory_order_acq_rel))
+			return;
+		
+		stream->Retain();
+		AudioPlayerState.streamQueue->Async(^{
+			__PKAudioPlayerOpenStream(stream, generation);
+			stream->Release();
+		});
+	}
+	else if(bufferingState == kPKAudioPlayerBufferingStateStalled)
+	{
+		if(stream->HasDataAhead(AudioPlayerState.streamingPolicy.resumingNumberOfBytes))
+			__PKAudioPlayerRequestStallReconcile();
+	}
+}
+
+#pragma mark -
+
+PK_EXTERN PKAudioPlayerStreamingPolicy PKAudioPlayerGetDefaultStreamingPolicy()
+{
+	PKAudioPlayerStreamingPolicy policy = {
+		.startingNumberOfBytes = 128 * 1024,
+		.stallingNumberOfBytes = 64 * 1024,
+		.resumingNumberOfBytes = 256 * 1024,
+	};
+	
+	return policy;
+}
+
+PK_EXTERN Boolean PKAudioPlayerSetStreamingPolicy(const PKAudioPlayerStreamingPolicy *policy, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	try
+	{
+		RBParameterAssert(policy);
+		RBParameterAssert(policy->stallingNumberOfBytes <= policy->resumingNumberOfBytes);
+		
+		RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+		AudioPlayerState.streamingPolicy = *policy;
 	}
 	catch (RBException e)
 	{
 		if(outError) *outError = e.CopyError();
+		
+		return false;
 	}
 	
 	return true;
 }
 
-PK_EXTERN Boolean PKAudioPlayerIsPlaying()
+PK_EXTERN PKAudioPlayerStreamingPolicy PKAudioPlayerGetStreamingPolicy()
 {
 	CHECK_STATE_INITIALIZED();
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
 	
-	return AudioPlayerState.engine->IsRunning();
+	return AudioPlayerState.streamingPolicy;
 }
 
 #pragma mark -
 
-PK_EXTERN Boolean PKAudioPlayerPause(CFErrorRef *outError)
+PK_EXTERN Boolean PKAudioPlayerBeginStream(CFStringRef pathExtension, UInt64 expectedLength, CFErrorRef *outError)
 {
 	CHECK_STATE_INITIALIZED();
 	
-	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
-	
-	if(OSMemoryBarrier(), AudioPlayerState.isPaused)
-		return true;
+	//Clearing the current source also supersedes any stream being received.
+	if(!PKAudioPlayerSetDecoder(NULL, outError))
+		return false;
 	
 	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
 	
-	//
-	//	If we're not playing, we do nothing. Why? Because attempting to
-	//	resume processing when we aren't paused will cause some problems.
-	//
-	if(PKAudioPlayerIsPlaying())
+	PKStreamByteSource *stream = NULL;
+	try
 	{
-		try
-		{
-			engine->StopGraph();
-			engine->PauseProcessing();
-		}
-		catch (RBException e)
-		{
-			if(outError) *outError = e.CopyError();
-			
-			return false;
-		}
+		stream = new PKStreamByteSource(pathExtension, expectedLength);
+	}
+	catch (RBException e)
+	{
+		if(outError) *outError = e.CopyError();
+		
+		return false;
+	}
+	
+	{
+		RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
 		
-		OSAtomicCompareAndSwap32Barrier(AudioPlayerState.preserveExistingBuffersOnResume, true, &AudioPlayerState.preserveExistingBuffersOnResume);
-		OSAtomicCompareAndSwap32Barrier(AudioPlayerState.isPaused, true, &AudioPlayerState.isPaused);
+		AudioPlayerState.stream = stream;
+		AudioPlayerState.streamGeneration = AudioPlayerState.openGeneration.load(std::memory_order_acquire);
+		AudioPlayerState.streamNumberOfBytesToOpen = AudioPlayerState.streamingPolicy.startingNumberOfBytes;
+		AudioPlayerState.streamPlayRequestHostTime = 0;
+		memset(&AudioPlayerState.streamStatistics, 0, sizeof(AudioPlayerState.streamStatistics));
+		
+		AudioPlayerState.streamIsOpening.store(false, std::memory_order_release);
+		__PKAudioPlayerSetBufferingState(kPKAudioPlayerBufferingStateBuffering);
 	}
 	
 	return true;
 }
 
-PK_EXTERN Boolean PKAudioPlayerResume(CFErrorRef *outError)
+PK_EXTERN Boolean PKAudioPlayerAppendStreamData(const void *bytes, size_t length, CFErrorRef *outError)
 {
 	CHECK_STATE_INITIALIZED();
 	
-	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
-	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
-	
-	if(OSMemoryBarrier(), AudioPlayerState.isPaused)
+	PKStreamByteSource *stream = NULL;
+	try
 	{
-		OSAtomicCompareAndSwap32Barrier(AudioPlayerState.isPaused, false, &AudioPlayerState.isPaused);
+		RBParameterAssert(bytes);
+		
+		stream = __PKAudioPlayerCopyStream();
+		RBAssert((stream != NULL), CFSTR("There is no stream to append data to."));
+		
+		stream->AppendBytes(bytes, length);
 		
-		try
-		{
-			OSMemoryBarrier();
-			engine->ResumeProcessing(AudioPlayerState.preserveExistingBuffersOnResume);
-			engine->StartGraph();
-		}
-		catch (RBException e)
 		{
-			if(outError) *outError = e.CopyError();
-			
-			return false;
+			RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+			if(AudioPlayerState.stream == stream)
+				AudioPlayerState.streamStatistics.numberOfBytesReceived += length;
 		}
+		
+		__PKAudioPlayerStreamDidReceiveData(stream);
+		
+		stream->Release();
 	}
-	else
+	catch (RBException e)
 	{
-		return PKAudioPlayerPlay(outError);
+		if(stream)
+			stream->Release();
+		
+		if(outError) *outError = e.CopyError();
+		
+		return false;
 	}
 	
 	return true;
 }
 
-PK_EXTERN Boolean PKAudioPlayerIsPaused()
-{
-	CHECK_STATE_INITIALIZED();
-	
-	return OSMemoryBarrier(), AudioPlayerState.isPaused;
-}
-
-#pragma mark -
-#pragma mark Properties
-
-PK_EXTERN Boolean PKAudioPlayerSetVolume(Float32 volume, CFErrorRef *outError)
+PK_EXTERN Boolean PKAudioPlayerFinishStream(CFErrorRef *outError)
 {
 	CHECK_STATE_INITIALIZED();
 	
 	try
 	{
-		AudioPlayerState.engine->SetVolume(volume);
+		PKStreamByteSource *stream = __PKAudioPlayerCopyStream();
+		RBAssert((stream != NULL), CFSTR("There is no stream to finish."));
+		
+		stream->Finish();
+		__PKAudioPlayerStreamDidReceiveData(stream);
+		
+		stream->Release();
 	}
 	catch (RBException e)
 	{
@@ -687,208 +2455,285 @@ PK_EXTERN Boolean PKAudioPlayerSetVolume(Float32 volume, CFErrorRef *outError)
 	return true;
 }
 
-PK_EXTERN Float32 PKAudioPlayerGetVolume()
+#pragma mark -
+
+PK_EXTERN PKAudioPlayerBufferingState PKAudioPlayerGetBufferingState()
 {
 	CHECK_STATE_INITIALIZED();
 	
-	try
-	{
-		return AudioPlayerState.engine->GetVolume();
-	}
-	catch (RBException e)
-	{
-		std::cerr << "***Warning: Could not get volume for PKAudioPlayer." << std::endl;
-	}
-	
-	return 1.0;
+	return PKAudioPlayerBufferingState(AudioPlayerState.bufferingState.load(std::memory_order_acquire));
 }
 
-PK_EXTERN Float32 PKAudioPlayerGetAverageCPUUsage()
+PK_EXTERN PKAudioPlayerStreamStatistics PKAudioPlayerGetStreamStatistics()
 {
 	CHECK_STATE_INITIALIZED();
 	
-	return AudioPlayerState.engine->GetAverageCPUUsage();
+	RBLockableObject::Acquisitor streamLock(&AudioPlayerStreamLock);
+	
+	PKAudioPlayerStreamStatistics statistics = AudioPlayerState.streamStatistics;
+	
+	//A stall that is still going on counts towards the time spent stalled.
+	if(AudioPlayerState.bufferingState.load(std::memory_order_acquire) == kPKAudioPlayerBufferingStateStalled)
+	{
+		UInt64 stalledNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(AudioPlayerState.streamStallHostTime, CAHostTimeBase::GetTheCurrentTime());
+		statistics.stalledDuration += stalledNanoseconds / 1000000000.0;
+	}
+	
+	return statistics;
 }
 
 #pragma mark -
+#pragma mark Render Statistics
 
-PK_EXTERN CFTimeInterval PKAudioPlayerGetDuration()
+PK_EXTERN PKAudioPlayerRenderStatistics PKAudioPlayerGetRenderStatistics()
 {
 	CHECK_STATE_INITIALIZED();
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+	PKAudioPlayerEngine::RenderStatistics engineStatistics = AudioPlayerState.engine->GetRenderStatistics();
+	PKAudioPlayerRenderStatistics statistics = {
+		.numberOfRenderCycles = engineStatistics.numberOfRenderCycles,
+		.numberOfUnderruns = engineStatistics.numberOfUnderruns,
+		.numberOfLateSlices = engineStatistics.numberOfLateSlices,
+		.worstSchedulingLateness = engineStatistics.worstSchedulingLateness,
+	};
 	
-	PKDecoder *decoder = AudioPlayerState.decoder;
-	if(decoder)
-		return decoder->GetTotalNumberOfFrames() / decoder->GetStreamFormat().mSampleRate;
+	return statistics;
+}
+
+PK_EXTERN void PKAudioPlayerResetRenderStatistics()
+{
+	CHECK_STATE_INITIALIZED();
 	
-	return 0.0;
+	AudioPlayerState.engine->ResetRenderStatistics();
 }
 
 #pragma mark -
+#pragma mark Latency
 
-PK_EXTERN Boolean PKAudioPlayerSetCurrentTime(CFTimeInterval currentTime, CFErrorRef *outError)
+PK_EXTERN void PKAudioPlayerFillOutLatencySummary(const PKLatencyHistogram::Summary &summary, PKAudioPlayerLatencySummary *outSummary)
+{
+	outSummary->numberOfSamples = summary.numberOfSamples;
+	outSummary->median = summary.median / 1000000000.0;
+	outSummary->ninetyNinthPercentile = summary.ninetyNinthPercentile / 1000000000.0;
+	outSummary->maximum = summary.maximum / 1000000000.0;
+}
+
+PK_EXTERN Boolean PKAudioPlayerGetLatencySummary(PKAudioPlayerLatencyStage stage, PKAudioPlayerLatencySummary *outSummary)
 {
 	CHECK_STATE_INITIALIZED();
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
-	
-	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
-	PKDecoder *decoder = AudioPlayerState.decoder;
+	if(!outSummary)
+		return false;
 	
-	if(decoder && decoder->CanSeek())
+	switch (stage)
 	{
-		Boolean shouldRestartGraph = PKAudioPlayerIsPlaying();
-		try
-		{
-			if(shouldRestartGraph)
-			{
-				engine->StopGraph();
-				
-				engine->Acquire();
-				engine->PauseProcessing();
-			}
-			
-			decoder->SetCurrentFrame(currentTime * decoder->GetStreamFormat().mSampleRate);
-			
-			if(shouldRestartGraph)
-			{
-				engine->ResumeProcessing();
-				engine->Relinquish();
-				
-				engine->StartGraph();
-			}
+		case kPKAudioPlayerLatencyStageDecode:
+			PKAudioPlayerFillOutLatencySummary(AudioPlayerState.decodeLatencyHistogram->GetSummary(), outSummary);
+			return true;
 			
-			OSAtomicCompareAndSwap32Barrier(AudioPlayerState.preserveExistingBuffersOnResume, false, &AudioPlayerState.preserveExistingBuffersOnResume);
-		}
-		catch (RBException e)
-		{
-			//
-			//	We prevent deadlocks here by relinquishing our exclusive access to the audio player engine.
-			//	We only relinquish if we should be starting and stopping the graph and there are
-			//	one or more locks active on the playback engine.
-			//
-			if(shouldRestartGraph)
-				engine->Relinquish();
+		case kPKAudioPlayerLatencyStageConvert:
+			PKAudioPlayerFillOutLatencySummary(AudioPlayerState.convertLatencyHistogram->GetSummary(), outSummary);
+			return true;
 			
-			if(outError) *outError = e.CopyError();
+		case kPKAudioPlayerLatencyStageEffects:
+			PKAudioPlayerFillOutLatencySummary(AudioPlayerState.engine->GetEffectsLatencyHistogram()->GetSummary(), outSummary);
+			return true;
 			
-			return false;
-		}
-		
-		return true;
+		case kPKAudioPlayerLatencyStageSchedule:
+			PKAudioPlayerFillOutLatencySummary(AudioPlayerState.engine->GetScheduleLatencyHistogram()->GetSummary(), outSummary);
+			return true;
 	}
 	
 	return false;
 }
 
-PK_EXTERN CFTimeInterval PKAudioPlayerGetCurrentTime()
+PK_EXTERN void PKAudioPlayerResetLatencySummaries()
 {
 	CHECK_STATE_INITIALIZED();
 	
-	RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
-	
-	PKDecoder *decoder = AudioPlayerState.decoder;
-	if(decoder)
-		return decoder->GetCurrentFrame() / decoder->GetStreamFormat().mSampleRate;
-	
-	return 0.0;
+	AudioPlayerState.decodeLatencyHistogram->Reset();
+	AudioPlayerState.convertLatencyHistogram->Reset();
+	AudioPlayerState.engine->ResetLatencyHistograms();
 }
 
 #pragma mark -
+#pragma mark Manual Rendering
 
-//Derived From <http://vgable.com/blog/2008/09/11/detecting-if-headphones-are-plugged-in/>
-PK_EXTERN PKAudioPlayerOutputDestination PKAudioPlayerGetAudioOutputDestination(CFErrorRef *outError)
+PK_EXTERN Boolean PKAudioPlayerRender(AudioBufferList *ioBuffers, UInt32 numberOfFrames, UInt32 *outNumberOfFramesRendered, CFErrorRef *outError)
 {
 	CHECK_STATE_INITIALIZED();
 	
-	OSStatus error = noErr;
-	UInt32 dataSize = 0;
-	
+	if(outNumberOfFramesRendered) *outNumberOfFramesRendered = 0;
 	
-	//Get the default output device
-	AudioObjectPropertyAddress outputDeviceAddress = {kAudioHardwarePropertyDefaultOutputDevice, kAudioObjectPropertyScopeGlobal};
-	AudioDeviceID outputDevice = NULL;
-	dataSize = sizeof(outputDevice);
-	error = AudioObjectGetPropertyData(/*inObjectID:*/ kAudioObjectSystemObject, 
-									   /*inAddress:*/ &outputDeviceAddress, 
-									   /*inQualifierDataSize:*/ 0, 
-									   /*inQualifierData:*/ NULL, 
-									   /*ioDataSize:*/ &dataSize, 
-									   /*outData:*/ &outputDevice);
-	if(error != noErr)
+	//
+	//	We intentionally do not acquire AudioPlayerStateLock here. The end of playback is
+	//	processed on the engine's scheduler queue, which the engine waits on while rendering.
+	//
+	try
 	{
-		if(outError) *outError = PKCopyError(PKPlaybackErrorDomain, 
-											 error, 
-											 NULL, 
-											 CFSTR("Could not find system output device. Error %s (%d)"), CoreAudioGetErrorName(error), error);
+		RBParameterAssert(ioBuffers);
 		
-		return kPKAudioPlayerOutputDestinationUnknown;
+		UInt32 numberOfFramesRendered = AudioPlayerState.engine->RenderFrames(ioBuffers, numberOfFrames);
+		if(outNumberOfFramesRendered) *outNumberOfFramesRendered = numberOfFramesRendered;
 	}
-	
-	
-	//Get the data source for the output device
-	AudioObjectPropertyAddress dataSourceAddress = {kAudioDevicePropertyDataSource, kAudioDevicePropertyScopeOutput};
-	UInt32 dataSource = NULL;
-	dataSize = sizeof(dataSource);
-	error = AudioObjectGetPropertyData(/*inObjectID:*/ outputDevice, 
-									   /*inAddress:*/ &dataSourceAddress, 
-									   /*inQualifierDataSize:*/ 0, 
-									   /*inQualifierData:*/ NULL, 
-									   /*ioDataSize:*/ &dataSize, 
-									   /*outData:*/ &dataSource);
-	if(error != noErr)
+	catch (RBException e)
 	{
-		if(outError) *outError = PKCopyError(PKPlaybackErrorDomain, 
-											 error, 
-											 NULL, 
-											 CFSTR("Could not copy system output device's output destination (data source). Error %s (%d)"), CoreAudioGetErrorName(error), error);
+		if(outError) *outError = e.CopyError();
 		
-		return kPKAudioPlayerOutputDestinationUnknown;
+		return false;
 	}
 	
-	return PKAudioPlayerOutputDestination(dataSource);
+	return true;
 }
 
 #pragma mark -
+#pragma mark Offline Rendering
 
-PK_EXTERN Boolean PKAudioPlayerSetPulseHandler(dispatch_block_t handler, dispatch_queue_t pulseHandlerQueue, CFErrorRef *outError)
+//Renders into and then releases `sink`.
+static Boolean __PKAudioPlayerRenderOffline(PKRenderSink *sink, CFTimeInterval maximumDuration, PKAudioPlayerOfflineRenderResult *outResult, CFErrorRef *outError)
 {
+	if(outResult) memset(outResult, 0, sizeof(PKAudioPlayerOfflineRenderResult));
+	
+	PKAudioPlayerEngine *engine = AudioPlayerState.engine;
+	bool manualRenderingWasEnabled = engine->IsManualRenderingEnabled();
+	
+	//The render plays the song from wherever it is, and leaves it there when it's done.
+	CFTimeInterval previousCurrentTime = 0.0;
+	bool positionNeedsRestoring = false;
+	
+	//The sink is closed exactly once, whether we finish or fail.
+	bool sinkIsClosed = false;
+	
 	try
 	{
-		RBParameterAssert(handler);
-		
-		if(AudioPlayerState.mPulseHandlerQueue)
 		{
-			dispatch_release(AudioPlayerState.mPulseHandlerQueue);
-			AudioPlayerState.mPulseHandlerQueue = NULL;
+			RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+			
+			RBAssert((AudioPlayerState.track.decoder != NULL), CFSTR("Attempted to render offline without a song."));
+			RBAssert(!PKAudioPlayerIsPlaying() && !PKAudioPlayerIsPaused(), CFSTR("Attempted to render offline while the audio player is playing."));
+			
+			previousCurrentTime = PKAudioPlayerGetCurrentTime();
+			positionNeedsRestoring = true;
+			
+			engine->SetManualRenderingEnabled(true);
+			engine->SetOfflineRenderingEnabled(true);
 		}
 		
-		AudioPlayerState.mPulseHandlerQueue = pulseHandlerQueue ?: dispatch_get_main_queue();
+		Float64 sampleRate = engine->GetStreamFormat().mSampleRate;
+		UInt64 maximumNumberOfFrames = (maximumDuration > 0.0)? UInt64(maximumDuration * sampleRate) : 0;
+		
+		//
+		//	We do not hold AudioPlayerStateLock while rendering. The error handler acquires it
+		//	on the scheduler queue, which the engine waits on before every render cycle.
+		//
+		CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
 		
+		engine->StartGraph();
+		engine->StartProcessing();
+		
+		UInt64 numberOfFramesRendered = engine->RenderToSink(sink, maximumNumberOfFrames);
+		
+		CFAbsoluteTime renderDuration = CFAbsoluteTimeGetCurrent() - startTime;
+		
+		OSStatus closeErrorCode = sink->Close();
+		sinkIsClosed = true;
+		RBAssertNoErr(closeErrorCode, CFSTR("Could not finish writing into render sink. Error %ld."), closeErrorCode);
 		
-		if(AudioPlayerState.mPulseHandler)
 		{
-			Block_release(AudioPlayerState.mPulseHandler);
-			AudioPlayerState.mPulseHandler = NULL;
+			RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+			
+			if(engine->IsRunning())
+				engine->StopGraph();
+			
+			engine->StopProcessing();
+			
+			engine->SetOfflineRenderingEnabled(false);
+			engine->SetManualRenderingEnabled(manualRenderingWasEnabled);
+			
+			positionNeedsRestoring = false;
+			PKAudioPlayerSetCurrentTime(previousCurrentTime, NULL);
 		}
 		
-		AudioPlayerState.mPulseHandler = Block_copy(handler);
+		if(outResult)
+		{
+			outResult->numberOfFramesRendered = numberOfFramesRendered;
+			outResult->audioDuration = numberOfFramesRendered / sampleRate;
+			outResult->renderDuration = renderDuration;
+			outResult->realtimeFactor = (renderDuration > 0.0)? (outResult->audioDuration / renderDuration) : 0.0;
+		}
 	}
 	catch (RBException e)
 	{
 		if(outError) *outError = e.CopyError();
 		
+		//Finish whatever made it into the sink so a file sink doesn't leave a truncated file open.
+		if(!sinkIsClosed && (sink->Close() != noErr))
+			std::cerr << "***Warning: Could not close render sink after a failed offline render." << std::endl;
+		
+		sink->Release();
+		
+		//Put the engine back the way we found it so real time playback continues to work.
+		try
+		{
+			RBLockableObject::Acquisitor lock(&AudioPlayerStateLock);
+			
+			if(engine->IsOfflineRenderingEnabled())
+			{
+				if(engine->IsRunning())
+					engine->StopGraph();
+				
+				engine->StopProcessing();
+				
+				engine->SetOfflineRenderingEnabled(false);
+			}
+			
+			//Manual rendering is turned on before offline rendering, so it may need restoring on its own.
+			engine->SetManualRenderingEnabled(manualRenderingWasEnabled);
+			
+			if(positionNeedsRestoring)
+				PKAudioPlayerSetCurrentTime(previousCurrentTime, NULL);
+		}
+		catch (RBException restoreException)
+		{
+			std::cerr << "***Warning: Could not restore PKAudioPlayer after a failed offline render." << std::endl;
+		}
+		
 		return false;
 	}
 	
+	sink->Release();
+	
 	return true;
 }
 
-PK_EXTERN dispatch_block_t PKAudioPlayerGetPulseHandler(dispatch_queue_t *outPulseHandlerQueue)
+PK_EXTERN Boolean PKAudioPlayerRenderOfflineToURL(CFURLRef destination, CFTimeInterval maximumDuration, PKAudioPlayerOfflineRenderResult *outResult, CFErrorRef *outError)
 {
-	if(outPulseHandlerQueue)
-		*outPulseHandlerQueue = AudioPlayerState.mPulseHandlerQueue;
+	CHECK_STATE_INITIALIZED();
 	
-	return Block_copy(AudioPlayerState.mPulseHandler);
+	PKRenderSink *sink = NULL;
+	if(destination)
+		sink = new PKWAVFileRenderSink(destination);
+	else
+		sink = new PKNullRenderSink();
+	
+	return __PKAudioPlayerRenderOffline(sink, maximumDuration, outResult, outError);
+}
+
+PK_EXTERN Boolean PKAudioPlayerRenderOfflineWithHandler(PKAudioPlayerOfflineRenderHandler handler, CFTimeInterval maximumDuration, PKAudioPlayerOfflineRenderResult *outResult, CFErrorRef *outError)
+{
+	CHECK_STATE_INITIALIZED();
+	
+	if(!handler)
+	{
+		if(outError) *outError = PKCopyError(PKPlaybackErrorDomain, 
+											 paramErr, 
+											 NULL, 
+											 CFSTR("PKAudioPlayerRenderOfflineWithHandler requires a handler."));
+		
+		return false;
+	}
+	
+	PKRenderSink *sink = new PKBlockRenderSink(handler);
+	
+	return __PKAudioPlayerRenderOffline(sink, maximumDuration, outResult, outError);
 }
@@ -11,6 +11,7 @@
 #define PKAudioPlayer_h 1
 
 #import <CoreFoundation/CoreFoundation.h>
+#import <CoreAudio/CoreAudioTypes.h>
 
 #pragma mark Constants
 
@@ -34,6 +35,19 @@ PK_EXTERN CFStringRef const PKAudioPlayerDidChangeOutputDeviceNotification;
 ///PlayerKit-powered application is playing music on the host computer.
 PK_EXTERN CFStringRef const PKAudioPlayerDidEncounterOtherPlayerNotification;
 
+///The notification posted when an audio player begins playing the audio file queued with
+///PKAudioPlayerQueueNextURL. The notification is always posted on the main thread. The userInfo
+///dictionary of the notification contains one key, CFSTR("Gapless"), which contains a CFBoolean
+///indicating whether or not the file was spliced onto the end of the previous one without a gap.
+///PKAudioPlayerDidFinishPlayingNotification is not posted for the previous file.
+PK_EXTERN CFStringRef const PKAudioPlayerDidAdvanceToNextTrackNotification;
+
+///The notification posted when the buffering state of a stream begun with PKAudioPlayerBeginStream
+///changes. The notification is always posted on the main thread. The userInfo dictionary of the
+///notification contains one key, CFSTR("BufferingState"), which contains a CFNumber holding the
+///new PKAudioPlayerBufferingState.
+PK_EXTERN CFStringRef const PKAudioPlayerDidChangeBufferingStateNotification;
+
 
 ///The different possible output destinations that can be returned by PKAudioPlayer.
 typedef enum PKAudioPlayerOutputDestination {
@@ -47,6 +61,16 @@ typedef enum PKAudioPlayerOutputDestination {
 	kPKAudioPlayerOutputDestinationInternalSpeakers = 'ispk',
 } PKAudioPlayerOutputDestination;
 
+///The options that may be passed to PKAudioPlayerInitWithOptions.
+typedef enum PKAudioPlayerInitOptions {
+	///The audio player sends audio to the default output device.
+	kPKAudioPlayerInitOptionNone = 0,
+	
+	///The audio player does not use an output device. Audio is only
+	///produced when it is pulled out through PKAudioPlayerRender.
+	kPKAudioPlayerInitOptionHeadless = (1 << 0),
+} PKAudioPlayerInitOptions;
+
 #pragma mark -
 #pragma mark Utilities
 
@@ -55,6 +79,95 @@ typedef enum PKAudioPlayerOutputDestination {
 ///	\result	true if the audio file can be played; false otherwise.
 PK_EXTERN Boolean PKAudioPlayerCanPlayFileAtLocation(CFURLRef location);
 
+///Indicates which of a collection of files the audio player is capable of playing.
+///
+///Files are checked concurrently, and most are recognized from their first few
+///kilobytes without being opened by a decoder, which makes this much faster than
+///calling PKAudioPlayerCanPlayFileAtLocation for each file when importing a library.
+///	\param	locations	An array of CFURLs to the audio files. Required.
+///	\param	outResults	On return, whether or not the file at each index of `locations` can be played. Must have room for one result per location. Required.
+PK_EXTERN void PKAudioPlayerCanPlayFilesAtLocations(CFArrayRef locations, Boolean *outResults);
+
+#pragma mark -
+#pragma mark Decoder Cache
+
+///The statistics the audio player keeps about its cache of which decoder plays which file.
+///
+///The cache lets a file that was just checked with PKAudioPlayerCanPlayFileAtLocation be
+///played without being probed again. Records are discarded when their file changes size
+///or is modified, and the least recently used record is evicted when the cache is full.
+typedef struct PKAudioPlayerDecoderCacheStatistics {
+	///The number of times a file was found in the cache.
+	UInt64 numberOfHits;
+	
+	///The number of times a file had to be probed because it was not in the cache, or had changed.
+	UInt64 numberOfMisses;
+	
+	///The number of records evicted to make room for others.
+	UInt64 numberOfEvictions;
+	
+	///The number of records in the cache.
+	UInt32 numberOfRecords;
+	
+	///The largest number of records the cache keeps.
+	UInt32 capacity;
+} PKAudioPlayerDecoderCacheStatistics;
+
+///Returns the statistics of the decoder cache since the process started,
+///or since PKAudioPlayerResetDecoderCacheStatistics was last called.
+PK_EXTERN PKAudioPlayerDecoderCacheStatistics PKAudioPlayerGetDecoderCacheStatistics();
+
+///Reset the hits, misses and evictions counted by the decoder cache.
+PK_EXTERN void PKAudioPlayerResetDecoderCacheStatistics();
+
+///Set the largest number of records the decoder cache keeps. 0 disables the cache.
+PK_EXTERN void PKAudioPlayerSetDecoderCacheCapacity(UInt32 capacity);
+
+#pragma mark -
+#pragma mark Seek Indexes
+
+///Set whether or not decoders keep seek indexes of the files they play. They do by default.
+///
+///FLAC files without a SEEKTABLE, and Ogg files, are seeked by bisecting the file. As they are
+///played, their decoders note where in the file every second of audio starts, and keep that
+///in a small file in the user's cache directory. Later seeks in the file, including in later
+///launches, go straight to the right place instead of bisecting the whole file. Indexes are
+///discarded when their file changes size or is modified. Only files played from a location
+///are indexed. Takes effect for decoders created after it is called.
+PK_EXTERN void PKAudioPlayerSetSeekIndexesEnabled(Boolean enabled);
+
+///Returns whether or not decoders keep seek indexes of the files they play.
+PK_EXTERN Boolean PKAudioPlayerGetSeekIndexesEnabled();
+
+#pragma mark -
+#pragma mark Parallel Decoding
+
+///Set whether or not files are decoded ahead of playback on several threads at once. They aren't by default.
+///
+///Decoding normally happens on the scheduler thread, one buffer at a time, which leaves a single
+///processor to keep up with high resolution lossless files. With parallel decoding turned on, FLAC
+///and uncompressed files are cut into blocks of 65536 frames that are decoded ahead of playback on
+///PlayerKit's default priority worker threads, one block per spare processor up to four, and handed to the scheduler
+///in order.
+///This uses a few megabytes more memory per track. Has no effect on machines with one processor.
+///Takes effect for files opened after it is called.
+PK_EXTERN void PKAudioPlayerSetParallelDecodingEnabled(Boolean enabled);
+
+///Returns whether or not files are decoded ahead of playback on several threads at once.
+PK_EXTERN Boolean PKAudioPlayerGetParallelDecodingEnabled();
+
+#pragma mark -
+#pragma mark Worker Threads
+
+///Set the number of threads PlayerKit runs its background work on.
+///	\param	numberOfWorkerThreads				The number of threads at the default priority, or 0 for one per processor.
+///	\param	numberOfHighPriorityWorkerThreads	The number of threads at the maximum priority, which keep the output fed, or 0 for two.
+///
+///Every player engine in the process shares these threads, instead of each engine having a
+///maximum priority thread of its own. Must be called before the first call to PKAudioPlayerInit,
+///and has no effect after it.
+PK_EXTERN void PKAudioPlayerSetNumberOfWorkerThreads(UInt32 numberOfWorkerThreads, UInt32 numberOfHighPriorityWorkerThreads);
+
 #pragma mark -
 #pragma mark Lifecycle
 
@@ -63,6 +176,14 @@ PK_EXTERN Boolean PKAudioPlayerCanPlayFileAtLocation(CFURLRef location);
 ///	\result	true if initialization succeeds; false otherwise.
 PK_EXTERN Boolean PKAudioPlayerInit(CFErrorRef *outError);
 
+///Initialize the audio player's internal state with a specified set of options.
+///	\param	options		The options to initialize the audio player with.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if initialization succeeds; false otherwise.
+///
+///The options are ignored if the audio player has already been initialized.
+PK_EXTERN Boolean PKAudioPlayerInitWithOptions(PKAudioPlayerInitOptions options, CFErrorRef *outError);
+
 ///Teardown the audio player's internal state.
 ///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
 ///	\result	true if the teardown succeeds; false otherwise.
@@ -80,6 +201,82 @@ PK_EXTERN Boolean PKAudioPlayerSetURL(CFURLRef location, CFErrorRef *outError);
 ///Returns the URL indicating the location of the source file of the audio player.
 PK_EXTERN CFURLRef PKAudioPlayerCopyURL();
 
+///The outcomes reported to a PKAudioPlayerSetURLCompletionHandler.
+typedef enum PKAudioPlayerSetURLResult {
+	///The file was loaded and is now the source file of the audio player.
+	kPKAudioPlayerSetURLResultSucceeded = 0,
+	
+	///The file could not be loaded. The source file of the audio player is unchanged.
+	kPKAudioPlayerSetURLResultFailed = 1,
+	
+	///Another source file was set before the file finished loading. The file was discarded.
+	kPKAudioPlayerSetURLResultCancelled = 2,
+} PKAudioPlayerSetURLResult;
+
+///The type of block invoked by PKAudioPlayerSetURLAsync once it is done with a file.
+///	\param	result	The outcome of loading the file.
+///	\param	error	When `result` is kPKAudioPlayerSetURLResultFailed, a description of the problem. NULL otherwise. Only valid for the duration of the call.
+typedef void(^PKAudioPlayerSetURLCompletionHandler)(PKAudioPlayerSetURLResult result, CFErrorRef error);
+
+///Set the source file of the audio player without blocking the caller.
+///	\param	location			The location of the audio file to play. May be NULL to clear the source file.
+///	\param	completionQueue		The queue to invoke `completionHandler` on. NULL indicates the main queue.
+///	\param	completionHandler	The block to invoke once the file is the source file of the audio player,
+///								or could not be loaded, or was cancelled. May be NULL.
+///
+///The file is opened and the beginning of it decoded on a background queue, so a slow disk or a large
+///file never stalls the calling thread. Playback of the current source file continues until the new
+///file is ready. Setting another source file, with this function or PKAudioPlayerSetURL, before the file
+///is ready cancels it; this makes it safe to call this function for every file while skipping through a
+///playlist. Like PKAudioPlayerSetURL, the audio player is stopped once the new file replaces the old one.
+PK_EXTERN void PKAudioPlayerSetURLAsync(CFURLRef location, dispatch_queue_t completionQueue, PKAudioPlayerSetURLCompletionHandler completionHandler);
+
+///The functions the audio player reads a byte source given to PKAudioPlayerSetByteSource through.
+///Each function is passed the `info` given to PKAudioPlayerSetByteSource.
+typedef struct PKAudioPlayerByteSourceCallbacks {
+	///Read up to `length` bytes into `buffer`. Returns the number of bytes read, 0 at the end of the stream, or -1 if an error occurs. Required.
+	long (*read)(void *info, void *buffer, size_t length);
+	
+	///Move the next read to `offset`. Returns whether or not this succeeded. May be NULL if the stream cannot seek.
+	Boolean (*seek)(void *info, UInt64 offset);
+	
+	///Returns the number of bytes in the stream, or 0 if that is not known. May be NULL.
+	UInt64 (*getLength)(void *info);
+	
+	///Invoked once the audio player is done with `info`. May be NULL.
+	void (*release)(void *info);
+} PKAudioPlayerByteSourceCallbacks;
+
+///Set the source of the audio player to a stream of bytes read through a set of callbacks.
+///	\param	callbacks		The callbacks to read the stream through. Copied. Required.
+///	\param	info			The value passed to each of the callbacks.
+///	\param	pathExtension	The path extension describing the contents of the stream, used to choose a decoder. May be NULL.
+///	\param	outError		An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the stream was loaded successfully; false otherwise.
+///
+///This lets audio that is in memory, inside an archive, or arriving over the network be played without
+///writing it to a file first. A stream that cannot seek is read from its start; only its first 64 kilobytes
+///are kept to be read again, and playback of it cannot be repositioned. Ogg streams must be able to seek.
+///PKAudioPlayerCopyURL returns NULL while a byte source is playing.
+PK_EXTERN Boolean PKAudioPlayerSetByteSource(const PKAudioPlayerByteSourceCallbacks *callbacks, void *info, CFStringRef pathExtension, CFErrorRef *outError);
+
+///Queue a file to be played once the source file of the audio player finishes playing.
+///	\param	location	The location of the audio file to play next. May be NULL to discard the queued file.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the file located at the passed in URL was queued successfully; false otherwise.
+///
+///The queued file is opened and the beginning of it decoded in the background, so this returns without
+///touching the disk. A file that cannot be opened is reported with PKAudioPlayerDidEncounterErrorNotification
+///instead of through `outError`. If the queued file decodes to the same format as the current one, it
+///is spliced onto the end of the current file without a gap and PKAudioPlayerGetCurrentTime reports time
+///in the queued file as soon as it starts being decoded. Otherwise, or if it is still being opened when
+///the current file runs out, it is started once the current file has finished playing. Setting the source
+///file of the audio player discards the queued file.
+PK_EXTERN Boolean PKAudioPlayerQueueNextURL(CFURLRef location, CFErrorRef *outError);
+
+///Returns the URL indicating the location of the file queued with PKAudioPlayerQueueNextURL, if any.
+PK_EXTERN CFURLRef PKAudioPlayerCopyNextURL();
+
 #pragma mark -
 
 ///Start playback in the audio player.
@@ -111,6 +308,35 @@ PK_EXTERN Boolean PKAudioPlayerResume(CFErrorRef *outError);
 ///Returns a Boolean indicating whether or not the audio player is currently paused.
 PK_EXTERN Boolean PKAudioPlayerIsPaused();
 
+#pragma mark -
+#pragma mark Crossfading
+
+///The curves the volume of two files can follow while the audio player crossfades between them.
+typedef enum PKAudioPlayerCrossfadeCurve {
+	///The volume of each file changes linearly. The combined loudness dips in the middle of the crossfade.
+	kPKAudioPlayerCrossfadeCurveLinear = 0,
+	
+	///The volume of each file follows a quarter sine wave, which keeps the combined loudness constant.
+	kPKAudioPlayerCrossfadeCurveEqualPower = 1,
+} PKAudioPlayerCrossfadeCurve;
+
+///Set how the audio player crossfades into the file queued with PKAudioPlayerQueueNextURL.
+///	\param	duration	The length of the crossfade in seconds. 0.0 disables crossfading, which is the default.
+///	\param	curve		The curve the volume of the two files follows.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the crossfade could be set; false otherwise.
+///
+///The crossfade starts `duration` seconds before the end of the current file. Only files that decode
+///to the same format as the current file are crossfaded into, any other file is played as usual. Both
+///files are only decoded at the same time for the length of the crossfade.
+PK_EXTERN Boolean PKAudioPlayerSetCrossfade(CFTimeInterval duration, PKAudioPlayerCrossfadeCurve curve, CFErrorRef *outError);
+
+///Returns the length of the audio player's crossfade in seconds. 0.0 if crossfading is disabled.
+PK_EXTERN CFTimeInterval PKAudioPlayerGetCrossfadeDuration();
+
+///Returns the curve the audio player crossfades with.
+PK_EXTERN PKAudioPlayerCrossfadeCurve PKAudioPlayerGetCrossfadeCurve();
+
 #pragma mark -
 #pragma mark Properties
 
@@ -131,6 +357,8 @@ PK_EXTERN CFTimeInterval PKAudioPlayerGetDuration();
 #pragma mark -
 
 ///Sets the location of playback in the song the audio player is playing.
+///
+///Seeking while playing does not stop the audio graph, so this is cheap enough to call repeatedly while scrubbing.
 PK_EXTERN Boolean PKAudioPlayerSetCurrentTime(CFTimeInterval currentTime, CFErrorRef *outError);
 
 ///Returns the current location of playback in the song the audio player is playing.
@@ -138,6 +366,9 @@ PK_EXTERN CFTimeInterval PKAudioPlayerGetCurrentTime();
 
 #pragma mark -
 
+///Returns whether or not the audio player was initialized without an output device.
+PK_EXTERN Boolean PKAudioPlayerIsHeadless();
+
 ///Returns the physical destination of audio sent from PKAudioPlayer to the user.
 PK_EXTERN PKAudioPlayerOutputDestination PKAudioPlayerGetAudioOutputDestination(CFErrorRef *outError);
 
@@ -159,4 +390,277 @@ PK_EXTERN Boolean PKAudioPlayerSetPulseHandler(dispatch_block_t handler, dispatc
 ///The pulse is provided as a reliable mechanism to observe the passage of time during playback.
 PK_EXTERN dispatch_block_t PKAudioPlayerGetPulseHandler(dispatch_queue_t *outPulseHandlerQueue);
 
+#pragma mark -
+#pragma mark Buffering
+
+///The policy the audio player uses to decide how much decoded audio to keep ahead of playback.
+typedef struct PKAudioPlayerBufferingPolicy {
+	///The amount of decoded audio to keep ahead of playback, in milliseconds.
+	UInt32 targetBufferedMilliseconds;
+	
+	///The fewest slices of audio to keep scheduled, regardless of the target.
+	UInt32 minimumNumberOfSlices;
+	
+	///The most slices of audio to keep scheduled, regardless of the target.
+	UInt32 maximumNumberOfSlices;
+	
+	///The number of frames in each slice of audio. Zero uses the audio player's default.
+	UInt32 numberOfFramesPerSlice;
+	
+	///Whether or not the audio player grows the amount of buffered audio when decoding falls behind playback.
+	Boolean isAdaptive;
+} PKAudioPlayerBufferingPolicy;
+
+///Returns the buffering policy the audio player uses when none has been set.
+PK_EXTERN PKAudioPlayerBufferingPolicy PKAudioPlayerGetDefaultBufferingPolicy();
+
+///Set the buffering policy of the audio player.
+///	\param	policy		The new policy. Required.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the policy could be set; false otherwise.
+///
+///The number and size of slices picks up the new policy the next time playback is started.
+PK_EXTERN Boolean PKAudioPlayerSetBufferingPolicy(const PKAudioPlayerBufferingPolicy *policy, CFErrorRef *outError);
+
+///Returns the buffering policy of the audio player.
+PK_EXTERN PKAudioPlayerBufferingPolicy PKAudioPlayerGetBufferingPolicy();
+
+///Returns the amount of decoded audio the audio player currently tries to keep ahead of playback, in milliseconds.
+///This is the target of the buffering policy, grown by any adaptation that has happened since.
+PK_EXTERN UInt32 PKAudioPlayerGetBufferedMilliseconds();
+
+#pragma mark -
+#pragma mark Streaming
+
+///The states a stream begun with PKAudioPlayerBeginStream goes through as its data arrives.
+typedef enum PKAudioPlayerBufferingState {
+	///There is no stream.
+	kPKAudioPlayerBufferingStateNone = 0,
+	
+	///Not enough of the stream has arrived to start playing it.
+	kPKAudioPlayerBufferingStateBuffering = 1,
+	
+	///The stream is ready to play, or playing.
+	kPKAudioPlayerBufferingStateReady = 2,
+	
+	///Playback ran out of data in the middle of the stream, and is paused until enough of it arrives.
+	kPKAudioPlayerBufferingStateStalled = 3,
+} PKAudioPlayerBufferingState;
+
+///The policy the audio player uses to decide when enough of a stream has arrived to play it.
+typedef struct PKAudioPlayerStreamingPolicy {
+	///The number of bytes of the stream to receive before trying to start playing it.
+	///If the stream cannot be opened yet, it is tried again once twice as much has arrived.
+	UInt32 startingNumberOfBytes;
+	
+	///The number of bytes that must have arrived past the decoder for it to keep decoding.
+	///Playback stalls when fewer than this have arrived. Should be at least as many bytes
+	///as a decoder reads at once, which is 64 kilobytes for FLAC.
+	UInt32 stallingNumberOfBytes;
+	
+	///The number of bytes that must have arrived past the decoder for stalled playback to resume.
+	UInt32 resumingNumberOfBytes;
+} PKAudioPlayerStreamingPolicy;
+
+///The statistics the audio player keeps about the current stream.
+typedef struct PKAudioPlayerStreamStatistics {
+	///The number of bytes of the stream received so far.
+	UInt64 numberOfBytesReceived;
+	
+	///The time from the later of the stream being begun and playback of it being requested, to
+	///playback starting, in seconds. 0 until playback has started.
+	CFTimeInterval timeToFirstAudio;
+	
+	///The number of times playback has stalled waiting for the stream.
+	UInt32 numberOfStalls;
+	
+	///The total time playback has spent stalled, in seconds.
+	CFTimeInterval stalledDuration;
+} PKAudioPlayerStreamStatistics;
+
+///Returns the streaming policy the audio player uses when none has been set.
+PK_EXTERN PKAudioPlayerStreamingPolicy PKAudioPlayerGetDefaultStreamingPolicy();
+
+///Set the streaming policy of the audio player.
+///	\param	policy		The new policy. Required.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the policy could be set; false otherwise.
+///
+///The starting number of bytes is picked up by the next stream begun, the other thresholds apply right away.
+PK_EXTERN Boolean PKAudioPlayerSetStreamingPolicy(const PKAudioPlayerStreamingPolicy *policy, CFErrorRef *outError);
+
+///Returns the streaming policy of the audio player.
+PK_EXTERN PKAudioPlayerStreamingPolicy PKAudioPlayerGetStreamingPolicy();
+
+///Set the source of the audio player to a stream whose data is handed to the audio player as it arrives.
+///	\param	pathExtension	The path extension describing the contents of the stream, used to choose a decoder. May be NULL.
+///	\param	expectedLength	The number of bytes the stream is expected to contain, or 0 if that is not known.
+///	\param	outError		An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the stream was begun; false otherwise.
+///
+///The stream is opened once the starting number of bytes of the streaming policy have arrived, without
+///blocking the caller of PKAudioPlayerAppendStreamData. PKAudioPlayerPlay may be called right away, in which
+///case playback starts as soon as the stream is open. If playback catches up with the data that has arrived
+///it is paused, rather than ended, until enough of the stream arrives to carry on. Ogg streams, and formats
+///that keep their index at the end of the file, can only be opened once the whole stream has arrived.
+///Setting another source, or beginning another stream, discards the stream.
+PK_EXTERN Boolean PKAudioPlayerBeginStream(CFStringRef pathExtension, UInt64 expectedLength, CFErrorRef *outError);
+
+///Hand data that has arrived for the stream begun with PKAudioPlayerBeginStream to the audio player.
+///	\param	bytes		The data. Copied. Required.
+///	\param	length		The number of bytes of data.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the data was added to the stream; false otherwise.
+PK_EXTERN Boolean PKAudioPlayerAppendStreamData(const void *bytes, size_t length, CFErrorRef *outError);
+
+///Mark the end of the stream begun with PKAudioPlayerBeginStream.
+///	\param	outError	An object encapsulating a description of any errors that occurred. May be null. Must be freed by caller.
+///	\result	true if the stream was finished; false otherwise.
+///
+///Playback of the stream ends once it reaches the last of the data, and it can be seeked from here on.
+PK_EXTERN Boolean PKAudioPlayerFinishStream(CFErrorRef *outError);
+
+///Returns the buffering state of the stream begun with PKAudioPlayerBeginStream.
+PK_EXTERN PKAudioPlayerBufferingState PKAudioPlayerGetBufferingState();
+
+///Returns the statistics of the stream begun with PKAudioPlayerBeginStream.
+PK_EXTERN PKAudioPlayerStreamStatistics PKAudioPlayerGetStreamStatistics();
+
+#pragma mark -
+#pragma mark Render Statistics
+
+///The statistics the audio player collects about how well it has kept up with playback.
+typedef struct PKAudioPlayerRenderStatistics {
+	///The number of render cycles observed during playback.
+	UInt32 numberOfRenderCycles;
+	
+	///The number of times playback ran out of decoded audio. Consecutive starved render cycles count once.
+	UInt32 numberOfUnderruns;
+	
+	///The number of slices of audio that began to play later than they were scheduled to.
+	UInt32 numberOfLateSlices;
+	
+	///The furthest decoded audio has fallen behind playback, in seconds.
+	CFTimeInterval worstSchedulingLateness;
+} PKAudioPlayerRenderStatistics;
+
+///Returns the render statistics the audio player has collected since it was initialized,
+///or since PKAudioPlayerResetRenderStatistics was last called.
+PK_EXTERN PKAudioPlayerRenderStatistics PKAudioPlayerGetRenderStatistics();
+
+///Reset the render statistics collected by the audio player.
+PK_EXTERN void PKAudioPlayerResetRenderStatistics();
+
+#pragma mark -
+#pragma mark Latency
+
+///The stages of the audio player's pipeline that are timed.
+typedef enum PKAudioPlayerLatencyStage {
+	///The time the decoder takes to produce audio.
+	kPKAudioPlayerLatencyStageDecode = 0,
+	
+	///The time taken to convert decoded audio into the audio player's format, excluding decoding.
+	///Nothing is recorded for audio that is decoded in the audio player's format to begin with.
+	kPKAudioPlayerLatencyStageConvert = 1,
+	
+	///The time all of the audio player's effects take to render, per render cycle.
+	kPKAudioPlayerLatencyStageEffects = 2,
+	
+	///The time taken to hand a slice of decoded audio to the output.
+	kPKAudioPlayerLatencyStageSchedule = 3,
+} PKAudioPlayerLatencyStage;
+
+///The shape of the durations recorded for a stage of the audio player's pipeline.
+typedef struct PKAudioPlayerLatencySummary {
+	///The number of durations recorded.
+	UInt64 numberOfSamples;
+	
+	///The median duration, in seconds.
+	CFTimeInterval median;
+	
+	///The duration 99 percent of recorded durations fall below, in seconds.
+	CFTimeInterval ninetyNinthPercentile;
+	
+	///The longest duration recorded, in seconds.
+	CFTimeInterval maximum;
+} PKAudioPlayerLatencySummary;
+
+///Get the latency summary of a stage of the audio player's pipeline.
+///	\param	stage		The stage to summarize.
+///	\param	outSummary	On return, the summary of the stage. Required.
+///	\result	true if the summary could be produced; false otherwise.
+///
+///Percentiles are accurate to within a quarter of their value. This function may be called from any thread.
+PK_EXTERN Boolean PKAudioPlayerGetLatencySummary(PKAudioPlayerLatencyStage stage, PKAudioPlayerLatencySummary *outSummary);
+
+///Discard the durations recorded for every stage of the audio player's pipeline, including each effect.
+PK_EXTERN void PKAudioPlayerResetLatencySummaries();
+
+#pragma mark -
+#pragma mark Manual Rendering
+
+///Pulls rendered audio out of a headless audio player.
+///
+///	\param	ioBuffers					The buffers to render into. Must match the canonical stream format
+///										of the audio player (non-interleaved 32 bit float) and be large
+///										enough to hold `numberOfFrames`. May not be NULL.
+///	\param	numberOfFrames				The number of frames to render.
+///	\param	outNumberOfFramesRendered	On return, the number of frames that contain audio. This will be less
+///										than `numberOfFrames` when playback finishes during the call. May be NULL.
+///	\param	outError					On return, a pointer to an error object indicating if any issues occurred.
+///
+///Audio is rendered through the same decoding, conversion, scheduling, and effects path used
+///for real time playback, as fast as the caller pulls it. This function may only be used when
+///the audio player was initialized with kPKAudioPlayerInitOptionHeadless.
+PK_EXTERN Boolean PKAudioPlayerRender(AudioBufferList *ioBuffers, UInt32 numberOfFrames, UInt32 *outNumberOfFramesRendered, CFErrorRef *outError);
+
+#pragma mark -
+#pragma mark Offline Rendering
+
+///The statistics describing a completed offline render.
+typedef struct PKAudioPlayerOfflineRenderResult {
+	///The number of frames rendered.
+	UInt64 numberOfFramesRendered;
+	
+	///The duration of the rendered audio.
+	CFTimeInterval audioDuration;
+	
+	///The wall clock time it took to render the audio.
+	CFTimeInterval renderDuration;
+	
+	///How many times faster than real time the audio was rendered. This is
+	///the audio duration divided by the render duration.
+	Float64 realtimeFactor;
+} PKAudioPlayerOfflineRenderResult;
+
+///The type of block invoked with rendered audio by PKAudioPlayerRenderOfflineWithHandler.
+///	\param	buffers			The rendered audio, in the canonical stream format of the audio player. Only valid for the duration of the call.
+///	\param	numberOfFrames	The number of frames contained in `buffers`.
+typedef void(^PKAudioPlayerOfflineRenderHandler)(const AudioBufferList *buffers, UInt32 numberOfFrames);
+
+///Renders the current song of the audio player as fast as possible, writing the audio into a file.
+///
+///	\param	destination		The location of the WAV file to write. Any existing file is replaced. Pass NULL to discard the rendered audio.
+///	\param	maximumDuration	The maximum duration of audio to render. Pass 0.0 to render until the end of the song.
+///	\param	outResult		On return, the statistics of the render. May be NULL.
+///	\param	outError		On return, a pointer to an error object indicating if any issues occurred.
+///
+///Rendering starts from the current time of the audio player and runs on the calling thread through the same
+///scheduling and effects path used for real time playback. The audio units of the effects chain are told
+///they are being rendered offline. The audio player may not be playing or paused when this function is called.
+///Once rendering finishes, or fails, the current time of the audio player is put back where rendering started.
+///
+///PKAudioPlayerDidFinishPlayingNotification is posted as usual when the end of the song is rendered.
+PK_EXTERN Boolean PKAudioPlayerRenderOfflineToURL(CFURLRef destination, CFTimeInterval maximumDuration, PKAudioPlayerOfflineRenderResult *outResult, CFErrorRef *outError);
+
+///Renders the current song of the audio player as fast as possible, handing the audio to a block.
+///
+///	\param	handler			The block to invoke with each rendered buffer. It is invoked on the calling thread. May not be NULL.
+///	\param	maximumDuration	The maximum duration of audio to render. Pass 0.0 to render until the end of the song.
+///	\param	outResult		On return, the statistics of the render. May be NULL.
+///	\param	outError		On return, a pointer to an error object indicating if any issues occurred.
+///
+///See PKAudioPlayerRenderOfflineToURL for details.
+PK_EXTERN Boolean PKAudioPlayerRenderOfflineWithHandler(PKAudioPlayerOfflineRenderHandler handler, CFTimeInterval maximumDuration, PKAudioPlayerOfflineRenderResult *outResult, CFErrorRef *outError);
+
 #endif /* PKAudioPlayer_h */
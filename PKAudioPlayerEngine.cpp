@@ -9,6 +9,7 @@
 
 #include "PKAudioPlayerEngine.h"
 #include <iostream>
+#include <unistd.h>
 
 #include "CAComponent.h"
 #include "CAComponentDescription.h"
@@ -16,7 +17,12 @@
 #include "CAStreamBasicDescription.h"
 
 #include "PKScheduledDataSlice.h"
+#include "PKAUGraphRenderCore.h"
 #include "PKTaskQueue.h"
+#include "PKRenderSink.h"
+#include "PKRingBuffer.h"
+#include "PKLatencyHistogram.h"
+#include "CAHostTimeBase.h"
 
 #pragma mark Tools
 
@@ -66,15 +72,18 @@ PKAudioPlayerEngine::~PKAudioPlayerEngine()
 	//	Remove `this` as an observer for the default output device.
 	//	We don't need notifications anymore.
 	//
-	AudioObjectPropertyAddress address = {
-		.mSelector = kAudioHardwarePropertyDefaultOutputDevice, 
-		.mScope = kAudioObjectPropertyScopeGlobal, 
-		.mElement = 0
-	};
-	AudioObjectRemovePropertyListener(kAudioObjectSystemObject, //in audioObjectID
-									  &address, //in propertyAddressPtr
-									  PKAudioPlayerEngine::DefaultAudioDeviceDidChangeListenerProc, //in listenerCallbackProc
-									  this); //in listenerCallbackProcUserData
+	if(mOutputType == kOutputTypeDefaultDevice)
+	{
+		AudioObjectPropertyAddress address = {
+			.mSelector = kAudioHardwarePropertyDefaultOutputDevice, 
+			.mScope = kAudioObjectPropertyScopeGlobal, 
+			.mElement = 0
+		};
+		AudioObjectRemovePropertyListener(kAudioObjectSystemObject, //in audioObjectID
+										  &address, //in propertyAddressPtr
+										  PKAudioPlayerEngine::DefaultAudioDeviceDidChangeListenerProc, //in listenerCallbackProc
+										  this); //in listenerCallbackProcUserData
+	}
 	
 	
 	if(mSortedDataSlicesForPausedProcessing)
@@ -83,6 +92,12 @@ PKAudioPlayerEngine::~PKAudioPlayerEngine()
 		mSortedDataSlicesForPausedProcessing = NULL;
 	}
 	
+	if(mRenderCore)
+	{
+		mRenderCore->Release();
+		mRenderCore = NULL;
+	}
+	
 	if(mAudioUnitGraph)
 	{
 		AUGraphClose(mAudioUnitGraph);
@@ -91,17 +106,67 @@ PKAudioPlayerEngine::~PKAudioPlayerEngine()
 	}
 	
 	
-	for (int index = 0; index < kNumberOfSlicesToKeepActive; index++)
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
 		mDataSlices[index]->Release();
 	
+	mNumberOfActiveSlicesAtomicCounter->Release();
+	mNumberOfActiveSlicesAtomicCounter = NULL;
+	
+	
+	//The graph is gone, so nothing can be rendering into these anymore.
+	for (std::map<AUNode, NodeRenderTiming *>::iterator timing = mNodeRenderTimings.begin(); timing != mNodeRenderTimings.end(); timing++)
+	{
+		timing->second->mHistogram->Release();
+		delete timing->second;
+	}
+	mNodeRenderTimings.clear();
+	
+	mScheduleLatencyHistogram->Release();
+	mScheduleLatencyHistogram = NULL;
+	
+	mEffectsLatencyHistogram->Release();
+	mEffectsLatencyHistogram = NULL;
+	
 	
 	mSchedulerQueue->Release();
 	mSchedulerQueue = NULL;
+	
+	
+	if(mRingBuffer)
+	{
+		mRingBuffer->Release();
+		mRingBuffer = NULL;
+	}
+	
+	if(mRingBufferFillBuffers)
+	{
+		_DeallocateBuffers(mRingBufferFillBuffers);
+		mRingBufferFillBuffers = NULL;
+	}
+	
+	if(mRingBufferFillError)
+	{
+		CFRelease(mRingBufferFillError);
+		mRingBufferFillError = NULL;
+	}
+	
+	if(mPlaybackMarkerHandler)
+	{
+		Block_release(mPlaybackMarkerHandler);
+		mPlaybackMarkerHandler = NULL;
+	}
 }
 
-PKAudioPlayerEngine::PKAudioPlayerEngine() throw(RBException) : 
+PKAudioPlayerEngine::PKAudioPlayerEngine(OutputType outputType) throw(RBException) : 
 	RBLockableObject("PKAudioPlayerEngine"),
-	mSchedulerQueue(new PKTaskQueue("com.roundabout.playerkit.PKAudioPlayerEngine.mSchedulerQueue")),
+	mOutputType(outputType),
+	mManualRenderingEnabled(outputType == kOutputTypeNone),
+	mManualRenderingIsRunning(false),
+	mManualRenderPlayerStartSampleTime(-1.0),
+	mSoftwareVolume(1.0f),
+	mOfflineRenderingEnabled(false),
+	mRenderCore(NULL),
+	mSchedulerQueue(new PKTaskQueue("com.roundabout.playerkit.PKAudioPlayerEngine.mSchedulerQueue", PKTaskExecutor::kLaneHighPriority)),
 	mSortedDataSlicesForPausedProcessing(NULL),
 	mProcessingIsPaused(false),
 	mErrorHasOccurredDuringProcessing(false),
@@ -110,7 +175,42 @@ PKAudioPlayerEngine::PKAudioPlayerEngine() throw(RBException) :
 	mPulseHandler(NULL),
 	mOutputDeviceDidChangeHandler(NULL),
 	mScheduleSliceFunctionHandler(NULL),
-	mScheduleSliceFunctionHandlerUserData(NULL)
+	mScheduleSliceFunctionHandlerUserData(NULL),
+	mDataSlices(),
+	mNumberOfActiveSlicesAtomicCounter(new RBAtomicCounter(0)),
+	mSchedulingGeneration(1),
+	mBufferingPolicy(GetDefaultBufferingPolicy()),
+	mAdaptiveBufferedMilliseconds(mBufferingPolicy.targetBufferedMilliseconds),
+	mNumberOfFramesPerSlice(0),
+	mNumberOfSlices(0),
+	mReadAheadNumberOfFrames(0),
+	mNumberOfReadAheadStarvations(0),
+	mIsObservingRenderCycles(false),
+	mRenderPlayerStartSampleTime(-1.0),
+	mRenderIsUnderrunning(false),
+	mNumberOfRenderCycles(0),
+	mNumberOfUnderruns(0),
+	mNumberOfLateSlices(0),
+	mWorstSchedulingLatenessInFrames(0),
+	mScheduleLatencyHistogram(new PKLatencyHistogram("schedule")),
+	mEffectsLatencyHistogram(new PKLatencyHistogram("effects")),
+	mNodeRenderTimings(),
+	mScheduledAudioPlayerPreRenderHostTime(0),
+	mScheduledAudioPlayerRenderNanoseconds(0),
+	mLastNodeRenderNanoseconds(0),
+	mRingBuffer(NULL),
+	mRingBufferFillBuffers(NULL),
+	mRingBufferFillNumberOfFrames(0),
+	mRingBufferFillIsPending(false),
+	mRingBufferReadIsInProgress(false),
+	mRingBufferHasReachedEnd(false),
+	mScheduleSliceDidStall(false),
+	mRingBufferFillError(NULL),
+	mRenderThreadScheduleErrorCode(noErr),
+	mPlaybackMarkerHandler(NULL),
+	mNumberOfFramesWrittenToRingBuffer(0),
+	mNumberOfFramesPlayed(0),
+	mPlaybackMarkerFrame(-1)
 {
 	//Initialize the AUGraph that's used to push audio to the sound system
 	OSStatus error = noErr;
@@ -118,8 +218,14 @@ PKAudioPlayerEngine::PKAudioPlayerEngine() throw(RBException) :
 	error = NewAUGraph(&mAudioUnitGraph);
 	RBAssertNoErr(error, CFSTR("NewAUGraph failed. Error %d."), error);
 	
+	//
+	//	Engines without an output device use a generic output unit. It never
+	//	talks to the hardware, so the graph can be opened and initialized on
+	//	machines without a sound card.
+	//
+	OSType outputSubType = (outputType == kOutputTypeNone)? kAudioUnitSubType_GenericOutput : kAudioUnitSubType_DefaultOutput;
 	CAComponentDescription outputComponent(kAudioUnitType_Output, 
-										   kAudioUnitSubType_DefaultOutput, 
+										   outputSubType, 
 										   kAudioUnitManufacturer_Apple);
 	error = AUGraphAddNode(mAudioUnitGraph, &outputComponent, &mOutputNode);
 	RBAssertNoErr(error, CFSTR("AUGraphAddNode failed for output audio unit. Error %d."), error);
@@ -153,6 +259,9 @@ PKAudioPlayerEngine::PKAudioPlayerEngine() throw(RBException) :
 	//Set aside the scheduled audio player's audio unit
 	mScheduledAudioPlayerUnit = this->GetAudioUnitForNode(mScheduledAudioPlayerNode);
 	
+	//Everything that schedules, starts, resets or pulls on the scheduled audio player goes through the render core.
+	mRenderCore = new PKAUGraphRenderCore(mAudioUnitGraph, mOutputNode, mScheduledAudioPlayerUnit);
+	
 	//We use a render notification observer to implement the PlayerKit pulse.
 	AudioUnitAddRenderNotify(mScheduledAudioPlayerUnit, //in audioUnit 
 							 &PKAudioPlayerEngine::RenderObserverCallback, //in proc
@@ -165,34 +274,28 @@ PKAudioPlayerEngine::PKAudioPlayerEngine() throw(RBException) :
 	//	is reset by the system, wreaking havoc with the scheduled audio player
 	//	and pretty much everything else.
 	//
-	AudioObjectPropertyAddress address = {
-		.mSelector = kAudioHardwarePropertyDefaultOutputDevice, 
-		.mScope = kAudioObjectPropertyScopeGlobal, 
-		.mElement = 0
-	};
-	error = AudioObjectAddPropertyListener(kAudioObjectSystemObject, //in audioObjectID
-										   &address, //in propertyAddressPtr
-										   PKAudioPlayerEngine::DefaultAudioDeviceDidChangeListenerProc, //in listenerCallbackProc
-										   this); //in listenerCallbackProcUserData
-	RBAssertNoErr(error, CFSTR("AudioObjectAddPropertyListener failed. Error %d."), error);
-	
-	
-	//Allocate the scheduled audio player slices that will be used during playback
-	RBAtomicCounter *activeSlicesAtomicCounter = new RBAtomicCounter(0);
-	for (int index = 0; index < kNumberOfSlicesToKeepActive; index++)
+	if(outputType == kOutputTypeDefaultDevice)
 	{
-		PKScheduledDataSlice *dataSlice = PKScheduledDataSlice::New(this, //in owner
-																	activeSlicesAtomicCounter, //in activeSlicesAtomicCounter
-																	NULL /* filled in later */, //in bufferList
-																	0 /* filled in later */, //in numberOfFramesPerRead
-																	mStreamFormat);
-		dataSlice->mDataSliceProgressionNumber = index;
-		
-		mDataSlices[index] = dataSlice;
+		AudioObjectPropertyAddress address = {
+			.mSelector = kAudioHardwarePropertyDefaultOutputDevice, 
+			.mScope = kAudioObjectPropertyScopeGlobal, 
+			.mElement = 0
+		};
+		error = AudioObjectAddPropertyListener(kAudioObjectSystemObject, //in audioObjectID
+											   &address, //in propertyAddressPtr
+											   PKAudioPlayerEngine::DefaultAudioDeviceDidChangeListenerProc, //in listenerCallbackProc
+											   this); //in listenerCallbackProcUserData
+		RBAssertNoErr(error, CFSTR("AudioObjectAddPropertyListener failed. Error %d."), error);
 	}
 	
-	//Balance the retain cycles so the AtomicCounter goes away when it should
-	activeSlicesAtomicCounter->Release();
+	
+	//The manual render time line starts at zero and only ever moves forward.
+	memset(&mManualRenderTimeStamp, 0, sizeof(mManualRenderTimeStamp));
+	mManualRenderTimeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+	
+	
+	//Allocate the scheduled audio player slices that will be used during playback
+	this->ResizeSlicePool(kDefaultNumberOfSlicesToKeepActive);
 }
 
 CFStringRef PKAudioPlayerEngine::CopyDescription()
@@ -252,11 +355,98 @@ OSStatus PKAudioPlayerEngine::DefaultAudioDeviceDidChangeListenerProc(AudioObjec
 	return noErr;
 }
 
+void PKAudioPlayerEngine::ObserveRenderCycle(const AudioTimeStamp *timeStamp, UInt32 numberOfFrames) throw()
+{
+	if(!mIsObservingRenderCycles)
+		return;
+	
+	//The scheduled audio player's timeline begins with the first render cycle after processing starts.
+	if(mRenderPlayerStartSampleTime < 0.0)
+		mRenderPlayerStartSampleTime = timeStamp->mSampleTime;
+	
+	mNumberOfRenderCycles.fetch_add(1, std::memory_order_relaxed);
+	
+	Float64 endOfRenderCycle = (timeStamp->mSampleTime - mRenderPlayerStartSampleTime) + numberOfFrames;
+	Float64 endOfScheduledAudio = mCurrentSampleTime.load(std::memory_order_acquire);
+	if((mNumberOfActiveSlicesAtomicCounter->GetValue() > 0) && (endOfScheduledAudio >= endOfRenderCycle))
+	{
+		mRenderIsUnderrunning = false;
+		return;
+	}
+	
+	//Running out of audio at the end of playback is not an underrun.
+	if(mRingBufferHasReachedEnd.load(std::memory_order_acquire) && (!mRingBuffer || (mRingBuffer->GetNumberOfFramesAvailableToRead() == 0)))
+		return;
+	
+	if(!mRenderIsUnderrunning)
+	{
+		mRenderIsUnderrunning = true;
+		mNumberOfUnderruns.fetch_add(1, std::memory_order_relaxed);
+		
+		//Adaptive buffering treats an underrun the same as finding the read-ahead dry.
+		mNumberOfReadAheadStarvations.fetch_add(1, std::memory_order_relaxed);
+	}
+	
+	//A failed exchange hands back the worst lateness seen since, so we only retry while ours is still worse.
+	int32_t latenessInFrames = int32_t(endOfRenderCycle - endOfScheduledAudio);
+	int32_t worstLatenessInFrames = mWorstSchedulingLatenessInFrames.load(std::memory_order_relaxed);
+	while ((latenessInFrames > worstLatenessInFrames) && 
+		   !mWorstSchedulingLatenessInFrames.compare_exchange_weak(worstLatenessInFrames, latenessInFrames, std::memory_order_relaxed));
+}
+
+OSStatus PKAudioPlayerEngine::NodeRenderTimingCallback(void *userData, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData)
+{
+	NodeRenderTiming *timing = (NodeRenderTiming *)userData;
+	if(PK_FLAG_IS_SET(*ioActionFlags, kAudioUnitRenderAction_PreRender))
+	{
+		timing->mPreRenderHostTime = CAHostTimeBase::GetTheCurrentTime();
+	}
+	else if(PK_FLAG_IS_SET(*ioActionFlags, kAudioUnitRenderAction_PostRender))
+	{
+		PKAudioPlayerEngine *self = timing->mEngine;
+		
+		//
+		//	Nodes are chained, so the last node to finish rendering before
+		//	us was our input, and its time is included in our own.
+		//
+		UInt64 renderNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(timing->mPreRenderHostTime, CAHostTimeBase::GetTheCurrentTime());
+		UInt64 inputRenderNanoseconds = self->mLastNodeRenderNanoseconds;
+		timing->mHistogram->Record((renderNanoseconds > inputRenderNanoseconds)? (renderNanoseconds - inputRenderNanoseconds) : 0);
+		self->mLastNodeRenderNanoseconds = renderNanoseconds;
+		
+		if(timing->mFeedsOutput)
+		{
+			UInt64 scheduledAudioPlayerRenderNanoseconds = self->mScheduledAudioPlayerRenderNanoseconds;
+			self->mEffectsLatencyHistogram->Record((renderNanoseconds > scheduledAudioPlayerRenderNanoseconds)? (renderNanoseconds - scheduledAudioPlayerRenderNanoseconds) : 0);
+		}
+	}
+	
+	return noErr;
+}
+
+void PKAudioPlayerEngine::UpdateNodeRenderTimings() throw(RBException)
+{
+	AUNode nodeFeedingOutput = this->GetNodeFeedingOutput();
+	for (std::map<AUNode, NodeRenderTiming *>::iterator timing = mNodeRenderTimings.begin(); timing != mNodeRenderTimings.end(); timing++)
+		timing->second->mFeedsOutput = (timing->first == nodeFeedingOutput);
+}
+
 OSStatus PKAudioPlayerEngine::RenderObserverCallback(void *userData, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData)
 {
-	if(PK_FLAG_IS_SET(*ioActionFlags, kAudioUnitRenderAction_PostRender))
+	if(PK_FLAG_IS_SET(*ioActionFlags, kAudioUnitRenderAction_PreRender))
 	{
 		PKAudioPlayerEngine *self = (PKAudioPlayerEngine *)userData;
+		self->mScheduledAudioPlayerPreRenderHostTime = CAHostTimeBase::GetTheCurrentTime();
+		self->ObserveRenderCycle(inTimeStamp, inNumberFrames);
+	}
+	else if(PK_FLAG_IS_SET(*ioActionFlags, kAudioUnitRenderAction_PostRender))
+	{
+		PKAudioPlayerEngine *self = (PKAudioPlayerEngine *)userData;
+		
+		//The first effect node pulls from the scheduled audio player, so it needs to know how long we took.
+		self->mScheduledAudioPlayerRenderNanoseconds = CAHostTimeBase::AbsoluteHostDeltaToNanos(self->mScheduledAudioPlayerPreRenderHostTime, CAHostTimeBase::GetTheCurrentTime());
+		self->mLastNodeRenderNanoseconds = self->mScheduledAudioPlayerRenderNanoseconds;
+		
 		int64_t timeInSeconds = int64_t(inTimeStamp->mSampleTime / self->mStreamFormat.mSampleRate);
 		if(timeInSeconds != self->mLastRenderSampleTime)
 		{
@@ -305,23 +495,48 @@ void PKAudioPlayerEngine::ScheduleSlice(PKScheduledDataSlice *slice)
 	if(slice->mInvalidated)
 		return;
 	
-	CFErrorRef error = NULL;
+	//Top up the read-ahead before taking a slice's worth of audio out of it.
+	this->FillRingBuffer();
 	
-	//Ask the delegate to give us some samples.
-	UInt32 numberOfFramesRead = mScheduleSliceFunctionHandler(this, //in audioUnitGraph
-															  slice->mScheduledAudioSlice.mBufferList, //in buffers
-															  slice->mNumberOfFramesToRead, //in numberOfFrames
-															  &error, //out Error
-															  mScheduleSliceFunctionHandlerUserData); //in userData
+	OSStatus errorCode = noErr;
+	bool ringBufferWasBusy = false;
+	UInt32 numberOfFramesScheduled = this->ScheduleSliceFromRingBuffer(slice, false, mSchedulingGeneration.load(std::memory_order_acquire), &errorCode, &ringBufferWasBusy);
+	
+	//The render thread is holding on to the read-ahead for longer than a copy takes, so we come back to the slice later instead of waiting for it.
+	if(ringBufferWasBusy)
+	{
+		mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKScheduledDataSlice::ScheduleSliceTaskProxy), slice);
+		return;
+	}
+	
+	//An error the render thread ran into scheduling a slice is just as fatal as one of our own.
+	OSStatus renderThreadErrorCode = mRenderThreadScheduleErrorCode.exchange(noErr, std::memory_order_acq_rel);
+	if(errorCode == noErr)
+		errorCode = renderThreadErrorCode;
 	
 	//
-	//	If they don't give us any data, then we've either encountered
-	//	a dreadful, dreadful error, or the end of their data source.
+	//	If the ring buffer doesn't give us any data, then we've either encountered
+	//	a dreadful, dreadful error, or the end of the data source.
 	//
-	if(numberOfFramesRead == 0)
+	if((numberOfFramesScheduled == 0) || (errorCode != noErr))
 	{
-		if(error)
+		if(errorCode != noErr)
 		{
+			this->StopProcessing();
+			this->StopGraph();
+			
+			CFErrorRef error = PKCopyError(PKPlaybackErrorDomain, 
+										   errorCode, 
+										   NULL, 
+										   CFSTR("Could not schedule samples for playback. Got error code %ld."), errorCode);
+			
+			mErrorHandler(error);
+		}
+		else if(mRingBufferFillError)
+		{
+			CFErrorRef error = mRingBufferFillError;
+			mRingBufferFillError = NULL;
+			
 			Acquisitor lock(this);
 			if(!mErrorHasOccurredDuringProcessing)
 			{
@@ -336,8 +551,12 @@ void PKAudioPlayerEngine::ScheduleSlice(PKScheduledDataSlice *slice)
 				
 				mErrorHasOccurredDuringProcessing = true;
 			}
+			else
+			{
+				CFRelease(error);
+			}
 		}
-		else if(slice->mNumberOfActiveSlicesAtomicCounter->GetValue() == 0)
+		else if(mRingBufferHasReachedEnd.load(std::memory_order_acquire) && (slice->mNumberOfActiveSlicesAtomicCounter->GetValue() == 0))
 		{
 			//Break the lock so that `slice` can be released in
 			//PKAudioPlayerEngine::StopProcessing without erroring.
@@ -348,63 +567,522 @@ void PKAudioPlayerEngine::ScheduleSlice(PKScheduledDataSlice *slice)
 			
 			mEndOfPlaybackHandler();
 		}
+	}
+}
+
+void PKAudioPlayerEngine::ProcessorDidFinishSlice(PKScheduledDataSlice *dataSlice, ScheduledAudioSlice *bufferList) //called on com.apple.audio.IOThread.client
+{
+	PKAudioPlayerEngine *self = dataSlice->mOwner;
+	if(!self->IsRunning())
+		return;
+	
+	//A slice scheduled before the slices were last invalidated belongs to whoever invalidated them, it is neither counted nor refilled.
+	uint32_t generation = self->mSchedulingGeneration.load(std::memory_order_acquire);
+	if(dataSlice->mSchedulingGeneration.load(std::memory_order_acquire) != generation)
+		return;
+	
+	dataSlice->mNumberOfActiveSlicesAtomicCounter->Decrement();
+	dataSlice->mBuffersHaveData = false;
+	
+	if((bufferList->mFlags & kScheduledAudioSliceFlag_BeganToRenderLate) == kScheduledAudioSliceFlag_BeganToRenderLate)
+		self->mNumberOfLateSlices.fetch_add(1, std::memory_order_relaxed);
+	
+	if((bufferList->mFlags & kScheduledAudioSliceFlag_Complete) == kScheduledAudioSliceFlag_Complete)
+	{
+		//Everything before the marker has been rendered, so the marked frame is playing from this cycle on.
+		int64_t numberOfFramesPlayed = self->mNumberOfFramesPlayed.fetch_add(bufferList->mNumberFrames, std::memory_order_acq_rel) + bufferList->mNumberFrames;
+		int64_t playbackMarkerFrame = self->mPlaybackMarkerFrame.load(std::memory_order_acquire);
+		if((playbackMarkerFrame >= 0) && (numberOfFramesPlayed >= playbackMarkerFrame) && 
+		   self->mPlaybackMarkerFrame.compare_exchange_strong(playbackMarkerFrame, -1, std::memory_order_acq_rel))
+			self->mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKAudioPlayerEngine::FirePlaybackMarkerTaskProxy), self);
+		
+		//
+		//	The common case is that the read-ahead already has the next slice's worth of audio
+		//	waiting, in which case we refill and reschedule the slice right here without waiting
+		//	or allocating. We only hop over to the scheduler queue when the read-ahead is dry,
+		//	which is also where the end of playback and errors are handled, or when the slice
+		//	is locked by a thread that is about to invalidate it.
+		//
+		OSStatus errorCode = noErr;
+		UInt32 numberOfFramesScheduled = 0;
+		if(dataSlice->TryToAcquire())
+		{
+			bool ringBufferWasBusy = false;
+			numberOfFramesScheduled = self->ScheduleSliceFromRingBuffer(dataSlice, true, generation, &errorCode, &ringBufferWasBusy);
+			dataSlice->Relinquish();
+		}
+		
+		if(numberOfFramesScheduled == 0)
+		{
+			//The slices were invalidated while we were at it, the fallback would be thrown away anyway.
+			if(self->mSchedulingGeneration.load(std::memory_order_acquire) != generation)
+				return;
+			
+			//Errors can't be reported from here, so the scheduler queue reports it when it gets to the slice.
+			if(errorCode != noErr)
+				self->mRenderThreadScheduleErrorCode.store(errorCode, std::memory_order_release);
+			
+			dataSlice->mFallbackGeneration.store(generation, std::memory_order_release);
+			self->mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKScheduledDataSlice::ScheduleSliceFallbackTaskProxy), dataSlice);
+		}
+		
+		self->RequestRingBufferFill();
+	}
+}
+
+void PKAudioPlayerEngine::AdvanceSchedulingGeneration() throw()
+{
+	//0 is what a slice that hasn't been scheduled carries, so it is skipped when the generation wraps around.
+	uint32_t generation = mSchedulingGeneration.load(std::memory_order_relaxed) + 1;
+	if(generation == 0)
+		generation = 1;
+	
+	mSchedulingGeneration.store(generation, std::memory_order_release);
+}
+
+#pragma mark -
+#pragma mark Read-ahead
+
+void PKAudioPlayerEngine::FillRingBuffer(UInt32 maximumNumberOfFrames) throw()
+{
+	mRingBufferFillIsPending.store(false, std::memory_order_release);
+	
+	if(!mRingBuffer || mRingBufferFillError || mRingBufferHasReachedEnd.load(std::memory_order_acquire))
+		return;
+	
+	UInt32 numberOfFramesWritten = 0;
+	while ((numberOfFramesWritten < maximumNumberOfFrames) && 
+		   (mRingBuffer->GetNumberOfFramesAvailableToWrite() >= mRingBufferFillNumberOfFrames))
+	{
+		if(!this->IsRunning() && !mProcessingIsPaused)
+			return;
+		
+		for (UInt32 index = 0; index < mRingBufferFillBuffers->mNumberBuffers; index++)
+			mRingBufferFillBuffers->mBuffers[index].mDataByteSize = mRingBufferFillNumberOfFrames * mRingBuffer->GetBytesPerFrame();
+		
+		CFErrorRef error = NULL;
+		
+		//Ask the delegate to give us some samples.
+		UInt32 numberOfFramesRead = mScheduleSliceFunctionHandler(this, //in audioUnitGraph
+																  mRingBufferFillBuffers, //in buffers
+																  mRingBufferFillNumberOfFrames, //in numberOfFrames
+																  &error, //out Error
+																  mScheduleSliceFunctionHandlerUserData); //in userData
+		if(numberOfFramesRead == 0)
+		{
+			//The error is reported once the audio decoded before it has been scheduled.
+			if(error)
+				mRingBufferFillError = error;
+			else if(!mScheduleSliceDidStall.exchange(false, std::memory_order_acq_rel))
+				mRingBufferHasReachedEnd.store(true, std::memory_order_release);
+			
+			return;
+		}
+		
+		mRingBuffer->Write(mRingBufferFillBuffers, numberOfFramesRead);
+		numberOfFramesWritten += numberOfFramesRead;
+		mNumberOfFramesWrittenToRingBuffer += numberOfFramesRead;
+	}
+}
+
+void PKAudioPlayerEngine::RequestRingBufferFill() throw()
+{
+	//Queuing an asynchronous task takes a pooled task and neither locks nor allocates, so this is safe on the IO thread.
+	if(!mRingBufferFillIsPending.exchange(true, std::memory_order_acq_rel))
+		mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKAudioPlayerEngine::FillRingBufferTaskProxy), this);
+}
+
+bool PKAudioPlayerEngine::TryToAcquireRingBufferForReading(UInt32 numberOfAttempts) throw()
+{
+	for (UInt32 attempt = 0; attempt < numberOfAttempts; attempt++)
+	{
+		bool readIsInProgress = false;
+		if(mRingBufferReadIsInProgress.compare_exchange_strong(readIsInProgress, true, std::memory_order_acquire, std::memory_order_relaxed))
+			return true;
+		
+		if((attempt + 1) < numberOfAttempts)
+			pthread_yield_np();
+	}
+	
+	return false;
+}
+
+UInt32 PKAudioPlayerEngine::ScheduleSliceFromRingBuffer(PKScheduledDataSlice *slice, bool isRenderThread, uint32_t generation, OSStatus *outErrorCode, bool *outWasBusy) throw()
+{
+	*outErrorCode = noErr;
+	*outWasBusy = false;
+	
+	if(!mRingBuffer)
+		return 0;
+	
+	//The render thread only holds the ring buffer for the duration of a copy, so the scheduler gives it a few chances to finish.
+	if(!this->TryToAcquireRingBufferForReading(isRenderThread? 1 : kMaximumNumberOfRingBufferReadAttempts))
+	{
+		*outWasBusy = true;
+		return 0;
+	}
+	
+	//Slices are invalidated before they are locked or the ring buffer is reset, so this is the last point we can back out.
+	if(mSchedulingGeneration.load(std::memory_order_acquire) != generation)
+	{
+		mRingBufferReadIsInProgress.store(false, std::memory_order_release);
+		return 0;
+	}
+	
+	//The end flag must be read before the number of frames available so we never miss the final frames.
+	bool ringBufferHasReachedEnd = mRingBufferHasReachedEnd.load(std::memory_order_acquire);
+	
+	UInt32 numberOfFramesAvailable = mRingBuffer->GetNumberOfFramesAvailableToRead();
+	if((numberOfFramesAvailable == 0) || 
+	   (isRenderThread && (numberOfFramesAvailable < slice->mNumberOfFramesToRead) && !ringBufferHasReachedEnd))
+	{
+		mRingBufferReadIsInProgress.store(false, std::memory_order_release);
+		
+		//The read-ahead running dry during playback is what adaptive buffering reacts to.
+		if(isRenderThread && !ringBufferHasReachedEnd)
+			mNumberOfReadAheadStarvations.fetch_add(1, std::memory_order_relaxed);
+		
+		return 0;
+	}
+	
+	UInt64 scheduleStartHostTime = CAHostTimeBase::GetTheCurrentTime();
+	
+	UInt32 numberOfFramesRead = mRingBuffer->Read(slice->mScheduledAudioSlice.mBufferList, slice->mNumberOfFramesToRead);
+	
+	//The sample time is just incremented by the number of samples read from the ring buffer.
+	int64_t sampleTime = mCurrentSampleTime.fetch_add(numberOfFramesRead, std::memory_order_release);
+	FillOutAudioTimeStampWithSampleTime(slice->mScheduledAudioSlice.mTimeStamp, sampleTime);
+	
+	slice->mScheduledAudioSlice.mNumberFrames = numberOfFramesRead;
+	
+	//Make sure its noted that the processing data has information in its buffers.
+	slice->mBuffersHaveData = true;
+	slice->mSchedulingGeneration.store(generation, std::memory_order_release);
+	
+	//Here we actually schedule the data we got above.
+	OSStatus errorCode = mRenderCore->ScheduleSlice(&slice->mScheduledAudioSlice);
+	if(errorCode == noErr)
+		slice->mNumberOfActiveSlicesAtomicCounter->Increment();
+	
+	//We release the ring buffer only after scheduling so that slices are always scheduled in order.
+	mRingBufferReadIsInProgress.store(false, std::memory_order_release);
+	
+	if(errorCode != noErr)
+	{
+		*outErrorCode = errorCode;
+		return 0;
+	}
+	
+	mScheduleLatencyHistogram->RecordHostTimeInterval(scheduleStartHostTime, CAHostTimeBase::GetTheCurrentTime());
+	
+	return numberOfFramesRead;
+}
+
+void PKAudioPlayerEngine::ResetRingBuffer() throw(RBException)
+{
+	//
+	//	We read the stream format directly because the thread that asked us to reset
+	//	is holding the engine lock while it waits for us. It cannot change underneath us.
+	//
+	CAStreamBasicDescription streamFormat(mStreamFormat);
+	UInt32 numberOfBuffers = streamFormat.IsInterleaved()? 1 : streamFormat.mChannelsPerFrame;
+	UInt32 numberOfFramesPerSlice = mNumberOfFramesPerSlice;
+	
+	//When seeking the graph is still running, so the render thread may be partway through a read.
+	while (!this->TryToAcquireRingBufferForReading(kMaximumNumberOfRingBufferReadAttempts))
+		usleep(100);
+	
+	if(!mRingBuffer || 
+	   (mRingBuffer->GetNumberOfBuffers() != numberOfBuffers) || 
+	   (mRingBuffer->GetBytesPerFrame() != streamFormat.mBytesPerFrame) || 
+	   (mRingBuffer->GetCapacity() < mReadAheadNumberOfFrames) || 
+	   (mRingBuffer->GetCapacity() >= (mReadAheadNumberOfFrames * 2)) || 
+	   (mRingBufferFillNumberOfFrames != numberOfFramesPerSlice))
+	{
+		if(mRingBuffer)
+		{
+			mRingBuffer->Release();
+			mRingBuffer = NULL;
+		}
 		
+		if(mRingBufferFillBuffers)
+		{
+			_DeallocateBuffers(mRingBufferFillBuffers);
+			mRingBufferFillBuffers = NULL;
+		}
+		
+		try
+		{
+			mRingBuffer = new PKRingBuffer(numberOfBuffers, 
+										   streamFormat.mBytesPerFrame, 
+										   mReadAheadNumberOfFrames);
+			mRingBufferFillBuffers = _AllocateBuffers(streamFormat, numberOfFramesPerSlice * streamFormat.mBytesPerFrame);
+			mRingBufferFillNumberOfFrames = numberOfFramesPerSlice;
+		}
+		catch (...)
+		{
+			mRingBufferReadIsInProgress.store(false, std::memory_order_release);
+			throw;
+		}
+	}
+	else
+	{
+		mRingBuffer->Reset();
+	}
+	
+	mRingBufferReadIsInProgress.store(false, std::memory_order_release);
+	
+	if(mRingBufferFillError)
+	{
+		CFRelease(mRingBufferFillError);
+		mRingBufferFillError = NULL;
+	}
+	
+	mRenderThreadScheduleErrorCode.store(noErr, std::memory_order_release);
+	
+	mRingBufferHasReachedEnd.store(false, std::memory_order_release);
+	mScheduleSliceDidStall.store(false, std::memory_order_release);
+	
+	//The marked audio will never play now, and both counts start over with the audio written next.
+	this->FirePlaybackMarker();
+	mNumberOfFramesWrittenToRingBuffer = 0;
+	mNumberOfFramesPlayed.store(0, std::memory_order_release);
+}
+
+void PKAudioPlayerEngine::FillRingBufferTaskProxy(PKAudioPlayerEngine *self)
+{
+	//We don't decode ahead while paused, the decoder may be about to be repositioned.
+	if(self->mProcessingIsPaused)
+	{
+		self->mRingBufferFillIsPending.store(false, std::memory_order_release);
 		return;
 	}
 	
-	FillOutAudioTimeStampWithSampleTime(slice->mScheduledAudioSlice.mTimeStamp, mCurrentSampleTime);
+	self->FillRingBuffer();
+}
+
+void PKAudioPlayerEngine::ResetRingBufferTaskProxy(PKAudioPlayerEngine *self)
+{
+	self->ResetRingBuffer();
+}
+
+#pragma mark -
+
+void PKAudioPlayerEngine::FirePlaybackMarker() throw()
+{
+	mPlaybackMarkerFrame.store(-1, std::memory_order_release);
+	
+	PlaybackMarkerHandler handler = mPlaybackMarkerHandler;
+	mPlaybackMarkerHandler = NULL;
+	
+	if(handler)
+	{
+		handler();
+		Block_release(handler);
+	}
+}
+
+void PKAudioPlayerEngine::FirePlaybackMarkerTaskProxy(PKAudioPlayerEngine *self)
+{
+	//A marker set after this task was queued is not ours to fire.
+	if(self->mPlaybackMarkerFrame.load(std::memory_order_acquire) < 0)
+		self->FirePlaybackMarker();
+}
+
+#pragma mark -
+#pragma mark Buffering
+
+void PKAudioPlayerEngine::UpdateBufferingConfiguration(bool canResizeSlicePool) throw(RBException)
+{
+	CAStreamBasicDescription streamFormat(mStreamFormat);
+	RBAssert((streamFormat.mBytesPerFrame > 0) && (streamFormat.mSampleRate > 0.0), 
+			 CFSTR("Attempted to configure buffering without a stream format."));
+	
+	if(canResizeSlicePool || (mNumberOfFramesPerSlice == 0))
+	{
+		if(mBufferingPolicy.numberOfFramesPerSlice > 0)
+			mNumberOfFramesPerSlice = mBufferingPolicy.numberOfFramesPerSlice;
+		else
+			mNumberOfFramesPerSlice = UInt32(kPKCanonicalBaseBufferSize / streamFormat.mBytesPerPacket);
+	}
+	
+	Float64 framesPerMillisecond = streamFormat.mSampleRate / 1000.0;
+	UInt32 maximumBufferedMilliseconds = UInt32((mBufferingPolicy.maximumNumberOfSlices * mNumberOfFramesPerSlice) / framesPerMillisecond);
+	
+	//
+	//	If the read-ahead ran dry since we last looked, we grow the amount of buffered
+	//	audio by half. The counter is shared with the render thread, so we take what
+	//	it counted in one exchange rather than reading and zeroing it.
+	//
+	int32_t numberOfStarvations = mNumberOfReadAheadStarvations.exchange(0, std::memory_order_acq_rel);
+	if(numberOfStarvations > 0)
+	{
+		if(mBufferingPolicy.isAdaptive)
+		{
+			mAdaptiveBufferedMilliseconds += (mAdaptiveBufferedMilliseconds / 2);
+			if(mAdaptiveBufferedMilliseconds > maximumBufferedMilliseconds)
+				mAdaptiveBufferedMilliseconds = maximumBufferedMilliseconds;
+		}
+	}
 	
-	//The sample time is just incremented by the number of samples read by the delegate.
-#if __LP64__
-	OSAtomicAdd64Barrier(numberOfFramesRead, &mCurrentSampleTime);
-#else
-	OSAtomicAdd32Barrier(numberOfFramesRead, &mCurrentSampleTime);
-#endif /* __LP64__ */
+	UInt32 targetNumberOfFrames = UInt32(mAdaptiveBufferedMilliseconds * framesPerMillisecond);
+	UInt32 numberOfSlices = (targetNumberOfFrames + (mNumberOfFramesPerSlice / 2)) / mNumberOfFramesPerSlice;
+	if(numberOfSlices < mBufferingPolicy.minimumNumberOfSlices)
+		numberOfSlices = mBufferingPolicy.minimumNumberOfSlices;
+	else if(numberOfSlices > mBufferingPolicy.maximumNumberOfSlices)
+		numberOfSlices = mBufferingPolicy.maximumNumberOfSlices;
+	
+	if(canResizeSlicePool)
+		mNumberOfSlices = numberOfSlices;
+	
+	//The read-ahead holds as much audio again as the slices combined.
+	mReadAheadNumberOfFrames = numberOfSlices * mNumberOfFramesPerSlice;
+}
+
+void PKAudioPlayerEngine::ResizeSlicePool(UInt32 numberOfSlices) throw(RBException)
+{
+	while (mDataSlices.size() > numberOfSlices)
+	{
+		mDataSlices.back()->Release();
+		mDataSlices.pop_back();
+	}
+	
+	while (mDataSlices.size() < numberOfSlices)
+	{
+		PKScheduledDataSlice *dataSlice = PKScheduledDataSlice::New(this, //in owner
+																	mNumberOfActiveSlicesAtomicCounter, //in activeSlicesAtomicCounter
+																	NULL /* filled in later */, //in bufferList
+																	0 /* filled in later */, //in numberOfFramesPerRead
+																	mStreamFormat);
+		dataSlice->mDataSliceProgressionNumber = mDataSlices.size();
+		
+		mDataSlices.push_back(dataSlice);
+	}
+}
+
+PKAudioPlayerEngine::BufferingPolicy PKAudioPlayerEngine::GetDefaultBufferingPolicy() throw()
+{
+	BufferingPolicy policy;
+	
+	//This is what kDefaultNumberOfSlicesToKeepActive slices of kPKCanonicalBaseBufferSize cover at the canonical sample rate.
+	UInt32 numberOfFramesPerSlice = UInt32(kPKCanonicalBaseBufferSize / sizeof(Float32));
+	policy.targetBufferedMilliseconds = UInt32((kDefaultNumberOfSlicesToKeepActive * numberOfFramesPerSlice * 1000.0) / kPKCanonicalSampleRate);
+	policy.minimumNumberOfSlices = 2;
+	policy.maximumNumberOfSlices = 64;
+	policy.numberOfFramesPerSlice = 0;
+	policy.isAdaptive = false;
+	
+	return policy;
+}
+
+void PKAudioPlayerEngine::SetBufferingPolicy(const BufferingPolicy &policy) throw(RBException)
+{
+	RBParameterAssert(policy.targetBufferedMilliseconds > 0);
+	RBParameterAssert(policy.minimumNumberOfSlices > 0);
+	RBParameterAssert(policy.maximumNumberOfSlices >= policy.minimumNumberOfSlices);
+	
+	Acquisitor lock(this);
+	
+	mBufferingPolicy = policy;
+	mAdaptiveBufferedMilliseconds = policy.targetBufferedMilliseconds;
+}
+
+PKAudioPlayerEngine::BufferingPolicy PKAudioPlayerEngine::GetBufferingPolicy() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mBufferingPolicy;
+}
+
+UInt32 PKAudioPlayerEngine::GetBufferedMilliseconds() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mAdaptiveBufferedMilliseconds;
+}
+
+UInt32 PKAudioPlayerEngine::GetNumberOfSlices() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mDataSlices.size();
+}
+
+#pragma mark -
+#pragma mark Render Statistics
+
+PKAudioPlayerEngine::RenderStatistics PKAudioPlayerEngine::GetRenderStatistics() const throw()
+{
+	RenderStatistics statistics;
+	statistics.numberOfRenderCycles = mNumberOfRenderCycles.load(std::memory_order_relaxed);
+	statistics.numberOfUnderruns = mNumberOfUnderruns.load(std::memory_order_relaxed);
+	statistics.numberOfLateSlices = mNumberOfLateSlices.load(std::memory_order_relaxed);
+	statistics.worstSchedulingLateness = this->FramesToSeconds(mWorstSchedulingLatenessInFrames.load(std::memory_order_relaxed));
 	
-	slice->mScheduledAudioSlice.mNumberFrames = numberOfFramesRead;
+	return statistics;
+}
+
+PKAudioPlayerEngine::RenderStatistics PKAudioPlayerEngine::ResetRenderStatistics() throw()
+{
+	//
+	//	The render thread keeps counting while we reset, so each counter is taken and zeroed in
+	//	one step. Anything counted after that is part of the next set of statistics, and the worst
+	//	lateness is only ever raised by a compare and swap against the zeroed value, never restored.
+	//
+	RenderStatistics statistics;
+	statistics.numberOfRenderCycles = mNumberOfRenderCycles.exchange(0, std::memory_order_relaxed);
+	statistics.numberOfUnderruns = mNumberOfUnderruns.exchange(0, std::memory_order_relaxed);
+	statistics.numberOfLateSlices = mNumberOfLateSlices.exchange(0, std::memory_order_relaxed);
+	statistics.worstSchedulingLateness = this->FramesToSeconds(mWorstSchedulingLatenessInFrames.exchange(0, std::memory_order_relaxed));
 	
-	//Make sure its noted that the processing data has information in its buffers.
-	slice->mBuffersHaveData = true;
+	return statistics;
+}
+
+Float64 PKAudioPlayerEngine::FramesToSeconds(int32_t numberOfFrames) const throw()
+{
+	return (mStreamFormat.mSampleRate > 0.0)? (numberOfFrames / mStreamFormat.mSampleRate) : 0.0;
+}
+
+#pragma mark -
+#pragma mark Latency
+
+PKLatencyHistogram *PKAudioPlayerEngine::GetScheduleLatencyHistogram() const throw()
+{
+	return mScheduleLatencyHistogram;
+}
+
+PKLatencyHistogram *PKAudioPlayerEngine::GetEffectsLatencyHistogram() const throw()
+{
+	return mEffectsLatencyHistogram;
+}
+
+PKLatencyHistogram::Summary PKAudioPlayerEngine::GetLatencySummaryForNode(AUNode node) const throw(RBException)
+{
+	//The histogram is released by RemoveNode, so it is only read while we hold the lock that keeps the node around.
+	Acquisitor lock(this);
 	
-	//Here we actually schedule the data we got above.
-	OSStatus errorCode = AudioUnitSetProperty(mScheduledAudioPlayerUnit, //in audioUnit
-											  kAudioUnitProperty_ScheduleAudioSlice, //in propertyID
-											  kAudioUnitScope_Global, //in scope
-											  0, //in element
-											  &slice->mScheduledAudioSlice, //io data
-											  sizeof(ScheduledAudioSlice)); //in dataSize
+	std::map<AUNode, NodeRenderTiming *>::const_iterator timing = mNodeRenderTimings.find(node);
+	RBAssert((timing != mNodeRenderTimings.end()), CFSTR("Node %ld was not added through AddNode."), node);
 	
-	if(errorCode == noErr)
-	{
-		slice->mNumberOfActiveSlicesAtomicCounter->Increment();
-	}
-	else
-	{
-		this->StopProcessing();
-		this->StopGraph();
-		
-		error = PKCopyError(PKPlaybackErrorDomain, 
-							errorCode, 
-							NULL, 
-							CFSTR("Could not schedule samples for playback. Got error code %ld."), errorCode);
-		
-		mErrorHandler(error);
-	}
+	return timing->second->mHistogram->GetSummary();
 }
 
-void PKAudioPlayerEngine::ProcessorDidFinishSlice(PKScheduledDataSlice *dataSlice, ScheduledAudioSlice *bufferList) //called on com.apple.audio.IOThread.client
+void PKAudioPlayerEngine::ResetLatencyHistograms() throw()
 {
-	PKAudioPlayerEngine *self = dataSlice->mOwner;
-	if(!self->IsRunning() || (self->mProcessingIsPaused && dataSlice->mInvalidated))
-		return;
+	Acquisitor lock(this);
 	
-	dataSlice->mNumberOfActiveSlicesAtomicCounter->Decrement();
-	dataSlice->mBuffersHaveData = false;
+	mScheduleLatencyHistogram->Reset();
+	mEffectsLatencyHistogram->Reset();
 	
-	if((bufferList->mFlags & kScheduledAudioSliceFlag_Complete) == kScheduledAudioSliceFlag_Complete)
-	{
-		self->mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKScheduledDataSlice::ScheduleSliceTaskProxy), dataSlice);
-	}
+	for (std::map<AUNode, NodeRenderTiming *>::iterator timing = mNodeRenderTimings.begin(); timing != mNodeRenderTimings.end(); timing++)
+		timing->second->mHistogram->Reset();
+}
+
+#pragma mark -
+
+void PKAudioPlayerEngine::SchedulerQueueBarrier(void *unused)
+{
+	//Everything submitted to the scheduler queue before this task has run by the time it returns.
 }
 
 #pragma mark -
@@ -530,6 +1208,22 @@ void *PKAudioPlayerEngine::GetScheduleSliceFunctionHandlerUserData() const throw
 	return mScheduleSliceFunctionHandlerUserData;
 }
 
+void PKAudioPlayerEngine::NoteScheduleSliceStalled() throw()
+{
+	mScheduleSliceDidStall.store(true, std::memory_order_release);
+}
+
+void PKAudioPlayerEngine::SetPlaybackMarker(PlaybackMarkerHandler handler) throw()
+{
+	this->FirePlaybackMarker();
+	
+	if(handler)
+	{
+		mPlaybackMarkerHandler = Block_copy(handler);
+		mPlaybackMarkerFrame.store(mNumberOfFramesWrittenToRingBuffer, std::memory_order_release);
+	}
+}
+
 #pragma mark -
 
 Float32 PKAudioPlayerEngine::GetAverageCPUUsage() const throw()
@@ -545,6 +1239,10 @@ Float32 PKAudioPlayerEngine::GetAverageCPUUsage() const throw()
 
 Float32 PKAudioPlayerEngine::GetVolume() const throw(RBException)
 {
+	//Generic output units have no volume parameter, so we apply the volume ourselves.
+	if(mOutputType == kOutputTypeNone)
+		return mSoftwareVolume;
+	
 	AudioUnitParameterValue volumeValue = 0.0f;
 	CopyParameterValue(&volumeValue, kHALOutputParam_Volume, kAudioUnitScope_Global, mOutputNode);
 	return volumeValue;
@@ -552,6 +1250,12 @@ Float32 PKAudioPlayerEngine::GetVolume() const throw(RBException)
 
 void PKAudioPlayerEngine::SetVolume(Float32 volume) throw(RBException)
 {
+	if(mOutputType == kOutputTypeNone)
+	{
+		mSoftwareVolume = volume;
+		return;
+	}
+	
 	SetParameterValue(volume, kHALOutputParam_Volume, kAudioUnitScope_Global, mOutputNode);
 }
 
@@ -567,40 +1271,52 @@ void PKAudioPlayerEngine::StartProcessing() throw(RBException)
 			 CFSTR("One or more handlers has not been set."));
 	
 	//Firstly, we reset the processor so we don't end up with inconsistent behavior.
-	AudioTimeStamp startTimeStamp;
-	FillOutAudioTimeStampWithSampleTime(startTimeStamp, -1.0f);
+	OSStatus startErrorCode = mRenderCore->SetStartSampleTime(-1.0);
+	RBAssertNoErr(startErrorCode, CFSTR("Could not set the start time of the scheduled audio player. Error %ld."), startErrorCode);
 	
-	this->SetPropertyValue(&startTimeStamp, //in data
-						   sizeof(startTimeStamp), //in dataSize
-						   kAudioUnitProperty_ScheduleStartTimeStamp, //in propertyID
-						   kAudioUnitScope_Global, //in scope
-						   mScheduledAudioPlayerNode); //in node
+	//The scheduled audio player starts playing on the next render cycle.
+	mManualRenderPlayerStartSampleTime = -1.0;
+	mRenderPlayerStartSampleTime = -1.0;
+	mRenderIsUnderrunning = false;
 	
 	CAStreamBasicDescription graphFormat = this->GetStreamFormat();
 	
 	//Then we reset some internal state and setup the slices
-	mCurrentSampleTime = 0;
+	this->AdvanceSchedulingGeneration();
+	mCurrentSampleTime.store(0, std::memory_order_release);
 	mErrorHasOccurredDuringProcessing = false;
 	
+	//The buffering policy may have changed, or adaptive buffering may have kicked in since we last played.
+	this->UpdateBufferingConfiguration(true);
+	
+	//
+	//	The read-ahead is only touched on the scheduler queue, so that's where we reset it. This
+	//	also drains any stale scheduling tasks so we can safely change the slices below.
+	//
+	mSchedulerQueue->Sync(PKTaskQueue::TaskProc(&PKAudioPlayerEngine::ResetRingBufferTaskProxy), this);
 	
-	for (int index = 0; index < kNumberOfSlicesToKeepActive; index++)
+	this->ResizeSlicePool(mNumberOfSlices);
+	
+	UInt32 sliceBufferSize = mNumberOfFramesPerSlice * graphFormat.mBytesPerFrame;
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
 	{
 		PKScheduledDataSlice *dataSlice = mDataSlices[index];
 		dataSlice->Acquire();
 		
 		dataSlice->Reset();
-		if((dataSlice->mNumberOfFramesToRead > 0) && (mStreamFormat == dataSlice->mBuffersStreamFormat))
+		if((dataSlice->mNumberOfFramesToRead == mNumberOfFramesPerSlice) && (mStreamFormat == dataSlice->mBuffersStreamFormat))
 		{
 			//Reset the buffer sizes; these sometimes get set to zero during playback.
 			AudioBufferList *buffers = dataSlice->mScheduledAudioSlice.mBufferList;
 			for (int bufferIndex = 0; bufferIndex < buffers->mNumberBuffers; bufferIndex++)
-				buffers->mBuffers[bufferIndex].mDataByteSize = kPKCanonicalBaseBufferSize;
+				buffers->mBuffers[bufferIndex].mDataByteSize = sliceBufferSize;
 		}
 		else
 		{
 			_DeallocateBuffers(dataSlice->mScheduledAudioSlice.mBufferList);
-			dataSlice->mScheduledAudioSlice.mBufferList = _AllocateBuffers(mStreamFormat, kPKCanonicalBaseBufferSize);
-			dataSlice->mNumberOfFramesToRead = (kPKCanonicalBaseBufferSize / graphFormat.mBytesPerPacket);
+			dataSlice->mScheduledAudioSlice.mBufferList = _AllocateBuffers(mStreamFormat, sliceBufferSize);
+			dataSlice->mNumberOfFramesToRead = mNumberOfFramesPerSlice;
+			dataSlice->mBuffersStreamFormat = mStreamFormat;
 		}
 		
 		dataSlice->Relinquish();
@@ -613,14 +1329,18 @@ void PKAudioPlayerEngine::StartProcessing() throw(RBException)
 	}
 	
 	mProcessingIsPaused = false;
+	mIsObservingRenderCycles = true;
 }
 
 void PKAudioPlayerEngine::StopProcessing() throw(RBException)
 {
 	Acquisitor lock(this);
 	
+	mIsObservingRenderCycles = false;
+	
 	//We first invalidate all of the processing data objects currently in use.
-	for (int index = 0; index < kNumberOfSlicesToKeepActive; index++)
+	this->AdvanceSchedulingGeneration();
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
 	{
 		PKScheduledDataSlice *dataSlice = mDataSlices[index];
 		dataSlice->Acquire();
@@ -662,24 +1382,23 @@ void PKAudioPlayerEngine::PauseProcessing() throw(RBException)
 	
 	//This must be set before we do anything else.
 	mProcessingIsPaused = true;
+	mIsObservingRenderCycles = false;
 	
 	if(this->IsRunning())
 		return;
 	
 	AudioTimeStamp currentPlayTime;
-	UInt32 size = sizeof(currentPlayTime);
-	this->CopyPropertyValue((void **)&currentPlayTime, 
-							&size, 
-							kAudioUnitProperty_CurrentPlayTime, 
-							kAudioUnitScope_Global, 
-							mScheduledAudioPlayerNode);
+	OSStatus playTimeErrorCode = mRenderCore->GetCurrentPlayTime(&currentPlayTime);
+	RBAssertNoErr(playTimeErrorCode, CFSTR("Could not get the current play time of the scheduled audio player. Error %ld."), playTimeErrorCode);
+	
+	this->AdvanceSchedulingGeneration();
 	
 	mSortedDataSlicesForPausedProcessing = CFArrayCreateMutable(kCFAllocatorDefault, 0, NULL);
 	AudioStreamBasicDescription streamFormat = this->GetStreamFormat();
 	void *temporaryBuffer = NULL;
 	
 	//We 'acquire' all of the processing datas.
-	for (int index = 0; index < kNumberOfSlicesToKeepActive; index++)
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
 	{
 		PKScheduledDataSlice *dataSlice = mDataSlices[index];
 		dataSlice->Acquire();
@@ -715,11 +1434,11 @@ void PKAudioPlayerEngine::PauseProcessing() throw(RBException)
 				//
 				if(!temporaryBuffer)
 				{
-					temporaryBuffer = calloc(streamFormat.mBytesPerPacket, kPKCanonicalBaseBufferSize);
+					temporaryBuffer = calloc(streamFormat.mBytesPerPacket, mNumberOfFramesPerSlice);
 					
 					//We need this buffer, so if it can't be allocated we explode.
 					RBAssert((temporaryBuffer != NULL), 
-							 CFSTR("Could not allocate temporary buffer of size %d for PauseProcessing."), kPKCanonicalBaseBufferSize * streamFormat.mBytesPerPacket);
+							 CFSTR("Could not allocate temporary buffer of size %d for PauseProcessing."), mNumberOfFramesPerSlice * streamFormat.mBytesPerPacket);
 				}
 				
 				//Calculate the buffer offset in bytes.
@@ -801,10 +1520,10 @@ void PKAudioPlayerEngine::PauseProcessing() throw(RBException)
 	
 	
 	//Reset the scheduled audio player.
-	AudioUnitReset(mScheduledAudioPlayerUnit, kAudioUnitScope_Global, 0);
+	mRenderCore->Reset();
 	
 	//Reset the sample time so playback resumes immediately.
-	mCurrentSampleTime = 0;
+	mCurrentSampleTime.store(0, std::memory_order_release);
 }
 
 void PKAudioPlayerEngine::ResumeProcessing(bool preserveExistingSampleBuffers) throw(RBException)
@@ -817,6 +1536,17 @@ void PKAudioPlayerEngine::ResumeProcessing(bool preserveExistingSampleBuffers) t
 	RBAssert((mSortedDataSlicesForPausedProcessing != NULL), 
 			 CFSTR("Attempting to resume processing when no data slices have been saved. You shouldn't be doing that."));
 	
+	//
+	//	If the existing buffers are being thrown away the decoder has most likely been
+	//	repositioned, so anything decoded ahead of the slices is stale as well. This is
+	//	also a safe point for adaptive buffering to grow the read-ahead.
+	//
+	if(!preserveExistingSampleBuffers)
+	{
+		this->UpdateBufferingConfiguration(false);
+		mSchedulerQueue->Sync(PKTaskQueue::TaskProc(&PKAudioPlayerEngine::ResetRingBufferTaskProxy), this);
+	}
+	
 	CFMutableArrayRef dataSlicesToReschedule = CFArrayCreateMutable(kCFAllocatorDefault, 0, NULL);
 	
 	for (int index = 0; index < CFArrayGetCount(mSortedDataSlicesForPausedProcessing); index++)
@@ -835,23 +1565,12 @@ void PKAudioPlayerEngine::ResumeProcessing(bool preserveExistingSampleBuffers) t
 				//	The sample time is just incremented by the
 				//	number of samples read by the delegate.
 				//
-				FillOutAudioTimeStampWithSampleTime(dataSlice->mScheduledAudioSlice.mTimeStamp, mCurrentSampleTime);
-#if __LP64__
-				OSAtomicAdd64Barrier(dataSlice->mScheduledAudioSlice.mNumberFrames, &mCurrentSampleTime);
-#else
-				OSAtomicAdd32Barrier(dataSlice->mScheduledAudioSlice.mNumberFrames, &mCurrentSampleTime);
-#endif /* __LP64__ */
+				int64_t sampleTime = mCurrentSampleTime.fetch_add(dataSlice->mScheduledAudioSlice.mNumberFrames, std::memory_order_release);
+				FillOutAudioTimeStampWithSampleTime(dataSlice->mScheduledAudioSlice.mTimeStamp, sampleTime);
+				dataSlice->mSchedulingGeneration.store(mSchedulingGeneration.load(std::memory_order_acquire), std::memory_order_release);
 				
-				//
-				//	Here we actually schedule the data we got above.
-				//	I don't know why this is done through a property.
-				//
-				OSStatus errorCode = AudioUnitSetProperty(mScheduledAudioPlayerUnit, //in audioUnit
-														  kAudioUnitProperty_ScheduleAudioSlice, //in propertyID
-														  kAudioUnitScope_Global, //in scope
-														  0, //in element
-														  &dataSlice->mScheduledAudioSlice, //io data
-														  sizeof(ScheduledAudioSlice)); //in dataSize
+				//Here we actually schedule the data we got above.
+				OSStatus errorCode = mRenderCore->ScheduleSlice(&dataSlice->mScheduledAudioSlice);
 				if(errorCode != noErr)
 				{
 					dataSlice->Relinquish();
@@ -899,23 +1618,129 @@ void PKAudioPlayerEngine::ResumeProcessing(bool preserveExistingSampleBuffers) t
 	CFRelease(mSortedDataSlicesForPausedProcessing);
 	mSortedDataSlicesForPausedProcessing = NULL;
 	
-	AudioTimeStamp startTimeStamp;
-	FillOutAudioTimeStampWithSampleTime(startTimeStamp, -1.0f);
+	OSStatus startErrorCode = mRenderCore->SetStartSampleTime(-1.0);
+	RBAssertNoErr(startErrorCode, CFSTR("Could not set the start time of the scheduled audio player. Error %ld."), startErrorCode);
+	
+	mManualRenderPlayerStartSampleTime = -1.0;
+	mRenderPlayerStartSampleTime = -1.0;
+	mRenderIsUnderrunning = false;
+	
+	mProcessingIsPaused = false;
+	mErrorHasOccurredDuringProcessing = false;
+	mIsObservingRenderCycles = true;
+}
+
+#pragma mark -
+
+void PKAudioPlayerEngine::SeekProcessing(RepositionHandler repositionHandler) throw(RBException)
+{
+	RBParameterAssert(repositionHandler);
+	
+	Acquisitor lock(this);
+	
+	RBAssert((this->IsRunning() && !mProcessingIsPaused), 
+			 CFSTR("Attempting to seek processing when the graph is not running. Use PauseProcessing/ResumeProcessing instead."));
+	
+	//
+	//	Invalidating the slices while processing is marked as paused stops both the render thread and
+	//	the scheduler queue from pulling any more samples. Whatever is already scheduled keeps playing.
+	//
+	mProcessingIsPaused = true;
+	mIsObservingRenderCycles = false;
+	this->AdvanceSchedulingGeneration();
+	
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
+	{
+		PKScheduledDataSlice *dataSlice = mDataSlices[index];
+		dataSlice->Acquire();
+		dataSlice->mInvalidated = true;
+		dataSlice->Relinquish();
+	}
+	
+	//This also drains any scheduling tasks that were queued before the slices were invalidated.
+	mSchedulerQueue->Sync(PKTaskQueue::TaskProc(&PKAudioPlayerEngine::ResetRingBufferTaskProxy), this);
+	
+	//
+	//	A fill requested by a slice that finished just before the invalidation above can still be
+	//	queued behind the reset, so the source is repositioned on the scheduler queue as well.
+	//	Task queues swallow exceptions, so a failure is carried back out by hand.
+	//
+	__block RBException *repositionError = NULL;
+	mSchedulerQueue->Sync(^{
+		try
+		{
+			repositionHandler();
+			
+			//The first slice is decoded while the old audio is still playing, so the switch over is as short as possible.
+			this->FillRingBuffer(mNumberOfFramesPerSlice);
+		}
+		catch (RBException e)
+		{
+			repositionError = new RBException(e);
+		}
+	});
+	
+	//Playback carries on from wherever the source was left.
+	this->RestartProcessingAfterSeek();
+	
+	if(repositionError)
+	{
+		RBException error(*repositionError);
+		repositionError->Release();
+		
+		throw error;
+	}
+}
+
+void PKAudioPlayerEngine::RestartProcessingAfterSeek() throw(RBException)
+{
+	//Dropping everything scheduled in the scheduled audio player is the only time the graph is touched.
+	OSStatus errorCode = mRenderCore->Reset();
+	RBAssertNoErr(errorCode, CFSTR("Could not reset scheduled audio player, error %ld."), errorCode);
+	
+	for (UInt32 index = 0; index < mDataSlices.size(); index++)
+	{
+		PKScheduledDataSlice *dataSlice = mDataSlices[index];
+		dataSlice->Acquire();
+		dataSlice->Reset();
+		dataSlice->Relinquish();
+	}
+	
+	mCurrentSampleTime.store(0, std::memory_order_release);
+	
+	//
+	//	The first slice comes straight out of the read-ahead we just filled. If that came up empty
+	//	it is scheduled along with the others below, which is where the end of playback and errors are handled.
+	//
+	OSStatus scheduleErrorCode = noErr;
+	bool ringBufferWasBusy = false;
+	UInt32 firstSliceIndex = 0;
+	if(this->ScheduleSliceFromRingBuffer(mDataSlices[0], false, mSchedulingGeneration.load(std::memory_order_acquire), &scheduleErrorCode, &ringBufferWasBusy) > 0)
+		firstSliceIndex = 1;
+	
+	OSStatus startErrorCode = mRenderCore->SetStartSampleTime(-1.0);
+	RBAssertNoErr(startErrorCode, CFSTR("Could not set the start time of the scheduled audio player. Error %ld."), startErrorCode);
 	
-	this->SetPropertyValue(&startTimeStamp, //in data
-						   sizeof(startTimeStamp), //in dataSize
-						   kAudioUnitProperty_ScheduleStartTimeStamp, //in propertyID
-						   kAudioUnitScope_Global, //in scope
-						   mScheduledAudioPlayerNode); //in node
+	mManualRenderPlayerStartSampleTime = -1.0;
+	mRenderPlayerStartSampleTime = -1.0;
+	mRenderIsUnderrunning = false;
 	
 	mProcessingIsPaused = false;
 	mErrorHasOccurredDuringProcessing = false;
+	mIsObservingRenderCycles = true;
+	
+	//The remaining slices fill up the rest of the read-ahead without holding up the caller.
+	for (UInt32 index = firstSliceIndex; index < mDataSlices.size(); index++)
+		mSchedulerQueue->Async(PKTaskQueue::TaskProc(&PKScheduledDataSlice::ScheduleSliceTaskProxy), mDataSlices[index]);
 }
 
 #pragma mark -
 
 bool PKAudioPlayerEngine::IsRunning() const throw()
 {
+	if(mManualRenderingEnabled)
+		return mManualRenderingIsRunning;
+	
 	Boolean isRunning = false;
 	if(AUGraphIsRunning(mAudioUnitGraph, &isRunning) == noErr)
 		return isRunning;
@@ -927,6 +1752,14 @@ void PKAudioPlayerEngine::StartGraph() throw(RBException)
 {
 	Acquisitor lock(this);
 	
+	if(mManualRenderingEnabled)
+	{
+		RBAssert(this->IsInitialized(), CFSTR("Attempted to start manual rendering before a stream format was set."));
+		
+		mManualRenderingIsRunning = true;
+		return;
+	}
+	
 	OSStatus error = AUGraphStart(mAudioUnitGraph);
 	RBAssertNoErr(error, CFSTR("Could not start audio graph. Error code %ld."), error);
 }
@@ -935,10 +1768,214 @@ void PKAudioPlayerEngine::StopGraph() throw(RBException)
 {
 	Acquisitor lock(this);
 	
+	if(mManualRenderingEnabled)
+	{
+		mManualRenderingIsRunning = false;
+		return;
+	}
+	
 	OSStatus error = AUGraphStop(mAudioUnitGraph);
 	RBAssertNoErr(error, CFSTR("Could not stop audio graph. Error code %ld."), error);
 }
 
+#pragma mark -
+#pragma mark Manual Rendering
+
+PKAudioPlayerEngine::OutputType PKAudioPlayerEngine::GetOutputType() const throw()
+{
+	return mOutputType;
+}
+
+void PKAudioPlayerEngine::SetManualRenderingEnabled(bool manualRenderingEnabled) throw(RBException)
+{
+	Acquisitor lock(this);
+	
+	if(manualRenderingEnabled == mManualRenderingEnabled)
+		return;
+	
+	RBAssert(!this->IsRunning(), CFSTR("Attempted to change manual rendering while the graph is running."));
+	RBAssert(manualRenderingEnabled || (mOutputType != kOutputTypeNone), 
+			 CFSTR("Attempted to disable manual rendering on an engine without an output device."));
+	RBAssert(manualRenderingEnabled || !mOfflineRenderingEnabled, 
+			 CFSTR("Attempted to disable manual rendering while offline rendering is enabled."));
+	
+	mManualRenderingIsRunning = false;
+	mManualRenderingEnabled = manualRenderingEnabled;
+}
+
+bool PKAudioPlayerEngine::IsManualRenderingEnabled() const throw()
+{
+	return mManualRenderingEnabled;
+}
+
+UInt32 PKAudioPlayerEngine::RenderFrames(AudioBufferList *ioBuffers, UInt32 numberOfFrames) throw(RBException)
+{
+	RBParameterAssert(ioBuffers);
+	RBAssert(mManualRenderingEnabled, CFSTR("Attempted to render manually without enabling manual rendering."));
+	
+	//
+	//	We deliberately do not acquire `this` here. The end of playback is detected on the
+	//	scheduler queue, which needs to acquire us to stop processing while we wait on it.
+	//
+	if(!this->IsRunning())
+		return 0;
+	
+	UInt32 bytesPerFrame = mStreamFormat.mBytesPerFrame;
+	
+	//The render buffers are pointed at the unrendered portion of `ioBuffers` each cycle.
+	UInt32 numberOfBuffers = ioBuffers->mNumberBuffers;
+	AudioBufferList *renderBuffers = (AudioBufferList *)alloca(offsetof(AudioBufferList, mBuffers) + (sizeof(AudioBuffer) * numberOfBuffers));
+	renderBuffers->mNumberBuffers = numberOfBuffers;
+	
+	UInt32 numberOfFramesRendered = 0;
+	while (numberOfFramesRendered < numberOfFrames)
+	{
+		UInt32 numberOfFramesToRender = numberOfFrames - numberOfFramesRendered;
+		if(numberOfFramesToRender > kMaximumFramesPerManualRender)
+			numberOfFramesToRender = kMaximumFramesPerManualRender;
+		
+		//Wait for every slice that finished during the last cycle to be refilled.
+		mSchedulerQueue->Sync(&SchedulerQueueBarrier, NULL);
+		
+		if(!this->IsRunning())
+			break;
+		
+		for (UInt32 index = 0; index < numberOfBuffers; index++)
+		{
+			renderBuffers->mBuffers[index].mNumberChannels = ioBuffers->mBuffers[index].mNumberChannels;
+			renderBuffers->mBuffers[index].mData = ((char *)(ioBuffers->mBuffers[index].mData) + (numberOfFramesRendered * bytesPerFrame));
+			renderBuffers->mBuffers[index].mDataByteSize = numberOfFramesToRender * bytesPerFrame;
+		}
+		
+		if(mManualRenderPlayerStartSampleTime < 0.0)
+			mManualRenderPlayerStartSampleTime = mManualRenderTimeStamp.mSampleTime;
+		
+		AudioUnitRenderActionFlags actionFlags = 0;
+		OSStatus errorCode = mRenderCore->Render(&actionFlags, //io actionFlags
+												 &mManualRenderTimeStamp, //in timeStamp
+												 numberOfFramesToRender, //in numberOfFrames
+												 renderBuffers); //io data
+		RBAssertNoErr(errorCode, CFSTR("Rendering failed during manual rendering. Error %ld."), errorCode);
+		
+		mManualRenderTimeStamp.mSampleTime += numberOfFramesToRender;
+		numberOfFramesRendered += numberOfFramesToRender;
+	}
+	
+	//
+	//	If playback ended during this call, we only report the frames that actually contained
+	//	scheduled audio. The scheduled audio player renders silence for the remainder of a cycle.
+	//
+	if(!this->IsRunning() && (mManualRenderPlayerStartSampleTime >= 0.0))
+	{
+		Float64 endOfPlaybackSampleTime = mManualRenderPlayerStartSampleTime + mCurrentSampleTime.load(std::memory_order_acquire);
+		Float64 firstSampleTime = mManualRenderTimeStamp.mSampleTime - numberOfFramesRendered;
+		if(endOfPlaybackSampleTime < mManualRenderTimeStamp.mSampleTime)
+			numberOfFramesRendered = (endOfPlaybackSampleTime > firstSampleTime)? UInt32(endOfPlaybackSampleTime - firstSampleTime) : 0;
+	}
+	
+	if((mSoftwareVolume != 1.0f) && (mStreamFormat.mFormatFlags & kAudioFormatFlagIsFloat))
+	{
+		for (UInt32 index = 0; index < numberOfBuffers; index++)
+		{
+			Float32 *samples = (Float32 *)(ioBuffers->mBuffers[index].mData);
+			UInt32 numberOfSamples = (numberOfFramesRendered * bytesPerFrame) / sizeof(Float32);
+			for (UInt32 sampleIndex = 0; sampleIndex < numberOfSamples; sampleIndex++)
+				samples[sampleIndex] *= mSoftwareVolume;
+		}
+	}
+	
+	return numberOfFramesRendered;
+}
+
+void PKAudioPlayerEngine::ApplyRenderContextToNode(AUNode node) throw()
+{
+	UInt32 isOffline = mOfflineRenderingEnabled? 1 : 0;
+	AudioUnitSetProperty(this->GetAudioUnitForNode(node), //in audioUnit
+						 kAudioUnitProperty_OfflineRender, //in propertyID
+						 kAudioUnitScope_Global, //in scope
+						 0, //in element
+						 &isOffline, //in data
+						 sizeof(isOffline)); //in dataSize
+}
+
+void PKAudioPlayerEngine::SetOfflineRenderingEnabled(bool offlineRenderingEnabled) throw(RBException)
+{
+	Acquisitor lock(this);
+	
+	if(offlineRenderingEnabled == mOfflineRenderingEnabled)
+		return;
+	
+	RBAssert(!this->IsRunning(), CFSTR("Attempted to change offline rendering while the graph is running."));
+	RBAssert(!offlineRenderingEnabled || mManualRenderingEnabled, 
+			 CFSTR("Attempted to enable offline rendering without enabling manual rendering."));
+	
+	mOfflineRenderingEnabled = offlineRenderingEnabled;
+	
+	//Audio units are only guaranteed to notice their render context changing when they are initialized.
+	bool graphWasInitialized = this->IsInitialized();
+	if(graphWasInitialized)
+		this->Uninitialize();
+	
+	UInt32 numberOfNodes = this->GetNumberOfNodes();
+	for (UInt32 index = 0; index < numberOfNodes; index++)
+		this->ApplyRenderContextToNode(this->GetNodeAtIndex(index));
+	
+	if(graphWasInitialized)
+		this->Initialize();
+}
+
+bool PKAudioPlayerEngine::IsOfflineRenderingEnabled() const throw()
+{
+	return mOfflineRenderingEnabled;
+}
+
+UInt64 PKAudioPlayerEngine::RenderToSink(PKRenderSink *sink, UInt64 maximumNumberOfFrames) throw(RBException)
+{
+	RBParameterAssert(sink);
+	
+	CAStreamBasicDescription streamFormat = this->GetStreamFormat();
+	if(!sink->IsOpen())
+	{
+		OSStatus errorCode = sink->Open(streamFormat);
+		RBAssertNoErr(errorCode, CFSTR("Could not open render sink. Error %ld."), errorCode);
+	}
+	
+	UInt32 bufferSize = kMaximumFramesPerManualRender * streamFormat.mBytesPerFrame;
+	AudioBufferList *buffers = _AllocateBuffers(streamFormat, bufferSize);
+	
+	UInt64 numberOfFramesWritten = 0;
+	try
+	{
+		while (this->IsRunning() && ((maximumNumberOfFrames == 0) || (numberOfFramesWritten < maximumNumberOfFrames)))
+		{
+			UInt32 numberOfFramesToRender = kMaximumFramesPerManualRender;
+			if((maximumNumberOfFrames != 0) && ((maximumNumberOfFrames - numberOfFramesWritten) < numberOfFramesToRender))
+				numberOfFramesToRender = UInt32(maximumNumberOfFrames - numberOfFramesWritten);
+			
+			for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+				buffers->mBuffers[index].mDataByteSize = numberOfFramesToRender * streamFormat.mBytesPerFrame;
+			
+			UInt32 numberOfFramesRendered = this->RenderFrames(buffers, numberOfFramesToRender);
+			if(numberOfFramesRendered == 0)
+				break;
+			
+			OSStatus errorCode = sink->Write(buffers, numberOfFramesRendered);
+			RBAssertNoErr(errorCode, CFSTR("Could not write into render sink. Error %ld."), errorCode);
+			
+			numberOfFramesWritten += numberOfFramesRendered;
+		}
+	}
+	catch (...)
+	{
+		_DeallocateBuffers(buffers);
+		throw;
+	}
+	
+	_DeallocateBuffers(buffers);
+	
+	return numberOfFramesWritten;
+}
+
 #pragma mark -
 #pragma mark Node Interaction
 
@@ -997,6 +2034,30 @@ AudioComponentDescription PKAudioPlayerEngine::GetComponentDescriptionForNode(AU
 	return description;
 }
 
+AUNode PKAudioPlayerEngine::GetNodeFeedingOutput() const throw(RBException)
+{
+	UInt32 numberOfInteractions = 0;
+	OSStatus error = AUGraphCountNodeInteractions(mAudioUnitGraph, mOutputNode, &numberOfInteractions);
+	RBAssertNoErr(error, CFSTR("AUGraphCountNodeInteractions failed for output node. Error %d."), error);
+	
+	AUNodeInteraction interactions[numberOfInteractions]; //This is _not_ Std C++.
+	error = AUGraphGetNodeInteractions(mAudioUnitGraph, mOutputNode, &numberOfInteractions, interactions);
+	RBAssertNoErr(error, CFSTR("AUGraphGetNodeInteractions failed for output node. Error %d."), error);
+	
+	for (UInt32 index = 0; index < numberOfInteractions; index++)
+	{
+		AUNodeInteraction interaction = interactions[index];
+		if((interaction.nodeInteractionType == kAUNodeInteraction_Connection) && 
+		   (interaction.nodeInteraction.connection.destNode == mOutputNode))
+		{
+			return interaction.nodeInteraction.connection.sourceNode;
+		}
+	}
+	
+	RBAssert(false, CFSTR("The output node of the graph is not connected to anything."));
+	return 0;
+}
+
 #pragma mark -
 
 void PKAudioPlayerEngine::Initialize() throw(RBException)
@@ -1149,6 +2210,9 @@ AUNode PKAudioPlayerEngine::AddNode(const AudioComponentDescription *inDescripti
 		throw;
 	}
 	
+	if(mOfflineRenderingEnabled)
+		this->ApplyRenderContextToNode(newNode);
+	
 	AUNode outputNode = this->GetNodeAtIndex(0);
 	AUNode nodeAfterOutputNode = this->GetNodeAtIndex(this->GetNumberOfNodes() - 2);
 	
@@ -1177,6 +2241,19 @@ AUNode PKAudioPlayerEngine::AddNode(const AudioComponentDescription *inDescripti
 	
 	this->Initialize();
 	
+	NodeRenderTiming *timing = new NodeRenderTiming;
+	timing->mEngine = this;
+	timing->mHistogram = new PKLatencyHistogram("effect");
+	timing->mPreRenderHostTime = 0;
+	timing->mFeedsOutput = false;
+	
+	AudioUnitAddRenderNotify(this->GetAudioUnitForNode(newNode), //in audioUnit
+							 &PKAudioPlayerEngine::NodeRenderTimingCallback, //in proc
+							 timing); //in userData
+	
+	mNodeRenderTimings[newNode] = timing;
+	this->UpdateNodeRenderTimings();
+	
 	if(graphWasRunning)
 	{
 		this->ResumeProcessing(/* preserveExistingSampleBuffers = */ true);
@@ -1235,6 +2312,26 @@ void PKAudioPlayerEngine::RemoveNode(AUNode node) throw(RBException)
 		AUGraphDisconnectNodeInput(mAudioUnitGraph, node, 0);
 		AUGraphDisconnectNodeInput(mAudioUnitGraph, nextNode, 0);
 		
+		//
+		//	Stop timing the node before it goes away. The render notify is what hands the timing
+		//	to the render thread, so it has to be gone before the timing and its histogram are.
+		//	If it can't be removed, the timing is leaked rather than freed out from under it.
+		//
+		std::map<AUNode, NodeRenderTiming *>::iterator timing = mNodeRenderTimings.find(node);
+		if(timing != mNodeRenderTimings.end())
+		{
+			OSStatus removeError = AudioUnitRemoveRenderNotify(this->GetAudioUnitForNode(node), //in audioUnit
+															   &PKAudioPlayerEngine::NodeRenderTimingCallback, //in proc
+															   timing->second); //in userData
+			if(removeError == noErr)
+			{
+				timing->second->mHistogram->Release();
+				delete timing->second;
+			}
+			
+			mNodeRenderTimings.erase(timing);
+		}
+		
 		//Remove our node
 		AUGraphRemoveNode(mAudioUnitGraph, node);
 		
@@ -1244,6 +2341,8 @@ void PKAudioPlayerEngine::RemoveNode(AUNode node) throw(RBException)
 			error = AUGraphConnectNodeInput(mAudioUnitGraph, previousNode, 0, nextNode, 0);
 			RBAssertNoErr(error, CFSTR("Could not establish necessary connection to maintain the integrity of the AUGraph. Error %d."), error);
 		}
+		
+		this->UpdateNodeRenderTimings();
 	}
 	
 	if(graphWasRunning)
@@ -14,13 +14,20 @@
 #include <AudioToolbox/AudioToolbox.h>
 #include <dispatch/dispatch.h>
 #include <Block.h>
+#include <vector>
+#include <map>
+#include <atomic>
 
 #include "RBObject.h"
 #include "RBAtomic.h"
 #include "RBException.h"
+#include "PKLatencyHistogram.h"
 
 class PKScheduledDataSlice;
+class PKRenderCore;
 class PKTaskQueue;
+class PKRenderSink;
+class PKRingBuffer;
 
 #pragma mark -
 
@@ -31,6 +38,11 @@ class PKTaskQueue;
  @discussion	The PKAudioPlayerEngine class manages almost every aspect of playback with the
 				exception of decoding. It is an implementation detail of PlayerKit and should
 				never be seen by the outside world.
+				
+				Slices are scheduled, the time line is started and reset, and audio is pulled
+				out of the engine through a PKRenderCore. The engine uses a PKAUGraphRenderCore
+				wrapping its graph; PKPullRenderCore is the portable implementation of the same
+				interface.
  */
 PK_FINAL class PK_VISIBILITY_HIDDEN PKAudioPlayerEngine : public RBLockableObject
 {
@@ -60,6 +72,18 @@ public:
 	 */
 	typedef void(^PulseHandler)();
 	
+	/*!
+	 @typedef
+	 @abstract	The prototype a reposition handler block passed to PKAudioPlayerEngine::SeekProcessing should conform to.
+	 */
+	typedef void(^RepositionHandler)();
+	
+	/*!
+	 @typedef
+	 @abstract	The prototype a playback marker handler block passed to PKAudioPlayerEngine::SetPlaybackMarker should conform to.
+	 */
+	typedef void(^PlaybackMarkerHandler)();
+	
 	/*!
 	 @typedef
 	 @abstract		The prototype a schedule slice handler function for PKAudioPlayerEngine should conform to.
@@ -68,30 +92,125 @@ public:
 	 @param			numberOfFrames	The number of frames of data to put into the buffer.
 	 @param			outError		If an error occurs, a CFError object should be placed in this object.
 	 @result	The number of frames read by the function. Should return 0 to indicate end of playback
-					and should return 0 and fill outError to indicate an error.
+					and should return 0 and fill outError to indicate an error. Should call NoteScheduleSliceStalled
+					and return 0 to indicate that the audio has not arrived yet.
 	 */
 	typedef UInt32(*ScheduleSliceFunctionHandler)(PKAudioPlayerEngine *graph, AudioBufferList *ioBuffer, UInt32 numberOfFrames, CFErrorRef *outError, void *userData);
 	
+	/*!
+	 @enum
+	 @abstract	The different kinds of output a PKAudioPlayerEngine can be constructed with.
+	 */
+	enum OutputType {
+		/*!
+		 @abstract	The engine sends its audio to the default output device of the host computer.
+		 */
+		kOutputTypeDefaultDevice = 0,
+		
+		/*!
+		 @abstract		The engine does not open an output device. Audio is only produced
+						when it is pulled out of the engine through RenderFrames.
+		 @discussion	Engines with this output type always render manually.
+		 */
+		kOutputTypeNone = 1,
+	};
+	
+	/*!
+	 @struct
+	 @abstract		The BufferingPolicy struct describes how much audio a PKAudioPlayerEngine keeps ready ahead of playback.
+	 @discussion	The engine keeps a number of slices scheduled in its scheduled audio player, and decodes
+					the same amount of audio again ahead of those slices. Larger values make playback more
+					robust against slow storage at the cost of memory and of latency when seeking or
+					changing effects.
+	 */
+	struct BufferingPolicy {
+		/*!
+		 @abstract	The amount of audio the scheduled slices should cover, in milliseconds.
+		 */
+		UInt32 targetBufferedMilliseconds;
+		
+		/*!
+		 @abstract	The fewest slices to keep scheduled.
+		 */
+		UInt32 minimumNumberOfSlices;
+		
+		/*!
+		 @abstract	The most slices to keep scheduled. This also bounds adaptive growth.
+		 */
+		UInt32 maximumNumberOfSlices;
+		
+		/*!
+		 @abstract	The number of frames in each slice. 0 uses kPKCanonicalBaseBufferSize bytes worth of frames.
+		 */
+		UInt32 numberOfFramesPerSlice;
+		
+		/*!
+		 @abstract	Whether or not the amount of buffered audio grows when the read-ahead is found dry during playback.
+		 */
+		bool isAdaptive;
+	};
+	
+	/*!
+	 @abstract		The RenderStatistics struct describes how well a PKAudioPlayerEngine has kept up with playback.
+	 @discussion	An underrun is counted each time a render cycle begins without enough scheduled audio to
+					cover it. Consecutive starved render cycles are counted as a single underrun.
+	 */
+	struct RenderStatistics {
+		/*!
+		 @abstract	The number of render cycles observed while processing.
+		 */
+		UInt32 numberOfRenderCycles;
+		
+		/*!
+		 @abstract	The number of times the scheduled audio player ran out of scheduled audio.
+		 */
+		UInt32 numberOfUnderruns;
+		
+		/*!
+		 @abstract	The number of slices the scheduled audio player reported as having begun to render late.
+		 */
+		UInt32 numberOfLateSlices;
+		
+		/*!
+		 @abstract	The furthest the scheduled audio has fallen behind a render cycle, in seconds.
+		 */
+		Float64 worstSchedulingLateness;
+	};
+	
 private:
 #pragma mark -
 #pragma mark • Private
 	
 	/*!
-	 @const			kPKNumberOfSlicesToKeepActive
-	 @abstract		The number of data slices PKAudioPlayerEngine should keep active during the course of playback.
-	 @discussion	Its value should be a power of two.
+	 @const			kDefaultNumberOfSlicesToKeepActive
+	 @abstract		The number of data slices the default buffering policy keeps active during the course of playback.
 	 */
 	enum {
 		//
 		//	This is inside of an anonymous enum because we want this enum to be confined to
 		//	the scope of PKAudioPlayerEngine and we cannot simply use a const integer for this.
 		//
-		kNumberOfSlicesToKeepActive = 8
+		kDefaultNumberOfSlicesToKeepActive = 8
+	};
+	
+	enum {
+		/*!
+		 @abstract	The largest number of frames the engine will pull through its graph in a single manual render cycle.
+		 */
+		kMaximumFramesPerManualRender = 512
+	};
+	
+	enum {
+		/*!
+		 @abstract	The number of times the scheduler queue tries to take the ring buffer from the render thread before it backs off.
+		 */
+		kMaximumNumberOfRingBufferReadAttempts = 16
 	};
 	
 	//Basic graph stuff
 	/* owner */	AUGraph mAudioUnitGraph;
 	/* weak */	AUNode mOutputNode;
+	/* n/a */	OutputType mOutputType;
 	
 	/* n/a */	AudioStreamBasicDescription mStreamFormat;
 	
@@ -107,15 +226,21 @@ private:
 	//Scheduled Audio Player things
 	/* weak */	AUNode mScheduledAudioPlayerNode;
 	/* weak */	AudioUnit mScheduledAudioPlayerUnit;
+	/* owner */	PKRenderCore *mRenderCore;
 	
 	//Processing
-	/* owner */	PKScheduledDataSlice *mDataSlices[kNumberOfSlicesToKeepActive];
+	/* owner */	std::vector<PKScheduledDataSlice *> mDataSlices;
+	/* owner */	RBAtomicCounter *mNumberOfActiveSlicesAtomicCounter;
+	
+	/* n/a */	std::atomic<int64_t> mCurrentSampleTime;
 	
-#ifdef __LP64__
-	/* n/a */	int64_t mCurrentSampleTime;
-#else
-	/* n/a */	int32_t mCurrentSampleTime;
-#endif /* __LP64__ */
+	/*!
+	 @abstract		The generation of the slices the receiver is scheduling.
+	 @discussion	Advanced whenever the slices are invalidated. A slice remembers the generation it was
+					scheduled in, so completions and fallback tasks left over from before the slices were
+					invalidated can be recognized and dropped. Never 0.
+	 */
+	/* n/a */	std::atomic<uint32_t> mSchedulingGeneration;
 	
 	/* owner */	RBAtomicBool mProcessingIsPaused;
 	/* owner */	RBAtomicBool mErrorHasOccurredDuringProcessing;
@@ -125,6 +250,67 @@ private:
 	
 	/* n/a */	int64_t mLastRenderSampleTime;
 	
+	//Render Statistics
+	/* owner */	RBAtomicBool mIsObservingRenderCycles;
+	/* n/a */	Float64 mRenderPlayerStartSampleTime;
+	/* n/a */	bool mRenderIsUnderrunning;
+	/* n/a */	std::atomic<int32_t> mNumberOfRenderCycles;
+	/* n/a */	std::atomic<int32_t> mNumberOfUnderruns;
+	/* n/a */	std::atomic<int32_t> mNumberOfLateSlices;
+	/* n/a */	std::atomic<int32_t> mWorstSchedulingLatenessInFrames;
+	
+	//Buffering
+	/* n/a */	BufferingPolicy mBufferingPolicy;
+	/* n/a */	UInt32 mAdaptiveBufferedMilliseconds;
+	/* n/a */	UInt32 mNumberOfFramesPerSlice;
+	/* n/a */	UInt32 mNumberOfSlices;
+	/* n/a */	UInt32 mReadAheadNumberOfFrames;
+	/* n/a */	std::atomic<int32_t> mNumberOfReadAheadStarvations;
+	
+	//Read-ahead
+	/* owner */	PKRingBuffer *mRingBuffer;
+	/* owner */	AudioBufferList *mRingBufferFillBuffers;
+	/* n/a */	UInt32 mRingBufferFillNumberOfFrames;
+	/* n/a */	std::atomic<bool> mRingBufferFillIsPending;
+	/* n/a */	std::atomic<bool> mRingBufferReadIsInProgress;
+	/* n/a */	std::atomic<bool> mRingBufferHasReachedEnd;
+	/* n/a */	std::atomic<bool> mScheduleSliceDidStall;
+	/* owner */	CFErrorRef mRingBufferFillError;
+	/* n/a */	std::atomic<OSStatus> mRenderThreadScheduleErrorCode;
+	
+	//Playback Markers
+	/* owner */	PlaybackMarkerHandler mPlaybackMarkerHandler;
+	/* n/a */	int64_t mNumberOfFramesWrittenToRingBuffer;
+	/* n/a */	std::atomic<int64_t> mNumberOfFramesPlayed;
+	/* n/a */	std::atomic<int64_t> mPlaybackMarkerFrame;
+	
+	//Latency
+	/*!
+	 @abstract		The NodeRenderTiming struct carries the state needed to time the rendering of a single effect node.
+	 @discussion	Node render timings are handed to render notification callbacks as their user data.
+	 */
+	struct NodeRenderTiming {
+		/* weak */	PKAudioPlayerEngine *mEngine;
+		/* owner */	PKLatencyHistogram *mHistogram;
+		/* n/a */	UInt64 mPreRenderHostTime;
+		/* n/a */	bool mFeedsOutput;
+	};
+	
+	/* owner */	PKLatencyHistogram *mScheduleLatencyHistogram;
+	/* owner */	PKLatencyHistogram *mEffectsLatencyHistogram;
+	/* owner */	std::map<AUNode, NodeRenderTiming *> mNodeRenderTimings;
+	/* n/a */	UInt64 mScheduledAudioPlayerPreRenderHostTime;
+	/* n/a */	UInt64 mScheduledAudioPlayerRenderNanoseconds;
+	/* n/a */	UInt64 mLastNodeRenderNanoseconds;
+	
+	//Manual Rendering
+	/* owner */	RBAtomicBool mManualRenderingEnabled;
+	/* owner */	RBAtomicBool mManualRenderingIsRunning;
+	/* n/a */	AudioTimeStamp mManualRenderTimeStamp;
+	/* n/a */	Float64 mManualRenderPlayerStartSampleTime;
+	/* n/a */	Float32 mSoftwareVolume;
+	/* n/a */	bool mOfflineRenderingEnabled;
+	
 #pragma mark Scheduling
 	
 	/*!
@@ -146,6 +332,115 @@ private:
 	 */
 	static void ProcessorDidFinishSlice(PKScheduledDataSlice *dataSlice, ScheduledAudioSlice *bufferList);
 	
+	/*!
+	 @abstract		Start a new generation of slices, so that nothing scheduled before the call is refilled or rescheduled.
+	 @discussion	It is only safe to call this method with the receiver acquired.
+	 */
+	void AdvanceSchedulingGeneration() throw();
+	
+	/*!
+	 @abstract		Reset the scheduled audio player and schedule the receiver's slices from the start of the read-ahead.
+	 @discussion	This is the second half of 'SeekProcessing.' It is called with the receiver acquired and processing
+					paused, and leaves processing running. The first slice is scheduled synchronously, the rest are
+					handed to the scheduler queue.
+	 */
+	void RestartProcessingAfterSeek() throw(RBException);
+	
+#pragma mark Read-ahead
+	
+	/*!
+	 @abstract		Decode audio into the receiver's ring buffer until it is full, the end of the
+					audio is reached, or an error occurs.
+	 @param			maximumNumberOfFrames	The number of frames after which to stop decoding, even if
+											the ring buffer is not yet full.
+	 @discussion	The ring buffer is the only place audio is pulled from the schedule slice function
+					handler. It is only safe to call this method on the receiver's scheduler queue.
+	 */
+	void FillRingBuffer(UInt32 maximumNumberOfFrames = UINT32_MAX) throw();
+	
+	/*!
+	 @abstract		Ask the scheduler queue to top up the receiver's ring buffer.
+	 @discussion	Only one fill request is ever outstanding at a time, so this is cheap to call
+					after every slice that is scheduled from the ring buffer.
+	 */
+	void RequestRingBufferFill() throw();
+	
+	/*!
+	 @abstract		Fill a slice from the receiver's ring buffer and schedule it in the scheduled audio player.
+	 @param			slice			The slice to fill and schedule.
+	 @param			isRenderThread	Whether or not the caller is the real time render thread. The render thread
+									never waits; it gives up if another thread is reading from the ring buffer,
+									or if the ring buffer cannot fill the whole slice before the end of the audio.
+	 @param			generation		The scheduling generation the caller expects. Nothing is scheduled if the
+									slices have been invalidated since the caller read it.
+	 @param			outErrorCode	On return, the error from scheduling the slice, if any.
+	 @param			outWasBusy		On return, whether or not the ring buffer was being read by another thread.
+	 @result		The number of frames scheduled. 0 if nothing could be scheduled.
+	 @discussion	The ring buffer only has one consumer at a time. The render thread and the scheduler
+					queue hand that role back and forth through mRingBufferReadIsInProgress.
+	 */
+	UInt32 ScheduleSliceFromRingBuffer(PKScheduledDataSlice *slice, bool isRenderThread, uint32_t generation, OSStatus *outErrorCode, bool *outWasBusy) throw();
+	
+	/*!
+	 @abstract		Try to become the consumer of the receiver's ring buffer.
+	 @param			numberOfAttempts	The number of times to try before giving up. The render thread only ever tries once.
+	 @result		Whether or not the caller is now the consumer. It must clear mRingBufferReadIsInProgress when it is done.
+	 */
+	bool TryToAcquireRingBufferForReading(UInt32 numberOfAttempts) throw();
+	
+	/*!
+	 @abstract	Discard everything in the receiver's ring buffer, (re)creating it for the current stream format if required.
+	 */
+	void ResetRingBuffer() throw(RBException);
+	
+	/*!
+	 @abstract	These static methods are provided for use with PKTaskQueue.
+	 */
+	static void FillRingBufferTaskProxy(PKAudioPlayerEngine *self);
+	static void ResetRingBufferTaskProxy(PKAudioPlayerEngine *self);
+	
+	/*!
+	 @abstract		Invoke and remove the receiver's playback marker handler, if it has one.
+	 @discussion	It is only safe to call this method on the receiver's scheduler queue.
+	 */
+	void FirePlaybackMarker() throw();
+	
+	/*!
+	 @abstract	This static method is provided for use with PKTaskQueue. It fires the marker only if the render side has claimed it.
+	 */
+	static void FirePlaybackMarkerTaskProxy(PKAudioPlayerEngine *self);
+	
+#pragma mark Buffering
+	
+	/*!
+	 @abstract		Recalculate the number of slices and the size of the read-ahead from the receiver's buffering policy.
+	 @param			canResizeSlicePool	Whether or not the slices may change. When this is false, only the
+										size of the read-ahead picks up the new configuration.
+	 @discussion	If the buffering policy is adaptive and the read-ahead has been found dry, or playback has
+					underrun, since the last time this method was called, the amount of buffered audio is grown first.
+	 */
+	void UpdateBufferingConfiguration(bool canResizeSlicePool) throw(RBException);
+	
+	/*!
+	 @abstract		Create or destroy slices so that the receiver has a specified number of them.
+	 @discussion	This may only be called while processing is stopped, after the scheduler queue has been drained.
+	 */
+	void ResizeSlicePool(UInt32 numberOfSlices) throw(RBException);
+	
+#pragma mark -
+	
+	/*!
+	 @abstract		This method does nothing. It is submitted synchronously to the scheduler queue
+					by the manual render path to wait for any outstanding slice refills to finish.
+	 */
+	static void SchedulerQueueBarrier(void *unused);
+	
+	/*!
+	 @abstract		Inform the audio unit of a specified node whether or not it is being rendered offline.
+	 @discussion	Errors are ignored, most audio units do not care about their render context.
+	 */
+	void ApplyRenderContextToNode(AUNode node) throw();
+	
 	/*!
 	 @abstract		The listener proc for observing changes to the default output unit.
 	 @param			propertyID	Ignored.
@@ -161,6 +456,28 @@ private:
 	 */
 	static OSStatus RenderObserverCallback(void *userData, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData);
 	
+	/*!
+	 @abstract		Look for an underrun at the beginning of a render cycle of the scheduled audio player.
+	 @discussion	Called on the render thread. This method never locks or allocates.
+	 */
+	void ObserveRenderCycle(const AudioTimeStamp *timeStamp, UInt32 numberOfFrames) throw();
+	
+	/*!
+	 @abstract	Returns the duration of a number of frames in the receiver's stream format, in seconds.
+	 */
+	Float64 FramesToSeconds(int32_t numberOfFrames) const throw();
+	
+	/*!
+	 @abstract		Begin timing an effect node when it is about to render, and record its time once it has.
+	 @discussion	An effect pulls its input while it renders, so the time its input took is subtracted from its own.
+	 */
+	static OSStatus NodeRenderTimingCallback(void *userData, AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *inTimeStamp, UInt32 inBusNumber, UInt32 inNumberFrames, AudioBufferList *ioData);
+	
+	/*!
+	 @abstract	Note which effect node feeds the output node, so that the time of the whole effects chain is recorded once per render cycle.
+	 */
+	void UpdateNodeRenderTimings() throw(RBException);
+	
 	/*!
 	 @abstract		PKScheduledDataSlice is a friend because we like it when it violates our encapsulation.
 	 @discussion	PKScheduledDataSlice takes a pointer to our ProcessorDidFinishSlice member, as such it
@@ -196,7 +513,7 @@ private:
 	 @discussion	This constructor is private so we can strictly control how
 					PKAudioPlayerEngine is constructed and how it is subclassed.
 	 */
-	explicit PKAudioPlayerEngine() throw(RBException);
+	explicit PKAudioPlayerEngine(OutputType outputType) throw(RBException);
 	
 	/*!
 	 @abstract	PKAudioPlayerEngine cannot be copied.
@@ -219,11 +536,12 @@ public:
 	
 	/*!
 	 @abstract		Create a new audio player engine instance.
+	 @param			outputType	The kind of output the engine should send its audio to.
 	 @discussion	This is the designated 'constructor' for PKAudioPlayerEngine.
 	 */
-	static PKAudioPlayerEngine *New() throw(RBException)
+	static PKAudioPlayerEngine *New(OutputType outputType = kOutputTypeDefaultDevice) throw(RBException)
 	{
-		return (new PKAudioPlayerEngine);
+		return (new PKAudioPlayerEngine(outputType));
 	}
 	
 #pragma mark -
@@ -298,6 +616,24 @@ public:
 	//! @abstract	Set the schedule slice function handler user data used by the receiver.
 	void *GetScheduleSliceFunctionHandlerUserData() const throw();
 	
+	/*!
+	 @abstract		Note that the schedule slice function handler is about to return 0 frames because its audio hasn't arrived yet.
+	 @discussion	This may only be called from within the schedule slice function handler. The 0 frames are not
+					treated as the end of playback, the read-ahead simply stops filling until it is next asked to.
+					It is up to the handler's owner to pause processing until the audio arrives.
+	 */
+	void NoteScheduleSliceStalled() throw();
+	
+	/*!
+	 @abstract		Invoke a handler once the audio the schedule slice function handler is about to return begins to play.
+	 @param			handler	The block to invoke on the receiver's scheduler queue. May be NULL to only clear the current marker.
+	 @discussion	This may only be called from within the schedule slice function handler, and marks the first
+					frame it returns from that call. There is one marker at a time, a marker that is still waiting
+					when another is set is invoked first. A marker whose audio is thrown away, because processing
+					is restarted or the receiver seeks, is invoked when the audio is thrown away.
+	 */
+	void SetPlaybackMarker(PlaybackMarkerHandler handler) throw();
+	
 #pragma mark -
 #pragma mark Volume
 	
@@ -347,11 +683,27 @@ public:
 	 */
 	void ResumeProcessing(bool preserveExistingSampleBuffers = false) throw(RBException);
 	
+	/*!
+	 @abstract		Move processing to a new position without stopping the graph.
+	 @param			repositionHandler	A block that moves the receiver's source of samples to the new position.
+										It is called on the receiver's scheduler queue once nothing else is pulling samples.
+										Exceptions raised by the block are propagated to the caller.
+	 @discussion	The slices already scheduled keep playing while the first slice at the new position is decoded.
+					Only then is the scheduled audio player reset and the new slice scheduled; the remaining slices
+					are filled in on the scheduler queue afterwards. Unlike pairing 'PauseProcessing' and
+					'ResumeProcessing' with a restart of the graph, this does not click and takes about as long
+					as decoding a single slice, which makes it suitable for scrubbing.
+					
+					Should only be called while the graph is running.
+	 */
+	void SeekProcessing(RepositionHandler repositionHandler) throw(RBException);
+	
 #pragma mark -
 #pragma mark Starting/Stopping Graph
 	
 	/*!
-	 @abstract	Whether or not the graph in the receiver is running.
+	 @abstract		Whether or not the graph in the receiver is running.
+	 @discussion	When manual rendering is enabled this reflects the last call to StartGraph/StopGraph.
 	 */
 	bool IsRunning() const throw();
 	
@@ -369,6 +721,143 @@ public:
 	 */
 	void StopGraph() throw(RBException);
 	
+#pragma mark -
+#pragma mark Buffering
+	
+	/*!
+	 @abstract	Returns the buffering policy engines use by default.
+	 @discussion	The default policy keeps kDefaultNumberOfSlicesToKeepActive slices of
+				kPKCanonicalBaseBufferSize bytes active at the canonical sample rate.
+	 */
+	static BufferingPolicy GetDefaultBufferingPolicy() throw();
+	
+	/*!
+	 @abstract		Set the buffering policy of the receiver.
+	 @discussion	The new policy takes effect the next time processing is started. Raises an
+					exception if the policy is not valid.
+	 */
+	void SetBufferingPolicy(const BufferingPolicy &policy) throw(RBException);
+	
+	/*!
+	 @abstract	Returns the buffering policy of the receiver.
+	 */
+	BufferingPolicy GetBufferingPolicy() const throw();
+	
+	/*!
+	 @abstract		Returns the amount of audio the receiver is currently trying to keep buffered, in milliseconds.
+	 @discussion	This is the target of the buffering policy, plus any growth from adaptive buffering.
+	 */
+	UInt32 GetBufferedMilliseconds() const throw();
+	
+	/*!
+	 @abstract	Returns the number of slices the receiver keeps active during playback.
+	 */
+	UInt32 GetNumberOfSlices() const throw();
+	
+#pragma mark -
+#pragma mark Render Statistics
+	
+	/*!
+	 @abstract		Returns the render statistics collected by the receiver.
+	 @discussion	Statistics accumulate across playback until ResetRenderStatistics is called.
+	 */
+	RenderStatistics GetRenderStatistics() const throw();
+	
+	/*!
+	 @abstract		Reset the render statistics collected by the receiver.
+	 @result		The statistics collected up to the reset.
+	 @discussion	Safe to call while rendering. Nothing counted by the render thread is lost: it is either
+					in the result, or in the statistics collected after the reset.
+	 */
+	RenderStatistics ResetRenderStatistics() throw();
+	
+#pragma mark -
+#pragma mark Latency
+	
+	/*!
+	 @abstract	Returns the histogram of the time the receiver takes to copy a slice out of its read-ahead and schedule it.
+	 */
+	PKLatencyHistogram *GetScheduleLatencyHistogram() const throw();
+	
+	/*!
+	 @abstract	Returns the histogram of the time the receiver's effect nodes take to render, per render cycle, as a whole.
+	 */
+	PKLatencyHistogram *GetEffectsLatencyHistogram() const throw();
+	
+	/*!
+	 @abstract		Returns a summary of the time a node added through AddNode takes to render, excluding its input.
+	 @discussion	The summary is a copy, so it stays valid after the node is removed. Raises an exception for unknown nodes.
+	 */
+	PKLatencyHistogram::Summary GetLatencySummaryForNode(AUNode node) const throw(RBException);
+	
+	/*!
+	 @abstract	Reset all of the latency histograms of the receiver.
+	 */
+	void ResetLatencyHistograms() throw();
+	
+#pragma mark -
+#pragma mark Manual Rendering
+	
+	/*!
+	 @abstract	Returns the kind of output the receiver was constructed with.
+	 */
+	OutputType GetOutputType() const throw();
+	
+	/*!
+	 @abstract		Set whether or not the receiver's audio is pulled out of it manually through RenderFrames.
+	 @discussion	When manual rendering is enabled StartGraph and StopGraph no longer touch the output
+					device, and the receiver only produces audio when RenderFrames is called. The graph
+					must not be running when this method is called. Engines constructed with kOutputTypeNone
+					cannot disable manual rendering.
+	 */
+	void SetManualRenderingEnabled(bool manualRenderingEnabled) throw(RBException);
+	
+	/*!
+	 @abstract	Returns whether or not the receiver's audio is pulled out of it manually.
+	 */
+	bool IsManualRenderingEnabled() const throw();
+	
+	/*!
+	 @abstract		Pull a specified number of frames through the receiver's graph.
+	 @param			ioBuffers		The buffers to render into. They must be able to contain `numberOfFrames`
+									frames in the receiver's stream format. Required.
+	 @param			numberOfFrames	The number of frames to render.
+	 @result		The number of frames rendered into `ioBuffers`. This is 0 when the receiver is not running.
+	 @discussion	This is the pull-model entry point into the engine. Rendering runs on the calling thread as
+					fast as the processor allows; before each render cycle the engine waits for any outstanding
+					slices to be scheduled, so the audio produced is identical no matter how fast it is pulled.
+					
+					Manual rendering must be enabled to use this method. End of playback is reported through the
+					end of playback handler as usual, after which IsRunning returns false.
+	 */
+	UInt32 RenderFrames(AudioBufferList *ioBuffers, UInt32 numberOfFrames) throw(RBException);
+	
+	/*!
+	 @abstract		Pull frames through the receiver's graph into a render sink until playback ends.
+	 @param			sink					The sink to write rendered audio into. If the sink is not open,
+											it is opened with the receiver's stream format. Required.
+	 @param			maximumNumberOfFrames	The maximum number of frames to render. Pass 0 to render until
+											the end of playback.
+	 @result		The number of frames written into `sink`.
+	 @discussion	The sink is not closed by this method.
+	 */
+	UInt64 RenderToSink(PKRenderSink *sink, UInt64 maximumNumberOfFrames = 0) throw(RBException);
+	
+	/*!
+	 @abstract		Set whether or not the audio units in the receiver's graph are told they are being rendered offline.
+	 @discussion	This sets kAudioUnitProperty_OfflineRender on every node in the receiver, and on every node added
+					afterwards, the same way CAAUProcessor does for its offline context. Units that support it may then
+					use higher quality processing that is not bound by real time deadlines.
+					
+					Manual rendering must be enabled to enable offline rendering, and the graph must not be running.
+	 */
+	void SetOfflineRenderingEnabled(bool offlineRenderingEnabled) throw(RBException);
+	
+	/*!
+	 @abstract	Returns whether or not the audio units in the receiver's graph are told they are being rendered offline.
+	 */
+	bool IsOfflineRenderingEnabled() const throw();
+	
 #pragma mark -
 #pragma mark Node Interaction
 	
@@ -397,6 +886,12 @@ public:
 	 */
 	AudioComponentDescription GetComponentDescriptionForNode(AUNode node) const throw(RBException);
 	
+	/*!
+	 @abstract		Get the node whose output is connected to the input of the receiver's output node.
+	 @discussion	This is the last effect in the receiver's graph, or the scheduled audio player if there are no effects.
+	 */
+	AUNode GetNodeFeedingOutput() const throw(RBException);
+	
 #pragma mark -
 	
 	/*!
@@ -9,26 +9,84 @@
 
 #import "PKAudioPlayer.h"
 #import <AudioToolbox/AudioToolbox.h>
+#import <atomic>
 
 #import "PKAudioPlayerEngine.h"
 #import "PKDecoder.h"
+#import "PKLatencyHistogram.h"
+#import "PKCrossfadeMixer.h"
+
+class PKStreamByteSource;
+class PKTaskQueue;
 
 #pragma mark Types
 
+///The struct used to represent a decoder and everything needed to turn its output into the engine's stream format.
+typedef struct PKAudioPlayerTrack {
+	//Decoder
+	PKDecoder *decoder;
+	AudioConverterRef decoderConverter;
+	AudioBufferList *decoderConverterBuffers;
+	UInt32 decoderConverterBuffersNumberOfFrames;
+	
+	//The engine stream format the track produces.
+	AudioStreamBasicDescription streamFormat;
+	
+	//Audio decoded before the track started playing, in the track's stream format.
+	AudioBufferList *prerollBuffers;
+	UInt32 prerollNumberOfFrames;
+	UInt32 prerollOffset;
+	
+	//The stream the decoder reads from, if the track is a stream begun with PKAudioPlayerBeginStream.
+	PKStreamByteSource *stream;
+} PKAudioPlayerTrack;
+
 ///The struct used to represent the internal state of the PKAudioPlayer.
 typedef struct PKAudioPlayer {
 	//Engine
 	PKAudioPlayerEngine *engine;
+	bool engineHasTrackStreamFormat;
 	
-	//Decoder
-	PKDecoder *decoder;
-	AudioConverterRef decoderConverter;
-	AudioBufferList *decoderConverterBuffers;
+	//Tracks
+	PKAudioPlayerTrack track;
+	PKAudioPlayerTrack *nextTrack;
+	std::atomic<int32_t> nextTrackIsPending;
+	PKTaskQueue *nextTrackQueue;
+	
+	//Opening
+	std::atomic<int32_t> openGeneration;
+	PKTaskQueue *openQueue;
+	
+	//Streaming
+	PKStreamByteSource *stream;
+	int32_t streamGeneration;
+	UInt64 streamNumberOfBytesToOpen;
+	std::atomic<bool> streamIsOpening;
+	std::atomic<int32_t> bufferingState;
+	std::atomic<bool> isStalled;
+	std::atomic<bool> stallReconcileIsPending;
+	std::atomic<bool> playWhenStreamIsReady;
+	UInt64 streamPlayRequestHostTime;
+	UInt64 streamStallHostTime;
+	PKAudioPlayerStreamingPolicy streamingPolicy;
+	PKAudioPlayerStreamStatistics streamStatistics;
+	PKTaskQueue *streamQueue;
+	
+	//Crossfading
+	PKAudioPlayerTrack *fadingInTrack;
+	PKCrossfadeMixer *crossfadeMixer;
+	bool fadingInTrackIsBeingMixed;
+	std::atomic<CFTimeInterval> crossfadeDuration;
+	PKAudioPlayerCrossfadeCurve crossfadeCurve;
+	
+	//Latency
+	PKLatencyHistogram *decodeLatencyHistogram;
+	PKLatencyHistogram *convertLatencyHistogram;
 	
 	//State
-	volatile int32_t isPaused;
-	volatile int32_t hasBroadcastedPresence;
-	volatile int32_t preserveExistingBuffersOnResume;
+	std::atomic<bool> isPaused;
+	std::atomic<bool> hasBroadcastedPresence;
+	std::atomic<bool> preserveExistingBuffersOnResume;
 	CFStringRef sessionID;
 	
 	//Pulse
@@ -44,7 +102,10 @@ PK_EXTERN PK_VISIBILITY_HIDDEN PKAudioPlayer AudioPlayerState;
 
 #define CFDICT(keys, values) CFDictionaryCreate(kCFAllocatorDefault, (const void *[])keys, (const void *[])values, sizeof((const void *[])keys) / sizeof(const void *), &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks)
 
-#define CHECK_STATE_INITIALIZED() ({ if(OSMemoryBarrier(), AudioPlayerStateInitCount == 0) RBAssert(0, CFSTR("Attempted use of PKAudioPlayer before PKAudioPlayerInit has been called.")); })
+///Fill out a public latency summary from the summary of one of PlayerKit's latency histograms.
+PK_EXTERN PK_VISIBILITY_HIDDEN void PKAudioPlayerFillOutLatencySummary(const PKLatencyHistogram::Summary &summary, PKAudioPlayerLatencySummary *outSummary);
+
+#define CHECK_STATE_INITIALIZED() ({ if(AudioPlayerStateInitCount.load(std::memory_order_acquire) == 0) RBAssert(0, CFSTR("Attempted use of PKAudioPlayer before PKAudioPlayerInit has been called.")); })
 
 #pragma mark -
 #pragma mark Controlling Playback
@@ -54,3 +115,9 @@ PK_EXTERN Boolean PKAudioPlayerSetDecoder(PKDecoder *decoder, CFErrorRef *outErr
 
 ///Get the decoder the audio player is currently using, if any.
 PK_EXTERN PKDecoder *PKAudioPlayerGetDecoder();
+
+///Queue a decoder for the audio player to play once the current decoder has finished.
+PK_EXTERN Boolean PKAudioPlayerQueueNextDecoder(PKDecoder *decoder, CFErrorRef *outError);
+
+///Get the decoder queued to play once the current decoder has finished, if any.
+PK_EXTERN PKDecoder *PKAudioPlayerGetQueuedDecoder();
@@ -0,0 +1,422 @@
+/*
+ *  PKByteSource.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKByteSource.h"
+
+#pragma mark PKByteSource
+
+#pragma mark Lifecycle
+
+PKByteSource::PKByteSource(const char *className) :
+	RBLockableObject(className)
+{
+	
+}
+
+PKByteSource::~PKByteSource()
+{
+	
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+CFURLRef PKByteSource::CopyLocation() const throw()
+{
+	return NULL;
+}
+
+CFStringRef PKByteSource::CopyPathExtension() const throw()
+{
+	CFURLRef location = this->CopyLocation();
+	if(!location)
+		return NULL;
+	
+	CFStringRef pathExtension = CFURLCopyPathExtension(location);
+	CFRelease(location);
+	
+	return pathExtension;
+}
+
+#pragma mark -
+#pragma mark Reading
+
+size_t PKByteSource::ReadAtOffset(void *buffer, size_t length, UInt64 offset) throw(RBException)
+{
+	this->SetOffset(offset);
+	
+	return this->Read(buffer, length);
+}
+
+#pragma mark -
+#pragma mark PKCallbackByteSource
+
+#pragma mark Lifecycle
+
+PKCallbackByteSource::PKCallbackByteSource(const Callbacks &callbacks, void *info, CFStringRef pathExtension) throw(RBException) :
+	PKByteSource("PKCallbackByteSource"),
+	mCallbacks(callbacks),
+	mInfo(info),
+	mPathExtension(pathExtension? CFStringRef(CFRetain(pathExtension)) : NULL),
+	mOffset(0),
+	mStreamOffset(0),
+	mHead(NULL),
+	mHeadLength(0)
+{
+	RBParameterAssert(callbacks.Read);
+	
+	if(!mCallbacks.Seek)
+	{
+		mHead = (UInt8 *)malloc(kRetainedHeadSize);
+		RBAssert((mHead != NULL), CFSTR("Could not allocate byte source buffer."));
+	}
+}
+
+PKCallbackByteSource::~PKCallbackByteSource()
+{
+	if(mCallbacks.Release)
+		mCallbacks.Release(mInfo);
+	
+	if(mHead)
+	{
+		free(mHead);
+		mHead = NULL;
+	}
+	
+	if(mPathExtension)
+	{
+		CFRelease(mPathExtension);
+		mPathExtension = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+CFStringRef PKCallbackByteSource::CopyPathExtension() const throw()
+{
+	return mPathExtension? CFStringRef(CFRetain(mPathExtension)) : NULL;
+}
+
+UInt64 PKCallbackByteSource::GetLength() const throw()
+{
+	return mCallbacks.GetLength? mCallbacks.GetLength(mInfo) : 0;
+}
+
+#pragma mark -
+#pragma mark Reading
+
+bool PKCallbackByteSource::CanSeek() const throw()
+{
+	return (mCallbacks.Seek != NULL);
+}
+
+UInt64 PKCallbackByteSource::GetOffset() const throw()
+{
+	return mOffset;
+}
+
+void PKCallbackByteSource::SetOffset(UInt64 offset) throw(RBException)
+{
+	if(offset == mOffset)
+		return;
+	
+	if(mCallbacks.Seek)
+	{
+		RBAssert(mCallbacks.Seek(mInfo, offset), CFSTR("Could not seek to %lld in byte source."), offset);
+	}
+	else
+	{
+		//Only the start of the stream is kept, everything else has to be read in order.
+		RBAssert((offset <= mHeadLength) || (offset >= mStreamOffset),
+				 CFSTR("Cannot seek back to %lld in a byte source that cannot seek."), offset);
+	}
+	
+	mOffset = offset;
+}
+
+size_t PKCallbackByteSource::ReadFromStream(void *buffer, size_t length) throw(RBException)
+{
+	long amountRead = mCallbacks.Read(mInfo, buffer, length);
+	RBAssert((amountRead >= 0), CFSTR("Could not read from byte source."));
+	
+	mStreamOffset += amountRead;
+	
+	return size_t(amountRead);
+}
+
+size_t PKCallbackByteSource::Read(void *buffer, size_t length) throw(RBException)
+{
+	if(mCallbacks.Seek)
+	{
+		size_t amountRead = this->ReadFromStream(buffer, length);
+		mOffset += amountRead;
+		
+		return amountRead;
+	}
+	
+	UInt8 *destination = (UInt8 *)buffer;
+	size_t amountRead = 0;
+	while (amountRead < length)
+	{
+		if(mOffset < mHeadLength)
+		{
+			size_t amountToCopy = mHeadLength - mOffset;
+			if(amountToCopy > (length - amountRead))
+				amountToCopy = length - amountRead;
+			
+			memcpy(destination + amountRead, mHead + mOffset, amountToCopy);
+			amountRead += amountToCopy;
+			mOffset += amountToCopy;
+		}
+		else if(mStreamOffset < kRetainedHeadSize)
+		{
+			//The start of the stream is read into the head first so it can be read again.
+			size_t amountPulled = this->ReadFromStream(mHead + mHeadLength, kRetainedHeadSize - mHeadLength);
+			if(amountPulled == 0)
+				break;
+			
+			mHeadLength += UInt32(amountPulled);
+		}
+		else if(mOffset > mStreamOffset)
+		{
+			UInt8 discard[4096];
+			size_t amountToSkip = sizeof(discard);
+			if(amountToSkip > (mOffset - mStreamOffset))
+				amountToSkip = size_t(mOffset - mStreamOffset);
+			
+			if(this->ReadFromStream(discard, amountToSkip) == 0)
+				break;
+		}
+		else
+		{
+			size_t amountPulled = this->ReadFromStream(destination + amountRead, length - amountRead);
+			if(amountPulled == 0)
+				break;
+			
+			amountRead += amountPulled;
+			mOffset += amountPulled;
+		}
+	}
+	
+	return amountRead;
+}
+
+#pragma mark -
+#pragma mark PKStreamByteSource
+
+#pragma mark Lifecycle
+
+PKStreamByteSource::PKStreamByteSource(CFStringRef pathExtension, UInt64 expectedLength) throw(RBException) :
+	PKByteSource("PKStreamByteSource"),
+	mPathExtension(pathExtension? CFStringRef(CFRetain(pathExtension)) : NULL),
+	mExpectedLength(expectedLength),
+	mOffset(0),
+	mBuffer(NULL),
+	mBufferCapacity(0),
+	mAvailableLength(0),
+	mIsComplete(false),
+	mIsCancelled(false),
+	mWaitsForData(true)
+{
+	int errorCode = pthread_mutex_init(&mStreamMutex, NULL);
+	RBAssertNoErr(errorCode, CFSTR("pthread_mutex_init failed with error code %d"), errorCode);
+	
+	errorCode = pthread_cond_init(&mDataArrivedCondition, NULL);
+	RBAssertNoErr(errorCode, CFSTR("pthread_cond_init failed with error code %d"), errorCode);
+	
+	mBufferCapacity = ((expectedLength > 0) && (expectedLength < SIZE_MAX))? size_t(expectedLength) : kDefaultBufferCapacity;
+	mBuffer = (UInt8 *)malloc(mBufferCapacity);
+	RBAssert((mBuffer != NULL), CFSTR("Could not allocate stream buffer of %zu bytes."), mBufferCapacity);
+}
+
+PKStreamByteSource::~PKStreamByteSource()
+{
+	if(mBuffer)
+	{
+		free(mBuffer);
+		mBuffer = NULL;
+	}
+	
+	if(mPathExtension)
+	{
+		CFRelease(mPathExtension);
+		mPathExtension = NULL;
+	}
+	
+	pthread_cond_destroy(&mDataArrivedCondition);
+	pthread_mutex_destroy(&mStreamMutex);
+}
+
+#pragma mark -
+#pragma mark Receiving
+
+void PKStreamByteSource::AppendBytes(const void *bytes, size_t length) throw(RBException)
+{
+	pthread_mutex_lock(&mStreamMutex);
+	
+	if(mIsComplete || mIsCancelled)
+	{
+		pthread_mutex_unlock(&mStreamMutex);
+		RBAssert(false, CFSTR("Cannot append to a stream that has been finished or cancelled."));
+	}
+	
+	if((mAvailableLength + length) > mBufferCapacity)
+	{
+		size_t newBufferCapacity = mBufferCapacity * 2;
+		while ((mAvailableLength + length) > newBufferCapacity)
+			newBufferCapacity *= 2;
+		
+		UInt8 *newBuffer = (UInt8 *)realloc(mBuffer, newBufferCapacity);
+		if(!newBuffer)
+		{
+			pthread_mutex_unlock(&mStreamMutex);
+			RBAssert(false, CFSTR("Could not grow stream buffer to %zu bytes."), newBufferCapacity);
+		}
+		
+		mBuffer = newBuffer;
+		mBufferCapacity = newBufferCapacity;
+	}
+	
+	memcpy(mBuffer + mAvailableLength, bytes, length);
+	mAvailableLength += length;
+	
+	pthread_cond_broadcast(&mDataArrivedCondition);
+	pthread_mutex_unlock(&mStreamMutex);
+}
+
+void PKStreamByteSource::Finish() throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	mIsComplete = true;
+	pthread_cond_broadcast(&mDataArrivedCondition);
+	pthread_mutex_unlock(&mStreamMutex);
+}
+
+void PKStreamByteSource::Cancel() throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	mIsCancelled = true;
+	pthread_cond_broadcast(&mDataArrivedCondition);
+	pthread_mutex_unlock(&mStreamMutex);
+}
+
+bool PKStreamByteSource::IsComplete() const throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	bool isComplete = mIsComplete;
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return isComplete;
+}
+
+UInt64 PKStreamByteSource::GetAvailableLength() const throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	UInt64 availableLength = mAvailableLength;
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return availableLength;
+}
+
+bool PKStreamByteSource::HasDataAhead(UInt64 numberOfBytes) const throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	bool hasDataAhead = mIsComplete || ((mOffset + numberOfBytes) <= mAvailableLength);
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return hasDataAhead;
+}
+
+void PKStreamByteSource::SetWaitsForData(bool waitsForData) throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	mWaitsForData = waitsForData;
+	pthread_mutex_unlock(&mStreamMutex);
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+CFStringRef PKStreamByteSource::CopyPathExtension() const throw()
+{
+	return mPathExtension? CFStringRef(CFRetain(mPathExtension)) : NULL;
+}
+
+UInt64 PKStreamByteSource::GetLength() const throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	UInt64 length = mIsComplete? mAvailableLength : mExpectedLength;
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return length;
+}
+
+#pragma mark -
+#pragma mark Reading
+
+bool PKStreamByteSource::CanSeek() const throw()
+{
+	return this->IsComplete();
+}
+
+UInt64 PKStreamByteSource::GetOffset() const throw()
+{
+	pthread_mutex_lock(&mStreamMutex);
+	UInt64 offset = mOffset;
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return offset;
+}
+
+void PKStreamByteSource::SetOffset(UInt64 offset) throw(RBException)
+{
+	pthread_mutex_lock(&mStreamMutex);
+	mOffset = offset;
+	pthread_mutex_unlock(&mStreamMutex);
+}
+
+size_t PKStreamByteSource::Read(void *buffer, size_t length) throw(RBException)
+{
+	pthread_mutex_lock(&mStreamMutex);
+	
+	//A short read means the end of the stream to decoders, so we only return one once the stream has ended.
+	while (!mIsComplete && ((mOffset + length) > mAvailableLength))
+	{
+		if(mIsCancelled)
+		{
+			pthread_mutex_unlock(&mStreamMutex);
+			RBAssert(false, CFSTR("The stream was cancelled."));
+		}
+		
+		if(!mWaitsForData)
+		{
+			UInt64 offset = mOffset;
+			pthread_mutex_unlock(&mStreamMutex);
+			RBAssert(false, CFSTR("Bytes %lld to %lld of the stream have not arrived yet."), offset, UInt64(offset + length));
+		}
+		
+		pthread_cond_wait(&mDataArrivedCondition, &mStreamMutex);
+	}
+	
+	size_t amountRead = 0;
+	if(mOffset < mAvailableLength)
+	{
+		amountRead = mAvailableLength - size_t(mOffset);
+		if(amountRead > length)
+			amountRead = length;
+		
+		memcpy(buffer, mBuffer + mOffset, amountRead);
+		mOffset += amountRead;
+	}
+	
+	pthread_mutex_unlock(&mStreamMutex);
+	
+	return amountRead;
+}
@@ -0,0 +1,310 @@
+/*
+ *  PKByteSource.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKByteSource_h
+#define PKByteSource_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <pthread.h>
+
+#include "RBLockableObject.h"
+
+/*!
+ @class
+ @abstract		The PKByteSource class is the abstract base of the streams of bytes decoders read encoded audio from.
+ @discussion	A byte source lets a decoder read a file that is in memory, inside an archive, or arriving over
+				the network the same way it reads a file on disk, without the bytes being written to a temporary
+				file first. Sources that cannot seek may still be read from the start, which is enough for
+				decoders that only read forward.
+				
+				A byte source is read by one decoder at a time.
+ */
+class PK_VISIBILITY_PUBLIC PKByteSource : public RBLockableObject
+{
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct the byte source passing in the name of the byte source subclass.
+	 */
+	explicit PKByteSource(const char *className = "PKByteSource");
+	
+	/*!
+	 @abstract	Destruct the byte source.
+	 */
+	virtual ~PKByteSource();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	/*!
+	 @abstract	Returns a copy of the location of the file the receiver reads, or NULL if it doesn't read a file.
+	 */
+	virtual CFURLRef CopyLocation() const throw();
+	
+	/*!
+	 @abstract		Returns a copy of the path extension describing the receiver's contents, or NULL if there isn't one.
+	 @discussion	The path extension is used to pick a decoder for the receiver. The default implementation returns
+					the path extension of the receiver's location.
+	 */
+	virtual CFStringRef CopyPathExtension() const throw();
+	
+	/*!
+	 @abstract	Returns the number of bytes in the receiver, or 0 if the length is not known.
+	 */
+	virtual UInt64 GetLength() const throw() PK_PURE_VIRTUAL;
+	
+#pragma mark -
+#pragma mark Reading
+	
+	/*!
+	 @abstract		Returns whether or not the receiver can be repositioned anywhere.
+	 @discussion	Sources that cannot seek must still allow reading to skip forward, and returning to the start.
+	 */
+	virtual bool CanSeek() const throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Returns the offset the next read from the receiver starts at.
+	 */
+	virtual UInt64 GetOffset() const throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Set the offset the next read from the receiver starts at.
+	 */
+	virtual void SetOffset(UInt64 offset) throw(RBException) PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Read from the receiver at its current offset, advancing the offset past the data read.
+	 @result	The number of bytes read. This is less than `length` only at the end of the receiver.
+	 */
+	virtual size_t Read(void *buffer, size_t length) throw(RBException) PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Read from the receiver at a specified offset, leaving the receiver's offset past the data read.
+	 @result	The number of bytes read.
+	 */
+	size_t ReadAtOffset(void *buffer, size_t length, UInt64 offset) throw(RBException);
+
+private:
+	PKByteSource(PKByteSource &source);
+	PKByteSource &operator=(PKByteSource &source);
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract		The PKCallbackByteSource class reads bytes from a set of client provided callbacks.
+ @discussion	When no seek callback is given the start of the stream is kept in memory as it is read, so
+				decoders can read the headers of the stream again once it has been probed. Seeking forward
+				past what has been read skips the bytes in between.
+ */
+class PK_VISIBILITY_HIDDEN PKCallbackByteSource : public PKByteSource
+{
+public:
+	/*!
+	 @abstract	The Callbacks struct describes the functions a PKCallbackByteSource reads through.
+	 */
+	struct Callbacks {
+		/*!
+		 @abstract	Read up to `length` bytes into `buffer`, returning the number of bytes read, 0 at the end of the stream, or -1 if an error occurs. Required.
+		 */
+		long (*Read)(void *info, void *buffer, size_t length);
+		
+		/*!
+		 @abstract	Move the next read to `offset`, returning whether or not this succeeded. May be NULL if the stream cannot seek.
+		 */
+		Boolean (*Seek)(void *info, UInt64 offset);
+		
+		/*!
+		 @abstract	Returns the number of bytes in the stream, or 0 if that is not known. May be NULL.
+		 */
+		UInt64 (*GetLength)(void *info);
+		
+		/*!
+		 @abstract	Invoked once the source no longer needs `info`. May be NULL.
+		 */
+		void (*Release)(void *info);
+	};
+	
+	enum {
+		/*!
+		 @abstract	The number of bytes from the start of a stream that cannot seek that are kept so they can be read again.
+		 */
+		kRetainedHeadSize = 64 * 1024,
+	};
+
+protected:
+	
+	/* n/a */	Callbacks mCallbacks;
+	/* weak */	void *mInfo;
+	/* owner */	CFStringRef mPathExtension;
+	/* n/a */	UInt64 mOffset;
+	
+	//Streams that cannot seek
+	/* n/a */	UInt64 mStreamOffset;
+	/* owner */	UInt8 *mHead;
+	/* n/a */	UInt32 mHeadLength;
+	
+	/*!
+	 @abstract	Read from the stream through the read callback, throwing if an error occurs.
+	 */
+	size_t ReadFromStream(void *buffer, size_t length) throw(RBException);
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a byte source reading through a specified set of callbacks.
+	 @param		callbacks		The callbacks to read through. Copied.
+	 @param		info			The value passed to each of the callbacks.
+	 @param		pathExtension	The path extension describing the stream's contents. May be NULL.
+	 */
+	explicit PKCallbackByteSource(const Callbacks &callbacks, void *info, CFStringRef pathExtension) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the byte source, invoking the release callback.
+	 */
+	virtual ~PKCallbackByteSource();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual CFStringRef CopyPathExtension() const throw();
+	virtual UInt64 GetLength() const throw();
+	
+#pragma mark -
+#pragma mark Reading
+	
+	virtual bool CanSeek() const throw();
+	virtual UInt64 GetOffset() const throw();
+	virtual void SetOffset(UInt64 offset) throw(RBException);
+	virtual size_t Read(void *buffer, size_t length) throw(RBException);
+
+private:
+	PKCallbackByteSource(PKCallbackByteSource &source);
+	PKCallbackByteSource &operator=(PKCallbackByteSource &source);
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract		The PKStreamByteSource class holds the bytes of a stream as they are received, so it can be decoded before all of it has arrived.
+ @discussion	Received bytes are appended to a buffer that grows to hold the whole stream, so anything that
+				has arrived can be read again. Reads of bytes that haven't arrived yet either fail or wait for
+				them, depending on whether the source is set to wait for data. Decoders are opened with waiting
+				turned off, so a stream that is too short to open fails quickly and can be tried again later.
+				
+				The source can only be repositioned freely once the whole stream has arrived.
+ */
+class PK_VISIBILITY_HIDDEN PKStreamByteSource : public PKByteSource
+{
+public:
+	enum {
+		/*!
+		 @abstract	The size of the buffer allocated for a stream whose length isn't known.
+		 */
+		kDefaultBufferCapacity = 256 * 1024,
+	};
+
+protected:
+	
+	/* owner */	CFStringRef mPathExtension;
+	/* n/a */	UInt64 mExpectedLength;
+	/* n/a */	UInt64 mOffset;
+	
+	/* owner */	UInt8 *mBuffer;
+	/* n/a */	size_t mBufferCapacity;
+	/* n/a */	size_t mAvailableLength;
+	
+	/* n/a */	bool mIsComplete;
+	/* n/a */	bool mIsCancelled;
+	/* n/a */	bool mWaitsForData;
+	
+	//The receiver's own lock is recursive, which a condition can't wait on, so the stream's state has a plain mutex.
+	/* n/a */	mutable pthread_mutex_t mStreamMutex;
+	/* n/a */	pthread_cond_t mDataArrivedCondition;
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct an empty stream byte source.
+	 @param		pathExtension	The path extension describing the stream's contents. May be NULL.
+	 @param		expectedLength	The number of bytes the stream is expected to contain, or 0 if that is not known.
+	 */
+	explicit PKStreamByteSource(CFStringRef pathExtension, UInt64 expectedLength) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the byte source.
+	 */
+	virtual ~PKStreamByteSource();
+	
+#pragma mark -
+#pragma mark Receiving
+	
+	/*!
+	 @abstract	Append bytes that have arrived to the end of the receiver, waking up any reads waiting for them.
+	 */
+	void AppendBytes(const void *bytes, size_t length) throw(RBException);
+	
+	/*!
+	 @abstract	Mark the end of the stream. Reads past the end of the receiver return short from here on.
+	 */
+	void Finish() throw();
+	
+	/*!
+	 @abstract	Stop receiving the stream. Reads waiting for data, and any made after this, fail.
+	 */
+	void Cancel() throw();
+	
+	/*!
+	 @abstract	Returns whether or not the whole stream has arrived.
+	 */
+	bool IsComplete() const throw();
+	
+	/*!
+	 @abstract	Returns the number of bytes that have arrived.
+	 */
+	UInt64 GetAvailableLength() const throw();
+	
+	/*!
+	 @abstract	Returns whether or not a specified number of bytes past the receiver's offset have arrived, or the whole stream has.
+	 */
+	bool HasDataAhead(UInt64 numberOfBytes) const throw();
+	
+	/*!
+	 @abstract	Set whether reads of bytes that haven't arrived yet wait for them, or fail.
+	 */
+	void SetWaitsForData(bool waitsForData) throw();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual CFStringRef CopyPathExtension() const throw();
+	virtual UInt64 GetLength() const throw();
+	
+#pragma mark -
+#pragma mark Reading
+	
+	virtual bool CanSeek() const throw();
+	virtual UInt64 GetOffset() const throw();
+	virtual void SetOffset(UInt64 offset) throw(RBException);
+	virtual size_t Read(void *buffer, size_t length) throw(RBException);
+	
+private:
+	PKStreamByteSource(PKStreamByteSource &source);
+	PKStreamByteSource &operator=(PKStreamByteSource &source);
+};
+
+#endif /* PKByteSource_h */
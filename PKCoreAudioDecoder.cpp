@@ -9,6 +9,7 @@
 
 #include "PKCoreAudioDecoder.h"
 #include "CAStreamBasicDescription.h"
+#include <dispatch/dispatch.h>
 
 #pragma mark PKCoreAudioDecoder
 
@@ -19,14 +20,60 @@ PKCoreAudioDecoder::PKCoreAudioDecoder(CFURLRef location) :
 	mAudioFile(NULL), 
 	mCurrentFrameInFile(0), 
 	mAudioStreamDescription(), 
-	mFileLocation(CFURLRef(CFRetain(location)))
+	mFileLocation(CFURLRef(CFRetain(location))),
+	mSource(NULL),
+	mSourceAudioFile(NULL)
 {
 	OSStatus status = ExtAudioFileOpenURL(location, &mAudioFile);
 	RBAssertNoErr(status, CFSTR("ExtAudioFileOpenURL failed with error code %ld."), status);
 	
+	this->SetUpAudioFile();
+}
+
+PKCoreAudioDecoder::PKCoreAudioDecoder(PKByteSource *source) throw(RBException) : 
+	PKDecoder("PKCoreAudioDecoder"),
+	mAudioFile(NULL), 
+	mCurrentFrameInFile(0), 
+	mAudioStreamDescription(), 
+	mFileLocation(source->CopyLocation()),
+	mSource(source),
+	mSourceAudioFile(NULL)
+{
+	mSource->Retain();
+	
+	//Audio File Services sniffs the contents when it isn't given a type, the extension just saves it the trouble.
+	AudioFileTypeID fileTypeHint = 0;
+	CFStringRef pathExtension = mSource->CopyPathExtension();
+	if(pathExtension)
+	{
+		UInt32 size = 0;
+		if((AudioFileGetGlobalInfoSize(kAudioFileGlobalInfo_TypesForExtension, sizeof(pathExtension), &pathExtension, &size) == noErr) && 
+		   (size >= sizeof(AudioFileTypeID)))
+		{
+			AudioFileTypeID *fileTypes = (AudioFileTypeID *)malloc(size);
+			if(fileTypes && (AudioFileGetGlobalInfo(kAudioFileGlobalInfo_TypesForExtension, sizeof(pathExtension), &pathExtension, &size, fileTypes) == noErr))
+				fileTypeHint = fileTypes[0];
+			
+			free(fileTypes);
+		}
+		
+		CFRelease(pathExtension);
+	}
+	
+	OSStatus status = AudioFileOpenWithCallbacks(this, &SourceRead, NULL, &SourceGetSize, NULL, fileTypeHint, &mSourceAudioFile);
+	RBAssertNoErr(status, CFSTR("AudioFileOpenWithCallbacks failed with error code %ld."), status);
+	
+	status = ExtAudioFileWrapAudioFileID(mSourceAudioFile, false, &mAudioFile);
+	RBAssertNoErr(status, CFSTR("ExtAudioFileWrapAudioFileID failed with error code %ld."), status);
+	
+	this->SetUpAudioFile();
+}
+
+void PKCoreAudioDecoder::SetUpAudioFile() throw(RBException)
+{
 	AudioStreamBasicDescription fileDataFormat;
 	UInt32 dataSize = sizeof(fileDataFormat);
-	status = ExtAudioFileGetProperty(mAudioFile, kExtAudioFileProperty_FileDataFormat, &dataSize, &fileDataFormat);
+	OSStatus status = ExtAudioFileGetProperty(mAudioFile, kExtAudioFileProperty_FileDataFormat, &dataSize, &fileDataFormat);
 	RBAssertNoErr(status, CFSTR("ExtAudioFileGetProperty(kExtAudioFileProperty_FileDataFormat) failed with error code %ld."), status);
 	
 	CAStreamBasicDescription format;
@@ -46,6 +93,19 @@ PKCoreAudioDecoder::~PKCoreAudioDecoder()
 		mAudioFile = NULL;
 	}
 	
+	//The wrapping extended audio file doesn't close the audio file it reads from.
+	if(mSourceAudioFile)
+	{
+		AudioFileClose(mSourceAudioFile);
+		mSourceAudioFile = NULL;
+	}
+	
+	if(mSource)
+	{
+		mSource->Release();
+		mSource = NULL;
+	}
+	
 	if(mFileLocation)
 	{
 		CFRelease(mFileLocation);
@@ -63,7 +123,7 @@ AudioStreamBasicDescription PKCoreAudioDecoder::GetStreamFormat() const
 
 CFURLRef PKCoreAudioDecoder::CopyLocation() const
 {
-	return CFURLRef(CFRetain(mFileLocation));
+	return mFileLocation? CFURLRef(CFRetain(mFileLocation)) : NULL;
 }
 
 #pragma mark -
@@ -82,7 +142,7 @@ PKDecoder::FrameLocation PKCoreAudioDecoder::GetTotalNumberOfFrames() const
 
 bool PKCoreAudioDecoder::CanSeek() const
 {
-	return true;
+	return mSource? mSource->CanSeek() : true;
 }
 
 PKDecoder::FrameLocation PKCoreAudioDecoder::GetCurrentFrame() const
@@ -99,6 +159,31 @@ void PKCoreAudioDecoder::SetCurrentFrame(PKDecoder::FrameLocation currentFrame)
 	}
 }
 
+#pragma mark -
+#pragma mark Byte Sources
+
+OSStatus PKCoreAudioDecoder::SourceRead(void *info, SInt64 position, UInt32 requestCount, void *buffer, UInt32 *actualCount)
+{
+	PKCoreAudioDecoder *self = (PKCoreAudioDecoder *)info;
+	try
+	{
+		*actualCount = UInt32(self->mSource->ReadAtOffset(buffer, requestCount, UInt64(position)));
+	}
+	catch (RBException e)
+	{
+		*actualCount = 0;
+		return kAudioFilePositionError;
+	}
+	
+	return noErr;
+}
+
+SInt64 PKCoreAudioDecoder::SourceGetSize(void *info)
+{
+	PKCoreAudioDecoder *self = (PKCoreAudioDecoder *)info;
+	return SInt64(self->mSource->GetLength());
+}
+
 #pragma mark -
 #pragma mark Decoding
 
@@ -126,6 +211,91 @@ static bool CanDecode(CFURLRef fileLocation)
 	return false;
 }
 
+//Returns a lowercased copy of a path extension. The result must be released by the caller.
+static CFStringRef CopyLowercaseExtension(CFStringRef extension)
+{
+	CFMutableStringRef lowercaseExtension = CFStringCreateMutableCopy(kCFAllocatorDefault, 0, extension);
+	CFStringLowercase(lowercaseExtension, NULL);
+	
+	return lowercaseExtension;
+}
+
+//Returns the set of lowercased path extensions Core Audio recognizes.
+static CFSetRef GetKnownExtensions()
+{
+	static CFSetRef knownExtensions = NULL;
+	static dispatch_once_t predicate = 0;
+	dispatch_once(&predicate, ^{
+		CFMutableSetRef extensions = CFSetCreateMutable(kCFAllocatorDefault, 0, &kCFTypeSetCallBacks);
+		
+		CFArrayRef allExtensions = NULL;
+		UInt32 size = sizeof(CFArrayRef);
+		if((AudioFileGetGlobalInfo(kAudioFileGlobalInfo_AllExtensions, 0, NULL, &size, &allExtensions) == noErr) && allExtensions)
+		{
+			for (CFIndex index = 0, count = CFArrayGetCount(allExtensions); index < count; index++)
+			{
+				CFStringRef extension = CopyLowercaseExtension(CFStringRef(CFArrayGetValueAtIndex(allExtensions, index)));
+				CFSetAddValue(extensions, extension);
+				CFRelease(extension);
+			}
+			
+			CFRelease(allExtensions);
+		}
+		
+		knownExtensions = extensions;
+	});
+	
+	return knownExtensions;
+}
+
+//Returns whether or not a header starts like one of the common formats Core Audio reads.
+static bool HasKnownSignature(const UInt8 *header, UInt32 headerLength)
+{
+	if(headerLength < 12)
+		return false;
+	
+	//MPEG audio, with or without an ID3v2 tag, and AAC in ADTS.
+	if((memcmp(header, "ID3", 3) == 0) || ((header[0] == 0xFF) && ((header[1] & 0xE0) == 0xE0)))
+		return true;
+	
+	//MPEG-4 and 3GPP.
+	if(memcmp(header + 4, "ftyp", 4) == 0)
+		return true;
+	
+	const char *signatures[] = { "FORM", "RIFF", "caff", "#!AMR", ".snd", "ADIF" };
+	for (size_t index = 0; index < (sizeof(signatures) / sizeof(signatures[0])); index++)
+	{
+		if(memcmp(header, signatures[index], strlen(signatures[index])) == 0)
+			return true;
+	}
+	
+	return false;
+}
+
+static PKDecoder::ProbeResult Probe(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension)
+{
+	bool hasKnownExtension = false;
+	if(pathExtension)
+	{
+		CFStringRef lowercaseExtension = CopyLowercaseExtension(pathExtension);
+		hasKnownExtension = CFSetContainsValue(GetKnownExtensions(), lowercaseExtension);
+		CFRelease(lowercaseExtension);
+	}
+	
+	//
+	//	Opening a file with Audio File Services is expensive, so it is only done when the
+	//	extension and contents disagree. Core Audio will sniff the contents of a file with
+	//	an unknown extension, which is why a known signature alone is still worth asking about.
+	//
+	bool hasKnownSignature = HasKnownSignature(header, headerLength);
+	if(hasKnownExtension && hasKnownSignature)
+		return PKDecoder::kProbeResultYes;
+	else if(hasKnownExtension || hasKnownSignature)
+		return PKDecoder::kProbeResultMaybe;
+	
+	return PKDecoder::kProbeResultNo;
+}
+
 static CFArrayRef CopySupportedTypes()
 {
 	CFArrayRef types = NULL;
@@ -141,4 +311,9 @@ static PKDecoder *CreateInstance(CFURLRef fileLocation) throw(RBException)
 	return new PKCoreAudioDecoder(fileLocation);
 }
 
-PKDecoder::Description PKCoreAudioDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance };
+static PKDecoder *CreateInstanceWithByteSource(PKByteSource *source) throw(RBException)
+{
+	return new PKCoreAudioDecoder(source);
+}
+
+PKDecoder::Description PKCoreAudioDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance, &Probe, &CreateInstanceWithByteSource };
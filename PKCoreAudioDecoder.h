@@ -11,6 +11,7 @@
 #define PKCoreAudioDecoder_h 1
 
 #include "PKDecoder.h"
+#include "PKByteSource.h"
 
 class PK_VISIBILITY_HIDDEN PKCoreAudioDecoder : public PKDecoder
 {
@@ -21,10 +22,30 @@ protected:
 	AudioStreamBasicDescription mAudioStreamDescription;
 	CFURLRef mFileLocation;
 	
+	//Byte sources
+	PKByteSource *mSource;
+	AudioFileID mSourceAudioFile;
+	
+	/*!
+	 @abstract	Set up the client data format of the receiver's audio file once it has been opened.
+	 */
+	void SetUpAudioFile() throw(RBException);
+	
+	/*!
+	 @abstract	The callbacks Audio File Services reads a byte source through.
+	 */
+	static OSStatus SourceRead(void *info, SInt64 position, UInt32 requestCount, void *buffer, UInt32 *actualCount);
+	static SInt64 SourceGetSize(void *info);
+	
 public:
 #pragma mark Lifetime
 	
 	explicit PKCoreAudioDecoder(CFURLRef location);
+	
+	/*!
+	 @abstract	Construct a decoder reading from a byte source through Audio File Services.
+	 */
+	explicit PKCoreAudioDecoder(PKByteSource *source) throw(RBException);
 	virtual ~PKCoreAudioDecoder();
 	
 #pragma mark -
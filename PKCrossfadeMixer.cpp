@@ -0,0 +1,145 @@
+/*
+ *  PKCrossfadeMixer.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKCrossfadeMixer.h"
+#include <Accelerate/Accelerate.h>
+
+#include "CAAudioBufferList.h"
+#include "CAStreamBasicDescription.h"
+
+#pragma mark Lifecycle
+
+PKCrossfadeMixer::PKCrossfadeMixer(const AudioStreamBasicDescription &streamFormat, UInt32 maximumNumberOfFramesPerMix, Curve curve, UInt64 numberOfFramesInFade) throw(RBException) :
+	RBObject("PKCrossfadeMixer"),
+	mCurve(curve),
+	mNumberOfFramesInFade(numberOfFramesInFade),
+	mPosition(0),
+	mMaximumNumberOfFramesPerMix(maximumNumberOfFramesPerMix),
+	mIncomingBuffers(NULL),
+	mIncomingBuffersWindow(NULL),
+	mFadeInGains(NULL),
+	mFadeOutGains(NULL)
+{
+	RBParameterAssert(PKStreamFormatIsCanonical(streamFormat));
+	RBParameterAssert(maximumNumberOfFramesPerMix > 0);
+	
+	//A crossfade that has already run out just hands over to the incoming song.
+	if(mNumberOfFramesInFade == 0)
+		mNumberOfFramesInFade = 1;
+	
+	UInt32 bufferSize = mMaximumNumberOfFramesPerMix * sizeof(Float32);
+	
+	mIncomingBuffers = CAAudioBufferList::Create(streamFormat.mChannelsPerFrame);
+	mIncomingBuffersWindow = CAAudioBufferList::Create(streamFormat.mChannelsPerFrame);
+	for (UInt32 index = 0; index < mIncomingBuffers->mNumberBuffers; index++)
+	{
+		mIncomingBuffers->mBuffers[index].mNumberChannels = 1;
+		mIncomingBuffers->mBuffers[index].mDataByteSize = bufferSize;
+		mIncomingBuffers->mBuffers[index].mData = calloc(mMaximumNumberOfFramesPerMix, sizeof(Float32));
+		RBAssert((mIncomingBuffers->mBuffers[index].mData != NULL), CFSTR("Could not allocate crossfade buffer of %ld frames."), mMaximumNumberOfFramesPerMix);
+		
+		mIncomingBuffersWindow->mBuffers[index] = mIncomingBuffers->mBuffers[index];
+	}
+	
+	mFadeInGains = (Float32 *)calloc(mMaximumNumberOfFramesPerMix, sizeof(Float32));
+	mFadeOutGains = (Float32 *)calloc(mMaximumNumberOfFramesPerMix, sizeof(Float32));
+	RBAssert((mFadeInGains != NULL) && (mFadeOutGains != NULL), CFSTR("Could not allocate crossfade gains of %ld frames."), mMaximumNumberOfFramesPerMix);
+}
+
+PKCrossfadeMixer::~PKCrossfadeMixer()
+{
+	if(mIncomingBuffers)
+	{
+		for (UInt32 index = 0; index < mIncomingBuffers->mNumberBuffers; index++)
+			free(mIncomingBuffers->mBuffers[index].mData);
+		
+		CAAudioBufferList::Destroy(mIncomingBuffers);
+		mIncomingBuffers = NULL;
+	}
+	
+	if(mIncomingBuffersWindow)
+	{
+		CAAudioBufferList::Destroy(mIncomingBuffersWindow);
+		mIncomingBuffersWindow = NULL;
+	}
+	
+	if(mFadeInGains)
+	{
+		free(mFadeInGains);
+		mFadeInGains = NULL;
+	}
+	
+	if(mFadeOutGains)
+	{
+		free(mFadeOutGains);
+		mFadeOutGains = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Mixing
+
+AudioBufferList *PKCrossfadeMixer::GetIncomingBuffers(UInt32 frameOffset, UInt32 numberOfFrames) throw()
+{
+	for (UInt32 index = 0; index < mIncomingBuffers->mNumberBuffers; index++)
+	{
+		Float32 *samples = (Float32 *)(mIncomingBuffers->mBuffers[index].mData);
+		if(frameOffset == 0)
+			vDSP_vclr(samples, 1, mMaximumNumberOfFramesPerMix);
+		
+		mIncomingBuffersWindow->mBuffers[index].mData = samples + frameOffset;
+		mIncomingBuffersWindow->mBuffers[index].mDataByteSize = numberOfFrames * sizeof(Float32);
+	}
+	
+	return mIncomingBuffersWindow;
+}
+
+void PKCrossfadeMixer::Mix(AudioBufferList *ioBuffers, UInt32 frameOffset, UInt32 numberOfFrames) throw()
+{
+	if(numberOfFrames > mMaximumNumberOfFramesPerMix)
+		numberOfFrames = mMaximumNumberOfFramesPerMix;
+	
+	//
+	//	The fade in gain ramps from 0 to 1 over the crossfade, and is pinned at 1
+	//	once the crossfade is over. Both gains are derived from it.
+	//
+	Float32 zero = 0.0f, one = 1.0f;
+	Float32 start = Float32(Float64(mPosition) / mNumberOfFramesInFade);
+	Float32 step = Float32(1.0 / mNumberOfFramesInFade);
+	vDSP_vramp(&start, &step, mFadeInGains, 1, numberOfFrames);
+	vDSP_vclip(mFadeInGains, 1, &zero, &one, mFadeInGains, 1, numberOfFrames);
+	
+	if(mCurve == kCurveEqualPower)
+	{
+		Float32 halfPi = Float32(M_PI / 2.0);
+		int count = int(numberOfFrames);
+		vDSP_vsmul(mFadeInGains, 1, &halfPi, mFadeInGains, 1, numberOfFrames);
+		vvcosf(mFadeOutGains, mFadeInGains, &count);
+		vvsinf(mFadeInGains, mFadeInGains, &count);
+	}
+	else
+	{
+		Float32 minusOne = -1.0f;
+		vDSP_vsmsa(mFadeInGains, 1, &minusOne, &one, mFadeOutGains, 1, numberOfFrames);
+	}
+	
+	UInt32 numberOfBuffers = ioBuffers->mNumberBuffers;
+	if(numberOfBuffers > mIncomingBuffers->mNumberBuffers)
+		numberOfBuffers = mIncomingBuffers->mNumberBuffers;
+	
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+	{
+		Float32 *outgoing = (Float32 *)(ioBuffers->mBuffers[index].mData) + frameOffset;
+		const Float32 *incoming = (const Float32 *)(mIncomingBuffers->mBuffers[index].mData);
+		
+		vDSP_vmma(outgoing, 1, mFadeOutGains, 1, incoming, 1, mFadeInGains, 1, outgoing, 1, numberOfFrames);
+	}
+	
+	mPosition += numberOfFrames;
+}
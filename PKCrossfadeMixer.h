@@ -0,0 +1,121 @@
+/*
+ *  PKCrossfadeMixer.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKCrossfadeMixer_h
+#define PKCrossfadeMixer_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <AudioToolbox/AudioToolbox.h>
+
+#include "RBObject.h"
+#include "RBException.h"
+
+/*!
+ @class
+ @abstract		The PKCrossfadeMixer class mixes the audio of a song fading in into the audio of a song fading out.
+ @discussion	A mixer is created for a single crossfade, and keeps track of how far into the crossfade it is
+				so that consecutive mixes line up sample for sample. Both songs must be in the same canonical
+				non-interleaved Float32 format. All of the mixer's storage is allocated up front, and mixing is
+				done with vDSP, so mixing never locks or allocates.
+ */
+class PK_VISIBILITY_HIDDEN PKCrossfadeMixer : public RBObject
+{
+public:
+	/*!
+	 @enum
+	 @abstract	The curves the volume of the two songs can follow over the course of a crossfade.
+	 */
+	enum Curve {
+		/*!
+		 @abstract	The volume of each song changes linearly. The combined loudness dips in the middle.
+		 */
+		kCurveLinear = 0,
+		
+		/*!
+		 @abstract	The volume of each song follows a quarter sine wave, which keeps the combined power constant.
+		 */
+		kCurveEqualPower = 1,
+	};
+
+protected:
+	
+	/* n/a */	Curve mCurve;
+	/* n/a */	UInt64 mNumberOfFramesInFade;
+	/* n/a */	UInt64 mPosition;
+	/* n/a */	UInt32 mMaximumNumberOfFramesPerMix;
+	
+	/* owner */	AudioBufferList *mIncomingBuffers;
+	/* owner */	AudioBufferList *mIncomingBuffersWindow;
+	/* owner */	Float32 *mFadeInGains;
+	/* owner */	Float32 *mFadeOutGains;
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a crossfade mixer.
+	 @param		streamFormat				The format of both songs. Must be canonical and non-interleaved.
+	 @param		maximumNumberOfFramesPerMix	The largest number of frames that will be mixed at once.
+	 @param		curve						The curve the volume of the two songs follows.
+	 @param		numberOfFramesInFade		The length of the crossfade in frames.
+	 */
+	explicit PKCrossfadeMixer(const AudioStreamBasicDescription &streamFormat, UInt32 maximumNumberOfFramesPerMix, Curve curve, UInt64 numberOfFramesInFade) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the mixer.
+	 */
+	virtual ~PKCrossfadeMixer();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	/*!
+	 @abstract	Returns the largest number of frames the receiver can mix at once.
+	 */
+	UInt32 GetMaximumNumberOfFramesPerMix() const throw() { return mMaximumNumberOfFramesPerMix; }
+	
+	/*!
+	 @abstract	Returns the number of frames of the crossfade that have been mixed so far.
+	 */
+	UInt64 GetPosition() const throw() { return mPosition; }
+	
+	/*!
+	 @abstract	Returns the length of the crossfade in frames.
+	 */
+	UInt64 GetNumberOfFramesInFade() const throw() { return mNumberOfFramesInFade; }
+	
+#pragma mark -
+#pragma mark Mixing
+	
+	/*!
+	 @abstract		Returns silent buffers for the incoming song's audio to be decoded into.
+	 @param			frameOffset		The offset in frames into the buffers of the first frame to decode.
+	 @param			numberOfFrames	The number of frames to decode. frameOffset + numberOfFrames must not exceed
+									the receiver's maximum number of frames per mix.
+	 @discussion	The buffers are silenced when frameOffset is 0, so audio the incoming song does not
+					provide is mixed as silence.
+	 */
+	AudioBufferList *GetIncomingBuffers(UInt32 frameOffset, UInt32 numberOfFrames) throw();
+	
+	/*!
+	 @abstract		Mix the audio decoded into the incoming buffers into the outgoing song's audio.
+	 @param			ioBuffers		The outgoing song's audio. The mix is written back into these buffers.
+	 @param			frameOffset		The offset in frames into ioBuffers of the first frame to mix.
+	 @param			numberOfFrames	The number of frames to mix. Must not exceed the receiver's maximum number of frames per mix.
+	 @discussion	This advances the receiver's position in the crossfade by numberOfFrames.
+	 */
+	void Mix(AudioBufferList *ioBuffers, UInt32 frameOffset, UInt32 numberOfFrames) throw();
+
+private:
+	PKCrossfadeMixer(PKCrossfadeMixer &mixer);
+	PKCrossfadeMixer &operator=(PKCrossfadeMixer &mixer);
+};
+
+#endif /* PKCrossfadeMixer_h */
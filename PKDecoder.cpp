@@ -8,8 +8,19 @@
  */
 
 #include "PKDecoder.h"
+#include "PKDecoderCache.h"
+#include "PKByteSource.h"
+#include "PKTaskExecutor.h"
 #include <dispatch/dispatch.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "PKCoreAudioDecoder.h"
+#include "PKFLACDecoder.h"
+#include "PKPCMDecoder.h"
+#include "PKVorbisDecoder.h"
+#include "PKOpusDecoder.h"
+#include "PKParallelDecoder.h"
 
 #pragma mark PKDecoder
 
@@ -18,44 +29,254 @@
 static std::vector<PKDecoder::Description> &RegisteredDecoders()
 {
 	static std::vector<PKDecoder::Description> *registeredDecoders = NULL;
-	if(!registeredDecoders)
-	{
+	static dispatch_once_t predicate = 0;
+	dispatch_once(&predicate, ^{
 		registeredDecoders = new std::vector<PKDecoder::Description>();
+		
+		//Native decoders are consulted before falling back on Core Audio.
+		registeredDecoders->push_back(PKFLACDecoderDescription);
+		registeredDecoders->push_back(PKPCMDecoderDescription);
+#if PK_ENABLE_OGG
+		registeredDecoders->push_back(PKVorbisDecoderDescription);
+		registeredDecoders->push_back(PKOpusDecoderDescription);
+#endif /* PK_ENABLE_OGG */
 		registeredDecoders->push_back(PKCoreAudioDecoderDescription);
-	}
+	});
 	
 	return *registeredDecoders;
 }
 
-void PKDecoder::RegisterDecoder(const Description &decoderDescription)
+//Reads up to kProbeHeaderSize bytes from the start of the file at a specified location, returning the number of bytes read.
+static UInt32 ReadProbeHeader(CFURLRef location, UInt8 *header)
 {
-	RegisteredDecoders().push_back(decoderDescription);
+	char path[PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(location, true, (UInt8 *)path, sizeof(path)))
+		return 0;
+	
+	int fileDescriptor = open(path, O_RDONLY);
+	if(fileDescriptor == -1)
+		return 0;
+	
+	ssize_t amountRead = read(fileDescriptor, header, PKDecoder::kProbeHeaderSize);
+	close(fileDescriptor);
+	
+	return (amountRead > 0)? UInt32(amountRead) : 0;
 }
 
-PKDecoder *PKDecoder::DecoderForURL(CFURLRef location) throw(RBException)
+//Finds the first registered decoder that can decode a file at a specified location.
+static bool FindDecoderForURL(CFURLRef location, PKDecoder::Description &outDecoder)
 {
+	//
+	//	The start of the file is read once and shown to each decoder's Probe function, so only
+	//	the decoders that can't tell from it alone have to open the file through CanDecode.
+	//
+	UInt8 header[PKDecoder::kProbeHeaderSize];
+	UInt32 headerLength = ReadProbeHeader(location, header);
+	CFStringRef pathExtension = CFURLCopyPathExtension(location);
+	
+	bool foundDecoder = false;
 	std::vector<PKDecoder::Description> &decoders = RegisteredDecoders();
 	for (std::vector<PKDecoder::Description>::const_iterator it = decoders.begin(); it != decoders.end(); it++)
 	{
 		PKDecoder::Description decoder = *it;
-		if(decoder.CanDecode(location))
-			return decoder.CreateInstance(location);
+		
+		PKDecoder::ProbeResult result = PKDecoder::kProbeResultMaybe;
+		if(decoder.Probe && (headerLength > 0))
+			result = decoder.Probe(header, headerLength, pathExtension);
+		
+		if((result == PKDecoder::kProbeResultYes) || ((result == PKDecoder::kProbeResultMaybe) && decoder.CanDecode(location)))
+		{
+			outDecoder = decoder;
+			foundDecoder = true;
+			break;
+		}
 	}
 	
-	return NULL;
+	if(pathExtension)
+		CFRelease(pathExtension);
+	
+	return foundDecoder;
 }
 
-bool PKDecoder::CanDecodeURL(CFURLRef location) throw(RBException)
+//Finds the record for a file in the shared cache, probing the file and caching what was found if there isn't one.
+static PKDecoderCache::Record GetRecordForURL(CFURLRef location, PKDecoderCache::FileIdentity &identity, bool hasIdentity)
 {
-	std::vector<PKDecoder::Description> &decoders = RegisteredDecoders();
-	for (std::vector<PKDecoder::Description>::const_iterator it = decoders.begin(); it != decoders.end(); it++)
+	PKDecoderCache::Record record;
+	if(hasIdentity && PKDecoderCache::SharedCache()->FindRecord(identity, record))
+		return record;
+	
+	memset(&record, 0, sizeof(record));
+	record.canDecode = FindDecoderForURL(location, record.decoder);
+	
+	if(hasIdentity)
+		PKDecoderCache::SharedCache()->SetRecord(identity, record);
+	
+	return record;
+}
+
+void PKDecoder::RegisterDecoder(const Description &decoderDescription)
+{
+	RegisteredDecoders().push_back(decoderDescription);
+	
+	//Files nothing could decode before may be decodable now.
+	PKDecoderCache::SharedCache()->RemoveAllRecords();
+}
+
+PKDecoder *PKDecoder::DecoderForURL(CFURLRef location) throw(RBException)
+{
+	PKDecoderCache::FileIdentity identity;
+	bool hasIdentity = PKDecoderCache::GetFileIdentity(location, identity);
+	
+	PKDecoderCache::Record record = GetRecordForURL(location, identity, hasIdentity);
+	if(!record.canDecode)
+		return NULL;
+	
+	PKDecoder *decoder = NULL;
+	try
 	{
-		PKDecoder::Description decoder = *it;
-		if(decoder.CanDecode(location))
-			return true;
+		decoder = record.decoder.CreateInstance(location);
+	}
+	catch (RBException e)
+	{
+		//Matching a decoder doesn't guarantee the file isn't damaged. Don't keep claiming it can be decoded.
+		if(hasIdentity)
+			PKDecoderCache::SharedCache()->RemoveRecord(identity);
+		
+		throw;
 	}
 	
-	return false;
+	if(hasIdentity && !record.hasStreamInfo)
+	{
+		record.hasStreamInfo = true;
+		record.streamFormat = decoder->GetStreamFormat();
+		record.totalNumberOfFrames = decoder->GetTotalNumberOfFrames();
+		PKDecoderCache::SharedCache()->SetRecord(identity, record);
+	}
+	
+	//A single processor has no one to share the work with.
+	if(PKParallelDecoder::IsEnabled() && (sysconf(_SC_NPROCESSORS_ONLN) > 1) && decoder->CanDecodeInParallel())
+	{
+		try
+		{
+			PKDecoder *parallelDecoder = new PKParallelDecoder(decoder, record.decoder);
+			decoder->Release();
+			decoder = parallelDecoder;
+		}
+		catch (RBException e)
+		{
+			//The decoder still works on its own, just on one thread.
+		}
+	}
+	
+	return decoder;
+}
+
+PKDecoder *PKDecoder::DecoderForByteSource(PKByteSource *source) throw(RBException)
+{
+	RBParameterAssert(source);
+	
+	UInt8 header[kProbeHeaderSize];
+	UInt32 headerLength = UInt32(source->ReadAtOffset(header, kProbeHeaderSize, 0));
+	CFStringRef pathExtension = source->CopyPathExtension();
+	
+	PKDecoder *decoder = NULL;
+	try
+	{
+		std::vector<PKDecoder::Description> &decoders = RegisteredDecoders();
+		for (std::vector<PKDecoder::Description>::const_iterator it = decoders.begin(); (it != decoders.end()) && !decoder; it++)
+		{
+			if(!it->CreateInstanceWithByteSource)
+				continue;
+			
+			ProbeResult result = kProbeResultMaybe;
+			if(it->Probe && (headerLength > 0))
+				result = it->Probe(header, headerLength, pathExtension);
+			
+			if(result == kProbeResultNo)
+				continue;
+			
+			source->SetOffset(0);
+			
+			//There's no CanDecode for a byte source, so a decoder that isn't sure is simply tried.
+			if(result == kProbeResultMaybe)
+			{
+				try
+				{
+					decoder = it->CreateInstanceWithByteSource(source);
+				}
+				catch (RBException e)
+				{
+					decoder = NULL;
+				}
+			}
+			else
+			{
+				decoder = it->CreateInstanceWithByteSource(source);
+			}
+		}
+	}
+	catch (RBException e)
+	{
+		if(pathExtension)
+			CFRelease(pathExtension);
+		
+		throw;
+	}
+	
+	if(pathExtension)
+		CFRelease(pathExtension);
+	
+	return decoder;
+}
+
+bool PKDecoder::CanDecodeURL(CFURLRef location) throw(RBException)
+{
+	PKDecoderCache::FileIdentity identity;
+	bool hasIdentity = PKDecoderCache::GetFileIdentity(location, identity);
+	
+	return GetRecordForURL(location, identity, hasIdentity).canDecode;
+}
+
+void PKDecoder::CanDecodeURLs(CFArrayRef locations, bool *outResults) throw(RBException)
+{
+	RBParameterAssert(locations);
+	RBParameterAssert(outResults);
+	
+	//Probing is mostly waiting on the disk, so each file gets its own iteration.
+	PKTaskExecutor::SharedExecutor()->Apply(CFArrayGetCount(locations), PKTaskExecutor::kLaneNormal, ^(size_t index) {
+		try
+		{
+			outResults[index] = PKDecoder::CanDecodeURL(CFURLRef(CFArrayGetValueAtIndex(locations, index)));
+		}
+		catch (RBException e)
+		{
+			outResults[index] = false;
+		}
+	});
+}
+
+bool PKDecoder::GetCachedStreamInfo(CFURLRef location, AudioStreamBasicDescription *outStreamFormat, UInt64 *outTotalNumberOfFrames) throw()
+{
+	PKDecoderCache::FileIdentity identity;
+	if(!PKDecoderCache::GetFileIdentity(location, identity))
+		return false;
+	
+	PKDecoderCache::Record record;
+	if(!PKDecoderCache::SharedCache()->FindRecord(identity, record) || !record.hasStreamInfo)
+		return false;
+	
+	if(outStreamFormat)
+		*outStreamFormat = record.streamFormat;
+	
+	if(outTotalNumberOfFrames)
+		*outTotalNumberOfFrames = record.totalNumberOfFrames;
+	
+	return true;
+}
+
+std::vector<PKDecoder::Description> PKDecoder::GetRegisteredDecoders()
+{
+	return RegisteredDecoders();
 }
 
 #pragma mark -
@@ -71,3 +292,11 @@ PKDecoder::~PKDecoder()
 {
 	
 }
+
+#pragma mark -
+#pragma mark Attributes
+
+bool PKDecoder::CanDecodeInParallel() const
+{
+	return false;
+}
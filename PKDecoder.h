@@ -16,6 +16,8 @@
 #ifndef PKDecoder_h
 #define PKDecoder_h 1
 
+class PKByteSource;
+
 /*!
  @abstract	The PKDecoder class encapsulates the decoder class cluster in PlayerKit
 			by providing a base interface and a class collection.
@@ -26,6 +28,34 @@ class PK_VISIBILITY_PUBLIC PKDecoder : public RBObject
 	
 public:
 	
+	/*!
+	 @enum
+	 @abstract	The answers a decoder can give when shown the start of a file.
+	 */
+	enum ProbeResult {
+		/*!
+		 @abstract	The decoder cannot decode the file.
+		 */
+		kProbeResultNo = 0,
+		
+		/*!
+		 @abstract	The decoder cannot tell from the start of the file alone, and has to be asked through CanDecode.
+		 */
+		kProbeResultMaybe,
+		
+		/*!
+		 @abstract	The decoder can decode the file.
+		 */
+		kProbeResultYes,
+	};
+	
+	enum {
+		/*!
+		 @abstract	The largest number of bytes from the start of a file that are given to a decoder's Probe function.
+		 */
+		kProbeHeaderSize = 4096,
+	};
+	
 	struct Description
 	{
 		/*!
@@ -42,6 +72,21 @@ public:
 		 @abstract	A function pointer that returns a new instance of a decoder, or throws an RBException instance if the decoder cannot be created.
 		 */
 		PKDecoder *(*CreateInstance)(CFURLRef fileLocation) throw(RBException);
+		
+		/*!
+		 @abstract		An optional function pointer that decides whether or not a decoder can decode a file from the start of the file and its path extension.
+		 @discussion	`header` holds up to kProbeHeaderSize bytes read from the start of the file, and `pathExtension`
+						may be NULL. The header is read once and shown to every registered decoder, so a decoder that
+						can answer from it avoids opening the file itself. Decoders without a Probe function are always
+						asked through CanDecode.
+		 */
+		ProbeResult (*Probe)(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension);
+		
+		/*!
+		 @abstract		An optional function pointer that returns a new instance of a decoder reading from a byte source, or throws an RBException instance if the decoder cannot be created.
+		 @discussion	The source is positioned at its start, and is retained by the decoder. Decoders without this function cannot decode byte sources.
+		 */
+		PKDecoder *(*CreateInstanceWithByteSource)(PKByteSource *source) throw(RBException);
 	};
 	
 	/*!
@@ -56,6 +101,15 @@ public:
 	 */
 	static PKDecoder *DecoderForURL(CFURLRef location) throw(RBException);
 	
+	/*!
+	 @abstract		Returns a decoder that can decode a specified byte source.
+	 @param			source	The byte source to find a decoder for. Required.
+	 @result		A decoder reading from `source` if one can be found; NULL otherwise.
+	 @discussion	The start of the source is shown to the Probe function of each decoder that can decode byte sources.
+					Decoders that cannot tell from it alone are tried in turn until one can be created.
+	 */
+	static PKDecoder *DecoderForByteSource(PKByteSource *source) throw(RBException);
+	
 	/*!
 	 @abstract	Returns a Bool indicating whether or not a specified file can be decoded.
 	 @param		location	The location of the file to find a decoder for. Optional.
@@ -63,6 +117,27 @@ public:
 	 */
 	static bool CanDecodeURL(CFURLRef location) throw(RBException);
 	
+	/*!
+	 @abstract		Determines whether or not each of a collection of files can be decoded.
+	 @param			locations	A CFArray of CFURLs to the files to check. Required.
+	 @param			outResults	On return, whether or not the file at the same index in `locations` can be decoded. Must have room for a result for every location. Required.
+	 @discussion	Files are probed concurrently on the shared executor's normal lane. Decoders must not be registered while this is in progress.
+	 */
+	static void CanDecodeURLs(CFArrayRef locations, bool *outResults) throw(RBException);
+	
+	/*!
+	 @abstract		Look up the stream format and length of a file the cluster has created a decoder for before, without opening it.
+	 @result		true if the file is in the cluster's cache and hasn't changed since; false otherwise.
+	 @discussion	The cluster remembers which decoder matched each of the files most recently passed to DecoderForURL,
+					CanDecodeURL and CanDecodeURLs, so asking about the same file again does not probe it again.
+	 */
+	static bool GetCachedStreamInfo(CFURLRef location, AudioStreamBasicDescription *outStreamFormat, UInt64 *outTotalNumberOfFrames) throw();
+	
+	/*!
+	 @abstract	Returns the descriptions of every decoder registered in the PKDecoder cluster, in the order they are consulted.
+	 */
+	static std::vector<Description> GetRegisteredDecoders();
+	
 #pragma mark -
 #pragma mark Types
 	
@@ -95,7 +170,7 @@ public:
 	virtual AudioStreamBasicDescription GetStreamFormat() const PK_PURE_VIRTUAL;
 	
 	/*!
-	 @abstract	Returns a copy of the decoder's location.
+	 @abstract	Returns a copy of the decoder's location, or NULL if the decoder is reading a byte source that isn't a file.
 	 */
 	virtual CFURLRef CopyLocation() const PK_PURE_VIRTUAL;
 	
@@ -123,6 +198,13 @@ public:
 	 */
 	virtual void SetCurrentFrame(FrameLocation currentFrame) PK_PURE_VIRTUAL;
 	
+	/*!
+	 @abstract		Returns whether or not other instances of the decoder's class can decode separate parts of its file at the same time.
+	 @discussion	Decoders that return true must have a location that the CreateInstance function of their description
+					opens, and must be able to seek to any frame exactly and cheaply. The default implementation returns false.
+	 */
+	virtual bool CanDecodeInParallel() const;
+	
 #pragma mark -
 #pragma mark Decoding
 	
@@ -0,0 +1,193 @@
+/*
+ *  PKDecoderCache.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKDecoderCache.h"
+#include <dispatch/dispatch.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#pragma mark Lifecycle
+
+PKDecoderCache *PKDecoderCache::SharedCache() throw()
+{
+	static PKDecoderCache *sharedCache = NULL;
+	static dispatch_once_t predicate = 0;
+	dispatch_once(&predicate, ^{
+		sharedCache = new PKDecoderCache(kDefaultCapacity);
+	});
+	
+	return sharedCache;
+}
+
+PKDecoderCache::PKDecoderCache(UInt32 capacity) throw(RBException) :
+	RBLockableObject("PKDecoderCache"),
+	mRecords(),
+	mRecordsByPath(),
+	mCapacity(capacity),
+	mNumberOfHits(0),
+	mNumberOfMisses(0),
+	mNumberOfEvictions(0)
+{
+}
+
+PKDecoderCache::~PKDecoderCache()
+{
+}
+
+#pragma mark -
+#pragma mark Identity
+
+bool PKDecoderCache::GetFileIdentity(CFURLRef location, FileIdentity &outIdentity) throw()
+{
+	if(!location)
+		return false;
+	
+	char path[PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(location, true, (UInt8 *)path, sizeof(path)))
+		return false;
+	
+	struct stat fileInfo;
+	if(stat(path, &fileInfo) != 0)
+		return false;
+	
+	outIdentity.path = path;
+	outIdentity.size = UInt64(fileInfo.st_size);
+	outIdentity.modificationTime = (SInt64(fileInfo.st_mtimespec.tv_sec) * 1000000000LL) + fileInfo.st_mtimespec.tv_nsec;
+	
+	return true;
+}
+
+#pragma mark -
+#pragma mark Records
+
+void PKDecoderCache::EvictRecordsOverCapacity() throw()
+{
+	while (mRecords.size() > mCapacity)
+	{
+		mRecordsByPath.erase(mRecords.back().identity.path);
+		mRecords.pop_back();
+		mNumberOfEvictions++;
+	}
+}
+
+bool PKDecoderCache::FindRecord(const FileIdentity &identity, Record &outRecord) throw()
+{
+	Acquisitor lock(this);
+	
+	std::map<std::string, RecordList::iterator>::iterator position = mRecordsByPath.find(identity.path);
+	if(position == mRecordsByPath.end())
+	{
+		mNumberOfMisses++;
+		return false;
+	}
+	
+	RecordList::iterator cachedRecord = position->second;
+	if((cachedRecord->identity.size != identity.size) || (cachedRecord->identity.modificationTime != identity.modificationTime))
+	{
+		//The file has changed since we looked at it.
+		mRecords.erase(cachedRecord);
+		mRecordsByPath.erase(position);
+		mNumberOfMisses++;
+		
+		return false;
+	}
+	
+	//The most recently used record is kept at the front.
+	mRecords.splice(mRecords.begin(), mRecords, cachedRecord);
+	outRecord = cachedRecord->record;
+	mNumberOfHits++;
+	
+	return true;
+}
+
+void PKDecoderCache::SetRecord(const FileIdentity &identity, const Record &record) throw()
+{
+	Acquisitor lock(this);
+	
+	std::map<std::string, RecordList::iterator>::iterator position = mRecordsByPath.find(identity.path);
+	if(position != mRecordsByPath.end())
+	{
+		position->second->identity = identity;
+		position->second->record = record;
+		mRecords.splice(mRecords.begin(), mRecords, position->second);
+		
+		return;
+	}
+	
+	CachedRecord cachedRecord = { identity, record };
+	mRecords.push_front(cachedRecord);
+	mRecordsByPath[identity.path] = mRecords.begin();
+	
+	this->EvictRecordsOverCapacity();
+}
+
+void PKDecoderCache::RemoveRecord(const FileIdentity &identity) throw()
+{
+	Acquisitor lock(this);
+	
+	std::map<std::string, RecordList::iterator>::iterator position = mRecordsByPath.find(identity.path);
+	if(position != mRecordsByPath.end())
+	{
+		mRecords.erase(position->second);
+		mRecordsByPath.erase(position);
+	}
+}
+
+void PKDecoderCache::RemoveAllRecords() throw()
+{
+	Acquisitor lock(this);
+	
+	mRecords.clear();
+	mRecordsByPath.clear();
+}
+
+#pragma mark -
+#pragma mark Capacity
+
+UInt32 PKDecoderCache::GetCapacity() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mCapacity;
+}
+
+void PKDecoderCache::SetCapacity(UInt32 capacity) throw()
+{
+	Acquisitor lock(this);
+	
+	mCapacity = capacity;
+	this->EvictRecordsOverCapacity();
+}
+
+#pragma mark -
+#pragma mark Statistics
+
+PKDecoderCache::Statistics PKDecoderCache::GetStatistics() const throw()
+{
+	Acquisitor lock(this);
+	
+	Statistics statistics = {
+		mNumberOfHits,
+		mNumberOfMisses,
+		mNumberOfEvictions,
+		UInt32(mRecords.size()),
+		mCapacity,
+	};
+	
+	return statistics;
+}
+
+void PKDecoderCache::ResetStatistics() throw()
+{
+	Acquisitor lock(this);
+	
+	mNumberOfHits = 0;
+	mNumberOfMisses = 0;
+	mNumberOfEvictions = 0;
+}
@@ -0,0 +1,178 @@
+/*
+ *  PKDecoderCache.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKDecoderCache_h
+#define PKDecoderCache_h 1
+
+#include "RBLockableObject.h"
+#include "PKDecoder.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/*!
+ @class
+ @abstract		The PKDecoderCache class remembers which decoder in the PKDecoder cluster matched a file.
+ @discussion	Records are keyed by the file's path, and are only returned while the file's size and modification
+				date are unchanged. Files no decoder can decode are remembered too. The least recently used record is
+				evicted once the cache is full. All methods are safe to call from any thread.
+ */
+class PK_VISIBILITY_HIDDEN PKDecoderCache : public RBLockableObject
+{
+public:
+	enum {
+		/*!
+		 @abstract	The number of records the shared cache keeps by default.
+		 */
+		kDefaultCapacity = 1024,
+	};
+	
+	/*!
+	 @abstract	The FileIdentity struct describes a file as it was when it was looked at.
+	 */
+	struct FileIdentity {
+		std::string path;
+		UInt64 size;
+		SInt64 modificationTime;
+	};
+	
+	/*!
+	 @abstract	The Record struct describes what was learned about a file.
+	 */
+	struct Record {
+		bool canDecode;
+		PKDecoder::Description decoder;
+		
+		bool hasStreamInfo;
+		AudioStreamBasicDescription streamFormat;
+		PKDecoder::FrameLocation totalNumberOfFrames;
+	};
+	
+	/*!
+	 @abstract	The Statistics struct describes how well the cache is doing.
+	 */
+	struct Statistics {
+		UInt64 numberOfHits;
+		UInt64 numberOfMisses;
+		UInt64 numberOfEvictions;
+		UInt32 numberOfRecords;
+		UInt32 capacity;
+	};
+
+protected:
+	
+	/*!
+	 @abstract	The CachedRecord struct is a record along with the identity of the file it describes.
+	 */
+	struct CachedRecord {
+		FileIdentity identity;
+		Record record;
+	};
+	
+	typedef std::list<CachedRecord> RecordList;
+	
+	/* n/a */	RecordList mRecords;
+	/* n/a */	std::map<std::string, RecordList::iterator> mRecordsByPath;
+	/* n/a */	UInt32 mCapacity;
+	
+	/* n/a */	UInt64 mNumberOfHits;
+	/* n/a */	UInt64 mNumberOfMisses;
+	/* n/a */	UInt64 mNumberOfEvictions;
+	
+	/*!
+	 @abstract	Evict the least recently used records until the receiver holds no more than its capacity.
+	 */
+	void EvictRecordsOverCapacity() throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Returns the cache shared by the PKDecoder cluster.
+	 */
+	static PKDecoderCache *SharedCache() throw();
+	
+	/*!
+	 @abstract	Construct an empty cache that keeps a specified number of records.
+	 */
+	explicit PKDecoderCache(UInt32 capacity) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the cache.
+	 */
+	virtual ~PKDecoderCache();
+	
+#pragma mark -
+#pragma mark Identity
+	
+	/*!
+	 @abstract	Look up the identity of the file at a specified location.
+	 @result	true if the file exists and its identity could be found; false otherwise.
+	 */
+	static bool GetFileIdentity(CFURLRef location, FileIdentity &outIdentity) throw();
+	
+#pragma mark -
+#pragma mark Records
+	
+	/*!
+	 @abstract		Find the record for a file.
+	 @result		true if there is a record for the file and the file hasn't changed since it was made; false otherwise.
+	 @discussion	Records for files that have changed are discarded. Every call counts as a hit or a miss.
+	 */
+	bool FindRecord(const FileIdentity &identity, Record &outRecord) throw();
+	
+	/*!
+	 @abstract	Remember a record for a file, replacing any existing record for it.
+	 */
+	void SetRecord(const FileIdentity &identity, const Record &record) throw();
+	
+	/*!
+	 @abstract	Forget the record for a file if there is one.
+	 */
+	void RemoveRecord(const FileIdentity &identity) throw();
+	
+	/*!
+	 @abstract	Forget every record in the receiver.
+	 */
+	void RemoveAllRecords() throw();
+	
+#pragma mark -
+#pragma mark Capacity
+	
+	/*!
+	 @abstract	Returns the number of records the receiver keeps.
+	 */
+	UInt32 GetCapacity() const throw();
+	
+	/*!
+	 @abstract	Set the number of records the receiver keeps, evicting records if it holds more.
+	 */
+	void SetCapacity(UInt32 capacity) throw();
+	
+#pragma mark -
+#pragma mark Statistics
+	
+	/*!
+	 @abstract	Returns the hits, misses and evictions the receiver has counted, along with its size.
+	 */
+	Statistics GetStatistics() const throw();
+	
+	/*!
+	 @abstract	Reset the hits, misses and evictions the receiver has counted.
+	 */
+	void ResetStatistics() throw();
+
+private:
+	PKDecoderCache(PKDecoderCache &cache);
+	PKDecoderCache &operator=(PKDecoderCache &cache);
+};
+
+#endif /* PKDecoderCache_h */
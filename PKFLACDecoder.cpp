@@ -0,0 +1,1056 @@
+/*
+ *  PKFLACDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKFLACDecoder.h"
+#include <Accelerate/Accelerate.h>
+#include <libkern/OSByteOrder.h>
+
+#include "CAStreamBasicDescription.h"
+
+#pragma mark Constants
+
+enum {
+	//The size of the buffer the file is read into.
+	kInputBufferSize = 64 * 1024,
+	
+	//The input buffer is padded with zeros so the bit reader can always load 64 bits at once.
+	kInputBufferPadding = 8,
+	
+	//Enough room for the longest possible frame header, with plenty to spare.
+	kMaximumFrameHeaderSize = 32,
+	
+	//Bisection stops once the frame to seek to is known to be within this many bytes.
+	kSeekBisectionThreshold = 16 * 1024,
+};
+
+enum {
+	kChannelAssignmentLeftSide = 8,
+	kChannelAssignmentSideRight = 9,
+	kChannelAssignmentMidSide = 10,
+};
+
+enum {
+	kMetadataBlockTypeStreamInfo = 0,
+	kMetadataBlockTypeSeekTable = 3,
+};
+
+static UInt64 const kSeekPointPlaceholder = 0xFFFFFFFFFFFFFFFFULL;
+
+#pragma mark -
+#pragma mark Tools
+
+static UInt8 CRC8(const UInt8 *bytes, UInt32 length)
+{
+	UInt8 crc = 0;
+	for (UInt32 index = 0; index < length; index++)
+	{
+		crc ^= bytes[index];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80)? UInt8((crc << 1) ^ 0x07) : UInt8(crc << 1);
+	}
+	
+	return crc;
+}
+
+static UInt16 CRC16(UInt16 crc, const UInt8 *bytes, UInt32 length)
+{
+	for (UInt32 index = 0; index < length; index++)
+	{
+		crc ^= UInt16(bytes[index] << 8);
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000)? UInt16((crc << 1) ^ 0x8005) : UInt16(crc << 1);
+	}
+	
+	return crc;
+}
+
+static bool SkipToStreamMarker(PKByteSource *source) throw(RBException)
+{
+	UInt8 marker[10];
+	if(source->Read(marker, 4) != 4)
+		return false;
+	
+	//Some taggers put an ID3v2 tag in front of the stream marker.
+	if(memcmp(marker, "ID3", 3) == 0)
+	{
+		if(source->Read(marker + 4, 6) != 6)
+			return false;
+		
+		UInt64 tagSize = ((marker[6] & 0x7F) << 21) | ((marker[7] & 0x7F) << 14) | ((marker[8] & 0x7F) << 7) | (marker[9] & 0x7F);
+		if((marker[5] & 0x10) == 0x10)
+			tagSize += 10;
+		
+		source->SetOffset(10 + tagSize);
+		if(source->Read(marker, 4) != 4)
+			return false;
+	}
+	
+	return (memcmp(marker, "fLaC", 4) == 0);
+}
+
+#pragma mark -
+#pragma mark Linear Prediction
+
+//
+//	Restoring linear prediction is a recurrence, so the only thing that can be done in parallel is the
+//	dot product of the coefficients with the preceding samples. Specializing the common orders lets the
+//	compiler fully unroll and vectorize that product. The 64 bit variant is only needed when the sample
+//	size and coefficient precision are large enough for the 32 bit sum to overflow.
+//
+
+template <UInt32 Order>
+static void RestoreLinearPrediction32(SInt32 *samples, UInt32 blockSize, const SInt32 *coefficients, int shift)
+{
+	for (UInt32 index = Order; index < blockSize; index++)
+	{
+		SInt32 prediction = 0;
+		for (UInt32 tap = 0; tap < Order; tap++)
+			prediction += coefficients[tap] * samples[index - 1 - tap];
+		
+		samples[index] += (prediction >> shift);
+	}
+}
+
+static void RestoreLinearPrediction32(SInt32 *samples, UInt32 blockSize, const SInt32 *coefficients, UInt32 order, int shift)
+{
+	switch (order)
+	{
+		case 1:		RestoreLinearPrediction32<1>(samples, blockSize, coefficients, shift); return;
+		case 2:		RestoreLinearPrediction32<2>(samples, blockSize, coefficients, shift); return;
+		case 3:		RestoreLinearPrediction32<3>(samples, blockSize, coefficients, shift); return;
+		case 4:		RestoreLinearPrediction32<4>(samples, blockSize, coefficients, shift); return;
+		case 5:		RestoreLinearPrediction32<5>(samples, blockSize, coefficients, shift); return;
+		case 6:		RestoreLinearPrediction32<6>(samples, blockSize, coefficients, shift); return;
+		case 7:		RestoreLinearPrediction32<7>(samples, blockSize, coefficients, shift); return;
+		case 8:		RestoreLinearPrediction32<8>(samples, blockSize, coefficients, shift); return;
+		case 10:	RestoreLinearPrediction32<10>(samples, blockSize, coefficients, shift); return;
+		case 12:	RestoreLinearPrediction32<12>(samples, blockSize, coefficients, shift); return;
+		default:	break;
+	}
+	
+	for (UInt32 index = order; index < blockSize; index++)
+	{
+		SInt32 prediction = 0;
+		for (UInt32 tap = 0; tap < order; tap++)
+			prediction += coefficients[tap] * samples[index - 1 - tap];
+		
+		samples[index] += (prediction >> shift);
+	}
+}
+
+static void RestoreLinearPrediction64(SInt32 *samples, UInt32 blockSize, const SInt32 *coefficients, UInt32 order, int shift)
+{
+	for (UInt32 index = order; index < blockSize; index++)
+	{
+		SInt64 prediction = 0;
+		for (UInt32 tap = 0; tap < order; tap++)
+			prediction += SInt64(coefficients[tap]) * samples[index - 1 - tap];
+		
+		samples[index] += SInt32(prediction >> shift);
+	}
+}
+
+static void RestoreFixedPrediction(SInt32 *samples, UInt32 blockSize, UInt32 order)
+{
+	switch (order)
+	{
+		case 1:
+			for (UInt32 index = 1; index < blockSize; index++)
+				samples[index] += samples[index - 1];
+			break;
+		
+		case 2:
+			for (UInt32 index = 2; index < blockSize; index++)
+				samples[index] += (2 * samples[index - 1]) - samples[index - 2];
+			break;
+		
+		case 3:
+			for (UInt32 index = 3; index < blockSize; index++)
+				samples[index] += (3 * (samples[index - 1] - samples[index - 2])) + samples[index - 3];
+			break;
+		
+		case 4:
+			for (UInt32 index = 4; index < blockSize; index++)
+				samples[index] += (4 * (samples[index - 1] + samples[index - 3])) - (6 * samples[index - 2]) - samples[index - 4];
+			break;
+		
+		default:
+			break;
+	}
+}
+
+#pragma mark -
+#pragma mark Lifetime
+
+PKFLACDecoder::PKFLACDecoder(PKByteSource *source) throw(RBException) :
+	PKDecoder("PKFLACDecoder"),
+	mFileLocation(source->CopyLocation()),
+	mSource(source),
+	mFileLength(0),
+	mStreamFormat(),
+	mMinimumBlockSize(0),
+	mMaximumBlockSize(0),
+	mBitsPerSample(0),
+	mNumberOfChannels(0),
+	mTotalNumberOfFrames(0),
+	mFirstFrameOffset(0),
+	mSeekPoints(),
+	mSeekIndex(NULL),
+	mInputBuffer(NULL),
+	mInputBufferLength(0),
+	mInputBufferFileOffset(0),
+	mInputIsExhausted(false),
+	mBitPosition(0),
+	mIsCheckingFrameCRC(false),
+	mFrameCRCFileOffset(0),
+	mFrameCRC(0),
+	mDecodedFirstFrame(0),
+	mDecodedNumberOfFrames(0),
+	mDecodedOffset(0),
+	mCurrentFrame(0),
+	mIsSeeking(false)
+{
+	memset(mDecodedSamples, 0, sizeof(mDecodedSamples));
+	memset(mDecodedBuffers, 0, sizeof(mDecodedBuffers));
+	
+	mSource->Retain();
+	
+	//The destructor isn't run when a constructor throws, so everything acquired so far is released here.
+	try
+	{
+		mFileLength = mSource->GetLength();
+		
+		mInputBuffer = (UInt8 *)calloc(kInputBufferSize + kInputBufferPadding, 1);
+		RBAssert((mInputBuffer != NULL), CFSTR("Could not allocate FLAC input buffer."));
+		
+		this->ReadMetadata();
+		
+		//Files with a SEEKTABLE already know where their frames are.
+		if(mSeekPoints.empty())
+			mSeekIndex = PKSeekIndex::CreateForByteSource(mSource, UInt64(mStreamFormat.mSampleRate));
+		
+		for (UInt32 channel = 0; channel < mNumberOfChannels; channel++)
+		{
+			mDecodedSamples[channel] = (SInt32 *)calloc(mMaximumBlockSize, sizeof(SInt32));
+			mDecodedBuffers[channel] = (Float32 *)calloc(mMaximumBlockSize, sizeof(Float32));
+			RBAssert((mDecodedSamples[channel] != NULL) && (mDecodedBuffers[channel] != NULL),
+					 CFSTR("Could not allocate FLAC decode buffers of %u frames."), mMaximumBlockSize);
+		}
+		
+		CAStreamBasicDescription format;
+		format.mSampleRate = mStreamFormat.mSampleRate;
+		format.SetCanonical(mNumberOfChannels, false);
+		mStreamFormat = format;
+	}
+	catch (RBException e)
+	{
+		this->ReleaseResources();
+		throw;
+	}
+}
+
+PKFLACDecoder::~PKFLACDecoder()
+{
+	this->ReleaseResources();
+}
+
+void PKFLACDecoder::ReleaseResources() throw()
+{
+	for (UInt32 channel = 0; channel < kMaximumNumberOfChannels; channel++)
+	{
+		if(mDecodedSamples[channel])
+		{
+			free(mDecodedSamples[channel]);
+			mDecodedSamples[channel] = NULL;
+		}
+		
+		if(mDecodedBuffers[channel])
+		{
+			free(mDecodedBuffers[channel]);
+			mDecodedBuffers[channel] = NULL;
+		}
+	}
+	
+	if(mInputBuffer)
+	{
+		free(mInputBuffer);
+		mInputBuffer = NULL;
+	}
+	
+	if(mSeekIndex)
+	{
+		mSeekIndex->SaveInBackground();
+		mSeekIndex->Release();
+		mSeekIndex = NULL;
+	}
+	
+	if(mSource)
+	{
+		mSource->Release();
+		mSource = NULL;
+	}
+	
+	if(mFileLocation)
+	{
+		CFRelease(mFileLocation);
+		mFileLocation = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Reading Bits
+
+void PKFLACDecoder::RefillInput() throw(RBException)
+{
+	//Once the file has run out there's nothing to gain from shuffling the buffer around.
+	if(mInputIsExhausted)
+		return;
+	
+	UInt32 numberOfBytesConsumed = (mBitPosition >> 3);
+	UInt32 numberOfBytesRemaining = mInputBufferLength - numberOfBytesConsumed;
+	
+	//The consumed bytes are about to be thrown away, so the frame being read is checksummed up to here first.
+	this->UpdateFrameCRC(mInputBufferFileOffset + numberOfBytesConsumed);
+	
+	memmove(mInputBuffer, mInputBuffer + numberOfBytesConsumed, numberOfBytesRemaining);
+	
+	mInputBufferFileOffset += numberOfBytesConsumed;
+	mBitPosition &= 7;
+	
+	size_t numberOfBytesWanted = kInputBufferSize - numberOfBytesRemaining;
+	size_t numberOfBytesRead = mSource->Read(mInputBuffer + numberOfBytesRemaining, numberOfBytesWanted);
+	
+	mInputBufferLength = numberOfBytesRemaining + UInt32(numberOfBytesRead);
+	mInputIsExhausted = (numberOfBytesRead < numberOfBytesWanted);
+	memset(mInputBuffer + mInputBufferLength, 0, kInputBufferPadding);
+}
+
+void PKFLACDecoder::SetFileOffset(UInt64 offset) throw(RBException)
+{
+	mIsCheckingFrameCRC = false;
+	
+	//Short hops, such as when we resynchronize, can usually stay within the buffer.
+	if((offset >= mInputBufferFileOffset) && (offset <= (mInputBufferFileOffset + mInputBufferLength)))
+	{
+		mBitPosition = UInt32(offset - mInputBufferFileOffset) << 3;
+		return;
+	}
+	
+	mSource->SetOffset(offset);
+	
+	mInputBufferFileOffset = offset;
+	mInputBufferLength = 0;
+	mInputIsExhausted = false;
+	mBitPosition = 0;
+	
+	this->RefillInput();
+}
+
+bool PKFLACDecoder::IsAtEndOfInput() throw(RBException)
+{
+	this->EnsureInput(1);
+	
+	return ((mBitPosition >> 3) >= mInputBufferLength);
+}
+
+UInt32 PKFLACDecoder::ReadBits(UInt32 numberOfBits) throw(RBException)
+{
+	if(numberOfBits == 0)
+		return 0;
+	
+	this->EnsureInput(kInputBufferPadding);
+	
+	UInt64 bits = OSReadBigInt64(mInputBuffer, mBitPosition >> 3) << (mBitPosition & 7);
+	mBitPosition += numberOfBits;
+	RBAssert((mBitPosition <= (mInputBufferLength << 3)), CFSTR("Unexpected end of FLAC file."));
+	
+	return UInt32(bits >> (64 - numberOfBits));
+}
+
+SInt32 PKFLACDecoder::ReadSignedBits(UInt32 numberOfBits) throw(RBException)
+{
+	if(numberOfBits == 0)
+		return 0;
+	
+	return SInt32(this->ReadBits(numberOfBits) << (32 - numberOfBits)) >> (32 - numberOfBits);
+}
+
+UInt32 PKFLACDecoder::ReadUnary() throw(RBException)
+{
+	UInt32 numberOfZeros = 0;
+	for (;;)
+	{
+		this->EnsureInput(kInputBufferPadding);
+		
+		UInt32 numberOfBitsLoaded = 64 - (mBitPosition & 7);
+		UInt64 bits = OSReadBigInt64(mInputBuffer, mBitPosition >> 3) << (mBitPosition & 7);
+		if(bits != 0)
+		{
+			UInt32 numberOfLeadingZeros = __builtin_clzll(bits);
+			
+			numberOfZeros += numberOfLeadingZeros;
+			mBitPosition += numberOfLeadingZeros + 1;
+			RBAssert((mBitPosition <= (mInputBufferLength << 3)), CFSTR("Unexpected end of FLAC file."));
+			
+			return numberOfZeros;
+		}
+		
+		numberOfZeros += numberOfBitsLoaded;
+		mBitPosition += numberOfBitsLoaded;
+		RBAssert((mBitPosition <= (mInputBufferLength << 3)), CFSTR("Unexpected end of FLAC file."));
+	}
+}
+
+#pragma mark -
+#pragma mark Frame Checksum
+
+void PKFLACDecoder::BeginFrameCRC() throw()
+{
+	mIsCheckingFrameCRC = true;
+	mFrameCRCFileOffset = this->GetFileOffset();
+	mFrameCRC = 0;
+}
+
+void PKFLACDecoder::UpdateFrameCRC(UInt64 endOffset) throw()
+{
+	if(!mIsCheckingFrameCRC || (endOffset <= mFrameCRCFileOffset))
+		return;
+	
+	const UInt8 *start = mInputBuffer + (mFrameCRCFileOffset - mInputBufferFileOffset);
+	mFrameCRC = CRC16(mFrameCRC, start, UInt32(endOffset - mFrameCRCFileOffset));
+	mFrameCRCFileOffset = endOffset;
+}
+
+UInt16 PKFLACDecoder::FinishFrameCRC() throw()
+{
+	this->UpdateFrameCRC(this->GetFileOffset());
+	mIsCheckingFrameCRC = false;
+	
+	return mFrameCRC;
+}
+
+#pragma mark -
+#pragma mark Parsing
+
+void PKFLACDecoder::ReadMetadata() throw(RBException)
+{
+	mSource->SetOffset(0);
+	RBAssert(SkipToStreamMarker(mSource), CFSTR("File is not a FLAC file."));
+	
+	mInputBufferFileOffset = mSource->GetOffset();
+	this->RefillInput();
+	
+	bool hasStreamInfo = false;
+	bool isLastMetadataBlock = false;
+	while (!isLastMetadataBlock)
+	{
+		isLastMetadataBlock = (this->ReadBits(1) == 1);
+		UInt32 blockType = this->ReadBits(7);
+		UInt32 blockLength = this->ReadBits(24);
+		UInt64 nextBlockOffset = this->GetFileOffset() + blockLength;
+		
+		if(blockType == kMetadataBlockTypeStreamInfo)
+		{
+			mMinimumBlockSize = this->ReadBits(16);
+			mMaximumBlockSize = this->ReadBits(16);
+			this->ReadBits(24); //minimum frame size
+			this->ReadBits(24); //maximum frame size
+			mStreamFormat.mSampleRate = this->ReadBits(20);
+			mNumberOfChannels = this->ReadBits(3) + 1;
+			mBitsPerSample = this->ReadBits(5) + 1;
+			mTotalNumberOfFrames = (UInt64(this->ReadBits(4)) << 32) | this->ReadBits(32);
+			
+			hasStreamInfo = true;
+		}
+		else if(blockType == kMetadataBlockTypeSeekTable)
+		{
+			for (UInt32 index = 0; index < (blockLength / 18); index++)
+			{
+				SeekPoint seekPoint;
+				seekPoint.sampleNumber = (UInt64(this->ReadBits(32)) << 32) | this->ReadBits(32);
+				seekPoint.frameOffset = (UInt64(this->ReadBits(32)) << 32) | this->ReadBits(32);
+				this->ReadBits(16); //number of samples in frame
+				
+				if(seekPoint.sampleNumber != kSeekPointPlaceholder)
+					mSeekPoints.push_back(seekPoint);
+			}
+		}
+		
+		this->SetFileOffset(nextBlockOffset);
+	}
+	
+	mFirstFrameOffset = this->GetFileOffset();
+	
+	RBAssert(hasStreamInfo, CFSTR("FLAC file is missing its STREAMINFO block."));
+	RBAssert((mStreamFormat.mSampleRate > 0), CFSTR("FLAC file has an invalid sample rate."));
+	RBAssert((mMaximumBlockSize >= 16) && (mMinimumBlockSize <= mMaximumBlockSize), CFSTR("FLAC file has invalid block sizes."));
+	RBAssert((mBitsPerSample >= 4) && (mBitsPerSample <= kMaximumBitsPerSample),
+			 CFSTR("FLAC files with %ld bits per sample are not supported."), mBitsPerSample);
+}
+
+bool PKFLACDecoder::ReadFrameHeader(FrameHeader &header) throw(RBException)
+{
+	this->AlignToByte();
+	this->EnsureInput(kMaximumFrameHeaderSize);
+	
+	//The header is never long enough to cause the buffer to be refilled underneath us.
+	const UInt8 *headerStart = mInputBuffer + (mBitPosition >> 3);
+	
+	//Sync code followed by a reserved 0 bit.
+	if(this->ReadBits(15) != 0x7FFC)
+		return false;
+	
+	bool isVariableBlockSize = (this->ReadBits(1) == 1);
+	UInt32 blockSizeCode = this->ReadBits(4);
+	UInt32 sampleRateCode = this->ReadBits(4);
+	UInt32 channelAssignment = this->ReadBits(4);
+	UInt32 sampleSizeCode = this->ReadBits(3);
+	
+	if((this->ReadBits(1) != 0) ||
+	   (blockSizeCode == 0) ||
+	   (sampleRateCode == 15) ||
+	   (channelAssignment > kChannelAssignmentMidSide) ||
+	   (sampleSizeCode == 3))
+		return false;
+	
+	//The frame or sample number is coded the same way as a UTF-8 character.
+	UInt32 leadingByte = this->ReadBits(8);
+	UInt32 numberOfTrailingBytes = 0;
+	UInt64 number = 0;
+	if((leadingByte & 0x80) == 0x00)		{ number = leadingByte; numberOfTrailingBytes = 0; }
+	else if((leadingByte & 0xE0) == 0xC0)	{ number = leadingByte & 0x1F; numberOfTrailingBytes = 1; }
+	else if((leadingByte & 0xF0) == 0xE0)	{ number = leadingByte & 0x0F; numberOfTrailingBytes = 2; }
+	else if((leadingByte & 0xF8) == 0xF0)	{ number = leadingByte & 0x07; numberOfTrailingBytes = 3; }
+	else if((leadingByte & 0xFC) == 0xF8)	{ number = leadingByte & 0x03; numberOfTrailingBytes = 4; }
+	else if((leadingByte & 0xFE) == 0xFC)	{ number = leadingByte & 0x01; numberOfTrailingBytes = 5; }
+	else if(leadingByte == 0xFE)			{ number = 0; numberOfTrailingBytes = 6; }
+	else
+		return false;
+	
+	for (UInt32 index = 0; index < numberOfTrailingBytes; index++)
+	{
+		UInt32 trailingByte = this->ReadBits(8);
+		if((trailingByte & 0xC0) != 0x80)
+			return false;
+		
+		number = (number << 6) | (trailingByte & 0x3F);
+	}
+	
+	if(blockSizeCode == 1)
+		header.blockSize = 192;
+	else if(blockSizeCode <= 5)
+		header.blockSize = 576 << (blockSizeCode - 2);
+	else if(blockSizeCode == 6)
+		header.blockSize = this->ReadBits(8) + 1;
+	else if(blockSizeCode == 7)
+		header.blockSize = this->ReadBits(16) + 1;
+	else
+		header.blockSize = 256 << (blockSizeCode - 8);
+	
+	//Frames are always played at the rate in STREAMINFO, so the frame's own rate is skipped over.
+	if(sampleRateCode == 12)
+		this->ReadBits(8);
+	else if((sampleRateCode == 13) || (sampleRateCode == 14))
+		this->ReadBits(16);
+	
+	const UInt8 *headerEnd = mInputBuffer + (mBitPosition >> 3);
+	if(this->ReadBits(8) != CRC8(headerStart, UInt32(headerEnd - headerStart)))
+		return false;
+	
+	static const UInt32 bitsPerSampleForSampleSizeCode[] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+	header.bitsPerSample = (sampleSizeCode == 0)? mBitsPerSample : bitsPerSampleForSampleSizeCode[sampleSizeCode];
+	header.channelAssignment = channelAssignment;
+	header.numberOfChannels = (channelAssignment < kChannelAssignmentLeftSide)? (channelAssignment + 1) : 2;
+	
+	if(isVariableBlockSize)
+		header.firstSampleNumber = number;
+	else if(mMinimumBlockSize == mMaximumBlockSize)
+		header.firstSampleNumber = number * mMaximumBlockSize;
+	else
+		header.firstSampleNumber = number * header.blockSize;
+	
+	//At this point the checksum has matched, so anything we can't handle is a real problem with the file.
+	RBAssert((header.numberOfChannels == mNumberOfChannels), CFSTR("FLAC frame has %ld channels, expected %ld."), header.numberOfChannels, mNumberOfChannels);
+	RBAssert((header.bitsPerSample <= kMaximumBitsPerSample), CFSTR("FLAC frames with %ld bits per sample are not supported."), header.bitsPerSample);
+	RBAssert((header.blockSize <= mMaximumBlockSize), CFSTR("FLAC frame has a block size of %ld, larger than the stream's maximum of %ld."), header.blockSize, mMaximumBlockSize);
+	
+	return true;
+}
+
+bool PKFLACDecoder::ReadNextFrameHeader(FrameHeader &header, UInt64 *outFrameOffset) throw(RBException)
+{
+	this->AlignToByte();
+	
+	for (;;)
+	{
+		this->EnsureInput(kMaximumFrameHeaderSize);
+		
+		UInt32 position = (mBitPosition >> 3);
+		while (((position + 1) < mInputBufferLength) &&
+			   !((mInputBuffer[position] == 0xFF) && ((mInputBuffer[position + 1] & 0xFE) == 0xF8)))
+			position++;
+		
+		mBitPosition = position << 3;
+		
+		if((position + 1) >= mInputBufferLength)
+		{
+			if(mInputIsExhausted)
+				return false;
+			
+			//The last byte may be the start of a sync code, so we keep it around.
+			this->RefillInput();
+			continue;
+		}
+		
+		UInt64 frameOffset = this->GetFileOffset();
+		
+		bool isValidHeader = false;
+		try
+		{
+			//The frame's CRC-16 covers its header too.
+			this->BeginFrameCRC();
+			isValidHeader = this->ReadFrameHeader(header);
+		}
+		catch (RBException e)
+		{
+			//A truncated header at the very end of the file is no different from garbage.
+			if(!mInputIsExhausted)
+				throw;
+		}
+		
+		if(isValidHeader)
+		{
+			if(outFrameOffset) *outFrameOffset = frameOffset;
+			
+			return true;
+		}
+		
+		this->SetFileOffset(frameOffset + 1);
+	}
+}
+
+#pragma mark -
+#pragma mark Decoding
+
+void PKFLACDecoder::DecodeResidual(SInt32 *samples, UInt32 blockSize, UInt32 predictorOrder) throw(RBException)
+{
+	UInt32 codingMethod = this->ReadBits(2);
+	RBAssert((codingMethod <= 1), CFSTR("FLAC subframe uses reserved residual coding method %ld."), codingMethod);
+	
+	UInt32 numberOfParameterBits = (codingMethod == 0)? 4 : 5;
+	UInt32 escapeParameter = (1 << numberOfParameterBits) - 1;
+	
+	UInt32 partitionOrder = this->ReadBits(4);
+	UInt32 numberOfPartitions = 1 << partitionOrder;
+	UInt32 partitionSize = blockSize >> partitionOrder;
+	RBAssert(((partitionSize << partitionOrder) == blockSize) && (partitionSize >= predictorOrder),
+			 CFSTR("FLAC subframe has invalid partition order %ld."), partitionOrder);
+	
+	SInt32 *residual = samples + predictorOrder;
+	for (UInt32 partition = 0; partition < numberOfPartitions; partition++)
+	{
+		UInt32 numberOfSamples = (partition == 0)? (partitionSize - predictorOrder) : partitionSize;
+		UInt32 parameter = this->ReadBits(numberOfParameterBits);
+		if(parameter == escapeParameter)
+		{
+			UInt32 numberOfBits = this->ReadBits(5);
+			for (UInt32 index = 0; index < numberOfSamples; index++)
+				*residual++ = this->ReadSignedBits(numberOfBits);
+		}
+		else
+		{
+			for (UInt32 index = 0; index < numberOfSamples; index++)
+			{
+				UInt32 value = (this->ReadUnary() << parameter) | this->ReadBits(parameter);
+				*residual++ = SInt32(value >> 1) ^ -SInt32(value & 1);
+			}
+		}
+	}
+}
+
+void PKFLACDecoder::DecodeSubframe(SInt32 *samples, UInt32 blockSize, UInt32 bitsPerSample) throw(RBException)
+{
+	RBAssert((this->ReadBits(1) == 0), CFSTR("FLAC subframe has invalid padding."));
+	
+	UInt32 type = this->ReadBits(6);
+	
+	UInt32 numberOfWastedBits = 0;
+	if(this->ReadBits(1) == 1)
+	{
+		numberOfWastedBits = this->ReadUnary() + 1;
+		RBAssert((numberOfWastedBits < bitsPerSample), CFSTR("FLAC subframe has too many wasted bits."));
+		
+		bitsPerSample -= numberOfWastedBits;
+	}
+	
+	if(type == 0)
+	{
+		SInt32 value = this->ReadSignedBits(bitsPerSample);
+		for (UInt32 index = 0; index < blockSize; index++)
+			samples[index] = value;
+	}
+	else if(type == 1)
+	{
+		for (UInt32 index = 0; index < blockSize; index++)
+			samples[index] = this->ReadSignedBits(bitsPerSample);
+	}
+	else if((type >= 8) && (type <= 12))
+	{
+		UInt32 order = type - 8;
+		RBAssert((order <= blockSize), CFSTR("FLAC subframe has a predictor order larger than its block size."));
+		
+		for (UInt32 index = 0; index < order; index++)
+			samples[index] = this->ReadSignedBits(bitsPerSample);
+		
+		this->DecodeResidual(samples, blockSize, order);
+		RestoreFixedPrediction(samples, blockSize, order);
+	}
+	else if(type >= 32)
+	{
+		UInt32 order = type - 31;
+		RBAssert((order <= blockSize), CFSTR("FLAC subframe has a predictor order larger than its block size."));
+		
+		for (UInt32 index = 0; index < order; index++)
+			samples[index] = this->ReadSignedBits(bitsPerSample);
+		
+		UInt32 precision = this->ReadBits(4) + 1;
+		RBAssert((precision != 16), CFSTR("FLAC subframe has invalid coefficient precision."));
+		
+		int shift = this->ReadSignedBits(5);
+		RBAssert((shift >= 0), CFSTR("FLAC subframe has negative quantization level."));
+		
+		SInt32 coefficients[kMaximumLPCOrder];
+		for (UInt32 index = 0; index < order; index++)
+			coefficients[index] = this->ReadSignedBits(precision);
+		
+		this->DecodeResidual(samples, blockSize, order);
+		
+		UInt32 orderLog2 = 0;
+		while ((1U << orderLog2) < order)
+			orderLog2++;
+		
+		if((bitsPerSample + precision + orderLog2) <= 32)
+			RestoreLinearPrediction32(samples, blockSize, coefficients, order, shift);
+		else
+			RestoreLinearPrediction64(samples, blockSize, coefficients, order, shift);
+	}
+	else
+	{
+		RBAssert(false, CFSTR("FLAC subframe has reserved type %ld."), type);
+	}
+	
+	if(numberOfWastedBits > 0)
+	{
+		for (UInt32 index = 0; index < blockSize; index++)
+			samples[index] <<= numberOfWastedBits;
+	}
+}
+
+bool PKFLACDecoder::DecodeNextFrame() throw(RBException)
+{
+	for (;;)
+	{
+		FrameHeader header;
+		UInt64 frameOffset = 0;
+		if(!this->ReadNextFrameHeader(header, &frameOffset))
+			return false;
+		
+		try
+		{
+			for (UInt32 channel = 0; channel < header.numberOfChannels; channel++)
+			{
+				//Side channels carry an extra bit.
+				UInt32 bitsPerSample = header.bitsPerSample;
+				if(((header.channelAssignment == kChannelAssignmentLeftSide) && (channel == 1)) ||
+				   ((header.channelAssignment == kChannelAssignmentSideRight) && (channel == 0)) ||
+				   ((header.channelAssignment == kChannelAssignmentMidSide) && (channel == 1)))
+					bitsPerSample++;
+				
+				this->DecodeSubframe(mDecodedSamples[channel], header.blockSize, bitsPerSample);
+			}
+			
+			//The header's CRC-8 keeps us in sync, but only the frame's CRC-16 catches damage to the audio itself.
+			this->AlignToByte();
+			UInt16 frameCRC = this->FinishFrameCRC();
+			RBAssert((this->ReadBits(16) == frameCRC), CFSTR("FLAC frame failed its CRC-16 check."));
+		}
+		catch (RBException e)
+		{
+			//A damaged frame is skipped rather than ending playback, unless the file has simply run out.
+			if(mInputIsExhausted && this->IsAtEndOfInput())
+				return false;
+			
+			this->SetFileOffset(frameOffset + 1);
+			continue;
+		}
+		
+		if(mSeekIndex)
+			mSeekIndex->NoteEntry(header.firstSampleNumber, frameOffset);
+		
+		SInt32 *left = mDecodedSamples[0];
+		SInt32 *right = mDecodedSamples[1];
+		switch (header.channelAssignment)
+		{
+			case kChannelAssignmentLeftSide:
+				for (UInt32 index = 0; index < header.blockSize; index++)
+					right[index] = left[index] - right[index];
+				break;
+			
+			case kChannelAssignmentSideRight:
+				for (UInt32 index = 0; index < header.blockSize; index++)
+					left[index] += right[index];
+				break;
+			
+			case kChannelAssignmentMidSide:
+				for (UInt32 index = 0; index < header.blockSize; index++)
+				{
+					SInt32 side = right[index];
+					SInt32 mid = (left[index] << 1) | (side & 1);
+					left[index] = (mid + side) >> 1;
+					right[index] = (mid - side) >> 1;
+				}
+				break;
+			
+			default:
+				break;
+		}
+		
+		Float32 scale = 1.0f / Float32(1 << (header.bitsPerSample - 1));
+		for (UInt32 channel = 0; channel < header.numberOfChannels; channel++)
+		{
+			vDSP_vflt32((int *)mDecodedSamples[channel], 1, mDecodedBuffers[channel], 1, header.blockSize);
+			vDSP_vsmul(mDecodedBuffers[channel], 1, &scale, mDecodedBuffers[channel], 1, header.blockSize);
+		}
+		
+		mDecodedFirstFrame = header.firstSampleNumber;
+		mDecodedNumberOfFrames = header.blockSize;
+		mDecodedOffset = 0;
+		
+		return true;
+	}
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+AudioStreamBasicDescription PKFLACDecoder::GetStreamFormat() const
+{
+	return mStreamFormat;
+}
+
+CFURLRef PKFLACDecoder::CopyLocation() const
+{
+	return mFileLocation? CFURLRef(CFRetain(mFileLocation)) : NULL;
+}
+
+#pragma mark -
+
+PKDecoder::FrameLocation PKFLACDecoder::GetTotalNumberOfFrames() const
+{
+	return mTotalNumberOfFrames;
+}
+
+#pragma mark -
+
+bool PKFLACDecoder::CanSeek() const
+{
+	//Without a length there's nothing to seek against.
+	return (mTotalNumberOfFrames > 0) && (mFileLength > 0) && mSource->CanSeek();
+}
+
+PKDecoder::FrameLocation PKFLACDecoder::GetCurrentFrame() const
+{
+	return mCurrentFrame;
+}
+
+void PKFLACDecoder::SetCurrentFrame(PKDecoder::FrameLocation currentFrame)
+{
+	if(currentFrame > mTotalNumberOfFrames)
+		return;
+	
+	UInt64 startOffset = mFirstFrameOffset;
+	if(!mSeekPoints.empty())
+	{
+		//Seek points are sorted by sample number, and their offsets are relative to the first frame.
+		for (std::vector<SeekPoint>::const_iterator seekPoint = mSeekPoints.begin(); seekPoint != mSeekPoints.end(); seekPoint++)
+		{
+			if(seekPoint->sampleNumber > currentFrame)
+				break;
+			
+			startOffset = mFirstFrameOffset + seekPoint->frameOffset;
+		}
+	}
+	else
+	{
+		//
+		//	Without a seek table we bisect the file, using the sample numbers in the frame headers
+		//	to narrow down where the frame containing `currentFrame` starts. Frames seen while playing
+		//	the file before narrow the range first, which usually leaves nothing to bisect.
+		//
+		UInt64 lowerOffset = mFirstFrameOffset;
+		UInt64 upperOffset = mFileLength;
+		
+		PKSeekIndex::Entry entry;
+		if(mSeekIndex && mSeekIndex->FindEntryAtOrBefore(currentFrame, entry) && (entry.offset > lowerOffset) && (entry.offset < upperOffset))
+			lowerOffset = entry.offset;
+		
+		if(mSeekIndex && mSeekIndex->FindEntryAfter(currentFrame, entry) && (entry.offset > lowerOffset) && (entry.offset < upperOffset))
+			upperOffset = entry.offset;
+		
+		while ((upperOffset - lowerOffset) > kSeekBisectionThreshold)
+		{
+			UInt64 middleOffset = lowerOffset + ((upperOffset - lowerOffset) / 2);
+			this->SetFileOffset(middleOffset);
+			
+			FrameHeader header;
+			UInt64 frameOffset = 0;
+			if(this->ReadNextFrameHeader(header, &frameOffset) && (frameOffset < upperOffset) && (header.firstSampleNumber <= currentFrame))
+				lowerOffset = frameOffset;
+			else
+				upperOffset = middleOffset;
+		}
+		
+		startOffset = lowerOffset;
+	}
+	
+	this->SetFileOffset(startOffset);
+	
+	//FillBuffers decodes forward from here, dropping everything before `currentFrame`.
+	mDecodedNumberOfFrames = 0;
+	mDecodedOffset = 0;
+	mCurrentFrame = currentFrame;
+	mIsSeeking = true;
+}
+
+bool PKFLACDecoder::CanDecodeInParallel() const
+{
+	//Every block is decoded by a decoder of its own, which has to be able to open the file again.
+	return (mFileLocation != NULL) && this->CanSeek();
+}
+
+#pragma mark -
+#pragma mark Decoding
+
+UInt32 PKFLACDecoder::FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException)
+{
+	RBParameterAssert(buffers);
+	
+	UInt32 numberOfBuffers = buffers->mNumberBuffers;
+	if(numberOfBuffers > mNumberOfChannels)
+		numberOfBuffers = mNumberOfChannels;
+	
+	UInt32 numberOfFramesFilled = 0;
+	while (numberOfFramesFilled < numberOfFrames)
+	{
+		if(mDecodedOffset >= mDecodedNumberOfFrames)
+		{
+			if(!this->DecodeNextFrame())
+				break;
+			
+			if(mIsSeeking)
+			{
+				if((mDecodedFirstFrame + mDecodedNumberOfFrames) <= mCurrentFrame)
+				{
+					mDecodedOffset = mDecodedNumberOfFrames;
+					continue;
+				}
+				
+				if(mCurrentFrame > mDecodedFirstFrame)
+					mDecodedOffset = UInt32(mCurrentFrame - mDecodedFirstFrame);
+				
+				mIsSeeking = false;
+			}
+		}
+		
+		UInt32 numberOfFramesToCopy = mDecodedNumberOfFrames - mDecodedOffset;
+		if(numberOfFramesToCopy > (numberOfFrames - numberOfFramesFilled))
+			numberOfFramesToCopy = (numberOfFrames - numberOfFramesFilled);
+		
+		for (UInt32 index = 0; index < numberOfBuffers; index++)
+		{
+			memcpy((Float32 *)(buffers->mBuffers[index].mData) + numberOfFramesFilled,
+				   mDecodedBuffers[index] + mDecodedOffset,
+				   numberOfFramesToCopy * sizeof(Float32));
+		}
+		
+		mDecodedOffset += numberOfFramesToCopy;
+		numberOfFramesFilled += numberOfFramesToCopy;
+	}
+	
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFramesFilled * sizeof(Float32);
+	
+	mCurrentFrame += numberOfFramesFilled;
+	
+	return numberOfFramesFilled;
+}
+
+#pragma mark -
+#pragma mark Description
+
+static bool CanDecode(CFURLRef fileLocation)
+{
+	PKFileReader *reader = NULL;
+	bool canDecode = false;
+	try
+	{
+		reader = new PKFileReader(fileLocation);
+		canDecode = SkipToStreamMarker(reader);
+	}
+	catch (RBException e)
+	{
+		canDecode = false;
+	}
+	
+	if(reader)
+		reader->Release();
+	
+	return canDecode;
+}
+
+static PKDecoder::ProbeResult Probe(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension)
+{
+	if(headerLength < 4)
+		return PKDecoder::kProbeResultNo;
+	
+	UInt32 markerOffset = 0;
+	if(memcmp(header, "ID3", 3) == 0)
+	{
+		if(headerLength < 10)
+			return PKDecoder::kProbeResultMaybe;
+		
+		markerOffset = 10 + (((header[6] & 0x7F) << 21) | ((header[7] & 0x7F) << 14) | ((header[8] & 0x7F) << 7) | (header[9] & 0x7F));
+		if((header[5] & 0x10) == 0x10)
+			markerOffset += 10;
+		
+		//Large tags, usually with cover art in them, push the stream marker past the header.
+		if((markerOffset + 4) > headerLength)
+			return PKDecoder::kProbeResultMaybe;
+	}
+	
+	return (memcmp(header + markerOffset, "fLaC", 4) == 0)? PKDecoder::kProbeResultYes : PKDecoder::kProbeResultNo;
+}
+
+static CFArrayRef CopySupportedTypes()
+{
+	CFStringRef types[] = { CFSTR("org.xiph.flac") };
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)types, 1, &kCFTypeArrayCallBacks);
+}
+
+static PKDecoder *CreateInstance(CFURLRef fileLocation) throw(RBException)
+{
+	return PKFileReader::CreateDecoder<PKFLACDecoder>(fileLocation);
+}
+
+static PKDecoder *CreateInstanceWithByteSource(PKByteSource *source) throw(RBException)
+{
+	return new PKFLACDecoder(source);
+}
+
+PKDecoder::Description PKFLACDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance, &Probe, &CreateInstanceWithByteSource };
@@ -0,0 +1,270 @@
+/*
+ *  PKFLACDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKFLACDecoder_h
+#define PKFLACDecoder_h 1
+
+#include "PKDecoder.h"
+#include "PKFileReader.h"
+#include "PKSeekIndex.h"
+
+/*!
+ @class
+ @abstract		The PKFLACDecoder class decodes FLAC files natively.
+ @discussion	Samples are decoded straight into non-interleaved Float32 buffers at the file's own sample rate,
+				so CD quality files come out in PlayerKit's canonical format without passing through an
+				AudioConverter. Seeking is frame accurate; the file's SEEKTABLE is used to find the frame to
+				start decoding from when there is one, otherwise the file is bisected between the closest
+				entries of a seek index built up as the file is played.
+ */
+class PK_VISIBILITY_HIDDEN PKFLACDecoder : public PKDecoder
+{
+public:
+	enum {
+		/*!
+		 @abstract	The largest number of channels a FLAC stream can have.
+		 */
+		kMaximumNumberOfChannels = 8,
+		
+		/*!
+		 @abstract	The largest number of bits per sample the receiver decodes.
+		 */
+		kMaximumBitsPerSample = 24,
+		
+		/*!
+		 @abstract	The largest LPC order a FLAC subframe can have.
+		 */
+		kMaximumLPCOrder = 32,
+	};
+	
+	/*!
+	 @abstract	The FrameHeader struct describes the header of a single FLAC frame.
+	 */
+	struct FrameHeader {
+		UInt64 firstSampleNumber;
+		UInt32 blockSize;
+		UInt32 channelAssignment;
+		UInt32 numberOfChannels;
+		UInt32 bitsPerSample;
+	};
+	
+	/*!
+	 @abstract	The SeekPoint struct describes a single entry in a FLAC SEEKTABLE.
+	 */
+	struct SeekPoint {
+		UInt64 sampleNumber;
+		UInt64 frameOffset;
+	};
+
+protected:
+	
+	/* owner */	CFURLRef mFileLocation;
+	/* owner */	PKByteSource *mSource;
+	/* n/a */	UInt64 mFileLength;
+	
+	//Stream Info
+	/* n/a */	AudioStreamBasicDescription mStreamFormat;
+	/* n/a */	UInt32 mMinimumBlockSize;
+	/* n/a */	UInt32 mMaximumBlockSize;
+	/* n/a */	UInt32 mBitsPerSample;
+	/* n/a */	UInt32 mNumberOfChannels;
+	/* n/a */	UInt64 mTotalNumberOfFrames;
+	/* n/a */	UInt64 mFirstFrameOffset;
+	/* n/a */	std::vector<SeekPoint> mSeekPoints;
+	/* owner */	PKSeekIndex *mSeekIndex;
+	
+	//Input
+	/* owner */	UInt8 *mInputBuffer;
+	/* n/a */	UInt32 mInputBufferLength;
+	/* n/a */	UInt64 mInputBufferFileOffset;
+	/* n/a */	bool mInputIsExhausted;
+	/* n/a */	UInt32 mBitPosition;
+	
+	//Frame Checksum
+	/* n/a */	bool mIsCheckingFrameCRC;
+	/* n/a */	UInt64 mFrameCRCFileOffset;
+	/* n/a */	UInt16 mFrameCRC;
+	
+	//Decoded Audio
+	/* owner */	SInt32 *mDecodedSamples[kMaximumNumberOfChannels];
+	/* owner */	Float32 *mDecodedBuffers[kMaximumNumberOfChannels];
+	/* n/a */	UInt64 mDecodedFirstFrame;
+	/* n/a */	UInt32 mDecodedNumberOfFrames;
+	/* n/a */	UInt32 mDecodedOffset;
+	
+	/* n/a */	UInt64 mCurrentFrame;
+	/* n/a */	bool mIsSeeking;
+	
+#pragma mark -
+#pragma mark Reading Bits
+	
+	/*!
+	 @abstract	Move everything in the input buffer that has not been read yet to its front, and read the file into the rest.
+	 */
+	void RefillInput() throw(RBException);
+	
+	/*!
+	 @abstract	Make sure at least a specified number of bytes can be read from the input buffer without refilling it.
+	 */
+	inline void EnsureInput(UInt32 numberOfBytes) throw(RBException)
+	{
+		if((mInputBufferLength - (mBitPosition >> 3)) < numberOfBytes)
+			this->RefillInput();
+	}
+	
+	/*!
+	 @abstract	Returns the offset in the file of the next byte to be read.
+	 */
+	UInt64 GetFileOffset() const throw() { return mInputBufferFileOffset + (mBitPosition >> 3); }
+	
+	/*!
+	 @abstract	Discard the input buffer and continue reading at a specified offset in the file.
+	 */
+	void SetFileOffset(UInt64 offset) throw(RBException);
+	
+	/*!
+	 @abstract	Returns whether or not there is nothing left to read in the file.
+	 */
+	bool IsAtEndOfInput() throw(RBException);
+	
+	/*!
+	 @abstract	Read an unsigned integer of up to 32 bits.
+	 */
+	UInt32 ReadBits(UInt32 numberOfBits) throw(RBException);
+	
+	/*!
+	 @abstract	Read a two's complement integer of up to 32 bits.
+	 */
+	SInt32 ReadSignedBits(UInt32 numberOfBits) throw(RBException);
+	
+	/*!
+	 @abstract	Read the number of 0 bits before the next 1 bit, consuming the 1 bit.
+	 */
+	UInt32 ReadUnary() throw(RBException);
+	
+	/*!
+	 @abstract	Skip to the start of the next byte.
+	 */
+	void AlignToByte() throw() { mBitPosition = (mBitPosition + 7) & ~7U; }
+	
+#pragma mark -
+#pragma mark Frame Checksum
+	
+	/*!
+	 @abstract		Start computing the CRC-16 of a frame at the next byte to be read.
+	 @discussion	Bytes are added to the checksum as the input buffer is refilled over them, so a frame
+					doesn't have to fit in the input buffer. Moving with SetFileOffset stops the checksum.
+	 */
+	void BeginFrameCRC() throw();
+	
+	/*!
+	 @abstract	Add the bytes between the end of the checksum so far and a specified offset in the file to the checksum.
+	 */
+	void UpdateFrameCRC(UInt64 endOffset) throw();
+	
+	/*!
+	 @abstract	Add every byte read since BeginFrameCRC to the checksum, stop computing it, and return it.
+	 */
+	UInt16 FinishFrameCRC() throw();
+	
+#pragma mark -
+#pragma mark Parsing
+	
+	/*!
+	 @abstract	Read the metadata blocks at the start of the file, leaving the receiver positioned at the first frame.
+	 */
+	void ReadMetadata() throw(RBException);
+	
+	/*!
+	 @abstract		Read a frame header at the current position.
+	 @result		true if a valid frame header was read; false otherwise.
+	 @discussion	The receiver is left positioned after the header if it is valid; where it is left otherwise is undefined.
+	 */
+	bool ReadFrameHeader(FrameHeader &header) throw(RBException);
+	
+	/*!
+	 @abstract	Scan forward from the current position for the next valid frame header and read it.
+	 @result	true if a frame header was found; false if the end of the file was reached first.
+	 */
+	bool ReadNextFrameHeader(FrameHeader &header, UInt64 *outFrameOffset) throw(RBException);
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	/*!
+	 @abstract	Decode the residual of a subframe into the samples following its warm up samples.
+	 */
+	void DecodeResidual(SInt32 *samples, UInt32 blockSize, UInt32 predictorOrder) throw(RBException);
+	
+	/*!
+	 @abstract	Decode a single subframe of the current frame.
+	 */
+	void DecodeSubframe(SInt32 *samples, UInt32 blockSize, UInt32 bitsPerSample) throw(RBException);
+	
+	/*!
+	 @abstract	Decode the next frame in the file into the receiver's decoded buffers.
+	 @result	false if the end of the file has been reached; true otherwise.
+	 */
+	bool DecodeNextFrame() throw(RBException);
+	
+#pragma mark -
+#pragma mark Cleanup
+	
+	/*!
+	 @abstract	Free everything the receiver owns. Used by the destructor, and by the constructor when it fails.
+	 */
+	void ReleaseResources() throw();
+
+public:
+
+#pragma mark -
+#pragma mark Lifetime
+	
+	/*!
+	 @abstract	Construct a FLAC decoder reading from a specified byte source.
+	 */
+	explicit PKFLACDecoder(PKByteSource *source) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKFLACDecoder();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual AudioStreamBasicDescription GetStreamFormat() const;
+	virtual CFURLRef CopyLocation() const;
+	
+#pragma mark -
+	
+	virtual PKDecoder::FrameLocation GetTotalNumberOfFrames() const;
+	
+#pragma mark -
+	
+	virtual bool CanSeek() const;
+	
+	virtual PKDecoder::FrameLocation GetCurrentFrame() const;
+	virtual void SetCurrentFrame(PKDecoder::FrameLocation currentFrame);
+	
+	virtual bool CanDecodeInParallel() const;
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	virtual UInt32 FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException);
+
+private:
+	PKFLACDecoder(PKFLACDecoder &decoder);
+	PKFLACDecoder &operator=(PKFLACDecoder &decoder);
+};
+
+extern PKDecoder::Description PKFLACDecoderDescription;
+
+#endif /* PKFLACDecoder_h */
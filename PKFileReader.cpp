@@ -0,0 +1,279 @@
+/*
+ *  PKFileReader.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKFileReader.h"
+#include "PKTaskQueue.h"
+#include <dispatch/dispatch.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#pragma mark Lifecycle
+
+PKTaskQueue *PKFileReader::GetPrefetchQueue() throw()
+{
+	static PKTaskQueue *prefetchQueue = NULL;
+	static dispatch_once_t predicate = 0;
+	dispatch_once(&predicate, ^{
+		prefetchQueue = new PKTaskQueue("com.roundabout.playerkit.PKFileReader.prefetchQueue");
+	});
+	
+	return prefetchQueue;
+}
+
+PKFileReader::PKFileReader(CFURLRef location) throw(RBException) :
+	PKByteSource("PKFileReader"),
+	mLocation(CFURLRef(CFRetain(location))),
+	mFileDescriptor(-1),
+	mLength(0),
+	mOffset(0),
+	mPagePool(NULL),
+	mLastPageIndex(UINT64_MAX),
+	mReadAheadWindow(0)
+{
+	memset(mPages, 0, sizeof(mPages));
+	
+	int errorCode = pthread_cond_init(&mPageLoadedCondition, NULL);
+	if(errorCode != 0)
+	{
+		CFRelease(mLocation);
+		mLocation = NULL;
+		
+		RBAssertNoErr(errorCode, CFSTR("pthread_cond_init failed with error code %d"), errorCode);
+	}
+	
+	//The destructor isn't run when a constructor throws, so the file and everything else acquired so far is released here.
+	try
+	{
+		char path[PATH_MAX];
+		RBAssert(CFURLGetFileSystemRepresentation(location, true, (UInt8 *)path, sizeof(path)),
+				 CFSTR("Could not get file system representation of URL."));
+		
+		mFileDescriptor = open(path, O_RDONLY);
+		RBAssert((mFileDescriptor != -1), CFSTR("Could not open file, error %d."), errno);
+		
+		struct stat fileInfo;
+		RBAssert((fstat(mFileDescriptor, &fileInfo) == 0), CFSTR("Could not get size of file, error %d."), errno);
+		mLength = UInt64(fileInfo.st_size);
+		
+		//The kernel's own read ahead covers the gaps between our pages. Failing to turn it on isn't worth failing over.
+#if defined(F_RDAHEAD)
+		fcntl(mFileDescriptor, F_RDAHEAD, 1);
+#elif defined(POSIX_FADV_SEQUENTIAL)
+		posix_fadvise(mFileDescriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif /* defined(F_RDAHEAD) */
+		
+		//Page aligned buffers let the file system copy straight out of its cache.
+		mPagePool = (UInt8 *)valloc(kPageSize * kNumberOfPages);
+		RBAssert((mPagePool != NULL), CFSTR("Could not allocate file reader pages."));
+		
+		for (UInt32 index = 0; index < kNumberOfPages; index++)
+			mPages[index].data = mPagePool + (index * kPageSize);
+	}
+	catch (RBException e)
+	{
+		this->ReleaseResources();
+		throw;
+	}
+}
+
+PKFileReader::~PKFileReader()
+{
+	//Prefetches retain the reader, so none can be outstanding by the time we get here.
+	this->ReleaseResources();
+}
+
+void PKFileReader::ReleaseResources() throw()
+{
+	if(mPagePool)
+	{
+		free(mPagePool);
+		mPagePool = NULL;
+	}
+	
+	if(mFileDescriptor != -1)
+	{
+		close(mFileDescriptor);
+		mFileDescriptor = -1;
+	}
+	
+	if(mLocation)
+	{
+		CFRelease(mLocation);
+		mLocation = NULL;
+	}
+	
+	pthread_cond_destroy(&mPageLoadedCondition);
+}
+
+#pragma mark -
+#pragma mark Pages
+
+void PKFileReader::LoadPage(Page *page) throw()
+{
+	UInt64 length = kPageSize;
+	if((page->offset + length) > mLength)
+		length = (page->offset < mLength)? (mLength - page->offset) : 0;
+	
+	int errorCode = 0;
+	UInt32 amountRead = 0;
+	while (amountRead < length)
+	{
+		ssize_t result = pread(mFileDescriptor, page->data + amountRead, size_t(length - amountRead), off_t(page->offset + amountRead));
+		if(result < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			
+			errorCode = errno;
+			break;
+		}
+		else if(result == 0)
+		{
+			//The file has been truncated since it was opened.
+			break;
+		}
+		
+		amountRead += UInt32(result);
+	}
+	
+	Acquisitor lock(this);
+	
+	page->length = amountRead;
+	page->errorCode = errorCode;
+	page->state = (errorCode == 0)? kPageStateLoaded : kPageStateFailed;
+	
+	pthread_cond_broadcast(&mPageLoadedCondition);
+}
+
+PKFileReader::Page &PKFileReader::GetPage(UInt64 pageIndex) throw(RBException)
+{
+	//Reading in sequence widens the window of pages loaded ahead, anything else closes it.
+	if(pageIndex == (mLastPageIndex + 1))
+	{
+		mReadAheadWindow = (mReadAheadWindow == 0)? 1 : (mReadAheadWindow * 2);
+		if(mReadAheadWindow > (kNumberOfPages - 1))
+			mReadAheadWindow = kNumberOfPages - 1;
+	}
+	else if(pageIndex != mLastPageIndex)
+	{
+		mReadAheadWindow = 0;
+	}
+	
+	mLastPageIndex = pageIndex;
+	
+	UInt64 pageOffset = pageIndex * kPageSize;
+	Page &page = mPages[pageIndex % kNumberOfPages];
+	bool wasLoadedHere = false;
+	for (;;)
+	{
+		if(page.state == kPageStateLoading)
+		{
+			pthread_cond_wait(&mPageLoadedCondition, &mMutex);
+			continue;
+		}
+		
+		if(page.offset == pageOffset)
+		{
+			if(page.state == kPageStateLoaded)
+				break;
+			
+			//A failed prefetch is retried here, where the error can be reported.
+			if((page.state == kPageStateFailed) && wasLoadedHere)
+			{
+				page.state = kPageStateEmpty;
+				RBAssert(0, CFSTR("Could not read file, error %d."), page.errorCode);
+			}
+		}
+		
+		page.offset = pageOffset;
+		page.state = kPageStateLoading;
+		wasLoadedHere = true;
+		
+		pthread_mutex_unlock(&mMutex);
+		this->LoadPage(&page);
+		pthread_mutex_lock(&mMutex);
+	}
+	
+	//The window never reaches around the pool to the page being handed out.
+	for (UInt64 nextPageIndex = pageIndex + 1; nextPageIndex <= (pageIndex + mReadAheadWindow); nextPageIndex++)
+	{
+		UInt64 nextPageOffset = nextPageIndex * kPageSize;
+		if(nextPageOffset >= mLength)
+			break;
+		
+		Page *nextPage = &mPages[nextPageIndex % kNumberOfPages];
+		if((nextPage->state == kPageStateLoading) || ((nextPage->offset == nextPageOffset) && (nextPage->state == kPageStateLoaded)))
+			continue;
+		
+		nextPage->offset = nextPageOffset;
+		nextPage->state = kPageStateLoading;
+		
+		this->Retain();
+		GetPrefetchQueue()->Async(^{
+			this->LoadPage(nextPage);
+			this->Release();
+		});
+	}
+	
+	return page;
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+CFURLRef PKFileReader::CopyLocation() const throw()
+{
+	return CFURLRef(CFRetain(mLocation));
+}
+
+#pragma mark -
+#pragma mark Reading
+
+UInt64 PKFileReader::GetOffset() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mOffset;
+}
+
+void PKFileReader::SetOffset(UInt64 offset) throw()
+{
+	Acquisitor lock(this);
+	
+	mOffset = offset;
+}
+
+size_t PKFileReader::Read(void *buffer, size_t length) throw(RBException)
+{
+	Acquisitor lock(this);
+	
+	UInt8 *destination = (UInt8 *)buffer;
+	size_t amountRead = 0;
+	while ((amountRead < length) && (mOffset < mLength))
+	{
+		Page &page = this->GetPage(mOffset / kPageSize);
+		
+		UInt32 offsetInPage = UInt32(mOffset - page.offset);
+		if(offsetInPage >= page.length)
+			break;
+		
+		size_t amountToCopy = page.length - offsetInPage;
+		if(amountToCopy > (length - amountRead))
+			amountToCopy = length - amountRead;
+		
+		memcpy(destination + amountRead, page.data + offsetInPage, amountToCopy);
+		amountRead += amountToCopy;
+		mOffset += amountToCopy;
+	}
+	
+	return amountRead;
+}
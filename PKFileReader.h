@@ -0,0 +1,160 @@
+/*
+ *  PKFileReader.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKFileReader_h
+#define PKFileReader_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "PKByteSource.h"
+
+class PKTaskQueue;
+
+/*!
+ @class
+ @abstract		The PKFileReader class is the byte source for files on disk, prefetching the data ahead of the decoder reading it.
+ @discussion	The file is read in large page aligned pages kept in a fixed pool owned by the reader. Pages after
+				the one being read are loaded on a task queue shared by every reader, so a decoder running
+				on the engine's scheduler thread usually finds its data already in memory instead of waiting on
+				the disk. The number of pages loaded ahead doubles with every page read in sequence and collapses
+				when the reader is repositioned, so probing a file or bisecting it to seek doesn't read it ahead.
+				
+				A reader may be used from any thread, but is meant to be used by one decoder at a time.
+ */
+class PK_VISIBILITY_HIDDEN PKFileReader : public PKByteSource
+{
+public:
+	enum {
+		/*!
+		 @abstract	The size of the pages the file is read in.
+		 */
+		kPageSize = 128 * 1024,
+		
+		/*!
+		 @abstract	The number of pages in a reader's pool.
+		 */
+		kNumberOfPages = 8,
+	};
+
+protected:
+	
+	/*!
+	 @enum
+	 @abstract	The states a page in the pool can be in.
+	 */
+	enum PageState {
+		kPageStateEmpty = 0,
+		kPageStateLoading,
+		kPageStateLoaded,
+		kPageStateFailed,
+	};
+	
+	/*!
+	 @abstract	The Page struct describes one page in the pool.
+	 */
+	struct Page {
+		UInt8 *data;
+		UInt64 offset;
+		UInt32 length;
+		PageState state;
+		int errorCode;
+	};
+	
+	/* owner */	CFURLRef mLocation;
+	/* n/a */	int mFileDescriptor;
+	/* n/a */	UInt64 mLength;
+	/* n/a */	UInt64 mOffset;
+	
+	/* owner */	UInt8 *mPagePool;
+	/* n/a */	Page mPages[kNumberOfPages];
+	/* n/a */	pthread_cond_t mPageLoadedCondition;
+	
+	/* n/a */	UInt64 mLastPageIndex;
+	/* n/a */	UInt32 mReadAheadWindow;
+	
+	/*!
+	 @abstract	Returns the queue pages are prefetched on, which runs in the shared executor's normal lane.
+	 */
+	static PKTaskQueue *GetPrefetchQueue() throw();
+	
+	/*!
+	 @abstract		Read a page from the file whose state the caller has set to loading.
+	 @discussion	The receiver must not be locked by the calling thread.
+	 */
+	void LoadPage(Page *page) throw();
+	
+	/*!
+	 @abstract		Returns the page at a specified index in the file, loading it if necessary, and starts prefetching the pages after it.
+	 @discussion	The receiver must be locked by the calling thread exactly once.
+	 */
+	Page &GetPage(UInt64 pageIndex) throw(RBException);
+	
+	/*!
+	 @abstract	Close the receiver's file and free everything it owns. Used by the destructor, and by the constructor when it fails.
+	 */
+	void ReleaseResources() throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a reader for the file at a specified location.
+	 */
+	explicit PKFileReader(CFURLRef location) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the reader, closing its file.
+	 */
+	virtual ~PKFileReader();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual CFURLRef CopyLocation() const throw();
+	virtual UInt64 GetLength() const throw() { return mLength; }
+	
+#pragma mark -
+#pragma mark Reading
+	
+	virtual bool CanSeek() const throw() { return true; }
+	virtual UInt64 GetOffset() const throw();
+	virtual void SetOffset(UInt64 offset) throw();
+	virtual size_t Read(void *buffer, size_t length) throw(RBException);
+	
+#pragma mark -
+#pragma mark Decoders
+	
+	/*!
+	 @abstract	Construct a decoder of a specified class that reads the file at a specified location through a new file reader.
+	 */
+	template <typename DecoderClass>
+	static DecoderClass *CreateDecoder(CFURLRef location) throw(RBException)
+	{
+		PKFileReader *reader = new PKFileReader(location);
+		try
+		{
+			DecoderClass *decoder = new DecoderClass(reader);
+			reader->Release();
+			
+			return decoder;
+		}
+		catch (RBException e)
+		{
+			reader->Release();
+			throw;
+		}
+	}
+
+private:
+	PKFileReader(PKFileReader &reader);
+	PKFileReader &operator=(PKFileReader &reader);
+};
+
+#endif /* PKFileReader_h */
@@ -0,0 +1,152 @@
+/*
+ *  PKLatencyHistogram.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKLatencyHistogram.h"
+#include "CAHostTimeBase.h"
+
+#pragma mark Buckets
+
+//
+//	Durations below kNumberOfBucketsPerPowerOfTwo nanoseconds get a bucket each. Above that,
+//	each power of two is split into kNumberOfBucketsPerPowerOfTwo linear buckets using the two
+//	bits following the most significant bit of the duration.
+//
+
+UInt32 PKLatencyHistogram::GetBucketForDuration(UInt64 nanoseconds) throw()
+{
+	if(nanoseconds < kNumberOfBucketsPerPowerOfTwo)
+		return UInt32(nanoseconds);
+	
+	UInt32 mostSignificantBit = 63 - __builtin_clzll(nanoseconds);
+	UInt32 subBucket = UInt32(nanoseconds >> (mostSignificantBit - 2)) & (kNumberOfBucketsPerPowerOfTwo - 1);
+	
+	return ((mostSignificantBit - 1) * kNumberOfBucketsPerPowerOfTwo) + subBucket;
+}
+
+UInt64 PKLatencyHistogram::GetUpperBoundOfBucket(UInt32 bucket) throw()
+{
+	if(bucket < kNumberOfBucketsPerPowerOfTwo)
+		return bucket;
+	
+	UInt32 mostSignificantBit = (bucket / kNumberOfBucketsPerPowerOfTwo) + 1;
+	UInt64 subBucket = bucket % kNumberOfBucketsPerPowerOfTwo;
+	UInt64 lowerBound = (kNumberOfBucketsPerPowerOfTwo + subBucket) << (mostSignificantBit - 2);
+	
+	return lowerBound + ((1ULL << (mostSignificantBit - 2)) - 1);
+}
+
+#pragma mark -
+#pragma mark Lifecycle
+
+PKLatencyHistogram::PKLatencyHistogram(const char *stageName) throw(RBException) :
+	RBObject("PKLatencyHistogram"),
+	mStageName(stageName),
+	mMaximum(0)
+{
+	RBParameterAssert(stageName);
+	
+	for (UInt32 bucket = 0; bucket < kNumberOfBuckets; bucket++)
+		mBuckets[bucket].store(0, std::memory_order_relaxed);
+	
+	//The host time base initializes itself lazily, which we don't want to happen on the render thread.
+	CAHostTimeBase::GetFrequency();
+}
+
+PKLatencyHistogram::~PKLatencyHistogram()
+{
+	
+}
+
+#pragma mark -
+#pragma mark Recording
+
+void PKLatencyHistogram::Record(UInt64 nanoseconds) throw()
+{
+	//The counts are statistics that nothing else is published through, so they need no ordering.
+	mBuckets[GetBucketForDuration(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	
+	UInt64 maximum = mMaximum.load(std::memory_order_relaxed);
+	while (nanoseconds > maximum && !mMaximum.compare_exchange_weak(maximum, nanoseconds, std::memory_order_relaxed))
+		;
+}
+
+void PKLatencyHistogram::RecordHostTimeInterval(UInt64 startHostTime, UInt64 endHostTime) throw()
+{
+	this->Record(CAHostTimeBase::AbsoluteHostDeltaToNanos(startHostTime, endHostTime));
+}
+
+void PKLatencyHistogram::Reset() throw()
+{
+	for (UInt32 bucket = 0; bucket < kNumberOfBuckets; bucket++)
+		mBuckets[bucket].store(0, std::memory_order_relaxed);
+	
+	mMaximum.store(0, std::memory_order_relaxed);
+}
+
+#pragma mark -
+#pragma mark Reading
+
+UInt64 PKLatencyHistogram::GetPercentile(Float64 percentile) const throw()
+{
+	//We work from a snapshot so the buckets can't change under us between the two passes.
+	int32_t buckets[kNumberOfBuckets];
+	UInt64 numberOfSamples = 0;
+	
+	for (UInt32 bucket = 0; bucket < kNumberOfBuckets; bucket++)
+	{
+		buckets[bucket] = mBuckets[bucket].load(std::memory_order_relaxed);
+		numberOfSamples += buckets[bucket];
+	}
+	
+	if(numberOfSamples == 0)
+		return 0;
+	
+	UInt64 rank = UInt64(percentile * numberOfSamples);
+	if(rank >= numberOfSamples)
+		rank = numberOfSamples - 1;
+	
+	UInt64 maximum = this->GetMaximum();
+	UInt64 numberOfSamplesSeen = 0;
+	for (UInt32 bucket = 0; bucket < kNumberOfBuckets; bucket++)
+	{
+		numberOfSamplesSeen += buckets[bucket];
+		if(numberOfSamplesSeen > rank)
+		{
+			UInt64 upperBound = GetUpperBoundOfBucket(bucket);
+			return (upperBound < maximum)? upperBound : maximum;
+		}
+	}
+	
+	return maximum;
+}
+
+UInt64 PKLatencyHistogram::GetMaximum() const throw()
+{
+	return mMaximum.load(std::memory_order_relaxed);
+}
+
+UInt64 PKLatencyHistogram::GetNumberOfSamples() const throw()
+{
+	UInt64 numberOfSamples = 0;
+	for (UInt32 bucket = 0; bucket < kNumberOfBuckets; bucket++)
+		numberOfSamples += mBuckets[bucket].load(std::memory_order_relaxed);
+	
+	return numberOfSamples;
+}
+
+PKLatencyHistogram::Summary PKLatencyHistogram::GetSummary() const throw()
+{
+	Summary summary;
+	summary.numberOfSamples = this->GetNumberOfSamples();
+	summary.median = this->GetPercentile(0.5);
+	summary.ninetyNinthPercentile = this->GetPercentile(0.99);
+	summary.maximum = this->GetMaximum();
+	
+	return summary;
+}
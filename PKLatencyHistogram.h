@@ -0,0 +1,139 @@
+/*
+ *  PKLatencyHistogram.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKLatencyHistogram_h
+#define PKLatencyHistogram_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <atomic>
+
+#include "RBObject.h"
+#include "RBException.h"
+
+/*!
+ @class
+ @abstract		The PKLatencyHistogram class collects the durations of a single stage of the PlayerKit pipeline.
+ @discussion	Durations are counted into logarithmic buckets, four per power of two nanoseconds, which bounds
+				the error of any reported percentile to a quarter of its value. Recording a duration is a single
+				atomic increment, so it is safe to do from the real time render thread, and the histogram can
+				be read from any thread while it is being recorded into.
+ */
+class PK_VISIBILITY_HIDDEN PKLatencyHistogram : public RBObject
+{
+public:
+	enum {
+		/*!
+		 @abstract	The number of buckets each power of two is divided into.
+		 */
+		kNumberOfBucketsPerPowerOfTwo = 4,
+		
+		/*!
+		 @abstract	The total number of buckets in a histogram. Enough to cover every 64 bit duration.
+		 */
+		kNumberOfBuckets = 252,
+	};
+	
+	/*!
+	 @abstract	The Summary struct describes the shape of a histogram at a point in time. All durations are in nanoseconds.
+	 */
+	struct Summary {
+		UInt64 numberOfSamples;
+		UInt64 median;
+		UInt64 ninetyNinthPercentile;
+		UInt64 maximum;
+	};
+
+protected:
+	
+	/* n/a */	const char *mStageName;
+	/* n/a */	std::atomic<UInt64> mMaximum;
+	/* n/a */	std::atomic<int32_t> mBuckets[kNumberOfBuckets];
+	
+	/*!
+	 @abstract	Returns the bucket a duration is counted into.
+	 */
+	static UInt32 GetBucketForDuration(UInt64 nanoseconds) throw();
+	
+	/*!
+	 @abstract	Returns the largest duration counted into a bucket.
+	 */
+	static UInt64 GetUpperBoundOfBucket(UInt32 bucket) throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct an empty histogram for a stage with a specified name.
+	 @param		stageName	A constant string naming the stage the histogram times. Used for debugging.
+	 */
+	explicit PKLatencyHistogram(const char *stageName) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the histogram.
+	 */
+	virtual ~PKLatencyHistogram();
+	
+#pragma mark -
+#pragma mark Recording
+	
+	/*!
+	 @abstract		Count a duration in nanoseconds into the receiver.
+	 @discussion	This method never locks or allocates.
+	 */
+	void Record(UInt64 nanoseconds) throw();
+	
+	/*!
+	 @abstract		Count the duration between two host times into the receiver.
+	 @discussion	Host times are as returned by CAHostTimeBase::GetTheCurrentTime. This method never locks or allocates.
+	 */
+	void RecordHostTimeInterval(UInt64 startHostTime, UInt64 endHostTime) throw();
+	
+	/*!
+	 @abstract		Discard all of the durations counted into the receiver.
+	 @discussion	Durations being recorded while the receiver is reset may or may not survive the reset.
+	 */
+	void Reset() throw();
+	
+#pragma mark -
+#pragma mark Reading
+	
+	/*!
+	 @abstract	Returns the name of the stage the receiver times.
+	 */
+	const char *GetStageName() const throw() { return mStageName; }
+	
+	/*!
+	 @abstract		Returns the duration below which a specified fraction of the receiver's durations fall, in nanoseconds.
+	 @param			percentile	A value between 0.0 and 1.0.
+	 @discussion	The result is the upper bound of the bucket the percentile falls into, capped at the largest duration recorded.
+	 */
+	UInt64 GetPercentile(Float64 percentile) const throw();
+	
+	/*!
+	 @abstract	Returns the longest duration counted into the receiver, in nanoseconds.
+	 */
+	UInt64 GetMaximum() const throw();
+	
+	/*!
+	 @abstract	Returns the number of durations counted into the receiver.
+	 */
+	UInt64 GetNumberOfSamples() const throw();
+	
+	/*!
+	 @abstract	Returns the median, 99th percentile and maximum of the receiver's durations.
+	 */
+	Summary GetSummary() const throw();
+
+private:
+	PKLatencyHistogram(PKLatencyHistogram &histogram);
+	PKLatencyHistogram &operator=(PKLatencyHistogram &histogram);
+};
+
+#endif /* PKLatencyHistogram_h */
@@ -0,0 +1,628 @@
+/*
+ *  PKOggDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKOggDecoder.h"
+
+#if PK_ENABLE_OGG
+
+#include "CAStreamBasicDescription.h"
+
+enum {
+	//The number of bytes read from the file at a time.
+	kReadSize = 16 * 1024,
+	
+	//The number of frames the decoded buffers start out with room for. They grow to fit larger pages.
+	kInitialDecodedCapacity = 8192,
+	
+	//Bisection stops once the range being searched is smaller than this, and the rest is read page by page.
+	kSeekBisectionThreshold = 64 * 1024,
+};
+
+#pragma mark Tools
+
+static bool FindStreamSerialNumber(PKByteSource *source, const char *signature, size_t signatureLength, int *outSerialNumber) throw(RBException)
+{
+	ogg_sync_state syncState;
+	ogg_sync_init(&syncState);
+	
+	//
+	//	The first page of every stream in a file comes before any other page, so
+	//	we only have to look at the pages up to the first one that isn't a first page.
+	//
+	bool foundStream = false;
+	while (!foundStream)
+	{
+		ogg_page page;
+		long result = ogg_sync_pageseek(&syncState, &page);
+		if(result == 0)
+		{
+			char *buffer = ogg_sync_buffer(&syncState, kReadSize);
+			size_t amountRead = 0;
+			try
+			{
+				amountRead = buffer? source->Read(buffer, kReadSize) : 0;
+			}
+			catch (RBException e)
+			{
+				ogg_sync_clear(&syncState);
+				throw;
+			}
+			if(amountRead == 0)
+				break;
+			
+			ogg_sync_wrote(&syncState, long(amountRead));
+		}
+		else if((result < 0) || !ogg_page_bos(&page))
+		{
+			//An Ogg file starts with a page, so junk here means this isn't one.
+			break;
+		}
+		else
+		{
+			ogg_stream_state streamState;
+			ogg_stream_init(&streamState, ogg_page_serialno(&page));
+			
+			ogg_packet packet;
+			if((ogg_stream_pagein(&streamState, &page) == 0) &&
+			   (ogg_stream_packetout(&streamState, &packet) == 1) &&
+			   (packet.bytes >= long(signatureLength)) &&
+			   (memcmp(packet.packet, signature, signatureLength) == 0))
+			{
+				*outSerialNumber = ogg_page_serialno(&page);
+				foundStream = true;
+			}
+			
+			ogg_stream_clear(&streamState);
+		}
+	}
+	
+	ogg_sync_clear(&syncState);
+	
+	return foundStream;
+}
+
+bool PKOggDecoder::ContainsStream(CFURLRef location, const char *signature, size_t signatureLength) throw()
+{
+	PKFileReader *reader = NULL;
+	bool containsStream = false;
+	try
+	{
+		reader = new PKFileReader(location);
+		
+		int serialNumber = 0;
+		containsStream = FindStreamSerialNumber(reader, signature, signatureLength, &serialNumber);
+	}
+	catch (RBException e)
+	{
+		containsStream = false;
+	}
+	
+	if(reader)
+		reader->Release();
+	
+	return containsStream;
+}
+
+PKDecoder::ProbeResult PKOggDecoder::ProbeHeader(const UInt8 *header, UInt32 headerLength, const char *signature, size_t signatureLength) throw()
+{
+	if((headerLength < 27) || (memcmp(header, "OggS", 4) != 0))
+		return PKDecoder::kProbeResultNo;
+	
+	//The first packet of the first stream starts right after the first page's segment table.
+	UInt32 packetOffset = 27 + header[26];
+	if(((packetOffset + signatureLength) <= headerLength) && (memcmp(header + packetOffset, signature, signatureLength) == 0))
+		return PKDecoder::kProbeResultYes;
+	
+	//Files with more than one stream may put ours second.
+	return PKDecoder::kProbeResultMaybe;
+}
+
+#pragma mark -
+#pragma mark Lifetime
+
+PKOggDecoder::PKOggDecoder(const char *className, PKByteSource *source, const char *signature, size_t signatureLength) throw(RBException) :
+	PKDecoder(className),
+	mFileLocation(source->CopyLocation()),
+	mSource(source),
+	mFileLength(0),
+	mSyncOffset(0),
+	mSerialNumber(0),
+	mFirstAudioPageOffset(0),
+	mSeekIndex(NULL),
+	mStreamFormat(),
+	mNumberOfChannels(0),
+	mTotalNumberOfFrames(0),
+	mDecodedCapacity(0),
+	mDecodedFirstFrame(0),
+	mDecodedNumberOfFrames(0),
+	mDecodedOffset(0),
+	mNextDecodedFrame(0),
+	mNextDecodedFrameIsKnown(false),
+	mCurrentFrame(0),
+	mIsSeeking(false)
+{
+	memset(mDecodedBuffers, 0, sizeof(mDecodedBuffers));
+	memset(&mStreamState, 0, sizeof(mStreamState));
+	ogg_sync_init(&mSyncState);
+	
+	mSource->Retain();
+	mFileLength = mSource->GetLength();
+	RBAssert(mSource->CanSeek() && (mFileLength > 0), CFSTR("Ogg files can only be decoded from byte sources that can seek."));
+	
+	RBAssert(FindStreamSerialNumber(mSource, signature, signatureLength, &mSerialNumber),
+			 CFSTR("Ogg file does not contain a %s stream."), className);
+	
+	ogg_stream_init(&mStreamState, mSerialNumber);
+}
+
+PKOggDecoder::~PKOggDecoder()
+{
+	for (UInt32 channel = 0; channel < kMaximumNumberOfChannels; channel++)
+	{
+		if(mDecodedBuffers[channel])
+		{
+			free(mDecodedBuffers[channel]);
+			mDecodedBuffers[channel] = NULL;
+		}
+	}
+	
+	ogg_stream_clear(&mStreamState);
+	ogg_sync_clear(&mSyncState);
+	
+	if(mSeekIndex)
+	{
+		mSeekIndex->SaveInBackground();
+		mSeekIndex->Release();
+		mSeekIndex = NULL;
+	}
+	
+	if(mSource)
+	{
+		mSource->Release();
+		mSource = NULL;
+	}
+	
+	if(mFileLocation)
+	{
+		CFRelease(mFileLocation);
+		mFileLocation = NULL;
+	}
+}
+
+#pragma mark -
+
+void PKOggDecoder::Open() throw(RBException)
+{
+	this->SetFileOffset(0);
+	
+	bool hasReadHeaders = false;
+	while (!hasReadHeaders)
+	{
+		ogg_page page;
+		RBAssert(this->ReadStreamPage(page, NULL), CFSTR("Ogg stream ends before its headers do."));
+		RBAssert((ogg_stream_pagein(&mStreamState, &page) == 0), CFSTR("Ogg stream header page is damaged."));
+		
+		ogg_packet packet;
+		int result = 0;
+		while (!hasReadHeaders && ((result = ogg_stream_packetout(&mStreamState, &packet)) != 0))
+		{
+			RBAssert((result > 0), CFSTR("Ogg stream headers are damaged."));
+			hasReadHeaders = this->ReadHeaderPacket(packet);
+		}
+	}
+	
+	//Audio always starts on a fresh page.
+	mFirstAudioPageOffset = mSyncOffset;
+	
+	RBAssert((mNumberOfChannels > 0) && (mNumberOfChannels <= kMaximumNumberOfChannels),
+			 CFSTR("Ogg stream has %ld channels, only 1 to %d are supported."), mNumberOfChannels, kMaximumNumberOfChannels);
+	RBAssert((mStreamFormat.mSampleRate > 0.0), CFSTR("Ogg stream has no sample rate."));
+	
+	SInt64 lastGranulePosition = this->FindLastGranulePosition();
+	if(lastGranulePosition >= 0)
+	{
+		SInt64 lastFrame = this->GetFrameForGranulePosition(lastGranulePosition);
+		if(lastFrame > 0)
+			mTotalNumberOfFrames = UInt64(lastFrame);
+	}
+	
+	mDecodedCapacity = kInitialDecodedCapacity;
+	for (UInt32 channel = 0; channel < mNumberOfChannels; channel++)
+	{
+		mDecodedBuffers[channel] = (Float32 *)calloc(mDecodedCapacity, sizeof(Float32));
+		RBAssert((mDecodedBuffers[channel] != NULL), CFSTR("Could not allocate Ogg decode buffers of %ld frames."), mDecodedCapacity);
+	}
+	
+	CAStreamBasicDescription format;
+	format.mSampleRate = mStreamFormat.mSampleRate;
+	format.SetCanonical(mNumberOfChannels, false);
+	mStreamFormat = format;
+	
+	mSeekIndex = PKSeekIndex::CreateForByteSource(mSource, UInt64(mStreamFormat.mSampleRate));
+	
+	this->Rewind();
+}
+
+#pragma mark -
+#pragma mark Reading Pages
+
+void PKOggDecoder::SetFileOffset(UInt64 offset) throw(RBException)
+{
+	mSource->SetOffset(offset);
+	
+	ogg_sync_reset(&mSyncState);
+	mSyncOffset = offset;
+}
+
+bool PKOggDecoder::ReadPage(ogg_page &page, UInt64 *outPageOffset) throw(RBException)
+{
+	for (;;)
+	{
+		long result = ogg_sync_pageseek(&mSyncState, &page);
+		if(result > 0)
+		{
+			if(outPageOffset)
+				*outPageOffset = mSyncOffset;
+			
+			mSyncOffset += result;
+			
+			return true;
+		}
+		else if(result < 0)
+		{
+			//Damaged or unrecognized bytes were skipped looking for the next page.
+			mSyncOffset += -result;
+			continue;
+		}
+		
+		char *buffer = ogg_sync_buffer(&mSyncState, kReadSize);
+		RBAssert((buffer != NULL), CFSTR("Could not allocate Ogg read buffer."));
+		
+		size_t amountRead = mSource->Read(buffer, kReadSize);
+		if(amountRead == 0)
+			return false;
+		
+		ogg_sync_wrote(&mSyncState, long(amountRead));
+	}
+}
+
+bool PKOggDecoder::ReadStreamPage(ogg_page &page, UInt64 *outPageOffset) throw(RBException)
+{
+	while (this->ReadPage(page, outPageOffset))
+	{
+		if(ogg_page_serialno(&page) == mSerialNumber)
+			return true;
+	}
+	
+	return false;
+}
+
+SInt64 PKOggDecoder::FindLastGranulePosition() throw(RBException)
+{
+	//
+	//	Rather than reading the whole file we read backwards from the end in
+	//	growing chunks until we find a chunk with a page from our stream in it.
+	//
+	UInt64 chunkSize = kReadSize;
+	UInt64 endOffset = mFileLength;
+	while (endOffset > mFirstAudioPageOffset)
+	{
+		UInt64 startOffset = mFirstAudioPageOffset;
+		if((endOffset - mFirstAudioPageOffset) > chunkSize)
+			startOffset = endOffset - chunkSize;
+		
+		this->SetFileOffset(startOffset);
+		
+		SInt64 lastGranulePosition = -1;
+		ogg_page page;
+		UInt64 pageOffset = 0;
+		while (this->ReadStreamPage(page, &pageOffset) && (pageOffset < endOffset))
+		{
+			if(ogg_page_granulepos(&page) != -1)
+				lastGranulePosition = ogg_page_granulepos(&page);
+		}
+		
+		if(lastGranulePosition != -1)
+			return lastGranulePosition;
+		
+		endOffset = startOffset;
+		chunkSize *= 2;
+	}
+	
+	return -1;
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+AudioStreamBasicDescription PKOggDecoder::GetStreamFormat() const
+{
+	return mStreamFormat;
+}
+
+CFURLRef PKOggDecoder::CopyLocation() const
+{
+	return mFileLocation? CFURLRef(CFRetain(mFileLocation)) : NULL;
+}
+
+#pragma mark -
+
+PKDecoder::FrameLocation PKOggDecoder::GetTotalNumberOfFrames() const
+{
+	return mTotalNumberOfFrames;
+}
+
+#pragma mark -
+
+bool PKOggDecoder::CanSeek() const
+{
+	//Without a length there's nothing to seek against.
+	return (mTotalNumberOfFrames > 0);
+}
+
+PKDecoder::FrameLocation PKOggDecoder::GetCurrentFrame() const
+{
+	return mCurrentFrame;
+}
+
+void PKOggDecoder::SetCurrentFrame(PKDecoder::FrameLocation currentFrame)
+{
+	if(currentFrame > mTotalNumberOfFrames)
+		return;
+	
+	//
+	//	We look for the last page that ends at least a preroll before `currentFrame`, and
+	//	start decoding from the page after it. The granule positions of pages only increase,
+	//	so the file is bisected on them until the range left is small, then read page by page.
+	//
+	SInt64 targetFrame = SInt64(currentFrame) - SInt64(this->GetSeekPreroll());
+	
+	UInt64 startOffset = mFirstAudioPageOffset;
+	if(targetFrame > 0)
+	{
+		ogg_page page;
+		UInt64 pageOffset = 0;
+		
+		UInt64 lowerOffset = mFirstAudioPageOffset;
+		UInt64 upperOffset = mFileLength;
+		
+		//Pages seen while playing the file before narrow the range first, which usually leaves nothing to bisect.
+		PKSeekIndex::Entry entry;
+		if(mSeekIndex && mSeekIndex->FindEntryAtOrBefore(UInt64(targetFrame), entry) && (entry.offset > lowerOffset) && (entry.offset < upperOffset))
+		{
+			lowerOffset = entry.offset;
+			startOffset = lowerOffset;
+		}
+		
+		if(mSeekIndex && mSeekIndex->FindEntryAfter(UInt64(targetFrame), entry) && (entry.offset > lowerOffset) && (entry.offset < upperOffset))
+			upperOffset = entry.offset;
+		
+		while ((upperOffset - lowerOffset) > kSeekBisectionThreshold)
+		{
+			UInt64 middleOffset = lowerOffset + ((upperOffset - lowerOffset) / 2);
+			this->SetFileOffset(middleOffset);
+			
+			SInt64 granulePosition = -1;
+			while ((granulePosition == -1) && this->ReadStreamPage(page, &pageOffset) && (pageOffset < upperOffset))
+				granulePosition = ogg_page_granulepos(&page);
+			
+			if((granulePosition != -1) && (this->GetFrameForGranulePosition(granulePosition) <= targetFrame))
+			{
+				lowerOffset = mSyncOffset;
+				startOffset = lowerOffset;
+			}
+			else
+			{
+				upperOffset = middleOffset;
+			}
+		}
+		
+		this->SetFileOffset(lowerOffset);
+		while (this->ReadStreamPage(page, &pageOffset))
+		{
+			SInt64 granulePosition = ogg_page_granulepos(&page);
+			if(granulePosition == -1)
+				continue;
+			
+			if(this->GetFrameForGranulePosition(granulePosition) > targetFrame)
+				break;
+			
+			startOffset = mSyncOffset;
+		}
+	}
+	
+	if(startOffset == mFirstAudioPageOffset)
+	{
+		this->Rewind();
+	}
+	else
+	{
+		//Where the decoded audio lands is worked out from the granule position of the first page decoded.
+		this->SetFileOffset(startOffset);
+		ogg_stream_reset(&mStreamState);
+		this->ResetDecoder();
+		
+		mNextDecodedFrameIsKnown = false;
+	}
+	
+	//FillBuffers decodes forward from here, dropping everything before `currentFrame`.
+	mDecodedNumberOfFrames = 0;
+	mDecodedOffset = 0;
+	mCurrentFrame = currentFrame;
+	mIsSeeking = true;
+}
+
+#pragma mark -
+#pragma mark Decoding
+
+void PKOggDecoder::Rewind() throw(RBException)
+{
+	this->SetFileOffset(mFirstAudioPageOffset);
+	ogg_stream_reset(&mStreamState);
+	this->ResetDecoder();
+	
+	mDecodedNumberOfFrames = 0;
+	mDecodedOffset = 0;
+	mNextDecodedFrame = this->GetInitialFrame();
+	mNextDecodedFrameIsKnown = true;
+}
+
+UInt32 PKOggDecoder::AppendDecodedFrames(UInt32 numberOfFrames) throw(RBException)
+{
+	UInt32 requiredCapacity = mDecodedNumberOfFrames + numberOfFrames;
+	if(requiredCapacity > mDecodedCapacity)
+	{
+		UInt32 newCapacity = mDecodedCapacity * 2;
+		if(newCapacity < requiredCapacity)
+			newCapacity = requiredCapacity;
+		
+		for (UInt32 channel = 0; channel < mNumberOfChannels; channel++)
+		{
+			Float32 *newBuffer = (Float32 *)realloc(mDecodedBuffers[channel], newCapacity * sizeof(Float32));
+			RBAssert((newBuffer != NULL), CFSTR("Could not grow Ogg decode buffers to %ld frames."), newCapacity);
+			
+			mDecodedBuffers[channel] = newBuffer;
+		}
+		
+		mDecodedCapacity = newCapacity;
+	}
+	
+	UInt32 index = mDecodedNumberOfFrames;
+	mDecodedNumberOfFrames += numberOfFrames;
+	
+	return index;
+}
+
+bool PKOggDecoder::DecodeNextPages() throw(RBException)
+{
+	mDecodedNumberOfFrames = 0;
+	mDecodedOffset = 0;
+	
+	for (;;)
+	{
+		ogg_page page;
+		if(!this->ReadStreamPage(page, NULL))
+		{
+			//Audio decoded after the last granule position can only be used if we know where it goes.
+			if((mDecodedNumberOfFrames > 0) && mNextDecodedFrameIsKnown)
+			{
+				mDecodedFirstFrame = mNextDecodedFrame;
+				mNextDecodedFrame += mDecodedNumberOfFrames;
+				
+				return true;
+			}
+			
+			mDecodedNumberOfFrames = 0;
+			return false;
+		}
+		
+		if(ogg_stream_pagein(&mStreamState, &page) != 0)
+			continue;
+		
+		ogg_packet packet;
+		int result = 0;
+		while ((result = ogg_stream_packetout(&mStreamState, &packet)) != 0)
+		{
+			//Data was lost, so counting frames from the last page no longer tells us where we are.
+			if(result < 0)
+			{
+				mNextDecodedFrameIsKnown = false;
+				continue;
+			}
+			
+			this->DecodePacket(packet);
+		}
+		
+		//A page with no packets ending on it doesn't tell us where we are.
+		SInt64 granulePosition = ogg_page_granulepos(&page);
+		if(granulePosition == -1)
+			continue;
+		
+		SInt64 endFrame = this->GetFrameForGranulePosition(granulePosition);
+		if(mSeekIndex && (endFrame > 0))
+			mSeekIndex->NoteEntry(UInt64(endFrame), mSyncOffset);
+		
+		SInt64 firstFrame = mNextDecodedFrameIsKnown? mNextDecodedFrame : (endFrame - SInt64(mDecodedNumberOfFrames));
+		
+		//The last page's granule position trims off the padding the encoder added to the last packet.
+		if(ogg_page_eos(&page) && ((firstFrame + SInt64(mDecodedNumberOfFrames)) > endFrame))
+			mDecodedNumberOfFrames = (endFrame > firstFrame)? UInt32(endFrame - firstFrame) : 0;
+		
+		//Anything before the start of the stream is the codec priming itself.
+		if(firstFrame < 0)
+			mDecodedOffset = (SInt64(mDecodedNumberOfFrames) < -firstFrame)? mDecodedNumberOfFrames : UInt32(-firstFrame);
+		
+		mDecodedFirstFrame = firstFrame;
+		mNextDecodedFrame = firstFrame + mDecodedNumberOfFrames;
+		mNextDecodedFrameIsKnown = true;
+		
+		if(mDecodedOffset < mDecodedNumberOfFrames)
+			return true;
+		
+		mDecodedNumberOfFrames = 0;
+		mDecodedOffset = 0;
+	}
+}
+
+UInt32 PKOggDecoder::FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException)
+{
+	RBParameterAssert(buffers);
+	
+	UInt32 numberOfBuffers = buffers->mNumberBuffers;
+	if(numberOfBuffers > mNumberOfChannels)
+		numberOfBuffers = mNumberOfChannels;
+	
+	UInt32 numberOfFramesFilled = 0;
+	while (numberOfFramesFilled < numberOfFrames)
+	{
+		if(mDecodedOffset >= mDecodedNumberOfFrames)
+		{
+			if(!this->DecodeNextPages())
+				break;
+			
+			if(mIsSeeking)
+			{
+				SInt64 currentFrame = SInt64(mCurrentFrame);
+				if((mDecodedFirstFrame + SInt64(mDecodedNumberOfFrames)) <= currentFrame)
+				{
+					mDecodedOffset = mDecodedNumberOfFrames;
+					continue;
+				}
+				
+				if(currentFrame > (mDecodedFirstFrame + SInt64(mDecodedOffset)))
+					mDecodedOffset = UInt32(currentFrame - mDecodedFirstFrame);
+				
+				mIsSeeking = false;
+			}
+		}
+		
+		UInt32 numberOfFramesToCopy = mDecodedNumberOfFrames - mDecodedOffset;
+		if(numberOfFramesToCopy > (numberOfFrames - numberOfFramesFilled))
+			numberOfFramesToCopy = (numberOfFrames - numberOfFramesFilled);
+		
+		for (UInt32 index = 0; index < numberOfBuffers; index++)
+		{
+			memcpy((Float32 *)(buffers->mBuffers[index].mData) + numberOfFramesFilled,
+				   mDecodedBuffers[index] + mDecodedOffset,
+				   numberOfFramesToCopy * sizeof(Float32));
+		}
+		
+		mDecodedOffset += numberOfFramesToCopy;
+		numberOfFramesFilled += numberOfFramesToCopy;
+	}
+	
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFramesFilled * sizeof(Float32);
+	
+	mCurrentFrame += numberOfFramesFilled;
+	
+	return numberOfFramesFilled;
+}
+
+#endif /* PK_ENABLE_OGG */
@@ -0,0 +1,216 @@
+/*
+ *  PKOggDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKOggDecoder_h
+#define PKOggDecoder_h 1
+
+#include "PKDecoder.h"
+#include "PKFileReader.h"
+#include "PKSeekIndex.h"
+
+#if PK_ENABLE_OGG
+
+#include <ogg/ogg.h>
+
+/*!
+ @class
+ @abstract		The PKOggDecoder class is the abstract base of the decoders for codecs carried in Ogg files.
+ @discussion	PKOggDecoder reads the pages of the first logical stream in a file whose identification header
+				matches its subclass's codec, and hands that stream's packets to its subclass to decode. Decoded
+				audio is placed on the stream's timeline using the granule positions of the pages it came from.
+				
+				The length of the stream is taken from the granule position of its last page, which is found by
+				reading backwards from the end of the file. Seeking bisects the file on granule positions, between
+				the closest entries of a seek index built up as the file is played.
+ */
+class PK_VISIBILITY_HIDDEN PKOggDecoder : public PKDecoder
+{
+public:
+	enum {
+		/*!
+		 @abstract	The largest number of channels the receiver decodes.
+		 */
+		kMaximumNumberOfChannels = 8,
+	};
+
+protected:
+	
+	/* owner */	CFURLRef mFileLocation;
+	/* owner */	PKByteSource *mSource;
+	/* n/a */	UInt64 mFileLength;
+	
+	//Pages
+	/* n/a */	ogg_sync_state mSyncState;
+	/* n/a */	UInt64 mSyncOffset;
+	/* n/a */	ogg_stream_state mStreamState;
+	/* n/a */	int mSerialNumber;
+	/* n/a */	UInt64 mFirstAudioPageOffset;
+	/* owner */	PKSeekIndex *mSeekIndex;
+	
+	//Stream Info
+	/* n/a */	AudioStreamBasicDescription mStreamFormat;
+	/* n/a */	UInt32 mNumberOfChannels;
+	/* n/a */	UInt64 mTotalNumberOfFrames;
+	
+	//Decoded Audio
+	/* owner */	Float32 *mDecodedBuffers[kMaximumNumberOfChannels];
+	/* n/a */	UInt32 mDecodedCapacity;
+	/* n/a */	SInt64 mDecodedFirstFrame;
+	/* n/a */	UInt32 mDecodedNumberOfFrames;
+	/* n/a */	UInt32 mDecodedOffset;
+	/* n/a */	SInt64 mNextDecodedFrame;
+	/* n/a */	bool mNextDecodedFrameIsKnown;
+	
+	/* n/a */	UInt64 mCurrentFrame;
+	/* n/a */	bool mIsSeeking;
+	
+#pragma mark -
+#pragma mark Reading Pages
+	
+	/*!
+	 @abstract	Discard everything that has been read and continue reading pages at a specified offset in the file.
+	 */
+	void SetFileOffset(UInt64 offset) throw(RBException);
+	
+	/*!
+	 @abstract	Read the next page in the file, belonging to any stream.
+	 @result	true if a page was read; false if the end of the file was reached first.
+	 */
+	bool ReadPage(ogg_page &page, UInt64 *outPageOffset) throw(RBException);
+	
+	/*!
+	 @abstract	Read the next page in the file belonging to the receiver's stream.
+	 @result	true if a page was read; false if the end of the file was reached first.
+	 */
+	bool ReadStreamPage(ogg_page &page, UInt64 *outPageOffset) throw(RBException);
+	
+	/*!
+	 @abstract	Returns the granule position of the last page in the receiver's stream that has one, or -1.
+	 */
+	SInt64 FindLastGranulePosition() throw(RBException);
+	
+#pragma mark -
+#pragma mark Subclass Hooks
+	
+	/*!
+	 @abstract		Finish opening the receiver.
+	 @discussion	Subclasses call this method from their constructors. It feeds the stream's header packets to
+					ReadHeaderPacket, and then works out the length and format of the stream.
+	 */
+	void Open() throw(RBException);
+	
+	/*!
+	 @abstract		Read one of the header packets at the start of the receiver's stream.
+	 @result		true once all of the headers have been read; false if more are needed.
+	 @discussion	Subclasses must fill in the sample rate and number of channels in mStreamFormat and mNumberOfChannels.
+	 */
+	virtual bool ReadHeaderPacket(ogg_packet &packet) throw(RBException) PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract		Decode an audio packet, appending its output to the receiver's decoded buffers.
+	 @discussion	Subclasses get room for their output in mDecodedBuffers from AppendDecodedFrames.
+	 */
+	virtual void DecodePacket(ogg_packet &packet) throw(RBException) PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Discard the state the subclass's codec carries between packets. Called before decoding from a new position.
+	 */
+	virtual void ResetDecoder() throw(RBException) PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Returns the frame that a granule position of the receiver's stream corresponds to.
+	 */
+	virtual SInt64 GetFrameForGranulePosition(SInt64 granulePosition) const throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Returns how many frames must be decoded and thrown away before output is correct after a seek.
+	 */
+	virtual UInt32 GetSeekPreroll() const throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract	Returns the frame of the first sample decoded from the start of the stream. This is negative when the codec asks for samples to be skipped.
+	 */
+	virtual SInt64 GetInitialFrame() const throw() PK_PURE_VIRTUAL;
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	/*!
+	 @abstract	Add a specified number of frames to the end of the receiver's decoded buffers for a subclass to write into.
+	 @result	The index in mDecodedBuffers to write the new frames at.
+	 */
+	UInt32 AppendDecodedFrames(UInt32 numberOfFrames) throw(RBException);
+	
+	/*!
+	 @abstract	Decode pages until a page that places the decoded audio on the stream's timeline has been decoded.
+	 @result	false if the end of the file has been reached; true otherwise.
+	 */
+	bool DecodeNextPages() throw(RBException);
+	
+	/*!
+	 @abstract	Position the receiver at the start of the first audio page, ready to decode the stream from the beginning.
+	 */
+	void Rewind() throw(RBException);
+	
+#pragma mark -
+#pragma mark Lifetime
+	
+	/*!
+	 @abstract	Construct an Ogg decoder for the first stream in a byte source whose first packet begins with a specified signature.
+	 @param		source	The byte source to read from. It must be able to seek, as the length of the stream is read from its end.
+	 */
+	PKOggDecoder(const char *className, PKByteSource *source, const char *signature, size_t signatureLength) throw(RBException);
+
+public:
+	
+	/*!
+	 @abstract	Returns whether or not a file at a specified location contains a stream whose first packet begins with a specified signature.
+	 */
+	static bool ContainsStream(CFURLRef location, const char *signature, size_t signatureLength) throw();
+	
+	/*!
+	 @abstract	Decides whether or not the start of a file shows a stream whose first packet begins with a specified signature.
+	 */
+	static PKDecoder::ProbeResult ProbeHeader(const UInt8 *header, UInt32 headerLength, const char *signature, size_t signatureLength) throw();
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKOggDecoder();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual AudioStreamBasicDescription GetStreamFormat() const;
+	virtual CFURLRef CopyLocation() const;
+	
+#pragma mark -
+	
+	virtual PKDecoder::FrameLocation GetTotalNumberOfFrames() const;
+	
+#pragma mark -
+	
+	virtual bool CanSeek() const;
+	
+	virtual PKDecoder::FrameLocation GetCurrentFrame() const;
+	virtual void SetCurrentFrame(PKDecoder::FrameLocation currentFrame);
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	virtual UInt32 FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException);
+
+private:
+	PKOggDecoder(PKOggDecoder &decoder);
+	PKOggDecoder &operator=(PKOggDecoder &decoder);
+};
+
+#endif /* PK_ENABLE_OGG */
+
+#endif /* PKOggDecoder_h */
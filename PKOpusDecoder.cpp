@@ -0,0 +1,165 @@
+/*
+ *  PKOpusDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKOpusDecoder.h"
+
+#if PK_ENABLE_OGG
+
+#include <Accelerate/Accelerate.h>
+#include <libkern/OSByteOrder.h>
+
+static const char kOpusSignature[] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd' };
+
+//Opus is always decoded at this rate, whatever rate the original audio had.
+static Float64 const kOpusSampleRate = 48000.0;
+
+#pragma mark Lifetime
+
+PKOpusDecoder::PKOpusDecoder(PKByteSource *source) throw(RBException) :
+	PKOggDecoder("PKOpusDecoder", source, kOpusSignature, sizeof(kOpusSignature)),
+	mDecoder(NULL),
+	mInterleavedBuffer(NULL),
+	mPreSkip(0),
+	mNumberOfHeadersRead(0)
+{
+	this->Open();
+	
+	mInterleavedBuffer = (Float32 *)calloc(kMaximumFramesPerPacket * mNumberOfChannels, sizeof(Float32));
+	RBAssert((mInterleavedBuffer != NULL), CFSTR("Could not allocate Opus decode buffer."));
+}
+
+PKOpusDecoder::~PKOpusDecoder()
+{
+	if(mInterleavedBuffer)
+	{
+		free(mInterleavedBuffer);
+		mInterleavedBuffer = NULL;
+	}
+	
+	if(mDecoder)
+	{
+		opus_multistream_decoder_destroy(mDecoder);
+		mDecoder = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Subclass Hooks
+
+bool PKOpusDecoder::ReadHeaderPacket(ogg_packet &packet) throw(RBException)
+{
+	//The comment header follows the identification header, and isn't of any use to us.
+	if(mNumberOfHeadersRead++ > 0)
+		return true;
+	
+	const UInt8 *header = packet.packet;
+	RBAssert((packet.bytes >= 19), CFSTR("Opus identification header is too short."));
+	RBAssert(((header[8] >> 4) == 0), CFSTR("Opus stream has unsupported version %d."), header[8]);
+	
+	UInt32 numberOfChannels = header[9];
+	mPreSkip = OSReadLittleInt16(header, 10);
+	SInt16 outputGain = SInt16(OSReadLittleInt16(header, 16));
+	UInt8 mappingFamily = header[18];
+	
+	//Family 0 is mono or stereo in a single stream, and leaves the mapping out.
+	int numberOfStreams = 1;
+	int numberOfCoupledStreams = (numberOfChannels > 1)? 1 : 0;
+	unsigned char defaultMapping[2] = { 0, 1 };
+	const unsigned char *mapping = defaultMapping;
+	if(mappingFamily == 0)
+	{
+		RBAssert((numberOfChannels > 0) && (numberOfChannels <= 2), CFSTR("Opus stream has %ld channels without a channel mapping."), numberOfChannels);
+	}
+	else
+	{
+		RBAssert((packet.bytes >= long(21 + numberOfChannels)), CFSTR("Opus channel mapping is too short."));
+		
+		numberOfStreams = header[19];
+		numberOfCoupledStreams = header[20];
+		mapping = header + 21;
+	}
+	
+	int error = OPUS_OK;
+	mDecoder = opus_multistream_decoder_create(opus_int32(kOpusSampleRate), int(numberOfChannels), numberOfStreams, numberOfCoupledStreams, mapping, &error);
+	RBAssert((error == OPUS_OK) && (mDecoder != NULL), CFSTR("Could not create Opus decoder, error %d."), error);
+	
+	if(outputGain != 0)
+		opus_multistream_decoder_ctl(mDecoder, OPUS_SET_GAIN(outputGain));
+	
+	mStreamFormat.mSampleRate = kOpusSampleRate;
+	mNumberOfChannels = numberOfChannels;
+	
+	return false;
+}
+
+void PKOpusDecoder::DecodePacket(ogg_packet &packet) throw(RBException)
+{
+	int numberOfFrames = opus_multistream_decode_float(mDecoder, packet.packet, opus_int32(packet.bytes), mInterleavedBuffer, kMaximumFramesPerPacket, 0);
+	
+	//Damaged packets are skipped.
+	if(numberOfFrames <= 0)
+		return;
+	
+	UInt32 index = this->AppendDecodedFrames(UInt32(numberOfFrames));
+	for (UInt32 channel = 0; channel < mNumberOfChannels; channel++)
+		cblas_scopy(numberOfFrames, mInterleavedBuffer + channel, int(mNumberOfChannels), mDecodedBuffers[channel] + index, 1);
+}
+
+void PKOpusDecoder::ResetDecoder() throw(RBException)
+{
+	opus_multistream_decoder_ctl(mDecoder, OPUS_RESET_STATE);
+}
+
+SInt64 PKOpusDecoder::GetFrameForGranulePosition(SInt64 granulePosition) const throw()
+{
+	return granulePosition - SInt64(mPreSkip);
+}
+
+UInt32 PKOpusDecoder::GetSeekPreroll() const throw()
+{
+	return kSeekPreroll;
+}
+
+SInt64 PKOpusDecoder::GetInitialFrame() const throw()
+{
+	return -SInt64(mPreSkip);
+}
+
+#pragma mark -
+#pragma mark Description
+
+static bool CanDecode(CFURLRef fileLocation)
+{
+	return PKOggDecoder::ContainsStream(fileLocation, kOpusSignature, sizeof(kOpusSignature));
+}
+
+static PKDecoder::ProbeResult Probe(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension)
+{
+	return PKOggDecoder::ProbeHeader(header, headerLength, kOpusSignature, sizeof(kOpusSignature));
+}
+
+static CFArrayRef CopySupportedTypes()
+{
+	CFStringRef types[] = { CFSTR("org.xiph.opus"), CFSTR("org.xiph.oga") };
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)types, 2, &kCFTypeArrayCallBacks);
+}
+
+static PKDecoder *CreateInstance(CFURLRef fileLocation) throw(RBException)
+{
+	return PKFileReader::CreateDecoder<PKOpusDecoder>(fileLocation);
+}
+
+static PKDecoder *CreateInstanceWithByteSource(PKByteSource *source) throw(RBException)
+{
+	return new PKOpusDecoder(source);
+}
+
+PKDecoder::Description PKOpusDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance, &Probe, &CreateInstanceWithByteSource };
+
+#endif /* PK_ENABLE_OGG */
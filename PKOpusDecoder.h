@@ -0,0 +1,80 @@
+/*
+ *  PKOpusDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKOpusDecoder_h
+#define PKOpusDecoder_h 1
+
+#include "PKOggDecoder.h"
+
+#if PK_ENABLE_OGG
+
+#include <opus/opus_multistream.h>
+
+/*!
+ @class
+ @abstract		The PKOpusDecoder class decodes Ogg Opus files with libopus.
+ @discussion	Opus is always decoded at 48kHz. The pre-skip and output gain in the stream's header are applied,
+				and multichannel streams are decoded with the channel mapping the header describes.
+ */
+class PK_VISIBILITY_HIDDEN PKOpusDecoder : public PKOggDecoder
+{
+public:
+	enum {
+		/*!
+		 @abstract	The largest number of frames in an Opus packet, 120ms at 48kHz.
+		 */
+		kMaximumFramesPerPacket = 5760,
+		
+		/*!
+		 @abstract	The number of frames to decode before output is correct after a seek, 80ms at 48kHz.
+		 */
+		kSeekPreroll = 3840,
+	};
+
+protected:
+	
+	/* owner */	OpusMSDecoder *mDecoder;
+	/* owner */	Float32 *mInterleavedBuffer;
+	/* n/a */	UInt32 mPreSkip;
+	/* n/a */	UInt32 mNumberOfHeadersRead;
+	
+#pragma mark -
+#pragma mark Subclass Hooks
+	
+	virtual bool ReadHeaderPacket(ogg_packet &packet) throw(RBException);
+	virtual void DecodePacket(ogg_packet &packet) throw(RBException);
+	virtual void ResetDecoder() throw(RBException);
+	virtual SInt64 GetFrameForGranulePosition(SInt64 granulePosition) const throw();
+	virtual UInt32 GetSeekPreroll() const throw();
+	virtual SInt64 GetInitialFrame() const throw();
+
+public:
+
+#pragma mark Lifetime
+	
+	/*!
+	 @abstract	Construct an Opus decoder reading from a specified byte source.
+	 */
+	explicit PKOpusDecoder(PKByteSource *source) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKOpusDecoder();
+
+private:
+	PKOpusDecoder(PKOpusDecoder &decoder);
+	PKOpusDecoder &operator=(PKOpusDecoder &decoder);
+};
+
+extern PKDecoder::Description PKOpusDecoderDescription;
+
+#endif /* PK_ENABLE_OGG */
+
+#endif /* PKOpusDecoder_h */
@@ -0,0 +1,698 @@
+/*
+ *  PKPCMDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKPCMDecoder.h"
+#include <Accelerate/Accelerate.h>
+#include <libkern/OSByteOrder.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "CAStreamBasicDescription.h"
+
+#pragma mark Tools
+
+static bool const kHostIsBigEndian = (OSHostByteOrder() == OSBigEndian);
+
+static Float64 ReadBigFloat64(const UInt8 *bytes)
+{
+	UInt64 bits = OSReadBigInt64(bytes, 0);
+	Float64 value;
+	memcpy(&value, &bits, sizeof(value));
+	
+	return value;
+}
+
+static Float64 ReadBigExtended80(const UInt8 *bytes)
+{
+	UInt16 signAndExponent = OSReadBigInt16(bytes, 0);
+	UInt64 mantissa = OSReadBigInt64(bytes, 2);
+	
+	Float64 value = ldexp(Float64(mantissa), int(signAndExponent & 0x7FFF) - 16383 - 63);
+	return ((signAndExponent & 0x8000) == 0x8000)? -value : value;
+}
+
+static UInt32 GetBytesPerSample(PKPCMDecoder::SampleType sampleType)
+{
+	switch (sampleType)
+	{
+		case PKPCMDecoder::kSampleTypeUnsignedInt8:
+		case PKPCMDecoder::kSampleTypeInt8:
+			return 1;
+		
+		case PKPCMDecoder::kSampleTypeInt16:
+			return 2;
+		
+		case PKPCMDecoder::kSampleTypeInt24:
+			return 3;
+		
+		case PKPCMDecoder::kSampleTypeInt32:
+		case PKPCMDecoder::kSampleTypeFloat32:
+			return 4;
+		
+		case PKPCMDecoder::kSampleTypeFloat64:
+			return 8;
+	}
+	
+	return 0;
+}
+
+static bool GetIntegerSampleType(UInt32 bitsPerSample, bool isSigned, PKPCMDecoder::SampleType &outSampleType)
+{
+	switch ((bitsPerSample + 7) / 8)
+	{
+		case 1:
+			outSampleType = isSigned? PKPCMDecoder::kSampleTypeInt8 : PKPCMDecoder::kSampleTypeUnsignedInt8;
+			return true;
+		
+		case 2:
+			outSampleType = PKPCMDecoder::kSampleTypeInt16;
+			return true;
+		
+		case 3:
+			outSampleType = PKPCMDecoder::kSampleTypeInt24;
+			return true;
+		
+		case 4:
+			outSampleType = PKPCMDecoder::kSampleTypeInt32;
+			return true;
+		
+		default:
+			return false;
+	}
+}
+
+static bool GetFloatSampleType(UInt32 bitsPerSample, PKPCMDecoder::SampleType &outSampleType)
+{
+	if(bitsPerSample == 32)
+		outSampleType = PKPCMDecoder::kSampleTypeFloat32;
+	else if(bitsPerSample == 64)
+		outSampleType = PKPCMDecoder::kSampleTypeFloat64;
+	else
+		return false;
+	
+	return true;
+}
+
+static void ClipDataToFile(PKPCMDecoder::Layout &layout, UInt64 fileLength)
+{
+	if(layout.dataOffset > fileLength)
+		layout.dataOffset = fileLength;
+	
+	//Files that were never finished being written often claim more audio than they have.
+	if(layout.dataLength > (fileLength - layout.dataOffset))
+		layout.dataLength = (fileLength - layout.dataOffset);
+}
+
+#pragma mark -
+#pragma mark Parsing
+
+static bool GetWAVELayout(const UInt8 *bytes, UInt64 length, PKPCMDecoder::Layout &layout)
+{
+	bool hasFormat = false;
+	
+	UInt64 offset = 12;
+	while ((offset + 8) <= length)
+	{
+		const UInt8 *chunk = bytes + offset;
+		UInt32 chunkSize = OSReadLittleInt32(chunk, 4);
+		UInt64 bodyOffset = offset + 8;
+		
+		if(memcmp(chunk, "fmt ", 4) == 0)
+		{
+			if((chunkSize < 16) || ((bodyOffset + chunkSize) > length))
+				return false;
+			
+			const UInt8 *body = bytes + bodyOffset;
+			UInt16 formatTag = OSReadLittleInt16(body, 0);
+			layout.numberOfChannels = OSReadLittleInt16(body, 2);
+			layout.sampleRate = OSReadLittleInt32(body, 4);
+			UInt32 bitsPerSample = OSReadLittleInt16(body, 14);
+			
+			//WAVE_FORMAT_EXTENSIBLE keeps the real format tag at the front of its sub-format GUID.
+			if((formatTag == 0xFFFE) && (chunkSize >= 40))
+				formatTag = OSReadLittleInt16(body, 24);
+			
+			layout.isBigEndian = false;
+			if(formatTag == 1)
+			{
+				//8 bit WAVE samples are the only unsigned ones.
+				if(!GetIntegerSampleType(bitsPerSample, (bitsPerSample > 8), layout.sampleType))
+					return false;
+			}
+			else if(formatTag == 3)
+			{
+				if(!GetFloatSampleType(bitsPerSample, layout.sampleType))
+					return false;
+			}
+			else
+			{
+				return false;
+			}
+			
+			hasFormat = true;
+		}
+		else if(memcmp(chunk, "data", 4) == 0)
+		{
+			if(!hasFormat)
+				return false;
+			
+			layout.dataOffset = bodyOffset;
+			layout.dataLength = chunkSize;
+			
+			return true;
+		}
+		
+		offset = bodyOffset + chunkSize + (chunkSize & 1);
+	}
+	
+	return false;
+}
+
+static bool GetAIFFLayout(const UInt8 *bytes, UInt64 length, PKPCMDecoder::Layout &layout)
+{
+	bool isAIFC = (memcmp(bytes + 8, "AIFC", 4) == 0);
+	bool hasCommon = false;
+	bool hasSoundData = false;
+	
+	UInt64 offset = 12;
+	while (((offset + 8) <= length) && !(hasCommon && hasSoundData))
+	{
+		const UInt8 *chunk = bytes + offset;
+		UInt32 chunkSize = OSReadBigInt32(chunk, 4);
+		UInt64 bodyOffset = offset + 8;
+		
+		if(memcmp(chunk, "COMM", 4) == 0)
+		{
+			if((chunkSize < 18) || ((bodyOffset + chunkSize) > length))
+				return false;
+			
+			const UInt8 *body = bytes + bodyOffset;
+			layout.numberOfChannels = OSReadBigInt16(body, 0);
+			UInt32 bitsPerSample = OSReadBigInt16(body, 6);
+			layout.sampleRate = ReadBigExtended80(body + 8);
+			
+			const UInt8 *compressionType = (const UInt8 *)"NONE";
+			if(isAIFC)
+			{
+				if(chunkSize < 22)
+					return false;
+				
+				compressionType = body + 18;
+			}
+			
+			if((memcmp(compressionType, "NONE", 4) == 0) || (memcmp(compressionType, "twos", 4) == 0))
+			{
+				layout.isBigEndian = true;
+				if(!GetIntegerSampleType(bitsPerSample, true, layout.sampleType))
+					return false;
+			}
+			else if(memcmp(compressionType, "sowt", 4) == 0)
+			{
+				layout.isBigEndian = false;
+				if(!GetIntegerSampleType(bitsPerSample, true, layout.sampleType))
+					return false;
+			}
+			else if((memcmp(compressionType, "fl32", 4) == 0) || (memcmp(compressionType, "FL32", 4) == 0))
+			{
+				layout.isBigEndian = true;
+				layout.sampleType = PKPCMDecoder::kSampleTypeFloat32;
+			}
+			else if((memcmp(compressionType, "fl64", 4) == 0) || (memcmp(compressionType, "FL64", 4) == 0))
+			{
+				layout.isBigEndian = true;
+				layout.sampleType = PKPCMDecoder::kSampleTypeFloat64;
+			}
+			else
+			{
+				return false;
+			}
+			
+			hasCommon = true;
+		}
+		else if(memcmp(chunk, "SSND", 4) == 0)
+		{
+			if((chunkSize < 8) || ((bodyOffset + 8) > length))
+				return false;
+			
+			UInt32 soundDataOffset = OSReadBigInt32(bytes + bodyOffset, 0);
+			if(soundDataOffset > (chunkSize - 8))
+				return false;
+			
+			layout.dataOffset = bodyOffset + 8 + soundDataOffset;
+			layout.dataLength = chunkSize - 8 - soundDataOffset;
+			
+			hasSoundData = true;
+		}
+		
+		offset = bodyOffset + chunkSize + (chunkSize & 1);
+	}
+	
+	return (hasCommon && hasSoundData);
+}
+
+static bool GetCAFLayout(const UInt8 *bytes, UInt64 length, PKPCMDecoder::Layout &layout)
+{
+	enum {
+		kCAFLinearPCMFormatFlagIsFloat = (1L << 0),
+		kCAFLinearPCMFormatFlagIsLittleEndian = (1L << 1),
+	};
+	
+	if(OSReadBigInt16(bytes, 4) != 1)
+		return false;
+	
+	bool hasDescription = false;
+	
+	UInt64 offset = 8;
+	while ((offset + 12) <= length)
+	{
+		const UInt8 *chunk = bytes + offset;
+		SInt64 chunkSize = SInt64(OSReadBigInt64(chunk, 4));
+		UInt64 bodyOffset = offset + 12;
+		
+		if(memcmp(chunk, "desc", 4) == 0)
+		{
+			if((chunkSize < 32) || ((bodyOffset + 32) > length))
+				return false;
+			
+			const UInt8 *body = bytes + bodyOffset;
+			layout.sampleRate = ReadBigFloat64(body);
+			UInt32 formatFlags = OSReadBigInt32(body, 12);
+			UInt32 bytesPerPacket = OSReadBigInt32(body, 16);
+			UInt32 framesPerPacket = OSReadBigInt32(body, 20);
+			layout.numberOfChannels = OSReadBigInt32(body, 24);
+			UInt32 bitsPerSample = OSReadBigInt32(body, 28);
+			
+			if((memcmp(body + 8, "lpcm", 4) != 0) || (framesPerPacket != 1))
+				return false;
+			
+			layout.isBigEndian = ((formatFlags & kCAFLinearPCMFormatFlagIsLittleEndian) == 0);
+			
+			bool isValid = false;
+			if((formatFlags & kCAFLinearPCMFormatFlagIsFloat) == kCAFLinearPCMFormatFlagIsFloat)
+				isValid = GetFloatSampleType(bitsPerSample, layout.sampleType);
+			else
+				isValid = GetIntegerSampleType(bitsPerSample, true, layout.sampleType);
+			
+			//We only handle packed samples.
+			if(!isValid || (bytesPerPacket != (GetBytesPerSample(layout.sampleType) * layout.numberOfChannels)))
+				return false;
+			
+			hasDescription = true;
+		}
+		else if(memcmp(chunk, "data", 4) == 0)
+		{
+			if(!hasDescription)
+				return false;
+			
+			//The data chunk starts with an edit count. A size of -1 means the audio runs to the end of the file.
+			layout.dataOffset = bodyOffset + 4;
+			layout.dataLength = (chunkSize < 4)? (length - layout.dataOffset) : UInt64(chunkSize - 4);
+			
+			return true;
+		}
+		
+		if(chunkSize < 0)
+			return false;
+		
+		offset = bodyOffset + chunkSize;
+	}
+	
+	return false;
+}
+
+bool PKPCMDecoder::GetLayout(const UInt8 *bytes, UInt64 length, Layout &outLayout) throw()
+{
+	if(!bytes || (length < 12))
+		return false;
+	
+	Layout layout;
+	memset(&layout, 0, sizeof(layout));
+	
+	bool isValid = false;
+	if((memcmp(bytes, "RIFF", 4) == 0) && (memcmp(bytes + 8, "WAVE", 4) == 0))
+		isValid = GetWAVELayout(bytes, length, layout);
+	else if((memcmp(bytes, "FORM", 4) == 0) && ((memcmp(bytes + 8, "AIFF", 4) == 0) || (memcmp(bytes + 8, "AIFC", 4) == 0)))
+		isValid = GetAIFFLayout(bytes, length, layout);
+	else if(memcmp(bytes, "caff", 4) == 0)
+		isValid = GetCAFLayout(bytes, length, layout);
+	
+	if(!isValid || (layout.numberOfChannels == 0) || !(layout.sampleRate > 0.0))
+		return false;
+	
+	ClipDataToFile(layout, length);
+	outLayout = layout;
+	
+	return true;
+}
+
+#pragma mark -
+#pragma mark Mapping
+
+static const UInt8 *MapFile(CFURLRef location, size_t *outLength)
+{
+	char path[PATH_MAX];
+	if(!CFURLGetFileSystemRepresentation(location, true, (UInt8 *)path, sizeof(path)))
+		return NULL;
+	
+	int fileDescriptor = open(path, O_RDONLY);
+	if(fileDescriptor == -1)
+		return NULL;
+	
+	struct stat fileInfo;
+	if((fstat(fileDescriptor, &fileInfo) != 0) || (fileInfo.st_size <= 0) || (UInt64(fileInfo.st_size) > SIZE_MAX))
+	{
+		close(fileDescriptor);
+		return NULL;
+	}
+	
+	//The mapping keeps its own reference to the file, so the descriptor isn't needed past this point.
+	void *mapping = mmap(NULL, size_t(fileInfo.st_size), PROT_READ, MAP_FILE | MAP_SHARED, fileDescriptor, 0);
+	close(fileDescriptor);
+	
+	if(mapping == MAP_FAILED)
+		return NULL;
+	
+	*outLength = size_t(fileInfo.st_size);
+	return (const UInt8 *)mapping;
+}
+
+#pragma mark -
+#pragma mark Lifetime
+
+PKPCMDecoder::PKPCMDecoder(CFURLRef location) throw(RBException) :
+	PKDecoder("PKPCMDecoder"),
+	mFileLocation(CFURLRef(CFRetain(location))),
+	mMapping(NULL),
+	mMappingLength(0),
+	mLayout(),
+	mBytesPerSample(0),
+	mBytesPerFrame(0),
+	mStreamFormat(),
+	mTotalNumberOfFrames(0),
+	mCurrentFrame(0)
+{
+	//The destructor isn't run when a constructor throws, so the mapping and the location are released before each assertion.
+	mMapping = MapFile(location, &mMappingLength);
+	if(!mMapping)
+	{
+		int mapError = errno;
+		
+		CFRelease(mFileLocation);
+		mFileLocation = NULL;
+		
+		RBAssert(false, CFSTR("Could not map file, error %d."), mapError);
+	}
+	
+	if(!GetLayout(mMapping, mMappingLength, mLayout))
+	{
+		munmap((void *)mMapping, mMappingLength);
+		mMapping = NULL;
+		
+		CFRelease(mFileLocation);
+		mFileLocation = NULL;
+		
+		RBAssert(false, CFSTR("File does not contain uncompressed audio."));
+	}
+	
+	mBytesPerSample = GetBytesPerSample(mLayout.sampleType);
+	mBytesPerFrame = mBytesPerSample * mLayout.numberOfChannels;
+	mTotalNumberOfFrames = mLayout.dataLength / mBytesPerFrame;
+	
+	//We read the audio from front to back, so the kernel can read ahead and drop pages behind us.
+	madvise((void *)mMapping, mMappingLength, MADV_SEQUENTIAL);
+	
+	CAStreamBasicDescription format;
+	format.mSampleRate = mLayout.sampleRate;
+	format.SetCanonical(mLayout.numberOfChannels, false);
+	mStreamFormat = format;
+}
+
+PKPCMDecoder::~PKPCMDecoder()
+{
+	if(mMapping)
+	{
+		munmap((void *)mMapping, mMappingLength);
+		mMapping = NULL;
+	}
+	
+	if(mFileLocation)
+	{
+		CFRelease(mFileLocation);
+		mFileLocation = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+AudioStreamBasicDescription PKPCMDecoder::GetStreamFormat() const
+{
+	return mStreamFormat;
+}
+
+CFURLRef PKPCMDecoder::CopyLocation() const
+{
+	return CFURLRef(CFRetain(mFileLocation));
+}
+
+#pragma mark -
+
+PKDecoder::FrameLocation PKPCMDecoder::GetTotalNumberOfFrames() const
+{
+	return mTotalNumberOfFrames;
+}
+
+#pragma mark -
+
+bool PKPCMDecoder::CanSeek() const
+{
+	return true;
+}
+
+PKDecoder::FrameLocation PKPCMDecoder::GetCurrentFrame() const
+{
+	return mCurrentFrame;
+}
+
+void PKPCMDecoder::SetCurrentFrame(PKDecoder::FrameLocation currentFrame)
+{
+	if(currentFrame > mTotalNumberOfFrames)
+		return;
+	
+	mCurrentFrame = currentFrame;
+	
+	//Get the kernel started on the first second of audio at the new position.
+	uintptr_t pageSize = uintptr_t(getpagesize());
+	uintptr_t start = uintptr_t(mMapping + mLayout.dataOffset + (mCurrentFrame * mBytesPerFrame));
+	uintptr_t end = uintptr_t(mMapping + mLayout.dataOffset + mLayout.dataLength);
+	uintptr_t wanted = start + uintptr_t(mLayout.sampleRate * mBytesPerFrame);
+	if(wanted < end)
+		end = wanted;
+	
+	start &= ~(pageSize - 1);
+	if(end > start)
+		madvise((void *)start, end - start, MADV_WILLNEED);
+}
+
+bool PKPCMDecoder::CanDecodeInParallel() const
+{
+	return (mFileLocation != NULL);
+}
+
+#pragma mark -
+#pragma mark Decoding
+
+void PKPCMDecoder::ConvertFrames(const UInt8 *source, AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	UInt32 numberOfChannels = mLayout.numberOfChannels;
+	bool isSwapped = (mLayout.isBigEndian != kHostIsBigEndian);
+	
+	UInt32 numberOfBuffers = buffers->mNumberBuffers;
+	if(numberOfBuffers > numberOfChannels)
+		numberOfBuffers = numberOfChannels;
+	
+	//
+	//	Each channel is deinterleaved and converted in one strided pass. Samples that vDSP
+	//	can't read directly (byte swapped and 24 bit samples) are widened by hand first.
+	//
+	for (UInt32 channel = 0; channel < numberOfBuffers; channel++)
+	{
+		const UInt8 *channelSource = source + (channel * mBytesPerSample);
+		Float32 *destination = (Float32 *)(buffers->mBuffers[channel].mData);
+		Float32 scale = 1.0f;
+		
+		switch (mLayout.sampleType)
+		{
+			case kSampleTypeUnsignedInt8:
+			{
+				Float32 offset = -1.0f;
+				scale = 1.0f / 128.0f;
+				vDSP_vfltu8(channelSource, numberOfChannels, destination, 1, numberOfFrames);
+				vDSP_vsmsa(destination, 1, &scale, &offset, destination, 1, numberOfFrames);
+				continue;
+			}
+			
+			case kSampleTypeInt8:
+				scale = 1.0f / 128.0f;
+				vDSP_vflt8((const char *)channelSource, numberOfChannels, destination, 1, numberOfFrames);
+				break;
+			
+			case kSampleTypeInt16:
+				scale = 1.0f / 32768.0f;
+				if(isSwapped)
+				{
+					for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+						destination[frame] = SInt16(OSReadSwapInt16(channelSource, frame * mBytesPerFrame));
+				}
+				else
+				{
+					vDSP_vflt16((const short *)channelSource, numberOfChannels, destination, 1, numberOfFrames);
+				}
+				break;
+			
+			case kSampleTypeInt24:
+				scale = 1.0f / 8388608.0f;
+				for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+				{
+					const UInt8 *sample = channelSource + (frame * mBytesPerFrame);
+					UInt32 value = mLayout.isBigEndian?
+						((sample[0] << 24) | (sample[1] << 16) | (sample[2] << 8)) :
+						((sample[2] << 24) | (sample[1] << 16) | (sample[0] << 8));
+					
+					destination[frame] = Float32(SInt32(value) >> 8);
+				}
+				break;
+			
+			case kSampleTypeInt32:
+				scale = 1.0f / 2147483648.0f;
+				if(isSwapped)
+				{
+					for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+						destination[frame] = Float32(SInt32(OSReadSwapInt32(channelSource, frame * mBytesPerFrame)));
+				}
+				else
+				{
+					vDSP_vflt32((const int *)channelSource, numberOfChannels, destination, 1, numberOfFrames);
+				}
+				break;
+			
+			case kSampleTypeFloat32:
+				if(isSwapped)
+				{
+					for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+					{
+						UInt32 bits = OSReadSwapInt32(channelSource, frame * mBytesPerFrame);
+						memcpy(&destination[frame], &bits, sizeof(Float32));
+					}
+				}
+				else if(numberOfChannels == 1)
+				{
+					memcpy(destination, channelSource, numberOfFrames * sizeof(Float32));
+				}
+				else
+				{
+					vDSP_vsmul((const Float32 *)channelSource, numberOfChannels, &scale, destination, 1, numberOfFrames);
+				}
+				continue;
+			
+			case kSampleTypeFloat64:
+				if(isSwapped)
+				{
+					for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+					{
+						UInt64 bits = OSReadSwapInt64(channelSource, frame * mBytesPerFrame);
+						Float64 value;
+						memcpy(&value, &bits, sizeof(value));
+						destination[frame] = Float32(value);
+					}
+				}
+				else
+				{
+					vDSP_vdpsp((const double *)channelSource, numberOfChannels, destination, 1, numberOfFrames);
+				}
+				continue;
+		}
+		
+		vDSP_vsmul(destination, 1, &scale, destination, 1, numberOfFrames);
+	}
+}
+
+UInt32 PKPCMDecoder::FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException)
+{
+	RBParameterAssert(buffers);
+	
+	UInt64 numberOfFramesRemaining = mTotalNumberOfFrames - mCurrentFrame;
+	if(numberOfFrames > numberOfFramesRemaining)
+		numberOfFrames = UInt32(numberOfFramesRemaining);
+	
+	if(numberOfFrames > 0)
+		this->ConvertFrames(mMapping + mLayout.dataOffset + (mCurrentFrame * mBytesPerFrame), buffers, numberOfFrames);
+	
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFrames * sizeof(Float32);
+	
+	mCurrentFrame += numberOfFrames;
+	
+	return numberOfFrames;
+}
+
+#pragma mark -
+#pragma mark Description
+
+static bool CanDecode(CFURLRef fileLocation)
+{
+	size_t length = 0;
+	const UInt8 *mapping = MapFile(fileLocation, &length);
+	if(!mapping)
+		return false;
+	
+	PKPCMDecoder::Layout layout;
+	bool canDecode = PKPCMDecoder::GetLayout(mapping, length, layout);
+	
+	munmap((void *)mapping, length);
+	
+	return canDecode;
+}
+
+static PKDecoder::ProbeResult Probe(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension)
+{
+	PKPCMDecoder::Layout layout;
+	if(PKPCMDecoder::GetLayout(header, headerLength, layout))
+		return PKDecoder::kProbeResultYes;
+	
+	//The chunks describing the audio can be further into the file than the header reaches.
+	if((headerLength >= 12) &&
+	   ((memcmp(header, "RIFF", 4) == 0) || (memcmp(header, "FORM", 4) == 0) || (memcmp(header, "caff", 4) == 0)))
+		return PKDecoder::kProbeResultMaybe;
+	
+	return PKDecoder::kProbeResultNo;
+}
+
+static CFArrayRef CopySupportedTypes()
+{
+	CFStringRef types[] = {
+		CFSTR("com.microsoft.waveform-audio"),
+		CFSTR("public.aiff-audio"),
+		CFSTR("public.aifc-audio"),
+		CFSTR("com.apple.coreaudio-format"),
+	};
+	
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)types, sizeof(types) / sizeof(types[0]), &kCFTypeArrayCallBacks);
+}
+
+static PKDecoder *CreateInstance(CFURLRef fileLocation) throw(RBException)
+{
+	return new PKPCMDecoder(fileLocation);
+}
+
+PKDecoder::Description PKPCMDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance, &Probe, NULL };
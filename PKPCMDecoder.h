@@ -0,0 +1,120 @@
+/*
+ *  PKPCMDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKPCMDecoder_h
+#define PKPCMDecoder_h 1
+
+#include "PKDecoder.h"
+
+/*!
+ @class
+ @abstract		The PKPCMDecoder class plays uncompressed WAV, AIFF and CAF files straight out of a memory mapping.
+ @discussion	The file is mapped rather than read, so its pages come from, and stay in, the page cache. Samples
+				are deinterleaved and converted to non-interleaved Float32 in a single vectorized pass from the
+				mapping into the caller's buffers. Mono native endian Float32 files are copied across as is.
+ */
+class PK_VISIBILITY_HIDDEN PKPCMDecoder : public PKDecoder
+{
+public:
+	/*!
+	 @enum
+	 @abstract	The layouts of samples on disk the receiver can convert from.
+	 */
+	enum SampleType {
+		kSampleTypeUnsignedInt8 = 0,
+		kSampleTypeInt8,
+		kSampleTypeInt16,
+		kSampleTypeInt24,
+		kSampleTypeInt32,
+		kSampleTypeFloat32,
+		kSampleTypeFloat64,
+	};
+	
+	/*!
+	 @abstract	The Layout struct describes where the audio in a file is and how its samples are stored.
+	 */
+	struct Layout {
+		Float64 sampleRate;
+		UInt32 numberOfChannels;
+		SampleType sampleType;
+		bool isBigEndian;
+		UInt64 dataOffset;
+		UInt64 dataLength;
+	};
+	
+	/*!
+	 @abstract	Find the audio in a mapped WAV, AIFF or CAF file.
+	 @result	true if the file contains uncompressed audio the receiver can play; false otherwise.
+	 */
+	static bool GetLayout(const UInt8 *bytes, UInt64 length, Layout &outLayout) throw();
+
+protected:
+	
+	/* owner */	CFURLRef mFileLocation;
+	/* owner */	const UInt8 *mMapping;
+	/* n/a */	size_t mMappingLength;
+	
+	/* n/a */	Layout mLayout;
+	/* n/a */	UInt32 mBytesPerSample;
+	/* n/a */	UInt32 mBytesPerFrame;
+	/* n/a */	AudioStreamBasicDescription mStreamFormat;
+	/* n/a */	UInt64 mTotalNumberOfFrames;
+	/* n/a */	UInt64 mCurrentFrame;
+	
+	/*!
+	 @abstract	Deinterleave and convert frames from the mapping into non-interleaved Float32 buffers.
+	 */
+	void ConvertFrames(const UInt8 *source, AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+
+public:
+
+#pragma mark Lifetime
+	
+	/*!
+	 @abstract	Construct a PCM decoder for a file at a specified location.
+	 */
+	explicit PKPCMDecoder(CFURLRef location) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKPCMDecoder();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual AudioStreamBasicDescription GetStreamFormat() const;
+	virtual CFURLRef CopyLocation() const;
+	
+#pragma mark -
+	
+	virtual PKDecoder::FrameLocation GetTotalNumberOfFrames() const;
+	
+#pragma mark -
+	
+	virtual bool CanSeek() const;
+	
+	virtual PKDecoder::FrameLocation GetCurrentFrame() const;
+	virtual void SetCurrentFrame(PKDecoder::FrameLocation currentFrame);
+	
+	virtual bool CanDecodeInParallel() const;
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	virtual UInt32 FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException);
+
+private:
+	PKPCMDecoder(PKPCMDecoder &decoder);
+	PKPCMDecoder &operator=(PKPCMDecoder &decoder);
+};
+
+extern PKDecoder::Description PKPCMDecoderDescription;
+
+#endif /* PKPCMDecoder_h */
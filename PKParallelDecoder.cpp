@@ -0,0 +1,384 @@
+/*
+ *  PKParallelDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKParallelDecoder.h"
+#include "CAAudioBufferList.h"
+#include "PKTaskExecutor.h"
+#include <unistd.h>
+#include <atomic>
+
+static std::atomic<bool> ParallelDecodingIsEnabled(false);
+
+#pragma mark Lifecycle
+
+PKParallelDecoder::PKParallelDecoder(PKDecoder *decoder, const PKDecoder::Description &description) throw(RBException) :
+	PKDecoder("PKParallelDecoder"),
+	mDescription(description),
+	mLocation(NULL),
+	mStreamFormat(),
+	mTotalNumberOfFrames(0),
+	mNumberOfBuffers(0),
+	mNumberOfWorkers(GetNumberOfWorkers()),
+	mBlockPool(NULL),
+	mNumberOfBlocks(0),
+	mNumberOfBlocksDecoding(0),
+	mIdleDecoders(),
+	mCurrentFrame(0)
+{
+	RBParameterAssert(decoder);
+	RBAssert(decoder->CanDecodeInParallel(), CFSTR("Decoder %s cannot decode in parallel."), decoder->GetClassName());
+	
+	memset(mBlocks, 0, sizeof(mBlocks));
+	
+	mStreamFormat = decoder->GetStreamFormat();
+	mTotalNumberOfFrames = decoder->GetTotalNumberOfFrames();
+	mNumberOfBuffers = (mStreamFormat.mFormatFlags & kAudioFormatFlagIsNonInterleaved)? mStreamFormat.mChannelsPerFrame : 1;
+	
+	//Two blocks per worker lets the ring hold a block being read while the workers decode the ones after it.
+	mNumberOfBlocks = mNumberOfWorkers * 2;
+	mBlockPool = (UInt8 *)malloc(mNumberOfBlocks * mNumberOfBuffers * this->GetBlockBufferSize());
+	RBAssert((mBlockPool != NULL), CFSTR("Could not allocate parallel decoder blocks."));
+	
+	for (UInt32 index = 0; index < mNumberOfBlocks; index++)
+		mBlocks[index].data = mBlockPool + (index * mNumberOfBuffers * this->GetBlockBufferSize());
+	
+	int errorCode = pthread_mutex_init(&mMutex, NULL);
+	if(errorCode != 0)
+	{
+		free(mBlockPool);
+		RBAssertNoErr(errorCode, CFSTR("pthread_mutex_init failed with error code %d"), errorCode);
+	}
+	
+	errorCode = pthread_cond_init(&mBlockDecodedCondition, NULL);
+	if(errorCode != 0)
+	{
+		free(mBlockPool);
+		pthread_mutex_destroy(&mMutex);
+		RBAssertNoErr(errorCode, CFSTR("pthread_cond_init failed with error code %d"), errorCode);
+	}
+	
+	mLocation = decoder->CopyLocation();
+	
+	//The decoder we're given becomes the first of the instances the blocks are decoded with.
+	decoder->Retain();
+	mIdleDecoders.push_back(decoder);
+}
+
+PKParallelDecoder::~PKParallelDecoder()
+{
+	//Workers retain the decoder, so none can be outstanding by the time we get here.
+	for (std::vector<PKDecoder *>::iterator decoder = mIdleDecoders.begin(); decoder != mIdleDecoders.end(); decoder++)
+		(*decoder)->Release();
+	
+	mIdleDecoders.clear();
+	
+	for (UInt32 index = 0; index < mNumberOfBlocks; index++)
+	{
+		if(mBlocks[index].error)
+		{
+			mBlocks[index].error->Release();
+			mBlocks[index].error = NULL;
+		}
+	}
+	
+	if(mBlockPool)
+	{
+		free(mBlockPool);
+		mBlockPool = NULL;
+	}
+	
+	if(mLocation)
+	{
+		CFRelease(mLocation);
+		mLocation = NULL;
+	}
+	
+	pthread_cond_destroy(&mBlockDecodedCondition);
+	pthread_mutex_destroy(&mMutex);
+}
+
+#pragma mark -
+#pragma mark Global Options
+
+void PKParallelDecoder::SetEnabled(bool enabled) throw()
+{
+	ParallelDecodingIsEnabled.store(enabled, std::memory_order_release);
+}
+
+bool PKParallelDecoder::IsEnabled() throw()
+{
+	return ParallelDecodingIsEnabled.load(std::memory_order_acquire);
+}
+
+UInt32 PKParallelDecoder::GetNumberOfWorkers() throw()
+{
+	//One processor is left for the scheduler thread and the render thread.
+	long numberOfWorkers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if(numberOfWorkers < 1)
+		numberOfWorkers = 1;
+	else if(numberOfWorkers > kMaximumNumberOfWorkers)
+		numberOfWorkers = kMaximumNumberOfWorkers;
+	
+	return UInt32(numberOfWorkers);
+}
+
+#pragma mark -
+#pragma mark Blocks
+
+void PKParallelDecoder::ScheduleBlocks(UInt64 firstBlockIndex) throw()
+{
+	UInt64 numberOfBlocksInFile = (mTotalNumberOfFrames + kNumberOfFramesPerBlock - 1) / kNumberOfFramesPerBlock;
+	for (UInt64 blockIndex = firstBlockIndex; (blockIndex < (firstBlockIndex + mNumberOfBlocks)) && (blockIndex < numberOfBlocksInFile); blockIndex++)
+	{
+		if(mNumberOfBlocksDecoding >= mNumberOfWorkers)
+			break;
+		
+		//Blocks that failed are left for WaitForBlock to retry, where the error can be reported.
+		Block *block = &mBlocks[blockIndex % mNumberOfBlocks];
+		if((block->state == kBlockStateDecoding) || ((block->blockIndex == blockIndex) && (block->state != kBlockStateEmpty)))
+			continue;
+		
+		if(block->error)
+		{
+			block->error->Release();
+			block->error = NULL;
+		}
+		
+		block->blockIndex = blockIndex;
+		block->numberOfFrames = 0;
+		block->state = kBlockStateDecoding;
+		mNumberOfBlocksDecoding++;
+		
+		this->Retain();
+		PKTaskExecutor::SharedExecutor()->Async(PKTaskExecutor::kLaneNormal, ^{
+			this->DecodeBlock(block);
+			this->Release();
+		});
+	}
+}
+
+void PKParallelDecoder::DecodeBlock(Block *block) throw()
+{
+	PKDecoder *decoder = NULL;
+	
+	pthread_mutex_lock(&mMutex);
+	if(!mIdleDecoders.empty())
+	{
+		decoder = mIdleDecoders.back();
+		mIdleDecoders.pop_back();
+	}
+	pthread_mutex_unlock(&mMutex);
+	
+	UInt32 blockBufferSize = this->GetBlockBufferSize();
+	UInt32 bytesPerFrame = mStreamFormat.mBytesPerFrame;
+	UInt32 numberOfFramesDecoded = 0;
+	RBException *error = NULL;
+	AudioBufferList *buffers = NULL;
+	try
+	{
+		if(!decoder)
+			decoder = mDescription.CreateInstance(mLocation);
+		
+		buffers = CAAudioBufferList::Create(mNumberOfBuffers);
+		RBAssert((buffers != NULL), CFSTR("Could not allocate buffer list."));
+		
+		PKDecoder::FrameLocation firstFrame = block->blockIndex * kNumberOfFramesPerBlock;
+		if(decoder->GetCurrentFrame() != firstFrame)
+			decoder->SetCurrentFrame(firstFrame);
+		
+		while (numberOfFramesDecoded < kNumberOfFramesPerBlock)
+		{
+			for (UInt32 index = 0; index < mNumberOfBuffers; index++)
+			{
+				buffers->mBuffers[index].mData = block->data + (index * blockBufferSize) + (numberOfFramesDecoded * bytesPerFrame);
+				buffers->mBuffers[index].mDataByteSize = (kNumberOfFramesPerBlock - numberOfFramesDecoded) * bytesPerFrame;
+				buffers->mBuffers[index].mNumberChannels = (mNumberOfBuffers == 1)? mStreamFormat.mChannelsPerFrame : 1;
+			}
+			
+			UInt32 numberOfFrames = decoder->FillBuffers(buffers, kNumberOfFramesPerBlock - numberOfFramesDecoded);
+			if(numberOfFrames == 0)
+				break;
+			
+			numberOfFramesDecoded += numberOfFrames;
+		}
+	}
+	catch (RBException e)
+	{
+		error = new RBException(e);
+	}
+	
+	if(buffers)
+		CAAudioBufferList::Destroy(buffers);
+	
+	pthread_mutex_lock(&mMutex);
+	
+	//A decoder that failed part way through a block may not be in a state worth reusing.
+	if(decoder && !error)
+		mIdleDecoders.push_back(decoder);
+	else if(decoder)
+		decoder->Release();
+	
+	block->numberOfFrames = numberOfFramesDecoded;
+	block->error = error;
+	block->state = error? kBlockStateFailed : kBlockStateDecoded;
+	mNumberOfBlocksDecoding--;
+	
+	pthread_cond_broadcast(&mBlockDecodedCondition);
+	
+	//The worker keeps the ring full without waiting for the next read.
+	this->ScheduleBlocks(mCurrentFrame / kNumberOfFramesPerBlock);
+	
+	pthread_mutex_unlock(&mMutex);
+}
+
+PKParallelDecoder::Block *PKParallelDecoder::WaitForBlock(UInt64 blockIndex, RBException **outError) throw()
+{
+	Block *block = &mBlocks[blockIndex % mNumberOfBlocks];
+	bool wasRetried = false;
+	for (;;)
+	{
+		if(block->blockIndex == blockIndex)
+		{
+			if(block->state == kBlockStateDecoded)
+				return block;
+			
+			if(block->state == kBlockStateFailed)
+			{
+				if(wasRetried)
+				{
+					*outError = block->error;
+					block->error = NULL;
+					block->state = kBlockStateEmpty;
+					
+					return NULL;
+				}
+				
+				block->state = kBlockStateEmpty;
+				wasRetried = true;
+			}
+		}
+		
+		//If every worker is busy, the block is scheduled by the first one to finish, which wakes us up.
+		this->ScheduleBlocks(blockIndex);
+		pthread_cond_wait(&mBlockDecodedCondition, &mMutex);
+	}
+}
+
+#pragma mark -
+#pragma mark Attributes
+
+AudioStreamBasicDescription PKParallelDecoder::GetStreamFormat() const
+{
+	return mStreamFormat;
+}
+
+CFURLRef PKParallelDecoder::CopyLocation() const
+{
+	return mLocation? CFURLRef(CFRetain(mLocation)) : NULL;
+}
+
+#pragma mark -
+
+PKDecoder::FrameLocation PKParallelDecoder::GetTotalNumberOfFrames() const
+{
+	return mTotalNumberOfFrames;
+}
+
+#pragma mark -
+
+bool PKParallelDecoder::CanSeek() const
+{
+	return true;
+}
+
+PKDecoder::FrameLocation PKParallelDecoder::GetCurrentFrame() const
+{
+	pthread_mutex_lock(&mMutex);
+	PKDecoder::FrameLocation currentFrame = mCurrentFrame;
+	pthread_mutex_unlock(&mMutex);
+	
+	return currentFrame;
+}
+
+void PKParallelDecoder::SetCurrentFrame(PKDecoder::FrameLocation currentFrame)
+{
+	if(currentFrame > mTotalNumberOfFrames)
+		return;
+	
+	//Blocks already decoded are kept, the ring moves over to the new position on the next read.
+	pthread_mutex_lock(&mMutex);
+	mCurrentFrame = currentFrame;
+	pthread_mutex_unlock(&mMutex);
+}
+
+#pragma mark -
+#pragma mark Decoding
+
+UInt32 PKParallelDecoder::FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException)
+{
+	RBParameterAssert(buffers);
+	
+	UInt32 numberOfBuffers = buffers->mNumberBuffers;
+	if(numberOfBuffers > mNumberOfBuffers)
+		numberOfBuffers = mNumberOfBuffers;
+	
+	UInt32 blockBufferSize = this->GetBlockBufferSize();
+	UInt32 bytesPerFrame = mStreamFormat.mBytesPerFrame;
+	UInt32 numberOfFramesFilled = 0;
+	RBException *error = NULL;
+	
+	pthread_mutex_lock(&mMutex);
+	
+	while ((numberOfFramesFilled < numberOfFrames) && (mCurrentFrame < mTotalNumberOfFrames))
+	{
+		Block *block = this->WaitForBlock(mCurrentFrame / kNumberOfFramesPerBlock, &error);
+		if(!block)
+			break;
+		
+		//A short block is the end of the file, wherever the file said that would be.
+		UInt32 offsetInBlock = UInt32(mCurrentFrame % kNumberOfFramesPerBlock);
+		if(offsetInBlock >= block->numberOfFrames)
+			break;
+		
+		UInt32 numberOfFramesToCopy = block->numberOfFrames - offsetInBlock;
+		if(numberOfFramesToCopy > (numberOfFrames - numberOfFramesFilled))
+			numberOfFramesToCopy = numberOfFrames - numberOfFramesFilled;
+		
+		for (UInt32 index = 0; index < numberOfBuffers; index++)
+		{
+			memcpy((UInt8 *)(buffers->mBuffers[index].mData) + (numberOfFramesFilled * bytesPerFrame),
+				   block->data + (index * blockBufferSize) + (offsetInBlock * bytesPerFrame),
+				   numberOfFramesToCopy * bytesPerFrame);
+		}
+		
+		numberOfFramesFilled += numberOfFramesToCopy;
+		mCurrentFrame += numberOfFramesToCopy;
+	}
+	
+	pthread_mutex_unlock(&mMutex);
+	
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFramesFilled * bytesPerFrame;
+	
+	//Audio decoded before the error is handed out first, the next read runs into the error again.
+	if(error)
+	{
+		if(numberOfFramesFilled > 0)
+		{
+			error->Release();
+			return numberOfFramesFilled;
+		}
+		
+		RBException exception(*error);
+		error->Release();
+		throw exception;
+	}
+	
+	return numberOfFramesFilled;
+}
@@ -0,0 +1,171 @@
+/*
+ *  PKParallelDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKParallelDecoder_h
+#define PKParallelDecoder_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <pthread.h>
+#include <vector>
+
+#include "PKDecoder.h"
+
+/*!
+ @class
+ @abstract		The PKParallelDecoder class decodes a file ahead of playback in blocks, on several threads at once.
+ @discussion	The file is cut into blocks of a fixed number of frames. The blocks after the one being read are
+				handed to the shared executor's normal lane, where each is decoded by its own instance of the wrapped
+				decoder's class, seeked to the start of the block. Finished blocks are kept in a ring owned by the
+				parallel decoder and handed out in order, so the thread reading the decoder only copies audio
+				that is already decoded. Seeking within the blocks already decoded costs nothing.
+				
+				Only decoders that return true from CanDecodeInParallel can be wrapped.
+ */
+class PK_VISIBILITY_HIDDEN PKParallelDecoder : public PKDecoder
+{
+public:
+	enum {
+		/*!
+		 @abstract	The number of frames in a block.
+		 */
+		kNumberOfFramesPerBlock = 64 * 1024,
+		
+		/*!
+		 @abstract	The largest number of blocks decoded at once.
+		 */
+		kMaximumNumberOfWorkers = 4,
+	};
+
+protected:
+	/*!
+	 @enum
+	 @abstract	The states a block in the ring can be in.
+	 */
+	enum BlockState {
+		kBlockStateEmpty = 0,
+		kBlockStateDecoding,
+		kBlockStateDecoded,
+		kBlockStateFailed,
+	};
+	
+	/*!
+	 @abstract	The Block struct describes one block in the ring.
+	 */
+	struct Block {
+		UInt8 *data;
+		UInt64 blockIndex;
+		UInt32 numberOfFrames;
+		BlockState state;
+		RBException *error;
+	};
+	
+	/* n/a */	PKDecoder::Description mDescription;
+	/* owner */	CFURLRef mLocation;
+	/* n/a */	AudioStreamBasicDescription mStreamFormat;
+	/* n/a */	UInt64 mTotalNumberOfFrames;
+	/* n/a */	UInt32 mNumberOfBuffers;
+	/* n/a */	UInt32 mNumberOfWorkers;
+	
+	/* owner */	UInt8 *mBlockPool;
+	/* n/a */	Block mBlocks[kMaximumNumberOfWorkers * 2];
+	/* n/a */	UInt32 mNumberOfBlocks;
+	/* n/a */	UInt32 mNumberOfBlocksDecoding;
+	/* owner */	std::vector<PKDecoder *> mIdleDecoders;
+	
+	/* n/a */	mutable pthread_mutex_t mMutex;
+	/* n/a */	pthread_cond_t mBlockDecodedCondition;
+	/* n/a */	UInt64 mCurrentFrame;
+	
+	/*!
+	 @abstract	Returns the number of bytes one buffer of a block takes up.
+	 */
+	UInt32 GetBlockBufferSize() const throw() { return kNumberOfFramesPerBlock * mStreamFormat.mBytesPerFrame; }
+	
+	/*!
+	 @abstract		Start decoding the blocks from a specified block on, that aren't decoded or being decoded already.
+	 @discussion	No more than the receiver's number of workers are decoded at once. The receiver's mutex must be held.
+	 */
+	void ScheduleBlocks(UInt64 firstBlockIndex) throw();
+	
+	/*!
+	 @abstract		Decode a block whose state the caller has set to decoding.
+	 @discussion	Runs on a worker in the shared executor's normal lane. The receiver's mutex must not be held.
+	 */
+	void DecodeBlock(Block *block) throw();
+	
+	/*!
+	 @abstract		Returns the decoded block at a specified index, waiting for it to be decoded.
+	 @discussion	A block that failed to decode ahead is decoded again before it is given up on, in which case
+					NULL is returned and `outError` is set to a copy of the error owned by the caller. The
+					receiver's mutex must be held.
+	 */
+	Block *WaitForBlock(UInt64 blockIndex, RBException **outError) throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a parallel decoder wrapping a specified decoder.
+	 @param		decoder		The decoder to wrap, positioned at its start. Must return true from CanDecodeInParallel. Retained.
+	 @param		description	The description of the decoder's class, used to create more instances of it.
+	 */
+	explicit PKParallelDecoder(PKDecoder *decoder, const PKDecoder::Description &description) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKParallelDecoder();
+	
+#pragma mark -
+#pragma mark Global Options
+	
+	/*!
+	 @abstract	Set whether or not the cluster wraps decoders that can decode in parallel. It doesn't by default.
+	 */
+	static void SetEnabled(bool enabled) throw();
+	
+	/*!
+	 @abstract	Returns whether or not the cluster wraps decoders that can decode in parallel.
+	 */
+	static bool IsEnabled() throw();
+	
+	/*!
+	 @abstract	Returns the number of blocks decoded at once, one less than the number of processors, up to kMaximumNumberOfWorkers.
+	 */
+	static UInt32 GetNumberOfWorkers() throw();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	virtual AudioStreamBasicDescription GetStreamFormat() const;
+	virtual CFURLRef CopyLocation() const;
+	
+#pragma mark -
+	
+	virtual PKDecoder::FrameLocation GetTotalNumberOfFrames() const;
+	
+#pragma mark -
+	
+	virtual bool CanSeek() const;
+	
+	virtual PKDecoder::FrameLocation GetCurrentFrame() const;
+	virtual void SetCurrentFrame(PKDecoder::FrameLocation currentFrame);
+	
+#pragma mark -
+#pragma mark Decoding
+	
+	virtual UInt32 FillBuffers(AudioBufferList *buffers, UInt32 numberOfFrames) throw(RBException);
+
+private:
+	PKParallelDecoder(PKParallelDecoder &decoder);
+	PKParallelDecoder &operator=(PKParallelDecoder &decoder);
+};
+
+#endif /* PKParallelDecoder_h */
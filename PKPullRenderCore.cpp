@@ -0,0 +1,462 @@
+/*
+ *  PKPullRenderCore.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKPullRenderCore.h"
+
+#include <algorithm>
+#include <string.h>
+
+#pragma mark PKGainRenderProcessor
+
+PKGainRenderProcessor::PKGainRenderProcessor(Float32 gain) :
+	PKRenderProcessor("PKGainRenderProcessor"),
+	mGain(gain)
+{
+	
+}
+
+PKGainRenderProcessor::~PKGainRenderProcessor()
+{
+	
+}
+
+OSStatus PKGainRenderProcessor::Process(AudioBufferList *ioData, UInt32 numberOfFrames, const AudioTimeStamp *timeStamp) throw()
+{
+	Float32 gain = mGain.load(std::memory_order_relaxed);
+	if(gain == 1.0f)
+		return noErr;
+	
+	for (UInt32 index = 0; index < ioData->mNumberBuffers; index++)
+	{
+		Float32 *samples = (Float32 *)(ioData->mBuffers[index].mData);
+		UInt32 numberOfSamples = numberOfFrames * ioData->mBuffers[index].mNumberChannels;
+		for (UInt32 sampleIndex = 0; sampleIndex < numberOfSamples; sampleIndex++)
+			samples[sampleIndex] *= gain;
+	}
+	
+	return noErr;
+}
+
+#pragma mark -
+#pragma mark PKPullRenderCore
+
+#if __BIG_ENDIAN__
+static UInt32 const kNativeEndianFormatFlag = kAudioFormatFlagIsBigEndian;
+#else
+static UInt32 const kNativeEndianFormatFlag = 0;
+#endif /* __BIG_ENDIAN__ */
+
+//Returns whether or not the pull render core can read (or, if `isOutput` is true, write) audio in a specified format.
+static bool IsSupportedFormat(const AudioStreamBasicDescription &format, bool isOutput)
+{
+	if((format.mFormatID != kAudioFormatLinearPCM) || (format.mSampleRate <= 0.0) || (format.mChannelsPerFrame == 0))
+		return false;
+	
+	if((format.mFormatFlags & kAudioFormatFlagIsBigEndian) != kNativeEndianFormatFlag)
+		return false;
+	
+	bool isFloat = ((format.mFormatFlags & kAudioFormatFlagIsFloat) != 0);
+	if(isFloat)
+	{
+		if(format.mBitsPerChannel != 32)
+			return false;
+	}
+	else
+	{
+		if(isOutput || ((format.mFormatFlags & kAudioFormatFlagIsSignedInteger) == 0))
+			return false;
+		
+		if((format.mBitsPerChannel != 16) && (format.mBitsPerChannel != 32))
+			return false;
+	}
+	
+	bool isNonInterleaved = ((format.mFormatFlags & kAudioFormatFlagIsNonInterleaved) != 0);
+	UInt32 bytesPerFrame = (format.mBitsPerChannel / 8) * (isNonInterleaved? 1 : format.mChannelsPerFrame);
+	
+	return (format.mBytesPerFrame == bytesPerFrame) && (format.mFramesPerPacket == 1);
+}
+
+//Returns whether or not a buffer list can hold a number of frames in a specified format.
+static bool BuffersCanHoldFrames(const AudioStreamBasicDescription &format, const AudioBufferList *buffers, UInt32 numberOfFrames)
+{
+	UInt32 numberOfBuffers = (format.mFormatFlags & kAudioFormatFlagIsNonInterleaved)? format.mChannelsPerFrame : 1;
+	if(buffers->mNumberBuffers != numberOfBuffers)
+		return false;
+	
+	UInt64 numberOfBytes = UInt64(numberOfFrames) * format.mBytesPerFrame;
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+	{
+		if(!buffers->mBuffers[index].mData || (buffers->mBuffers[index].mDataByteSize < numberOfBytes))
+			return false;
+	}
+	
+	return true;
+}
+
+//Returns the first sample of a channel at a frame offset, and the distance in samples from one frame of the channel to the next.
+static void *GetChannelSamples(const AudioStreamBasicDescription &format, const AudioBufferList *buffers, UInt32 channel, UInt32 frameOffset, UInt32 *outStride)
+{
+	UInt32 bytesPerSample = format.mBitsPerChannel / 8;
+	if(format.mFormatFlags & kAudioFormatFlagIsNonInterleaved)
+	{
+		*outStride = 1;
+		return (UInt8 *)(buffers->mBuffers[channel].mData) + (frameOffset * bytesPerSample);
+	}
+	
+	*outStride = format.mChannelsPerFrame;
+	return (UInt8 *)(buffers->mBuffers[0].mData) + (frameOffset * format.mBytesPerFrame) + (channel * bytesPerSample);
+}
+
+#pragma mark -
+#pragma mark Lifecycle
+
+PKPullRenderCore::PKPullRenderCore() :
+	PKRenderCore("PKPullRenderCore"),
+	mSliceFormat(),
+	mOutputFormat(),
+	mIsInitialized(false),
+	mIncomingSlices(NULL),
+	mFirstScheduledSlice(NULL),
+	mLastScheduledSlice(NULL),
+	mRequestedStartSampleTime(-1.0),
+	mStartIsPending(false),
+	mHasStarted(false),
+	mStartSampleTime(0.0),
+	mCurrentPlayTime(-1.0),
+	mProcessors(),
+	mRenderLock()
+{
+	
+}
+
+PKPullRenderCore::~PKPullRenderCore()
+{
+	for (std::vector<PKRenderProcessor *>::iterator processor = mProcessors.begin(); processor != mProcessors.end(); processor++)
+		(*processor)->Release();
+	
+	mProcessors.clear();
+}
+
+#pragma mark -
+#pragma mark Formats
+
+OSStatus PKPullRenderCore::SetStreamFormats(const AudioStreamBasicDescription &sliceFormat, const AudioStreamBasicDescription &outputFormat) throw()
+{
+	if(!IsSupportedFormat(sliceFormat, false) ||
+	   !IsSupportedFormat(outputFormat, true) ||
+	   (sliceFormat.mSampleRate != outputFormat.mSampleRate))
+	{
+		return kAudioUnitErr_FormatNotSupported;
+	}
+	
+	//Slices scheduled in the old format can't be rendered in the new one.
+	this->Reset();
+	
+	std::lock_guard<std::mutex> lock(mRenderLock);
+	
+	mSliceFormat = sliceFormat;
+	mOutputFormat = outputFormat;
+	
+	OSStatus errorCode = noErr;
+	for (std::vector<PKRenderProcessor *>::iterator processor = mProcessors.begin(); processor != mProcessors.end(); processor++)
+	{
+		errorCode = (*processor)->Initialize(mOutputFormat);
+		if(errorCode != noErr)
+			break;
+	}
+	
+	mIsInitialized.store((errorCode == noErr), std::memory_order_release);
+	
+	return errorCode;
+}
+
+#pragma mark -
+#pragma mark Effects
+
+OSStatus PKPullRenderCore::AddProcessor(PKRenderProcessor *processor) throw()
+{
+	if(!processor)
+		return paramErr;
+	
+	std::lock_guard<std::mutex> lock(mRenderLock);
+	
+	if(mIsInitialized.load(std::memory_order_acquire))
+	{
+		OSStatus errorCode = processor->Initialize(mOutputFormat);
+		if(errorCode != noErr)
+			return errorCode;
+	}
+	
+	processor->Retain();
+	mProcessors.push_back(processor);
+	
+	return noErr;
+}
+
+OSStatus PKPullRenderCore::RemoveProcessor(PKRenderProcessor *processor) throw()
+{
+	std::lock_guard<std::mutex> lock(mRenderLock);
+	
+	std::vector<PKRenderProcessor *>::iterator position = std::find(mProcessors.begin(), mProcessors.end(), processor);
+	if(position == mProcessors.end())
+		return paramErr;
+	
+	mProcessors.erase(position);
+	processor->Release();
+	
+	return noErr;
+}
+
+#pragma mark -
+#pragma mark Scheduling
+
+OSStatus PKPullRenderCore::ScheduleSlice(ScheduledAudioSlice *slice) throw()
+{
+	if(!slice || !slice->mBufferList || ((slice->mTimeStamp.mFlags & kAudioTimeStampSampleTimeValid) == 0))
+		return paramErr;
+	
+	if(!mIsInitialized.load(std::memory_order_acquire))
+		return kAudioUnitErr_Uninitialized;
+	
+	if(!BuffersCanHoldFrames(mSliceFormat, slice->mBufferList, slice->mNumberFrames))
+		return paramErr;
+	
+	slice->mFlags = 0;
+	
+	//The incoming slices are linked newest first through their reserved field, so scheduling never locks or allocates.
+	ScheduledAudioSlice *newestSlice = mIncomingSlices.load(std::memory_order_relaxed);
+	do
+	{
+		slice->mReserved2 = newestSlice;
+	}
+	while (!mIncomingSlices.compare_exchange_weak(newestSlice, slice, std::memory_order_release, std::memory_order_relaxed));
+	
+	return noErr;
+}
+
+void PKPullRenderCore::TakeIncomingSlices() throw()
+{
+	ScheduledAudioSlice *newestSlice = mIncomingSlices.exchange(NULL, std::memory_order_acquire);
+	
+	//Put the incoming slices back in the order they were scheduled in.
+	ScheduledAudioSlice *oldestSlice = NULL;
+	while (newestSlice)
+	{
+		ScheduledAudioSlice *nextSlice = (ScheduledAudioSlice *)(newestSlice->mReserved2);
+		newestSlice->mReserved2 = oldestSlice;
+		oldestSlice = newestSlice;
+		newestSlice = nextSlice;
+	}
+	
+	if(!oldestSlice)
+		return;
+	
+	if(mLastScheduledSlice)
+		mLastScheduledSlice->mReserved2 = oldestSlice;
+	else
+		mFirstScheduledSlice = oldestSlice;
+	
+	while (oldestSlice->mReserved2)
+		oldestSlice = (ScheduledAudioSlice *)(oldestSlice->mReserved2);
+	
+	mLastScheduledSlice = oldestSlice;
+}
+
+OSStatus PKPullRenderCore::SetStartSampleTime(Float64 sampleTime) throw()
+{
+	mRequestedStartSampleTime.store(sampleTime, std::memory_order_relaxed);
+	mStartIsPending.store(true, std::memory_order_release);
+	
+	return noErr;
+}
+
+OSStatus PKPullRenderCore::GetCurrentPlayTime(AudioTimeStamp *outTimeStamp) const throw()
+{
+	if(!outTimeStamp)
+		return paramErr;
+	
+	memset(outTimeStamp, 0, sizeof(AudioTimeStamp));
+	outTimeStamp->mSampleTime = mCurrentPlayTime.load(std::memory_order_acquire);
+	outTimeStamp->mFlags = kAudioTimeStampSampleTimeValid;
+	
+	return noErr;
+}
+
+OSStatus PKPullRenderCore::Reset() throw()
+{
+	std::lock_guard<std::mutex> lock(mRenderLock);
+	
+	mIncomingSlices.store(NULL, std::memory_order_relaxed);
+	mFirstScheduledSlice = NULL;
+	mLastScheduledSlice = NULL;
+	
+	mStartIsPending.store(false, std::memory_order_relaxed);
+	mHasStarted = false;
+	mCurrentPlayTime.store(-1.0, std::memory_order_release);
+	
+	for (std::vector<PKRenderProcessor *>::iterator processor = mProcessors.begin(); processor != mProcessors.end(); processor++)
+		(*processor)->Reset();
+	
+	return noErr;
+}
+
+#pragma mark -
+#pragma mark Rendering
+
+void PKPullRenderCore::ConvertFrames(const AudioBufferList *source, UInt32 sourceOffset, AudioBufferList *destination, UInt32 destinationOffset, UInt32 numberOfFrames) const throw()
+{
+	UInt32 sourceNumberOfChannels = mSliceFormat.mChannelsPerFrame;
+	bool sourceIsFloat = ((mSliceFormat.mFormatFlags & kAudioFormatFlagIsFloat) != 0);
+	
+	for (UInt32 channel = 0; channel < mOutputFormat.mChannelsPerFrame; channel++)
+	{
+		UInt32 sourceChannel = (sourceNumberOfChannels == 1)? 0 : channel;
+		if(sourceChannel >= sourceNumberOfChannels)
+			continue;
+		
+		UInt32 sourceStride = 0;
+		const void *sourceSamples = GetChannelSamples(mSliceFormat, source, sourceChannel, sourceOffset, &sourceStride);
+		
+		UInt32 destinationStride = 0;
+		Float32 *destinationSamples = (Float32 *)GetChannelSamples(mOutputFormat, destination, channel, destinationOffset, &destinationStride);
+		
+		if(sourceIsFloat)
+		{
+			const Float32 *samples = (const Float32 *)sourceSamples;
+			for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+				destinationSamples[frame * destinationStride] += samples[frame * sourceStride];
+		}
+		else if(mSliceFormat.mBitsPerChannel == 16)
+		{
+			const SInt16 *samples = (const SInt16 *)sourceSamples;
+			for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+				destinationSamples[frame * destinationStride] += Float32(samples[frame * sourceStride]) * (1.0f / 32768.0f);
+		}
+		else
+		{
+			const SInt32 *samples = (const SInt32 *)sourceSamples;
+			for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+				destinationSamples[frame * destinationStride] += Float32(samples[frame * sourceStride]) * (1.0f / 2147483648.0f);
+		}
+	}
+}
+
+OSStatus PKPullRenderCore::Render(AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *timeStamp, UInt32 numberOfFrames, AudioBufferList *ioData) throw()
+{
+	if(!ioActionFlags || !timeStamp || !ioData)
+		return paramErr;
+	
+	//
+	//	Someone is resetting or reconfiguring us. We don't wait for them, the cycle is
+	//	simply silent. What's in the buffers is all we can safely assume about them.
+	//
+	std::unique_lock<std::mutex> lock(mRenderLock, std::try_to_lock);
+	if(!lock.owns_lock())
+	{
+		for (UInt32 index = 0; index < ioData->mNumberBuffers; index++)
+		{
+			if(ioData->mBuffers[index].mData)
+				memset(ioData->mBuffers[index].mData, 0, ioData->mBuffers[index].mDataByteSize);
+		}
+		
+		*ioActionFlags |= kAudioUnitRenderAction_OutputIsSilence;
+		return noErr;
+	}
+	
+	if(!mIsInitialized.load(std::memory_order_acquire))
+		return kAudioUnitErr_Uninitialized;
+	
+	if(!BuffersCanHoldFrames(mOutputFormat, ioData, numberOfFrames))
+		return paramErr;
+	
+	for (UInt32 index = 0; index < ioData->mNumberBuffers; index++)
+	{
+		ioData->mBuffers[index].mDataByteSize = numberOfFrames * mOutputFormat.mBytesPerFrame;
+		memset(ioData->mBuffers[index].mData, 0, ioData->mBuffers[index].mDataByteSize);
+	}
+	
+	if(mStartIsPending.exchange(false, std::memory_order_acquire))
+	{
+		Float64 requestedStartSampleTime = mRequestedStartSampleTime.load(std::memory_order_relaxed);
+		mStartSampleTime = (requestedStartSampleTime < 0.0)? timeStamp->mSampleTime : requestedStartSampleTime;
+		mHasStarted = true;
+	}
+	
+	bool didRenderSlices = false;
+	if(mHasStarted)
+	{
+		Float64 startOfCycle = timeStamp->mSampleTime - mStartSampleTime;
+		Float64 endOfCycle = startOfCycle + numberOfFrames;
+		
+		this->TakeIncomingSlices();
+		while (mFirstScheduledSlice)
+		{
+			ScheduledAudioSlice *slice = mFirstScheduledSlice;
+			Float64 startOfSlice = slice->mTimeStamp.mSampleTime;
+			Float64 endOfSlice = startOfSlice + slice->mNumberFrames;
+			if(startOfSlice >= endOfCycle)
+				break;
+			
+			if(endOfSlice > startOfCycle)
+			{
+				if((slice->mFlags & kScheduledAudioSliceFlag_BeganToRender) == 0)
+				{
+					slice->mFlags |= kScheduledAudioSliceFlag_BeganToRender;
+					if(startOfSlice < startOfCycle)
+						slice->mFlags |= kScheduledAudioSliceFlag_BeganToRenderLate;
+				}
+				
+				Float64 firstFrame = std::max(startOfSlice, startOfCycle);
+				Float64 lastFrame = std::min(endOfSlice, endOfCycle);
+				this->ConvertFrames(slice->mBufferList,
+									UInt32(firstFrame - startOfSlice),
+									ioData,
+									UInt32(firstFrame - startOfCycle),
+									UInt32(lastFrame - firstFrame));
+				didRenderSlices = true;
+				
+				if(endOfSlice > endOfCycle)
+					break;
+			}
+			else
+			{
+				//The slice was scheduled too late for any of it to be heard.
+				slice->mFlags |= kScheduledAudioSliceFlag_BeganToRenderLate;
+			}
+			
+			mFirstScheduledSlice = (ScheduledAudioSlice *)(slice->mReserved2);
+			if(!mFirstScheduledSlice)
+				mLastScheduledSlice = NULL;
+			
+			//The slice is no longer ours once it has been handed back, it is usually scheduled again right away.
+			slice->mReserved2 = NULL;
+			slice->mFlags |= kScheduledAudioSliceFlag_Complete;
+			if(slice->mCompletionProc)
+				slice->mCompletionProc(slice->mCompletionProcUserData, slice);
+			
+			//Slices scheduled by the completion proc may still belong to this render cycle.
+			if(!mFirstScheduledSlice)
+				this->TakeIncomingSlices();
+		}
+		
+		mCurrentPlayTime.store(endOfCycle, std::memory_order_release);
+	}
+	
+	for (std::vector<PKRenderProcessor *>::iterator processor = mProcessors.begin(); processor != mProcessors.end(); processor++)
+	{
+		OSStatus errorCode = (*processor)->Process(ioData, numberOfFrames, timeStamp);
+		if(errorCode != noErr)
+			return errorCode;
+	}
+	
+	if(!didRenderSlices && mProcessors.empty())
+		*ioActionFlags |= kAudioUnitRenderAction_OutputIsSilence;
+	
+	return noErr;
+}
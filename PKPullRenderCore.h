@@ -0,0 +1,214 @@
+/*
+ *  PKPullRenderCore.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKPullRenderCore_h
+#define PKPullRenderCore_h 1
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "PKRenderCore.h"
+
+/*!
+ @class
+ @abstract		The PKRenderProcessor class is the abstract effect of PKPullRenderCore.
+ @discussion	Processors work in place on the output of the render core they are added to,
+				which is always 32 bit floating point linear PCM.
+ */
+class PK_VISIBILITY_HIDDEN PKRenderProcessor : public RBObject
+{
+public:
+	
+	/*!
+	 @abstract	Construct the processor passing in the name of the processor subclass.
+	 */
+	explicit PKRenderProcessor(const char *className = "PKRenderProcessor") : RBObject(className) {}
+	virtual ~PKRenderProcessor() {}
+	
+#pragma mark -
+	
+	/*!
+	 @abstract		Prepare the receiver to process audio in a specified format.
+	 @discussion	Called when the receiver is added to a render core, and whenever the format of the core
+					changes. Never called while the receiver is processing. The default implementation does nothing.
+	 */
+	virtual OSStatus Initialize(const AudioStreamBasicDescription &streamFormat) throw() { return noErr; }
+	
+	/*!
+	 @abstract		Process a number of frames in place.
+	 @discussion	Called on the render thread. Implementations must not lock or allocate.
+	 */
+	virtual OSStatus Process(AudioBufferList *ioData, UInt32 numberOfFrames, const AudioTimeStamp *timeStamp) throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract		Forget any audio the receiver is holding on to, such as the tail of a delay.
+	 @discussion	Called when the render core the receiver belongs to is reset. The default implementation does nothing.
+	 */
+	virtual void Reset() throw() {}
+
+private:
+	PKRenderProcessor(PKRenderProcessor &processor);
+	PKRenderProcessor &operator=(PKRenderProcessor &processor);
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract	The PKGainRenderProcessor class scales the audio it processes by a gain that can be changed while rendering.
+ */
+class PK_VISIBILITY_HIDDEN PKGainRenderProcessor : public PKRenderProcessor
+{
+protected:
+	
+	/* n/a */	std::atomic<Float32> mGain;
+
+public:
+	
+	explicit PKGainRenderProcessor(Float32 gain = 1.0f);
+	virtual ~PKGainRenderProcessor();
+	
+#pragma mark -
+	
+	virtual OSStatus Process(AudioBufferList *ioData, UInt32 numberOfFrames, const AudioTimeStamp *timeStamp) throw();
+	
+#pragma mark -
+	
+	/*!
+	 @abstract	Set the gain of the receiver. Safe to call from any thread.
+	 */
+	void SetGain(Float32 gain) throw() { mGain.store(gain, std::memory_order_relaxed); }
+	
+	/*!
+	 @abstract	Returns the gain of the receiver.
+	 */
+	Float32 GetGain() const throw() { return mGain.load(std::memory_order_relaxed); }
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract		The PKPullRenderCore class is the portable render core. It schedules slices against its own
+				time line, converts them into its output format, and runs them through a chain of processors,
+				all on the thread that pulls audio out of it with Render.
+ @discussion	Slices may be scheduled in any linear PCM format with native endian 16 or 32 bit signed integer or
+				32 bit floating point samples, interleaved or not. The output format is always 32 bit floating point
+				linear PCM at the same sample rate. Mono slices are played on every output channel, other slices
+				channel for channel; output channels a slice doesn't have are silent.
+				
+				The render thread never waits. Slices are handed to it through a lock free list, and if a reset or a
+				configuration change is in progress when a render cycle begins, the cycle is rendered as silence.
+				Slices must be scheduled in the order of their sample times, which is how PKAudioPlayerEngine schedules them.
+ */
+class PK_VISIBILITY_HIDDEN PKPullRenderCore : public PKRenderCore
+{
+protected:
+	
+	/* n/a */	AudioStreamBasicDescription mSliceFormat;
+	/* n/a */	AudioStreamBasicDescription mOutputFormat;
+	/* n/a */	std::atomic<bool> mIsInitialized;
+	
+	//Scheduling
+	/* weak */	std::atomic<ScheduledAudioSlice *> mIncomingSlices;
+	/* weak */	ScheduledAudioSlice *mFirstScheduledSlice;
+	/* weak */	ScheduledAudioSlice *mLastScheduledSlice;
+	
+	//Time line
+	/* n/a */	std::atomic<Float64> mRequestedStartSampleTime;
+	/* n/a */	std::atomic<bool> mStartIsPending;
+	/* n/a */	bool mHasStarted;
+	/* n/a */	Float64 mStartSampleTime;
+	/* n/a */	std::atomic<Float64> mCurrentPlayTime;
+	
+	//Effects
+	/* owner */	std::vector<PKRenderProcessor *> mProcessors;
+	
+	/*!
+	 @abstract		Held by the render thread for the duration of a render cycle, and by anything that changes
+					what a render cycle touches. The render thread only ever tries to take it.
+	 */
+	/* n/a */	std::mutex mRenderLock;
+	
+#pragma mark -
+	
+	/*!
+	 @abstract		Move the slices scheduled since the last render cycle onto the end of the scheduled slices.
+	 @discussion	Only called with mRenderLock held.
+	 */
+	void TakeIncomingSlices() throw();
+	
+	/*!
+	 @abstract		Convert a range of frames of a slice into the output format, adding them to a range of the output.
+	 @discussion	The output is silent where it is written to, so adding is the same as copying. Adding keeps
+					this correct if scheduled slices ever overlap.
+	 */
+	void ConvertFrames(const AudioBufferList *source, UInt32 sourceOffset, AudioBufferList *destination, UInt32 destinationOffset, UInt32 numberOfFrames) const throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	PKPullRenderCore();
+	virtual ~PKPullRenderCore();
+	
+#pragma mark -
+#pragma mark Formats
+	
+	/*!
+	 @abstract		Set the format slices are scheduled in, and the format the receiver renders.
+	 @result		kAudioUnitErr_FormatNotSupported if the receiver can't convert from one format into the other.
+	 @discussion	Any slices that are scheduled are dropped, as with Reset. The receiver must be
+					given its formats before anything can be scheduled or rendered, and they must not
+					change while slices are being scheduled.
+	 */
+	OSStatus SetStreamFormats(const AudioStreamBasicDescription &sliceFormat, const AudioStreamBasicDescription &outputFormat) throw();
+	
+	/*!
+	 @abstract	Returns the format slices are scheduled in.
+	 */
+	AudioStreamBasicDescription GetSliceFormat() const throw() { return mSliceFormat; }
+	
+	/*!
+	 @abstract	Returns the format the receiver renders.
+	 */
+	AudioStreamBasicDescription GetOutputFormat() const throw() { return mOutputFormat; }
+	
+#pragma mark -
+#pragma mark Effects
+	
+	/*!
+	 @abstract		Add a processor to the end of the receiver's effects chain. The processor is retained.
+	 @discussion	Waits for the render cycle in progress, if there is one, to finish.
+	 */
+	OSStatus AddProcessor(PKRenderProcessor *processor) throw();
+	
+	/*!
+	 @abstract		Remove a processor from the receiver's effects chain, releasing it.
+	 @discussion	Waits for the render cycle in progress, if there is one, to finish.
+	 */
+	OSStatus RemoveProcessor(PKRenderProcessor *processor) throw();
+	
+	/*!
+	 @abstract	Returns the number of processors in the receiver's effects chain.
+	 */
+	UInt32 GetNumberOfProcessors() const throw() { return UInt32(mProcessors.size()); }
+	
+#pragma mark -
+#pragma mark PKRenderCore
+	
+	virtual OSStatus ScheduleSlice(ScheduledAudioSlice *slice) throw();
+	virtual OSStatus SetStartSampleTime(Float64 sampleTime) throw();
+	virtual OSStatus GetCurrentPlayTime(AudioTimeStamp *outTimeStamp) const throw();
+	virtual OSStatus Reset() throw();
+	virtual OSStatus Render(AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *timeStamp, UInt32 numberOfFrames, AudioBufferList *ioData) throw();
+};
+
+#endif /* PKPullRenderCore_h */
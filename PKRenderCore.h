@@ -0,0 +1,97 @@
+/*
+ *  PKRenderCore.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKRenderCore_h
+#define PKRenderCore_h 1
+
+#include "PKRenderTypes.h"
+#include "RBObject.h"
+
+/*!
+ @class
+ @abstract		The PKRenderCore class is the abstract bottom half of PKAudioPlayerEngine. It plays
+				slices of audio scheduled against a sample time line, and renders them on demand.
+ @discussion	The interface mirrors the parts of the scheduled sound player audio unit the engine relies
+				on: slices are scheduled with ScheduleSlice and handed back through their completion proc once
+				they have been rendered, the time line starts with SetStartSampleTime and is thrown away
+				with Reset, and audio is pulled out with Render.
+				
+				Render cores report errors with OSStatus codes instead of raising, like the Core Audio calls
+				they stand in for. They are driven from the render thread, and from the completion procs of
+				the slices they render, where raising is not an option.
+ */
+class PK_VISIBILITY_HIDDEN PKRenderCore : public RBObject
+{
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct the render core passing in the name of the render core subclass.
+	 */
+	explicit PKRenderCore(const char *className = "PKRenderCore") : RBObject(className) {}
+	
+	/*!
+	 @abstract	Destruct the render core.
+	 */
+	virtual ~PKRenderCore() {}
+	
+#pragma mark -
+#pragma mark Scheduling
+	
+	/*!
+	 @abstract		Schedule a slice of audio for playback.
+	 @param			slice	The slice to schedule. Its time stamp must contain a valid sample time on the
+							receiver's time line. Required. The slice must stay alive until its completion
+							proc has been invoked, or the receiver has been reset.
+	 @result		noErr if the slice was scheduled.
+	 @discussion	Safe to call from any thread, including from the completion proc of another slice.
+	 */
+	virtual OSStatus ScheduleSlice(ScheduledAudioSlice *slice) throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract		Set the render sample time at which the receiver's time line begins.
+	 @param			sampleTime	The render sample time. Pass -1 to begin with the next render cycle.
+	 */
+	virtual OSStatus SetStartSampleTime(Float64 sampleTime) throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract		Get the position of the receiver on its own time line.
+	 @param			outTimeStamp	On return, a time stamp whose sample time is the number of frames played since the
+									time line began, or -1 if it has not begun yet. Required.
+	 */
+	virtual OSStatus GetCurrentPlayTime(AudioTimeStamp *outTimeStamp) const throw() PK_PURE_VIRTUAL;
+	
+	/*!
+	 @abstract		Drop every slice scheduled in the receiver without invoking their completion procs, and stop its time line.
+	 @discussion	Once this returns the receiver no longer touches any slice that was scheduled before the call.
+	 */
+	virtual OSStatus Reset() throw() PK_PURE_VIRTUAL;
+	
+#pragma mark -
+#pragma mark Rendering
+	
+	/*!
+	 @abstract		Render a number of frames into a buffer list.
+	 @param			ioActionFlags	The render action flags. Required.
+	 @param			timeStamp		The render time of the first frame. Required.
+	 @param			numberOfFrames	The number of frames to render.
+	 @param			ioData			The buffers to render into. They must be able to contain `numberOfFrames`
+									frames in the format the receiver renders. Required.
+	 @discussion	This is the pull-model entry point. Completion procs of slices that finish
+					during the call are invoked on the calling thread before this returns.
+	 */
+	virtual OSStatus Render(AudioUnitRenderActionFlags *ioActionFlags, const AudioTimeStamp *timeStamp, UInt32 numberOfFrames, AudioBufferList *ioData) throw() PK_PURE_VIRTUAL;
+
+private:
+	PKRenderCore(PKRenderCore &core);
+	PKRenderCore &operator=(PKRenderCore &core);
+};
+
+#endif /* PKRenderCore_h */
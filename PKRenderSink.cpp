@@ -0,0 +1,334 @@
+/*
+ *  PKRenderSink.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKRenderSink.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/types.h>
+
+#pragma mark PKRenderSink
+
+#pragma mark Lifecycle
+
+PKRenderSink::PKRenderSink(const char *className) :
+	RBObject(className),
+	mStreamFormat(),
+	mNumberOfFramesWritten(0),
+	mIsOpen(false)
+{
+	
+}
+
+PKRenderSink::~PKRenderSink()
+{
+	
+}
+
+#pragma mark -
+#pragma mark Writing
+
+OSStatus PKRenderSink::Open(const AudioStreamBasicDescription &streamFormat) throw()
+{
+	if(mIsOpen)
+		return paramErr;
+	
+	mStreamFormat = streamFormat;
+	mNumberOfFramesWritten = 0;
+	mIsOpen = true;
+	
+	return noErr;
+}
+
+OSStatus PKRenderSink::Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	if(!mIsOpen)
+		return paramErr;
+	
+	mNumberOfFramesWritten += numberOfFrames;
+	
+	return noErr;
+}
+
+OSStatus PKRenderSink::Close() throw()
+{
+	mIsOpen = false;
+	
+	return noErr;
+}
+
+#pragma mark -
+#pragma mark PKNullRenderSink
+
+PKNullRenderSink::PKNullRenderSink() :
+	PKRenderSink("PKNullRenderSink")
+{
+	
+}
+
+PKNullRenderSink::~PKNullRenderSink()
+{
+	
+}
+
+#if defined(__BLOCKS__)
+
+#pragma mark -
+#pragma mark PKBlockRenderSink
+
+PKBlockRenderSink::PKBlockRenderSink(WriteHandler handler) :
+	PKRenderSink("PKBlockRenderSink"),
+	mWriteHandler(Block_copy(handler))
+{
+	
+}
+
+PKBlockRenderSink::~PKBlockRenderSink()
+{
+	if(mWriteHandler)
+	{
+		Block_release(mWriteHandler);
+		mWriteHandler = NULL;
+	}
+}
+
+OSStatus PKBlockRenderSink::Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	if(!buffers || !mIsOpen)
+		return paramErr;
+	
+	mWriteHandler(buffers, numberOfFrames);
+	
+	return PKRenderSink::Write(buffers, numberOfFrames);
+}
+
+#endif /* defined(__BLOCKS__) */
+
+#pragma mark -
+#pragma mark PKWAVFileRenderSink
+
+//WAVE_FORMAT_IEEE_FLOAT from mmreg.h
+static UInt16 const kWAVFormatIEEEFloat = 0x0003;
+
+//The size of a canonical RIFF header with a 16 byte 'fmt ' chunk.
+static UInt32 const kWAVHeaderSize = 44;
+
+static void WriteLittleEndian32(UInt8 *destination, UInt32 value)
+{
+	destination[0] = UInt8(value);
+	destination[1] = UInt8(value >> 8);
+	destination[2] = UInt8(value >> 16);
+	destination[3] = UInt8(value >> 24);
+}
+
+static void WriteLittleEndian16(UInt8 *destination, UInt16 value)
+{
+	destination[0] = UInt8(value);
+	destination[1] = UInt8(value >> 8);
+}
+
+#pragma mark -
+#pragma mark Lifecycle
+
+PKWAVFileRenderSink::PKWAVFileRenderSink(const char *path) :
+	PKRenderSink("PKWAVFileRenderSink"),
+	mPath(path? strdup(path) : NULL),
+	mFile(NULL),
+	mInterleavingBuffer(NULL),
+	mInterleavingBufferNumberOfFrames(0)
+{
+	
+}
+
+#if defined(__APPLE__)
+
+PKWAVFileRenderSink::PKWAVFileRenderSink(CFURLRef location) :
+	PKRenderSink("PKWAVFileRenderSink"),
+	mPath(NULL),
+	mFile(NULL),
+	mInterleavingBuffer(NULL),
+	mInterleavingBufferNumberOfFrames(0)
+{
+	//Locations that aren't files are reported when the sink is opened.
+	char path[PATH_MAX];
+	if(location && CFURLGetFileSystemRepresentation(location, true, (UInt8 *)path, sizeof(path)))
+		mPath = strdup(path);
+}
+
+#endif /* defined(__APPLE__) */
+
+PKWAVFileRenderSink::~PKWAVFileRenderSink()
+{
+	if(mFile)
+	{
+		fclose(mFile);
+		mFile = NULL;
+	}
+	
+	if(mInterleavingBuffer)
+	{
+		free(mInterleavingBuffer);
+		mInterleavingBuffer = NULL;
+	}
+	
+	if(mPath)
+	{
+		free(mPath);
+		mPath = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Writing
+
+OSStatus PKWAVFileRenderSink::WriteHeader() throw()
+{
+	UInt32 bytesPerFrame = sizeof(Float32) * mStreamFormat.mChannelsPerFrame;
+	UInt64 dataSize = mNumberOfFramesWritten * bytesPerFrame;
+	
+	//Rendered audio that is too large to be stored in a WAV file.
+	if(dataSize > (UINT32_MAX - kWAVHeaderSize))
+		return ioErr;
+	
+	UInt8 header[kWAVHeaderSize];
+	memcpy(header + 0, "RIFF", 4);
+	WriteLittleEndian32(header + 4, UInt32(kWAVHeaderSize - 8 + dataSize));
+	memcpy(header + 8, "WAVE", 4);
+	
+	memcpy(header + 12, "fmt ", 4);
+	WriteLittleEndian32(header + 16, 16);
+	WriteLittleEndian16(header + 20, kWAVFormatIEEEFloat);
+	WriteLittleEndian16(header + 22, UInt16(mStreamFormat.mChannelsPerFrame));
+	WriteLittleEndian32(header + 24, UInt32(mStreamFormat.mSampleRate));
+	WriteLittleEndian32(header + 28, UInt32(mStreamFormat.mSampleRate * bytesPerFrame));
+	WriteLittleEndian16(header + 32, UInt16(bytesPerFrame));
+	WriteLittleEndian16(header + 34, sizeof(Float32) * 8);
+	
+	memcpy(header + 36, "data", 4);
+	WriteLittleEndian32(header + 40, UInt32(dataSize));
+	
+	if((fseeko(mFile, 0, SEEK_SET) != 0) || 
+	   (fwrite(header, sizeof(header), 1, mFile) != 1) || 
+	   (fseeko(mFile, 0, SEEK_END) != 0))
+	{
+		return ioErr;
+	}
+	
+	return noErr;
+}
+
+OSStatus PKWAVFileRenderSink::Open(const AudioStreamBasicDescription &streamFormat) throw()
+{
+	if(mIsOpen || !mPath)
+		return paramErr;
+	
+	if((streamFormat.mFormatID != kAudioFormatLinearPCM) || 
+	   ((streamFormat.mFormatFlags & kAudioFormatFlagIsFloat) != kAudioFormatFlagIsFloat) || 
+	   (streamFormat.mBitsPerChannel != 32))
+	{
+		//PKWAVFileRenderSink only supports 32 bit floating point linear PCM.
+		return kAudioUnitErr_FormatNotSupported;
+	}
+	
+	mFile = fopen(mPath, "w+b");
+	if(!mFile)
+		return ioErr;
+	
+	PKRenderSink::Open(streamFormat);
+	
+	//Reserve room for the header, it is rewritten with the final sizes when the sink is closed.
+	OSStatus errorCode = this->WriteHeader();
+	if(errorCode != noErr)
+	{
+		fclose(mFile);
+		mFile = NULL;
+		
+		PKRenderSink::Close();
+	}
+	
+	return errorCode;
+}
+
+OSStatus PKWAVFileRenderSink::Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	if(!buffers || !mIsOpen)
+		return paramErr;
+	
+	if(numberOfFrames == 0)
+		return noErr;
+	
+	UInt32 numberOfChannels = mStreamFormat.mChannelsPerFrame;
+	size_t numberOfSamples = size_t(numberOfFrames) * numberOfChannels;
+	
+	const Float32 *interleavedSamples = NULL;
+	if(buffers->mNumberBuffers == 1)
+	{
+		//Interleaved (or mono) audio can be written as is.
+		interleavedSamples = (const Float32 *)(buffers->mBuffers[0].mData);
+	}
+	else
+	{
+		if(mInterleavingBufferNumberOfFrames < numberOfFrames)
+		{
+			Float32 *interleavingBuffer = (Float32 *)realloc(mInterleavingBuffer, numberOfSamples * sizeof(Float32));
+			if(!interleavingBuffer)
+				return memFullErr;
+			
+			mInterleavingBuffer = interleavingBuffer;
+			mInterleavingBufferNumberOfFrames = numberOfFrames;
+		}
+		
+		for (UInt32 channel = 0; channel < numberOfChannels; channel++)
+		{
+			const Float32 *channelSamples = (const Float32 *)(buffers->mBuffers[channel].mData);
+			for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+				mInterleavingBuffer[(frame * numberOfChannels) + channel] = channelSamples[frame];
+		}
+		
+		interleavedSamples = mInterleavingBuffer;
+	}
+	
+#if __BIG_ENDIAN__
+	for (size_t index = 0; index < numberOfSamples; index++)
+	{
+		UInt32 sample;
+		memcpy(&sample, &interleavedSamples[index], sizeof(sample));
+		
+		UInt8 littleEndianSample[sizeof(sample)];
+		WriteLittleEndian32(littleEndianSample, sample);
+		if(fwrite(littleEndianSample, sizeof(littleEndianSample), 1, mFile) != 1)
+			return ioErr;
+	}
+#else
+	size_t numberOfSamplesWritten = fwrite(interleavedSamples, sizeof(Float32), numberOfSamples, mFile);
+	if(numberOfSamplesWritten != numberOfSamples)
+		return ioErr;
+#endif /* __BIG_ENDIAN__ */
+	
+	return PKRenderSink::Write(buffers, numberOfFrames);
+}
+
+OSStatus PKWAVFileRenderSink::Close() throw()
+{
+	if(!mIsOpen)
+		return noErr;
+	
+	//The file is closed even if the header can't be finished, so a failed close is never retried.
+	OSStatus errorCode = this->WriteHeader();
+	
+	if((fclose(mFile) != 0) && (errorCode == noErr))
+		errorCode = ioErr;
+	mFile = NULL;
+	
+	PKRenderSink::Close();
+	
+	return errorCode;
+}
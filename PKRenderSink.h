@@ -0,0 +1,209 @@
+/*
+ *  PKRenderSink.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKRenderSink_h
+#define PKRenderSink_h 1
+
+#if defined(__APPLE__)
+#include <CoreFoundation/CoreFoundation.h>
+#endif /* defined(__APPLE__) */
+#if defined(__BLOCKS__)
+#include <Block.h>
+#endif /* defined(__BLOCKS__) */
+#include <stdio.h>
+
+#include "PKRenderTypes.h"
+#include "RBObject.h"
+
+/*!
+ @class
+ @abstract		The PKRenderSink class is the abstract destination for audio that is pulled out
+				of a PKAudioPlayerEngine instance through its manual rendering interface.
+ @discussion	Render sinks allow the complete decode, convert, effects and output path of PlayerKit
+				to be exercised without an output device. Sinks are always opened with the stream
+				format of the engine that feeds them before any audio is written into them.
+				
+				Sinks report errors with OSStatus codes so that they, like PKRenderCore, build without
+				Core Foundation. paramErr is returned when a sink is used out of order.
+ */
+class PK_VISIBILITY_HIDDEN PKRenderSink : public RBObject
+{
+protected:
+	
+	/* n/a */	AudioStreamBasicDescription mStreamFormat;
+	/* n/a */	UInt64 mNumberOfFramesWritten;
+	/* n/a */	bool mIsOpen;
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct the sink passing in the name of the sink subclass.
+	 */
+	explicit PKRenderSink(const char *className = "PKRenderSink");
+	
+	/*!
+	 @abstract	Destruct the sink.
+	 */
+	virtual ~PKRenderSink();
+	
+#pragma mark -
+#pragma mark Writing
+	
+	/*!
+	 @abstract		Prepare the sink to receive audio in a specified stream format.
+	 @discussion	Subclasses that override this method must call through to PKRenderSink::Open.
+	 */
+	virtual OSStatus Open(const AudioStreamBasicDescription &streamFormat) throw();
+	
+	/*!
+	 @abstract		Write a number of rendered frames into the sink.
+	 @param			buffers			The buffers containing the rendered audio. Required.
+	 @param			numberOfFrames	The number of frames contained in `buffers`.
+	 @discussion	Subclasses that override this method must call through to PKRenderSink::Write.
+	 */
+	virtual OSStatus Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+	
+	/*!
+	 @abstract		Finish writing into the sink.
+	 @discussion	Closing a sink that is not open does nothing. Subclasses that override
+					this method must call through to PKRenderSink::Close.
+	 */
+	virtual OSStatus Close() throw();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	/*!
+	 @abstract	Returns whether or not the sink has been opened.
+	 */
+	bool IsOpen() const { return mIsOpen; }
+	
+	/*!
+	 @abstract	Returns the stream format the sink was opened with.
+	 */
+	AudioStreamBasicDescription GetStreamFormat() const { return mStreamFormat; }
+	
+	/*!
+	 @abstract	Returns the number of frames written into the sink since it was opened.
+	 */
+	UInt64 GetNumberOfFramesWritten() const { return mNumberOfFramesWritten; }
+
+private:
+	PKRenderSink(PKRenderSink &sink);
+	PKRenderSink &operator=(PKRenderSink &sink);
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract	The PKNullRenderSink class discards all of the audio written into it.
+			It is used to measure the throughput of the render path.
+ */
+class PK_VISIBILITY_HIDDEN PKNullRenderSink : public PKRenderSink
+{
+public:
+	
+	PKNullRenderSink();
+	virtual ~PKNullRenderSink();
+};
+
+#if defined(__BLOCKS__)
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract	The PKBlockRenderSink class hands the audio written into it to a block.
+ */
+class PK_VISIBILITY_HIDDEN PKBlockRenderSink : public PKRenderSink
+{
+public:
+	
+	/*!
+	 @abstract		The type of block invoked by PKBlockRenderSink.
+	 @param			buffers			The rendered audio. Only valid for the duration of the call.
+	 @param			numberOfFrames	The number of frames contained in `buffers`.
+	 */
+	typedef void(^WriteHandler)(const AudioBufferList *buffers, UInt32 numberOfFrames);
+	
+protected:
+	
+	/* owner */	WriteHandler mWriteHandler;
+	
+public:
+	
+	/*!
+	 @abstract	Construct a block sink with a handler. The handler is copied.
+	 */
+	explicit PKBlockRenderSink(WriteHandler handler);
+	virtual ~PKBlockRenderSink();
+	
+#pragma mark -
+	
+	virtual OSStatus Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+};
+
+#endif /* defined(__BLOCKS__) */
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract		The PKWAVFileRenderSink class writes the audio written into it to a RIFF WAVE file.
+ @discussion	Audio is stored as interleaved 32 bit IEEE floating point samples. The sink
+				only accepts linear PCM Float32 stream formats, which is what PlayerKit renders.
+ */
+class PK_VISIBILITY_HIDDEN PKWAVFileRenderSink : public PKRenderSink
+{
+protected:
+	
+	/* owner */	char *mPath;
+	/* owner */	FILE *mFile;
+	/* owner */	Float32 *mInterleavingBuffer;
+	/* n/a */	UInt32 mInterleavingBufferNumberOfFrames;
+	
+	/*!
+	 @abstract	Write the RIFF header of the receiver's file, reflecting the number of frames written so far.
+	 */
+	OSStatus WriteHeader() throw();
+
+public:
+	
+	/*!
+	 @abstract	Construct a WAV file sink that will write to a specified path, replacing any existing file.
+	 */
+	explicit PKWAVFileRenderSink(const char *path);
+	
+#if defined(__APPLE__)
+	/*!
+	 @abstract	Construct a WAV file sink that will write to a specified file URL, replacing any existing file.
+	 */
+	explicit PKWAVFileRenderSink(CFURLRef location);
+#endif /* defined(__APPLE__) */
+	
+	virtual ~PKWAVFileRenderSink();
+	
+#pragma mark -
+	
+	virtual OSStatus Open(const AudioStreamBasicDescription &streamFormat) throw();
+	virtual OSStatus Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+	virtual OSStatus Close() throw();
+	
+#pragma mark -
+	
+	/*!
+	 @abstract	Returns the path of the sink's file. NULL if the sink was given a location that is not a file.
+	 */
+	const char *GetPath() const { return mPath; }
+};
+
+#endif /* PKRenderSink_h */
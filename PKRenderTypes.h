@@ -0,0 +1,159 @@
+/*
+ *  PKRenderTypes.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKRenderTypes_h
+#define PKRenderTypes_h 1
+
+//
+//	The render core and the render sinks describe audio with the Core Audio types,
+//	so that the engine can hand them its slices and buffer lists as is. Everywhere
+//	else we declare the handful of types and constants they use, with the same layout
+//	and values, so that the headless render path builds without Core Audio.
+//
+
+#if defined(__APPLE__)
+
+#include <CoreAudio/CoreAudioTypes.h>
+#include <AudioToolbox/AudioToolbox.h>
+
+#else
+
+#include <stdint.h>
+
+typedef uint8_t		UInt8;
+typedef uint16_t	UInt16;
+typedef uint32_t	UInt32;
+typedef uint64_t	UInt64;
+typedef int8_t		SInt8;
+typedef int16_t		SInt16;
+typedef int32_t		SInt32;
+typedef int64_t		SInt64;
+typedef float		Float32;
+typedef double		Float64;
+typedef SInt32		OSStatus;
+typedef unsigned char Boolean;
+
+enum {
+	noErr = 0,
+	ioErr = -36,
+	paramErr = -50,
+	memFullErr = -108,
+	
+	kAudioUnitErr_Uninitialized = -10867,
+	kAudioUnitErr_FormatNotSupported = -10868,
+	kAudioUnitErr_TooManyFramesToProcess = -10874,
+};
+
+#pragma mark -
+#pragma mark Stream Formats
+
+struct AudioStreamBasicDescription {
+	Float64 mSampleRate;
+	UInt32 mFormatID;
+	UInt32 mFormatFlags;
+	UInt32 mBytesPerPacket;
+	UInt32 mFramesPerPacket;
+	UInt32 mBytesPerFrame;
+	UInt32 mChannelsPerFrame;
+	UInt32 mBitsPerChannel;
+	UInt32 mReserved;
+};
+
+enum {
+	kAudioFormatLinearPCM = 0x6C70636D, //'lpcm'
+};
+
+enum {
+	kAudioFormatFlagIsFloat = (1U << 0),
+	kAudioFormatFlagIsBigEndian = (1U << 1),
+	kAudioFormatFlagIsSignedInteger = (1U << 2),
+	kAudioFormatFlagIsPacked = (1U << 3),
+	kAudioFormatFlagIsAlignedHigh = (1U << 4),
+	kAudioFormatFlagIsNonInterleaved = (1U << 5),
+	kAudioFormatFlagIsNonMixable = (1U << 6),
+};
+
+#pragma mark -
+#pragma mark Buffers
+
+struct AudioBuffer {
+	UInt32 mNumberChannels;
+	UInt32 mDataByteSize;
+	void *mData;
+};
+
+struct AudioBufferList {
+	UInt32 mNumberBuffers;
+	AudioBuffer mBuffers[1];
+};
+
+#pragma mark -
+#pragma mark Time Stamps
+
+struct SMPTETime {
+	SInt16 mSubframes;
+	SInt16 mSubframeDivisor;
+	UInt32 mCounter;
+	UInt32 mType;
+	UInt32 mFlags;
+	SInt16 mHours;
+	SInt16 mMinutes;
+	SInt16 mSeconds;
+	SInt16 mFrames;
+};
+
+struct AudioTimeStamp {
+	Float64 mSampleTime;
+	UInt64 mHostTime;
+	Float64 mRateScalar;
+	UInt64 mWordClockTime;
+	SMPTETime mSMPTETime;
+	UInt32 mFlags;
+	UInt32 mReserved;
+};
+
+enum {
+	kAudioTimeStampSampleTimeValid = (1U << 0),
+	kAudioTimeStampHostTimeValid = (1U << 1),
+};
+
+#pragma mark -
+#pragma mark Rendering
+
+typedef UInt32 AudioUnitRenderActionFlags;
+
+enum {
+	kAudioUnitRenderAction_PreRender = (1U << 2),
+	kAudioUnitRenderAction_PostRender = (1U << 3),
+	kAudioUnitRenderAction_OutputIsSilence = (1U << 4),
+};
+
+struct ScheduledAudioSlice;
+typedef void (*ScheduledAudioSliceCompletionProc)(void *userData, ScheduledAudioSlice *bufferList);
+
+struct ScheduledAudioSlice {
+	AudioTimeStamp mTimeStamp;
+	ScheduledAudioSliceCompletionProc mCompletionProc;
+	void *mCompletionProcUserData;
+	UInt32 mFlags;
+	UInt32 mReserved;
+	void *mReserved2;
+	UInt32 mNumberFrames;
+	AudioBufferList *mBufferList;
+};
+
+enum {
+	kScheduledAudioSliceFlag_Complete = 0x01,
+	kScheduledAudioSliceFlag_BeganToRender = 0x02,
+	kScheduledAudioSliceFlag_BeganToRenderLate = 0x04,
+};
+
+#endif /* defined(__APPLE__) */
+
+#endif /* PKRenderTypes_h */
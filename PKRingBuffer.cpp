@@ -0,0 +1,162 @@
+/*
+ *  PKRingBuffer.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKRingBuffer.h"
+
+#pragma mark Tools
+
+static UInt32 RoundUpToPowerOfTwo(UInt32 value)
+{
+	UInt32 result = 1;
+	while (result < value)
+		result <<= 1;
+	
+	return result;
+}
+
+#pragma mark -
+#pragma mark Lifecycle
+
+PKRingBuffer::PKRingBuffer(UInt32 numberOfBuffers, UInt32 bytesPerFrame, UInt32 minimumCapacity) throw(RBException) :
+	RBObject("PKRingBuffer"),
+	mNumberOfBuffers(numberOfBuffers),
+	mBytesPerFrame(bytesPerFrame),
+	mCapacity(RoundUpToPowerOfTwo(minimumCapacity)),
+	mCapacityMask(0),
+	mBuffers(NULL),
+	mWriteIndex(0),
+	mReadIndex(0)
+{
+	RBParameterAssert(numberOfBuffers > 0);
+	RBParameterAssert(bytesPerFrame > 0);
+	RBParameterAssert(minimumCapacity > 0);
+	
+	mCapacityMask = mCapacity - 1;
+	
+	mBuffers = (UInt8 **)calloc(mNumberOfBuffers, sizeof(UInt8 *));
+	RBAssert((mBuffers != NULL), CFSTR("Could not allocate ring buffer planes."));
+	
+	for (UInt32 index = 0; index < mNumberOfBuffers; index++)
+	{
+		mBuffers[index] = (UInt8 *)calloc(mCapacity, mBytesPerFrame);
+		if(!mBuffers[index])
+		{
+			//The destructor isn't run when a constructor throws, so the planes allocated so far are freed here.
+			for (UInt32 allocatedIndex = 0; allocatedIndex < index; allocatedIndex++)
+				free(mBuffers[allocatedIndex]);
+			
+			free(mBuffers);
+			mBuffers = NULL;
+			
+			RBAssert((mBuffers != NULL), CFSTR("Could not allocate ring buffer plane of %u frames."), mCapacity);
+		}
+	}
+}
+
+PKRingBuffer::~PKRingBuffer()
+{
+	if(mBuffers)
+	{
+		for (UInt32 index = 0; index < mNumberOfBuffers; index++)
+			free(mBuffers[index]);
+		
+		free(mBuffers);
+		mBuffers = NULL;
+	}
+}
+
+#pragma mark -
+#pragma mark Producer
+
+UInt32 PKRingBuffer::GetNumberOfFramesAvailableToWrite() const throw()
+{
+	UInt32 readIndex = mReadIndex.load(std::memory_order_acquire);
+	
+	return mCapacity - (mWriteIndex.load(std::memory_order_relaxed) - readIndex);
+}
+
+UInt32 PKRingBuffer::Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	UInt32 numberOfFramesToWrite = this->GetNumberOfFramesAvailableToWrite();
+	if(numberOfFramesToWrite > numberOfFrames)
+		numberOfFramesToWrite = numberOfFrames;
+	
+	if(numberOfFramesToWrite == 0)
+		return 0;
+	
+	UInt32 writeIndex = mWriteIndex.load(std::memory_order_relaxed);
+	UInt32 writeOffset = writeIndex & mCapacityMask;
+	UInt32 numberOfFramesBeforeWrap = mCapacity - writeOffset;
+	if(numberOfFramesBeforeWrap > numberOfFramesToWrite)
+		numberOfFramesBeforeWrap = numberOfFramesToWrite;
+	
+	for (UInt32 index = 0; index < mNumberOfBuffers; index++)
+	{
+		const UInt8 *source = (const UInt8 *)(buffers->mBuffers[index].mData);
+		UInt8 *destination = mBuffers[index];
+		
+		memcpy(destination + (writeOffset * mBytesPerFrame), source, numberOfFramesBeforeWrap * mBytesPerFrame);
+		memcpy(destination, source + (numberOfFramesBeforeWrap * mBytesPerFrame), (numberOfFramesToWrite - numberOfFramesBeforeWrap) * mBytesPerFrame);
+	}
+	
+	//The frames must be visible to the consumer before the index that publishes them.
+	mWriteIndex.store(writeIndex + numberOfFramesToWrite, std::memory_order_release);
+	
+	return numberOfFramesToWrite;
+}
+
+#pragma mark -
+#pragma mark Consumer
+
+UInt32 PKRingBuffer::GetNumberOfFramesAvailableToRead() const throw()
+{
+	UInt32 writeIndex = mWriteIndex.load(std::memory_order_acquire);
+	
+	return writeIndex - mReadIndex.load(std::memory_order_relaxed);
+}
+
+UInt32 PKRingBuffer::Read(AudioBufferList *buffers, UInt32 numberOfFrames) throw()
+{
+	UInt32 numberOfFramesToRead = this->GetNumberOfFramesAvailableToRead();
+	if(numberOfFramesToRead > numberOfFrames)
+		numberOfFramesToRead = numberOfFrames;
+	
+	UInt32 readIndex = mReadIndex.load(std::memory_order_relaxed);
+	UInt32 readOffset = readIndex & mCapacityMask;
+	UInt32 numberOfFramesBeforeWrap = mCapacity - readOffset;
+	if(numberOfFramesBeforeWrap > numberOfFramesToRead)
+		numberOfFramesBeforeWrap = numberOfFramesToRead;
+	
+	for (UInt32 index = 0; index < mNumberOfBuffers; index++)
+	{
+		UInt8 *destination = (UInt8 *)(buffers->mBuffers[index].mData);
+		const UInt8 *source = mBuffers[index];
+		
+		memcpy(destination, source + (readOffset * mBytesPerFrame), numberOfFramesBeforeWrap * mBytesPerFrame);
+		memcpy(destination + (numberOfFramesBeforeWrap * mBytesPerFrame), source, (numberOfFramesToRead - numberOfFramesBeforeWrap) * mBytesPerFrame);
+		
+		buffers->mBuffers[index].mDataByteSize = numberOfFramesToRead * mBytesPerFrame;
+	}
+	
+	if(numberOfFramesToRead == 0)
+		return 0;
+	
+	//We must be done with the frames before the producer is allowed to overwrite them.
+	mReadIndex.store(readIndex + numberOfFramesToRead, std::memory_order_release);
+	
+	return numberOfFramesToRead;
+}
+
+#pragma mark -
+
+void PKRingBuffer::Reset() throw()
+{
+	mReadIndex.store(0, std::memory_order_release);
+	mWriteIndex.store(0, std::memory_order_release);
+}
@@ -0,0 +1,142 @@
+/*
+ *  PKRingBuffer.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKRingBuffer_h
+#define PKRingBuffer_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <AudioToolbox/AudioToolbox.h>
+#include <atomic>
+
+#include "RBObject.h"
+#include "RBException.h"
+
+/*!
+ @class
+ @abstract		The PKRingBuffer class is a wait-free single-producer/single-consumer ring of PCM frames.
+ @discussion	The ring stores one plane per buffer of the stream format it carries, which for PlayerKit's
+				canonical format means one non-interleaved Float32 plane per channel. Exactly one thread may
+				write into a ring and exactly one thread may read from it at any given time. Neither side
+				ever takes a lock, allocates memory, or makes a system call, so the reading side can safely
+				be a real time audio thread.
+				
+				The read and write indices are free running and live on separate cache lines so the
+				producer and consumer never contend for the same line.
+ */
+class PK_VISIBILITY_HIDDEN PKRingBuffer : public RBObject
+{
+public:
+	enum {
+		/*!
+		 @abstract	The size of a cache line on the processors PlayerKit runs on.
+		 */
+		kCacheLineSize = 64,
+	};
+
+protected:
+	
+	/* n/a */	UInt32 mNumberOfBuffers;
+	/* n/a */	UInt32 mBytesPerFrame;
+	/* n/a */	UInt32 mCapacity;
+	/* n/a */	UInt32 mCapacityMask;
+	/* owner */	UInt8 **mBuffers;
+	
+	/* n/a */	std::atomic<UInt32> mWriteIndex;
+	/* n/a */	UInt8 mWriteIndexPadding[kCacheLineSize - sizeof(std::atomic<UInt32>)];
+	/* n/a */	std::atomic<UInt32> mReadIndex;
+	/* n/a */	UInt8 mReadIndexPadding[kCacheLineSize - sizeof(std::atomic<UInt32>)];
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Construct a ring buffer.
+	 @param		numberOfBuffers		The number of planes in the ring. This is the number of buffers
+									in the AudioBufferLists written into and read from the ring.
+	 @param		bytesPerFrame		The number of bytes a single frame occupies in each plane.
+	 @param		minimumCapacity		The minimum number of frames the ring should be able to hold.
+									This is rounded up to the next power of two.
+	 */
+	explicit PKRingBuffer(UInt32 numberOfBuffers, UInt32 bytesPerFrame, UInt32 minimumCapacity) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the ring buffer.
+	 */
+	virtual ~PKRingBuffer();
+	
+#pragma mark -
+#pragma mark Attributes
+	
+	/*!
+	 @abstract	Returns the number of frames the receiver can hold.
+	 */
+	UInt32 GetCapacity() const throw() { return mCapacity; }
+	
+	/*!
+	 @abstract	Returns the number of planes in the receiver.
+	 */
+	UInt32 GetNumberOfBuffers() const throw() { return mNumberOfBuffers; }
+	
+	/*!
+	 @abstract	Returns the number of bytes a single frame occupies in each plane of the receiver.
+	 */
+	UInt32 GetBytesPerFrame() const throw() { return mBytesPerFrame; }
+	
+#pragma mark -
+#pragma mark Producer
+	
+	/*!
+	 @abstract	Returns the number of frames that can currently be written into the receiver.
+	 @discussion	This method may only be called from the producing thread.
+	 */
+	UInt32 GetNumberOfFramesAvailableToWrite() const throw();
+	
+	/*!
+	 @abstract		Copy frames into the receiver.
+	 @param			buffers			The buffers to copy frames from. Must contain as many buffers as the receiver has planes.
+	 @param			numberOfFrames	The number of frames to copy.
+	 @result		The number of frames actually written. This will be less than `numberOfFrames` if the receiver is full.
+	 @discussion	This method may only be called from the producing thread.
+	 */
+	UInt32 Write(const AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+	
+#pragma mark -
+#pragma mark Consumer
+	
+	/*!
+	 @abstract	Returns the number of frames that can currently be read out of the receiver.
+	 @discussion	This method may only be called from the consuming thread.
+	 */
+	UInt32 GetNumberOfFramesAvailableToRead() const throw();
+	
+	/*!
+	 @abstract		Copy frames out of the receiver.
+	 @param			buffers			The buffers to copy frames into. Must contain as many buffers as the receiver has planes.
+									The byte size of each buffer is updated to reflect the number of frames read.
+	 @param			numberOfFrames	The number of frames to copy.
+	 @result		The number of frames actually read. This will be less than `numberOfFrames` if the receiver runs dry.
+	 @discussion	This method may only be called from the consuming thread.
+	 */
+	UInt32 Read(AudioBufferList *buffers, UInt32 numberOfFrames) throw();
+	
+#pragma mark -
+	
+	/*!
+	 @abstract		Discard all of the frames in the receiver.
+	 @discussion	Neither the producer nor the consumer may be using the receiver when this method is called.
+	 */
+	void Reset() throw();
+
+private:
+	PKRingBuffer(PKRingBuffer &ringBuffer);
+	PKRingBuffer &operator=(PKRingBuffer &ringBuffer);
+};
+
+#endif /* PKRingBuffer_h */
@@ -30,7 +30,9 @@ PKScheduledDataSlice::PKScheduledDataSlice(PKAudioPlayerEngine *owner,
 	mDataSliceProgressionNumber(0),
 	mNumberOfFramesToRead(numberOfFrames),
 	mBuffersHaveData(false),
-	mInvalidated(false)
+	mInvalidated(false),
+	mSchedulingGeneration(0),
+	mFallbackGeneration(0)
 {
 	mNumberOfActiveSlicesAtomicCounter->Retain();
 	
@@ -85,6 +87,16 @@ void PKScheduledDataSlice::ScheduleSliceTaskProxy(PKScheduledDataSlice *self) th
 	self->mOwner->ScheduleSlice(self);
 }
 
+void PKScheduledDataSlice::ScheduleSliceFallbackTaskProxy(PKScheduledDataSlice *self) throw(RBException)
+{
+	//Claiming the generation means only one of any number of queued fallbacks ever schedules the slice.
+	uint32_t generation = self->mFallbackGeneration.exchange(0, std::memory_order_acq_rel);
+	if((generation == 0) || (generation != self->mOwner->mSchedulingGeneration.load(std::memory_order_acquire)))
+		return;
+	
+	self->mOwner->ScheduleSlice(self);
+}
+
 void PKScheduledDataSlice::Reset()
 {
 	Acquisitor lock(this);
@@ -94,4 +106,6 @@ void PKScheduledDataSlice::Reset()
 	mNumberOfActiveSlicesAtomicCounter->SetValue(0);
 	mBuffersHaveData = false;
 	mInvalidated = false;
+	mSchedulingGeneration.store(0, std::memory_order_release);
+	mFallbackGeneration.store(0, std::memory_order_release);
 }
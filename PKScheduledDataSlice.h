@@ -11,6 +11,7 @@
 #define PKScheduledDataSlice_h 1
 
 #include <AudioToolbox/AudioToolbox.h>
+#include <atomic>
 
 #include "RBObject.h"
 #include "RBAtomic.h"
@@ -70,6 +71,18 @@ public:
 	 */
 	/* n/a */	bool mInvalidated;
 	
+	/*!
+	 @abstract		The scheduling generation of the owner the receiver was last scheduled in, 0 if it hasn't been.
+	 @discussion	The render thread only refills and reschedules the receiver while this is the owner's current generation.
+	 */
+	/* n/a */	std::atomic<uint32_t> mSchedulingGeneration;
+	
+	/*!
+	 @abstract		The scheduling generation of the fallback task queued for the receiver by the render thread, 0 if there isn't one.
+	 @discussion	A fallback task claims this once. It does nothing if it finds 0, or a generation that has since been invalidated.
+	 */
+	/* n/a */	std::atomic<uint32_t> mFallbackGeneration;
+	
 	/*!
 	 @abstract	Whether or not this processing data has been populated with data.
 	 */
@@ -115,6 +128,12 @@ public:
 	 */
 	static void ScheduleSliceTaskProxy(PKScheduledDataSlice *self) throw(RBException);
 	
+	/*!
+	 @abstract	This static method is provided for use with PKTaskQueue. It is queued by the render thread when it
+				can't reschedule a slice itself, and only schedules the slice if it hasn't been invalidated since.
+	 */
+	static void ScheduleSliceFallbackTaskProxy(PKScheduledDataSlice *self) throw(RBException);
+	
 	/*!
 	 @abstract	Reset the scheduled data slice's state.
 	 */
@@ -0,0 +1,266 @@
+/*
+ *  PKSeekIndex.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKSeekIndex.h"
+#include "PKTaskExecutor.h"
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+
+enum {
+	//The first four bytes of a sidecar file, 'PKSI'.
+	kSidecarMagic = 0x504B5349,
+	
+	//Bumped whenever the layout of sidecar files changes, so old ones are ignored.
+	kSidecarVersion = 1,
+};
+
+//The header at the start of a sidecar file. It is followed by the path of the file, then the entries.
+struct SidecarHeader {
+	UInt32 magic;
+	UInt32 version;
+	UInt64 size;
+	SInt64 modificationTime;
+	UInt64 interval;
+	UInt32 pathLength;
+	UInt32 numberOfEntries;
+};
+
+static std::atomic<bool> SeekIndexesAreDisabled(false);
+
+#pragma mark Lifecycle
+
+PKSeekIndex::PKSeekIndex(const PKDecoderCache::FileIdentity &identity, UInt64 interval) throw() :
+	RBLockableObject("PKSeekIndex"),
+	mIdentity(identity),
+	mInterval(interval),
+	mEntries(),
+	mHasChanges(false)
+{
+	
+}
+
+PKSeekIndex::~PKSeekIndex()
+{
+	
+}
+
+PKSeekIndex *PKSeekIndex::CreateForByteSource(PKByteSource *source, UInt64 interval) throw()
+{
+	if(!source || !IsEnabled())
+		return NULL;
+	
+	CFURLRef location = source->CopyLocation();
+	if(!location)
+		return NULL;
+	
+	PKDecoderCache::FileIdentity identity;
+	bool hasIdentity = PKDecoderCache::GetFileIdentity(location, identity);
+	CFRelease(location);
+	
+	if(!hasIdentity)
+		return NULL;
+	
+	PKSeekIndex *index = new PKSeekIndex(identity, (interval > 0)? interval : 1);
+	index->Load();
+	
+	return index;
+}
+
+#pragma mark -
+#pragma mark Global Options
+
+void PKSeekIndex::SetEnabled(bool enabled) throw()
+{
+	SeekIndexesAreDisabled.store(!enabled, std::memory_order_release);
+}
+
+bool PKSeekIndex::IsEnabled() throw()
+{
+	return !SeekIndexesAreDisabled.load(std::memory_order_acquire);
+}
+
+#pragma mark -
+#pragma mark Entries
+
+static bool EntryFrameIsLess(const PKSeekIndex::Entry &left, const PKSeekIndex::Entry &right)
+{
+	return left.frame < right.frame;
+}
+
+void PKSeekIndex::NoteEntry(UInt64 frame, UInt64 offset) throw()
+{
+	Acquisitor lock(this);
+	
+	Entry entry = { frame, offset };
+	
+	//Playback usually notes entries in order, so the end is checked before searching.
+	std::vector<Entry>::iterator position = mEntries.end();
+	if(!mEntries.empty() && (mEntries.back().frame > frame))
+		position = std::upper_bound(mEntries.begin(), mEntries.end(), entry, &EntryFrameIsLess);
+	
+	if((position != mEntries.begin()) && ((frame - (position - 1)->frame) < mInterval))
+		return;
+	
+	if((position != mEntries.end()) && ((position->frame - frame) < mInterval))
+		return;
+	
+	mEntries.insert(position, entry);
+	mHasChanges = true;
+}
+
+bool PKSeekIndex::FindEntryAtOrBefore(UInt64 frame, Entry &outEntry) const throw()
+{
+	Acquisitor lock(this);
+	
+	Entry key = { frame, 0 };
+	std::vector<Entry>::const_iterator position = std::upper_bound(mEntries.begin(), mEntries.end(), key, &EntryFrameIsLess);
+	if(position == mEntries.begin())
+		return false;
+	
+	outEntry = *(position - 1);
+	
+	return true;
+}
+
+bool PKSeekIndex::FindEntryAfter(UInt64 frame, Entry &outEntry) const throw()
+{
+	Acquisitor lock(this);
+	
+	Entry key = { frame, 0 };
+	std::vector<Entry>::const_iterator position = std::upper_bound(mEntries.begin(), mEntries.end(), key, &EntryFrameIsLess);
+	if(position == mEntries.end())
+		return false;
+	
+	outEntry = *position;
+	
+	return true;
+}
+
+size_t PKSeekIndex::GetNumberOfEntries() const throw()
+{
+	Acquisitor lock(this);
+	
+	return mEntries.size();
+}
+
+#pragma mark -
+#pragma mark Persistence
+
+std::string PKSeekIndex::GetSidecarPath() const throw()
+{
+	char cacheDirectory[PATH_MAX] = "/tmp/";
+	confstr(_CS_DARWIN_USER_CACHE_DIR, cacheDirectory, sizeof(cacheDirectory));
+	
+	//The path is hashed with 64 bit FNV-1a to name the sidecar, and kept inside it to tell collisions apart.
+	UInt64 hash = 0xcbf29ce484222325ULL;
+	for (std::string::const_iterator character = mIdentity.path.begin(); character != mIdentity.path.end(); character++)
+	{
+		hash ^= UInt8(*character);
+		hash *= 0x100000001b3ULL;
+	}
+	
+	char sidecarPath[PATH_MAX];
+	snprintf(sidecarPath, sizeof(sidecarPath), "%scom.roundabout.playerkit/SeekIndexes/%016llx.seekindex", cacheDirectory, hash);
+	
+	return sidecarPath;
+}
+
+void PKSeekIndex::Load() throw()
+{
+	Acquisitor lock(this);
+	
+	FILE *sidecar = fopen(this->GetSidecarPath().c_str(), "rb");
+	if(!sidecar)
+		return;
+	
+	//A damaged sidecar is ignored; the header's entry count is checked against the file before anything is allocated for it.
+	struct stat sidecarInfo;
+	SidecarHeader header;
+	if((fstat(fileno(sidecar), &sidecarInfo) == 0) &&
+	   (fread(&header, sizeof(header), 1, sidecar) == 1) &&
+	   (header.magic == kSidecarMagic) &&
+	   (header.version == kSidecarVersion) &&
+	   (header.size == mIdentity.size) &&
+	   (header.modificationTime == mIdentity.modificationTime) &&
+	   (header.interval == mInterval) &&
+	   (header.pathLength == mIdentity.path.size()) &&
+	   (UInt64(sidecarInfo.st_size) == (sizeof(header) + header.pathLength + (UInt64(header.numberOfEntries) * sizeof(Entry)))))
+	{
+		std::string path(header.pathLength, '\0');
+		if((header.pathLength == 0) || (fread(&path[0], header.pathLength, 1, sidecar) == 1))
+		{
+			std::vector<Entry> entries(header.numberOfEntries);
+			if((path == mIdentity.path) &&
+			   ((header.numberOfEntries == 0) || (fread(&entries[0], sizeof(Entry), header.numberOfEntries, sidecar) == header.numberOfEntries)) &&
+			   std::is_sorted(entries.begin(), entries.end(), &EntryFrameIsLess))
+			{
+				mEntries.swap(entries);
+				mHasChanges = false;
+			}
+		}
+	}
+	
+	fclose(sidecar);
+}
+
+void PKSeekIndex::Save() throw()
+{
+	Acquisitor lock(this);
+	
+	if(!mHasChanges)
+		return;
+	
+	std::string sidecarPath = this->GetSidecarPath();
+	
+	//The directory is made one level at a time, the cache directory itself always exists.
+	std::string::size_type indexesDirectoryEnd = sidecarPath.rfind('/');
+	std::string::size_type cacheDirectoryEnd = sidecarPath.rfind('/', indexesDirectoryEnd - 1);
+	mkdir(sidecarPath.substr(0, cacheDirectoryEnd).c_str(), 0755);
+	mkdir(sidecarPath.substr(0, indexesDirectoryEnd).c_str(), 0755);
+	
+	//Written next to the sidecar and moved over it, so a reader never sees half an index.
+	char temporaryPath[PATH_MAX];
+	snprintf(temporaryPath, sizeof(temporaryPath), "%s.%d.%p", sidecarPath.c_str(), getpid(), this);
+	
+	FILE *sidecar = fopen(temporaryPath, "wb");
+	if(!sidecar)
+		return;
+	
+	SidecarHeader header = {
+		kSidecarMagic,
+		kSidecarVersion,
+		mIdentity.size,
+		mIdentity.modificationTime,
+		mInterval,
+		UInt32(mIdentity.path.size()),
+		UInt32(mEntries.size()),
+	};
+	
+	bool didWrite = (fwrite(&header, sizeof(header), 1, sidecar) == 1) &&
+					(mIdentity.path.empty() || (fwrite(mIdentity.path.data(), mIdentity.path.size(), 1, sidecar) == 1)) &&
+					(mEntries.empty() || (fwrite(&mEntries[0], sizeof(Entry), mEntries.size(), sidecar) == mEntries.size()));
+	
+	if((fclose(sidecar) == 0) && didWrite && (rename(temporaryPath, sidecarPath.c_str()) == 0))
+		mHasChanges = false;
+	else
+		unlink(temporaryPath);
+}
+
+void PKSeekIndex::SaveInBackground() throw()
+{
+	this->Retain();
+	PKTaskExecutor::SharedExecutor()->Async(PKTaskExecutor::kLaneNormal, ^{
+		this->Save();
+		this->Release();
+	});
+}
@@ -0,0 +1,141 @@
+/*
+ *  PKSeekIndex.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKSeekIndex_h
+#define PKSeekIndex_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <vector>
+
+#include "RBLockableObject.h"
+#include "PKDecoderCache.h"
+#include "PKByteSource.h"
+
+/*!
+ @class
+ @abstract		The PKSeekIndex class remembers where in a file decoding can start from to reach a frame.
+ @discussion	Decoders that find their seek positions by bisecting a file note where they are as they decode, about
+				once every interval, which builds the index up over the first playback of the file. Once a decoder has
+				an index, seeking narrows its bisection to the space between two entries, which usually needs no
+				bisection at all.
+				
+				Indexes are kept in small sidecar files in the user's cache directory, keyed by the path of the file
+				they describe, and are thrown away if the file's size or modification date changes.
+ */
+class PK_VISIBILITY_HIDDEN PKSeekIndex : public RBLockableObject
+{
+public:
+	/*!
+	 @abstract	The Entry struct describes a single place decoding can start from.
+	 @field		frame	The frame decoding from `offset` reaches first, or reaches next for formats that are positioned by where frames end.
+	 @field		offset	The offset in the file to start reading from.
+	 */
+	struct Entry {
+		UInt64 frame;
+		UInt64 offset;
+	};
+
+protected:
+	
+	/* n/a */	PKDecoderCache::FileIdentity mIdentity;
+	/* n/a */	UInt64 mInterval;
+	/* n/a */	std::vector<Entry> mEntries;
+	/* n/a */	bool mHasChanges;
+	
+	/*!
+	 @abstract	Returns the path of the sidecar file the receiver is kept in.
+	 */
+	std::string GetSidecarPath() const throw();
+	
+	/*!
+	 @abstract	Read the entries of the receiver from its sidecar file, if it has one that still describes the file.
+	 */
+	void Load() throw();
+	
+	/*!
+	 @abstract	Construct an empty index for a file, with entries a specified number of frames apart.
+	 */
+	explicit PKSeekIndex(const PKDecoderCache::FileIdentity &identity, UInt64 interval) throw();
+
+public:
+
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract		Returns the index for the file a byte source reads, loading it from its sidecar file if it has one.
+	 @param			source		The byte source the index describes. Required.
+	 @param			interval	The number of frames entries are kept apart.
+	 @result		A new index owned by the caller, or NULL if indexes are turned off or the source doesn't read a file.
+	 */
+	static PKSeekIndex *CreateForByteSource(PKByteSource *source, UInt64 interval) throw();
+	
+	/*!
+	 @abstract	Destruct the index.
+	 */
+	virtual ~PKSeekIndex();
+	
+#pragma mark -
+#pragma mark Global Options
+	
+	/*!
+	 @abstract	Set whether or not decoders build and use seek indexes. They do by default.
+	 */
+	static void SetEnabled(bool enabled) throw();
+	
+	/*!
+	 @abstract	Returns whether or not decoders build and use seek indexes.
+	 */
+	static bool IsEnabled() throw();
+	
+#pragma mark -
+#pragma mark Entries
+	
+	/*!
+	 @abstract		Note that decoding can start from a specified offset to reach a specified frame.
+	 @discussion	The entry is dropped unless it is at least an interval away from the entries around it, so this can be
+					called for every frame decoded.
+	 */
+	void NoteEntry(UInt64 frame, UInt64 offset) throw();
+	
+	/*!
+	 @abstract	Find the last entry at or before a specified frame.
+	 @result	true if there is one; false otherwise.
+	 */
+	bool FindEntryAtOrBefore(UInt64 frame, Entry &outEntry) const throw();
+	
+	/*!
+	 @abstract	Find the first entry after a specified frame.
+	 @result	true if there is one; false otherwise.
+	 */
+	bool FindEntryAfter(UInt64 frame, Entry &outEntry) const throw();
+	
+	/*!
+	 @abstract	Returns the number of entries in the receiver.
+	 */
+	size_t GetNumberOfEntries() const throw();
+	
+#pragma mark -
+#pragma mark Persistence
+	
+	/*!
+	 @abstract	Write the receiver to its sidecar file if it has changed since it was loaded.
+	 */
+	void Save() throw();
+	
+	/*!
+	 @abstract	Write the receiver to its sidecar file on a worker in the shared executor's normal lane.
+	 */
+	void SaveInBackground() throw();
+
+private:
+	PKSeekIndex(PKSeekIndex &index);
+	PKSeekIndex &operator=(PKSeekIndex &index);
+};
+
+#endif /* PKSeekIndex_h */
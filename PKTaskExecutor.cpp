@@ -0,0 +1,427 @@
+/*
+ *  PKTaskExecutor.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKTaskExecutor.h"
+#include "CAPThread.h"
+#include <Block.h>
+#include <dispatch/dispatch.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+
+//We load the objc_registerThreadWithCollector function at runtime
+//so we don't have to link the objc runtime in PlayerKit.
+typedef void(*ObjCGarbageCollectorProc)();
+
+static ObjCGarbageCollectorProc objc_registerThreadWithCollector = (ObjCGarbageCollectorProc)dlsym(RTLD_DEFAULT, "objc_registerThreadWithCollector");
+
+static std::atomic<UInt32> DefaultNumberOfWorkers[PKTaskExecutor::kNumberOfLanes];
+
+///The job Async submits, which carries its block and is deleted once the block has run.
+struct BlockJob {
+	PKTaskExecutor::Job job;
+	PKTaskExecutor::JobBlock block;
+};
+
+static void BlockJobForwarder(BlockJob *blockJob)
+{
+	try
+	{
+		blockJob->block();
+	}
+	catch (...)
+	{
+		std::cerr << "An unexpected exception was raised in a PKTaskExecutor block." << std::endl;
+	}
+	
+	Block_release(blockJob->block);
+	delete blockJob;
+}
+
+///The state the iterations of an Apply share.
+struct ApplyState {
+	PKTaskExecutor::ApplyBlock block;
+	size_t count;
+	std::atomic<size_t> nextIndex;
+	RBSemaphore *jobFinishedSemaphore;
+};
+
+static void ApplyIterations(ApplyState *state)
+{
+	for (size_t index = state->nextIndex.fetch_add(1, std::memory_order_relaxed); index < state->count; index = state->nextIndex.fetch_add(1, std::memory_order_relaxed))
+	{
+		try
+		{
+			state->block(index);
+		}
+		catch (...)
+		{
+			std::cerr << "An unexpected exception was raised in a PKTaskExecutor apply block." << std::endl;
+		}
+	}
+}
+
+static void ApplyJobForwarder(ApplyState *state)
+{
+	ApplyIterations(state);
+	
+	try
+	{
+		state->jobFinishedSemaphore->Signal();
+	}
+	catch (RBException e)
+	{
+		std::cerr << "jobFinishedSemaphore->Signal failed with error code " << e.GetCode() << "." << std::endl;
+	}
+}
+
+#pragma mark Lifecycle
+
+PKTaskExecutor *PKTaskExecutor::SharedExecutor() throw()
+{
+	static PKTaskExecutor *sharedExecutor = NULL;
+	static dispatch_once_t predicate = 0;
+	dispatch_once(&predicate, ^{
+		long numberOfProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+		if(numberOfProcessors < 1)
+			numberOfProcessors = 1;
+		
+		UInt32 numberOfWorkers[kNumberOfLanes];
+		numberOfWorkers[kLaneNormal] = DefaultNumberOfWorkers[kLaneNormal].load(std::memory_order_acquire);
+		if(numberOfWorkers[kLaneNormal] == 0)
+			numberOfWorkers[kLaneNormal] = UInt32(numberOfProcessors);
+		
+		numberOfWorkers[kLaneHighPriority] = DefaultNumberOfWorkers[kLaneHighPriority].load(std::memory_order_acquire);
+		if(numberOfWorkers[kLaneHighPriority] == 0)
+			numberOfWorkers[kLaneHighPriority] = (numberOfProcessors > 1)? 2 : 1;
+		
+		sharedExecutor = new PKTaskExecutor(numberOfWorkers);
+	});
+	
+	return sharedExecutor;
+}
+
+void PKTaskExecutor::SetDefaultNumberOfWorkers(Lane lane, UInt32 numberOfWorkers) throw()
+{
+	if(lane >= kNumberOfLanes)
+		return;
+	
+	DefaultNumberOfWorkers[lane].store(numberOfWorkers, std::memory_order_release);
+}
+
+PKTaskExecutor::PKTaskExecutor(const UInt32 numberOfWorkers[kNumberOfLanes]) throw(RBException) :
+	RBLockableObject("PKTaskExecutor")
+{
+	int errorCode = pthread_key_create(&mCurrentWorkerKey, NULL);
+	RBAssertNoErr(errorCode, CFSTR("pthread_key_create failed with error code %d"), errorCode);
+	
+	static const char *const laneNames[kNumberOfLanes] = { "normal", "high-priority" };
+	for (UInt32 laneIndex = 0; laneIndex < kNumberOfLanes; laneIndex++)
+	{
+		LaneState &lane = mLanes[laneIndex];
+		errorCode = pthread_mutex_init(&lane.sharedQueueMutex, NULL);
+		RBAssertNoErr(errorCode, CFSTR("pthread_mutex_init failed with error code %d"), errorCode);
+		
+		lane.workAvailableSemaphore = new RBSemaphore("PKTaskExecutor::LaneState::workAvailableSemaphore");
+		lane.numberOfSleepingWorkers.store(0, std::memory_order_relaxed);
+		
+		//Every worker exists before any starts, so a worker looking for something to steal never sees the list change.
+		for (UInt32 index = 0; index < numberOfWorkers[laneIndex]; index++)
+		{
+			Worker *worker = new Worker();
+			worker->executor = this;
+			worker->lane = Lane(laneIndex);
+			worker->index = index;
+			worker->dequeFront = NULL;
+			worker->dequeBack = NULL;
+			
+			errorCode = pthread_mutex_init(&worker->dequeMutex, NULL);
+			RBAssertNoErr(errorCode, CFSTR("pthread_mutex_init failed with error code %d"), errorCode);
+			
+			char threadName[64];
+			snprintf(threadName, sizeof(threadName), "com.roundabout.playerkit.PKTaskExecutor.%s-%u", laneNames[laneIndex], index);
+			
+			bool isHighPriority = (laneIndex == kLaneHighPriority);
+			worker->thread = new CAPThread(CAPThread::ThreadRoutine(&WorkerThreadCallback), //in threadRoutine
+										   worker, //in threadRoutineUserInfo
+										   isHighPriority? CAPThread::kMaxThreadPriority : CAPThread::kDefaultThreadPriority, //in priority
+										   isHighPriority, //in isPriorityFixed?
+										   true, //in shouldAutoDelete?
+										   threadName); //in threadName
+			
+			lane.workers.push_back(worker);
+		}
+	}
+	
+	for (UInt32 laneIndex = 0; laneIndex < kNumberOfLanes; laneIndex++)
+	{
+		for (std::vector<Worker *>::iterator worker = mLanes[laneIndex].workers.begin(); worker != mLanes[laneIndex].workers.end(); worker++)
+			(*worker)->thread->Start();
+	}
+}
+
+PKTaskExecutor::~PKTaskExecutor()
+{
+	//Workers run for the life of the process, so there is nothing to take down here.
+}
+
+#pragma mark -
+#pragma mark Workers
+
+void PKTaskExecutor::PushJob(Worker *worker, Job *job, bool atFront) throw()
+{
+	pthread_mutex_lock(&worker->dequeMutex);
+	
+	//The deque mutex orders everything here, so the links don't need anything stronger than relaxed.
+	if(atFront)
+	{
+		job->previous = NULL;
+		job->next.store(worker->dequeFront, std::memory_order_relaxed);
+		if(worker->dequeFront)
+			worker->dequeFront->previous = job;
+		else
+			worker->dequeBack = job;
+		
+		worker->dequeFront = job;
+	}
+	else
+	{
+		job->next.store(NULL, std::memory_order_relaxed);
+		job->previous = worker->dequeBack;
+		if(worker->dequeBack)
+			worker->dequeBack->next.store(job, std::memory_order_relaxed);
+		else
+			worker->dequeFront = job;
+		
+		worker->dequeBack = job;
+	}
+	
+	pthread_mutex_unlock(&worker->dequeMutex);
+}
+
+PKTaskExecutor::Job *PKTaskExecutor::PopJob(Worker *worker, bool fromFront) throw()
+{
+	pthread_mutex_lock(&worker->dequeMutex);
+	
+	Job *job = fromFront? worker->dequeFront : worker->dequeBack;
+	if(job)
+	{
+		Job *next = job->next.load(std::memory_order_relaxed);
+		if(job->previous)
+			job->previous->next.store(next, std::memory_order_relaxed);
+		else
+			worker->dequeFront = next;
+		
+		if(next)
+			next->previous = job->previous;
+		else
+			worker->dequeBack = job->previous;
+		
+		job->next.store(NULL, std::memory_order_relaxed);
+		job->previous = NULL;
+	}
+	
+	pthread_mutex_unlock(&worker->dequeMutex);
+	
+	return job;
+}
+
+PKTaskExecutor::Job *PKTaskExecutor::FindJob(Worker *worker) throw()
+{
+	//A worker runs its own jobs oldest first, so a task queue that yields goes behind the ones already waiting.
+	Job *job = PopJob(worker, true);
+	if(job)
+		return job;
+	
+	LaneState &lane = mLanes[worker->lane];
+	
+	pthread_mutex_lock(&lane.sharedQueueMutex);
+	job = lane.sharedQueue.Pop();
+	pthread_mutex_unlock(&lane.sharedQueueMutex);
+	
+	if(job)
+		return job;
+	
+	//Thieves take the newest job, the one its owner would have gotten to last.
+	size_t numberOfWorkers = lane.workers.size();
+	for (size_t offset = 1; offset < numberOfWorkers; offset++)
+	{
+		job = PopJob(lane.workers[(worker->index + offset) % numberOfWorkers], false);
+		if(job)
+			return job;
+	}
+	
+	return NULL;
+}
+
+void PKTaskExecutor::WakeWorker(Lane lane) throw()
+{
+	LaneState &laneState = mLanes[lane];
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(laneState.numberOfSleepingWorkers.load(std::memory_order_relaxed) > 0)
+	{
+		try
+		{
+			laneState.workAvailableSemaphore->Signal();
+		}
+		catch (RBException e)
+		{
+			std::cerr << "workAvailableSemaphore->Signal failed with error code " << e.GetCode() << "." << std::endl;
+		}
+	}
+}
+
+void *PKTaskExecutor::WorkerThreadCallback(Worker *worker)
+{
+	//Prevent «auto_zone_thread_registration_error» issues caused by block based tasks.
+	if(objc_registerThreadWithCollector) objc_registerThreadWithCollector();
+	
+	PKTaskExecutor *self = worker->executor;
+	LaneState &lane = self->mLanes[worker->lane];
+	pthread_setspecific(self->mCurrentWorkerKey, worker);
+	
+	for (;;)
+	{
+		Job *job = self->FindJob(worker);
+		if(!job)
+		{
+			//Looking again after saying we're asleep means a job submitted in between either is found, or wakes us.
+			//The fences here and in WakeWorker order each side's write before its read, so the two can't both miss each other.
+			lane.numberOfSleepingWorkers.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			
+			job = self->FindJob(worker);
+			if(!job)
+			{
+				try
+				{
+					lane.workAvailableSemaphore->Wait();
+				}
+				catch (RBException e)
+				{
+					std::cerr << "workAvailableSemaphore->Wait failed with error code " << e.GetCode() << "." << std::endl;
+				}
+			}
+			
+			lane.numberOfSleepingWorkers.fetch_sub(1, std::memory_order_acq_rel);
+			
+			if(!job)
+				continue;
+		}
+		
+		try
+		{
+			job->proc(job->userInfo);
+		}
+		catch (...)
+		{
+			std::cerr << "An unexpected exception was raised in a PKTaskExecutor job." << std::endl;
+		}
+	}
+	
+	return NULL;
+}
+
+#pragma mark -
+#pragma mark Submitting Jobs
+
+void PKTaskExecutor::Submit(Job *job, Lane lane) throw()
+{
+	if(!job || (lane >= kNumberOfLanes))
+		return;
+	
+	//Work a worker submits to its own lane stays on that worker, where it's most likely to find its data in cache.
+	Worker *currentWorker = (Worker *)pthread_getspecific(mCurrentWorkerKey);
+	if(currentWorker && (currentWorker->executor == this) && (currentWorker->lane == lane))
+	{
+		PushJob(currentWorker, job, false);
+	}
+	else
+	{
+		job->previous = NULL;
+		mLanes[lane].sharedQueue.Push(job);
+	}
+	
+	this->WakeWorker(lane);
+}
+
+void PKTaskExecutor::Async(Lane lane, JobBlock block) throw()
+{
+	if(!block || (lane >= kNumberOfLanes))
+		return;
+	
+	BlockJob *blockJob = new BlockJob();
+	blockJob->job.proc = JobProc(&BlockJobForwarder);
+	blockJob->job.userInfo = blockJob;
+	blockJob->block = Block_copy(block);
+	
+	this->Submit(&blockJob->job, lane);
+}
+
+void PKTaskExecutor::Apply(size_t count, Lane lane, ApplyBlock block) throw()
+{
+	if(!block || (count == 0) || (lane >= kNumberOfLanes))
+		return;
+	
+	ApplyState state;
+	state.block = block;
+	state.count = count;
+	state.nextIndex.store(0, std::memory_order_relaxed);
+	state.jobFinishedSemaphore = NULL;
+	
+	//A worker waiting on its own lane could be waiting on jobs queued behind itself.
+	Worker *currentWorker = (Worker *)pthread_getspecific(mCurrentWorkerKey);
+	bool isWorkerInLane = (currentWorker && (currentWorker->executor == this) && (currentWorker->lane == lane));
+	
+	//The calling thread takes one share of the iterations itself.
+	size_t numberOfJobs = isWorkerInLane? 0 : std::min(count, mLanes[lane].workers.size() + 1) - 1;
+	std::vector<Job> jobs(numberOfJobs);
+	if(numberOfJobs > 0)
+	{
+		try
+		{
+			state.jobFinishedSemaphore = new RBSemaphore("PKTaskExecutor::Apply::jobFinishedSemaphore");
+		}
+		catch (RBException e)
+		{
+			numberOfJobs = 0;
+		}
+	}
+	
+	for (size_t index = 0; index < numberOfJobs; index++)
+	{
+		jobs[index].proc = JobProc(&ApplyJobForwarder);
+		jobs[index].userInfo = &state;
+		this->Submit(&jobs[index], lane);
+	}
+	
+	ApplyIterations(&state);
+	
+	//The jobs point into this stack frame, so every one has to have finished, even the ones that found nothing left.
+	for (size_t index = 0; index < numberOfJobs; index++)
+	{
+		try
+		{
+			state.jobFinishedSemaphore->Wait();
+		}
+		catch (RBException e)
+		{
+			std::cerr << "jobFinishedSemaphore->Wait failed with error code " << e.GetCode() << "." << std::endl;
+		}
+	}
+	
+	if(state.jobFinishedSemaphore)
+		state.jobFinishedSemaphore->Release();
+}
+
+UInt32 PKTaskExecutor::GetNumberOfWorkers(Lane lane) const throw()
+{
+	return (lane < kNumberOfLanes)? UInt32(mLanes[lane].workers.size()) : 0;
+}
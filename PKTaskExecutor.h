@@ -0,0 +1,217 @@
+/*
+ *  PKTaskExecutor.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKTaskExecutor_h
+#define PKTaskExecutor_h 1
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+
+#include "RBLockableObject.h"
+#include "RBAtomic.h"
+
+class CAPThread;
+
+/*!
+ @class
+ @abstract		The PKTaskExecutor class runs jobs on a small pool of worker threads shared by the whole process.
+ @discussion	Workers are split into lanes. The high priority lane runs at the fixed, maximum thread priority and
+				is kept for work that feeds the render thread, everything else shares the normal lane. Each worker
+				has a deque of its own: jobs submitted from a worker go onto its deque, jobs submitted from
+				anywhere else go onto the lane's shared queue, and a worker that runs out of jobs steals from the
+				other workers in its lane before going to sleep. Submitting a job from outside of a lane never
+				takes a lock, a worker submitting to its own lane briefly locks its own deque.
+				
+				Jobs are intrusive, they are linked into the executor through the Job struct itself, so the
+				executor never allocates to take one. A job must not be submitted again until it has started.
+ */
+class PK_VISIBILITY_HIDDEN PKTaskExecutor : public RBLockableObject
+{
+public:
+	/*!
+	 @enum
+	 @abstract	The lanes jobs can be submitted to.
+	 */
+	enum Lane {
+		/*!
+		 @abstract	Workers at the default thread priority.
+		 */
+		kLaneNormal = 0,
+		
+		/*!
+		 @abstract	Workers at the maximum thread priority, for work the render thread is waiting on.
+		 */
+		kLaneHighPriority,
+		
+		kNumberOfLanes,
+	};
+	
+	/*!
+	 @typedef
+	 @abstract		The prototype functions must match to be used as jobs.
+	 @discussion	Any C++ exceptions thrown by a JobProc will be consumed and ignored.
+	 */
+	typedef void(*JobProc)(void *userInfo);
+	
+	/*!
+	 @typedef
+	 @abstract		The prototype blocks must match to be run with Async.
+	 @discussion	Any C++ exceptions thrown by a JobBlock will be consumed and ignored.
+	 */
+	typedef void(^JobBlock)();
+	
+	/*!
+	 @typedef
+	 @abstract		The prototype blocks must match to be run with Apply.
+	 @discussion	Any C++ exceptions thrown by an ApplyBlock will be consumed and ignored.
+	 */
+	typedef void(^ApplyBlock)(size_t index);
+	
+	/*!
+	 @abstract		The Job struct describes a unit of work, and links it into the executor while it waits to run.
+	 @discussion	The `next` and `previous` fields belong to the executor while the job is submitted.
+	 */
+	struct Job {
+		JobProc proc;
+		void *userInfo;
+		std::atomic<Job *> next;
+		Job *previous;
+	};
+
+protected:
+	/*!
+	 @abstract	The Worker struct describes one worker thread and its deque.
+	 */
+	struct Worker {
+		PKTaskExecutor *executor;
+		Lane lane;
+		UInt32 index;
+		
+		pthread_mutex_t dequeMutex;
+		Job *dequeFront;
+		Job *dequeBack;
+		
+		CAPThread *thread;
+	};
+	
+	/*!
+	 @abstract		The LaneState struct describes the workers of one lane and the jobs submitted to it from outside of them.
+	 @discussion	Jobs are pushed onto the shared queue without locking, so submitting from the audio threads never
+					blocks. The workers take turns popping from it under `sharedQueueMutex`.
+	 */
+	struct LaneState {
+		std::vector<Worker *> workers;
+		
+		RBAtomicQueue<Job> sharedQueue;
+		pthread_mutex_t sharedQueueMutex;
+		
+		RBSemaphore *workAvailableSemaphore;
+		std::atomic<int32_t> numberOfSleepingWorkers;
+	};
+	
+	/* n/a */	LaneState mLanes[kNumberOfLanes];
+	/* n/a */	pthread_key_t mCurrentWorkerKey;
+	
+	/*!
+	 @abstract	Construct an executor with a specified number of workers in each lane, and start them.
+	 */
+	explicit PKTaskExecutor(const UInt32 numberOfWorkers[kNumberOfLanes]) throw(RBException);
+	
+	/*!
+	 @abstract	The executor is shared for the life of the process, and is never destructed.
+	 */
+	virtual ~PKTaskExecutor();
+	
+#pragma mark -
+#pragma mark Workers
+	
+	/*!
+	 @abstract	Add a job to the front or back of a worker's deque.
+	 */
+	static void PushJob(Worker *worker, Job *job, bool atFront) throw();
+	
+	/*!
+	 @abstract	Remove the job from the front or back of a worker's deque, returning NULL if it is empty.
+	 */
+	static Job *PopJob(Worker *worker, bool fromFront) throw();
+	
+	/*!
+	 @abstract	Find the next job for a worker: from its own deque, then from its lane's shared queue, then from the other workers in its lane.
+	 */
+	Job *FindJob(Worker *worker) throw();
+	
+	/*!
+	 @abstract	Wake up a sleeping worker in a specified lane, if there is one.
+	 */
+	void WakeWorker(Lane lane) throw();
+	
+	/*!
+	 @abstract	The implementation of the worker threads.
+	 */
+	static void *WorkerThreadCallback(Worker *worker);
+
+public:
+
+#pragma mark -
+#pragma mark Lifecycle
+	
+	/*!
+	 @abstract	Returns the executor shared by every task queue in the process, creating it if necessary.
+	 */
+	static PKTaskExecutor *SharedExecutor() throw();
+	
+	/*!
+	 @abstract		Set the number of workers the shared executor starts in a specified lane.
+	 @discussion	This has no effect once the shared executor has been created. Passing 0 restores the default of
+					one normal worker per processor, and two high priority workers.
+	 */
+	static void SetDefaultNumberOfWorkers(Lane lane, UInt32 numberOfWorkers) throw();
+	
+#pragma mark -
+#pragma mark Submitting Jobs
+	
+	/*!
+	 @abstract		Submit a job to run on a worker in a specified lane.
+	 @param			job		The job to run. Required. Must stay valid until it has started running.
+	 @param			lane	The lane whose workers run the job.
+	 @discussion	There is no ordering between jobs, serial execution is provided by PKTaskQueue.
+	 */
+	void Submit(Job *job, Lane lane) throw();
+	
+	/*!
+	 @abstract		Run a block on a worker in a specified lane.
+	 @param			lane	The lane whose workers run the block.
+	 @param			block	The block to run. Required.
+	 @discussion	Unlike Submit this allocates a job to carry the block, so it is not for use on the audio threads.
+	 */
+	void Async(Lane lane, JobBlock block) throw();
+	
+	/*!
+	 @abstract		Apply a block once for each index up to a specified count on the workers in a specified lane, waiting for them all.
+	 @param			count	The number of times to apply the block.
+	 @param			lane	The lane whose workers apply the block.
+	 @param			block	The block to apply. Required.
+	 @discussion	The calling thread applies the block too, so the iterations finish even when every worker is busy.
+					Called from a worker in the lane, the block is applied on that worker alone.
+	 */
+	void Apply(size_t count, Lane lane, ApplyBlock block) throw();
+	
+	/*!
+	 @abstract	Returns the number of workers in a specified lane.
+	 */
+	UInt32 GetNumberOfWorkers(Lane lane) const throw();
+
+private:
+	PKTaskExecutor(PKTaskExecutor &executor);
+	PKTaskExecutor &operator=(PKTaskExecutor &executor);
+};
+
+#endif /* PKTaskExecutor_h */
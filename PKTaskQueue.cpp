@@ -8,17 +8,38 @@
  */
 
 #include "PKTaskQueue.h"
-#include "CAPThread.h"
-#include <dlfcn.h>
+#include <stddef.h>
+#include <iostream>
 
-//We load the objc_[un]registerThreadWithCollector functions at runtime
-//so we don't have to link the objc runtime in PlayerKit.
-typedef void(*ObjCGarbageCollectorProc)();
+#pragma mark PKTaskQueue
 
-static ObjCGarbageCollectorProc objc_registerThreadWithCollector = (ObjCGarbageCollectorProc)dlsym(RTLD_DEFAULT, "objc_registerThreadWithCollector");
-static ObjCGarbageCollectorProc objc_unregisterThreadWithCollector = (ObjCGarbageCollectorProc)dlsym(RTLD_DEFAULT, "objc_unregisterThreadWithCollector");
+static pthread_key_t ThreadSemaphoreKey;
+static pthread_once_t ThreadSemaphoreKeyOnce = PTHREAD_ONCE_INIT;
 
-#pragma mark PKTaskQueue
+static void ReleaseThreadSemaphore(void *semaphore)
+{
+	((RBSemaphore *)semaphore)->Release();
+}
+
+static void CreateThreadSemaphoreKey()
+{
+	pthread_key_create(&ThreadSemaphoreKey, &ReleaseThreadSemaphore);
+}
+
+///Returns the semaphore the calling thread waits on for synchronous tasks, creating it if necessary.
+static RBSemaphore *GetCurrentThreadSemaphore()
+{
+	pthread_once(&ThreadSemaphoreKeyOnce, &CreateThreadSemaphoreKey);
+	
+	RBSemaphore *semaphore = (RBSemaphore *)pthread_getspecific(ThreadSemaphoreKey);
+	if(!semaphore)
+	{
+		semaphore = new RBSemaphore("PKTaskQueue::ThreadSemaphore");
+		pthread_setspecific(ThreadSemaphoreKey, semaphore);
+	}
+	
+	return semaphore;
+}
 
 static void TaskBlockForwarder(void *userInfo)
 {
@@ -30,18 +51,28 @@ static void TaskBlockForwarder(void *userInfo)
 #pragma mark -
 #pragma mark Constructor/Destructor
 
-PKTaskQueue::PKTaskQueue(const char *name) :
+PKTaskQueue::PKTaskQueue(const char *name, PKTaskExecutor::Lane lane) :
 	RBLockableObject("PKTaskQueue"), 
 	
 	mName(strdup(name)), 
+	mLane(lane), 
 	
-	mQueueTasks(), 
-	mIsCancelled(false), 
+	mQueuedTasks(), 
+	mNumberOfQueuedTasks(0), 
 	
-	mSleepSemaphore("PKTaskQueue::mSleepSemaphore"), 
-	mProcessingThread(NULL)
+	mFreeTasks(offsetof(QueuedTask, nextFree)), 
+	
+	mProcessingJob(), 
+	mProcessingThread()
 {
+	for (UInt32 index = 0; index < kNumberOfPooledTasks; index++)
+	{
+		mTaskPool[index].isPooled = true;
+		mFreeTasks.push_atomic(&mTaskPool[index]);
+	}
 	
+	mProcessingJob.proc = PKTaskExecutor::JobProc(&ProcessingJobCallback);
+	mProcessingJob.userInfo = this;
 }
 
 PKTaskQueue::~PKTaskQueue()
@@ -59,81 +90,104 @@ CFStringRef PKTaskQueue::CopyDescription()
 }
 
 #pragma mark -
-#pragma mark Processing Thread
+#pragma mark Processing
 
-void PKTaskQueue::StartProcessingThread()
+PKTaskQueue::QueuedTask *PKTaskQueue::TakePooledTask(TaskProc proc, void *userInfo) throw()
 {
-	Acquisitor lock(this);
-	mIsCancelled = false;
-	
-	if(!mProcessingThread)
+	QueuedTask *task = (QueuedTask *)mFreeTasks.pop_atomic();
+	if(!task)
 	{
-		mProcessingThread = new CAPThread(CAPThread::ThreadRoutine(&ProcessingThreadCallback), //in threadRoutine
-										  this, //in threadRoutineUserInfo
-										  CAPThread::kMaxThreadPriority, //in priority
-										  true, //in isPriorityFixed?
-										  true); //in shouldAutoDelete?
-		mProcessingThread->Start();
+		//The pool is sized so this only happens when a queue is backed up far beyond what playback needs.
+		task = new QueuedTask();
+		task->isPooled = false;
 	}
+	
+	task->proc = proc;
+	task->userInfo = userInfo;
+	task->completionSemaphore = NULL;
+	
+	return task;
 }
 
-void PKTaskQueue::StopProcessingThread()
+void PKTaskQueue::EnqueueTask(QueuedTask *task) throw()
 {
-	mIsCancelled = true;
-	mSleepSemaphore.SignalIf(^(int value) { return value > 1; });
+	mQueuedTasks.Push(task);
+	
+	//The task that makes the queue non-empty is the one that gets it processed.
+	if(mNumberOfQueuedTasks.fetch_add(1, std::memory_order_acq_rel) == 0)
+		this->SubmitProcessingJob();
 }
 
-#pragma mark -
-
-void *PKTaskQueue::ProcessingThreadCallback(PKTaskQueue *self)
+void PKTaskQueue::SubmitProcessingJob() throw()
 {
-	//Prevent «auto_zone_thread_registration_error» issues caused by `TaskBlockForwarder`.
-	if(objc_registerThreadWithCollector) objc_registerThreadWithCollector();
-	
-	self->Retain();
+	//The job keeps the queue alive until it has run out of tasks.
+	this->Retain();
 	
-	pthread_setname_np(self->mName);
+	PKTaskExecutor::SharedExecutor()->Submit(&mProcessingJob, mLane);
+}
+
+void PKTaskQueue::ProcessingJobCallback(PKTaskQueue *self)
+{
+	self->mProcessingThread = pthread_self();
 	
-	while (!self->mIsCancelled)
+	for (UInt32 numberOfTasksRun = 0; ; numberOfTasksRun++)
 	{
-		while (self->mQueueTasks.size() > 0)
+		//A busy queue goes to the back of the line every so often, so it can't keep the other queues in its lane waiting.
+		if(numberOfTasksRun == kMaximumNumberOfTasksPerTurn)
+			break;
+		
+		//The task that was counted may not be reachable yet if the thread queuing it is half way through.
+		QueuedTask *task = self->mQueuedTasks.Pop();
+		if(!task)
+			break;
+		
+		try
 		{
-			QueuedTask *topTask = NULL;
-			{
-				Acquisitor lock(self);
-				
-				topTask = self->mQueueTasks.front();
-				self->mQueueTasks.pop();
-			}
+			task->proc(task->userInfo);
+		}
+		catch (...)
+		{
+			std::cerr << "An unexpected exception was raised in the PKTaskQueue named " << self->mName << std::endl;
+		}
+		
+		if(task->completionSemaphore)
+		{
+			//The waiting thread can return, and exit, the moment it is signalled, so the semaphore is kept alive until we're done with it.
+			RBSemaphore *completionSemaphore = task->completionSemaphore;
+			completionSemaphore->Retain();
 			
 			try
 			{
-				(*topTask)();
+				completionSemaphore->Signal();
 			}
-			catch (...)
+			catch (RBException e)
 			{
-				std::cerr << "An unexpected exception was raised in the PKTaskQueue named " << self->mName << std::endl;
+				std::cerr << "completionSemaphore->Signal failed with error code " << e.GetCode() << "." << std::endl;
 			}
 			
-			topTask->Release();
+			completionSemaphore->Release();
 		}
-		
-		try
+		else if(task->isPooled)
 		{
-			self->mSleepSemaphore.Wait();
+			self->mFreeTasks.push_atomic(task);
 		}
-		catch (RBException e)
+		else
 		{
-			std::cerr << "mSleepSemaphore.Wait failed with error code " << e.GetCode() << ". Aborting." << std::endl;
+			delete task;
+		}
+		
+		if(self->mNumberOfQueuedTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			self->mProcessingThread = pthread_t();
+			self->Release();
+			
+			return;
 		}
 	}
 	
-	self->mProcessingThread = NULL;
-	self->Release();
-	
-	if(objc_unregisterThreadWithCollector) objc_unregisterThreadWithCollector();
-	
-	return NULL;
+	//There are still tasks waiting, so the job goes back to the executor holding on to its retain.
+	self->mProcessingThread = pthread_t();
+	PKTaskExecutor::SharedExecutor()->Submit(&self->mProcessingJob, self->mLane);
 }
 
 #pragma mark -
@@ -143,19 +197,7 @@ void PKTaskQueue::Async(TaskProc proc, void *userInfo)
 {
 	RBParameterAssert(proc);
 	
-	Acquisitor lock(this);
-	
-	//Start the processing thread if it hasn't been already
-	if(!mProcessingThread)
-		this->StartProcessingThread();
-	
-	QueuedTask *task = new QueuedTask(proc, userInfo, true);
-	mQueueTasks.push(task);
-	
-	//Prevent «auto_zone_thread_registration_error» issues caused by `RBSemaphore::SignalIf`.
-	if(objc_registerThreadWithCollector) objc_registerThreadWithCollector();
-	
-	mSleepSemaphore.SignalIf(^(int value) { return value > 0; });
+	this->EnqueueTask(this->TakePooledTask(proc, userInfo));
 }
 
 void PKTaskQueue::Async(TaskBlock block)
@@ -171,40 +213,22 @@ void PKTaskQueue::Sync(TaskProc proc, void *userInfo)
 {
 	RBParameterAssert(proc);
 	
-	Acquisitor lock(this);
-	
-	//Start the processing thread if it hasn't been already
-	if(!mProcessingThread)
-		this->StartProcessingThread();
-	
-	QueuedTask *task = new QueuedTask(proc, userInfo, true);
-	
-	//We retain the task so it can't be destroyed out from underneath us if it's processed and released
-	task->Retain();
-	
-	mQueueTasks.push(task);
-	
-	//Prevent «auto_zone_thread_registration_error» issues caused by `RBSemaphore::SignalIf`.
-	if(objc_registerThreadWithCollector) objc_registerThreadWithCollector();
-	
-	try
+	//A task waiting on its own queue would wait forever, so it runs here instead.
+	if(pthread_equal(mProcessingThread, pthread_self()))
 	{
-		mSleepSemaphore.SignalIf(^(int value) { return value > 0; });
-		
-		//We relinquish `lock` before waiting for a signal so we don't cause a deadlock
-		lock.Relinquish();
-		
-		task->WaitForApplication();
-	}
-	catch (...)
-	{
-		//Balance the above retain
-		task->Release();
-		throw;
+		proc(userInfo);
+		return;
 	}
 	
-	//Balance the above retain
-	task->Release();
+	QueuedTask task;
+	task.proc = proc;
+	task.userInfo = userInfo;
+	task.isPooled = false;
+	task.completionSemaphore = GetCurrentThreadSemaphore();
+	
+	this->EnqueueTask(&task);
+	
+	task.completionSemaphore->Wait();
 }
 
 void PKTaskQueue::Sync(TaskBlock block)
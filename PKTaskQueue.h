@@ -10,21 +10,26 @@
 #ifndef PKTaskQueue_h
 #define PKTaskQueue_h
 
-#include <queue>
+#include <pthread.h>
 #include <Block.h>
+#include <atomic>
 
 #include "RBObject.h"
 #include "RBAtomic.h"
 #include "RBException.h"
-
-class CAPThread;
+#include "PKTaskExecutor.h"
+#include "CAAtomicStack.h"
 
 /*!
  @class
- @abstract		The PKTaskQueue class is a simple FIFO task queue that executes tasks on a secondary worker thread.
- @discussion	Internally PKTaskQueue is simply an std::queue, an RBSemaphore, and a CAPThread. When a task
-				is added to a queue, it is injected into the std::queue of the receiver, and the RBSemaphore
-				is signalled to wake up the CAPThread.
+ @abstract		The PKTaskQueue class is a simple FIFO task queue that executes tasks one at a time on the shared PKTaskExecutor.
+ @discussion	Internally PKTaskQueue is simply an RBAtomicQueue and a PKTaskExecutor job. When a task is added
+				to a queue that has nothing waiting, the job is submitted to the queue's lane of the shared
+				executor, and runs the queue's tasks in order until the queue is empty. Task queues do not
+				have threads of their own, so any number of them can share the executor's workers.
+				
+				Queuing an asynchronous task takes neither a lock nor an allocation, so it is safe to do
+				from the audio threads.
  */
 class PKTaskQueue : public RBLockableObject
 {
@@ -49,114 +54,75 @@ protected:
 #pragma mark -Protected
 	
 	/*!
-	 @class
-	 @abstract	The QueuedTask functor class is used to represent tasks in PKTaskQueue's task-queue.
+	 @abstract		The QueuedTask struct describes a task waiting in a PKTaskQueue.
+	 @discussion	Asynchronous tasks are taken from the queue's pool, synchronous tasks live on the stack
+					of the thread waiting for them, so queuing a task doesn't allocate.
 	 */
-	class QueuedTask : public RBObject
-	{
-	protected:
-		
-		TaskProc mImplementation;
-		void *mUserInfo;
-		RBSemaphore *mSignalSemaphore;
-		
-	public:
-		
-#pragma mark Constructor/Destructor
-		
-		/*!
-		 @abstract		The one and only constructor.
-		 @param			implementation	The function that provides the implementation of this task
-		 @param			userInfo		The value to pass to `implementation`
-		 @param			isSynchronous	Whether or not this task is to be executed synchronously
-		 @discussion	Synchronous tasks have an internal semaphore that is signalled after their implementation
-						is applied. When a synchronous task is queued, `WaitForApplication` should be called on it.
-		 */
-		QueuedTask(TaskProc implementaton, void *userInfo, bool isSynchronous) : 
-			RBObject("PKTaskQueue::QueuedTask"), 
-			mImplementation(implementaton), 
-			mUserInfo(userInfo), 
-			mSignalSemaphore(NULL)
-		{
-			if(isSynchronous)
-				mSignalSemaphore = new RBSemaphore("PKTaskQueue::QueuedTask::mSignalSemaphore");
-		}
-		
-		/*!
-		 @abstract		The one and only destructor.
-		 @discussion	If the task is synchronous this will signal its semaphore to prevent deadlock.
-		 */
-		~QueuedTask()
-		{
-			if(mSignalSemaphore)
-			{
-				mSignalSemaphore->SignalIf(^(int value) { return value > 1; });
-				delete mSignalSemaphore;
-			}
-		}
+	struct QueuedTask {
+		std::atomic<QueuedTask *> next;
+		QueuedTask *nextFree;
 		
-#pragma mark -
-#pragma mark Overloads
+		TaskProc proc;
+		void *userInfo;
 		
+		bool isPooled;
+		RBSemaphore *completionSemaphore;
+	};
+	
+	enum {
 		/*!
-		 @method
-		 @abstract		Apply the queued task's implementation.
-		 @discussion	If the receiver is synchronous, this will cause the receiver's semaphore to be signalled.
+		 @abstract	The number of tasks a queue runs before it lets the other jobs in its lane have the worker.
 		 */
-		void operator()()
-		{
-			mImplementation(mUserInfo);
-			
-			if(mSignalSemaphore)
-				mSignalSemaphore->SignalIf(^(int value) { return value > 1; });
-		}
-		
-#pragma mark -
-#pragma mark Waiting
+		kMaximumNumberOfTasksPerTurn = 32,
 		
 		/*!
-		 @method
-		 @abstract		Block the calling thread until the receiver is applied.
-		 @discussion	This method does nothing for asynchronous tasks.
+		 @abstract	The number of asynchronous tasks a queue can hold before it has to allocate.
 		 */
-		void WaitForApplication() const throw(RBException)
-		{
-			if(mSignalSemaphore && (mSignalSemaphore->GetInstantaneousValue() == 1))
-				mSignalSemaphore->Wait();
-		}
+		kNumberOfPooledTasks = 128,
 	};
 	
 	/* owner */	const char *mName;
+	/* n/a */	PKTaskExecutor::Lane mLane;
+	
+	/* n/a */	RBAtomicQueue<QueuedTask> mQueuedTasks;
+	/* n/a */	std::atomic<int32_t> mNumberOfQueuedTasks;
 	
-	/* n/a */	std::queue</* strong */ QueuedTask *> mQueueTasks;
-	/* n/a */	RBAtomicBool mIsCancelled;
+	/* n/a */	QueuedTask mTaskPool[kNumberOfPooledTasks];
+	/* n/a */	CAAtomicStack mFreeTasks;
 	
-	/* n/a */	RBSemaphore mSleepSemaphore;
-	/* weak */	CAPThread *mProcessingThread;
+	/* n/a */	PKTaskExecutor::Job mProcessingJob;
+	/* n/a */	pthread_t mProcessingThread;
 	
 #pragma mark -
-#pragma mark Processing Thread
+#pragma mark Processing
 	
 	/*!
 	 @method
-	 @abstract	Start the receiver's processing thread if it isn't already running.
+	 @abstract		Returns a task from the receiver's pool, or a new one if the pool is empty.
 	 */
-	void StartProcessingThread();
+	QueuedTask *TakePooledTask(TaskProc proc, void *userInfo) throw();
 	
 	/*!
 	 @method
-	 @abstract	Stop the receiver's processing thread if it's running.
+	 @abstract		Add a task to the back of the receiver, submitting the processing job if the receiver was empty.
+	 @discussion	This method neither locks nor allocates.
 	 */
-	void StopProcessingThread();
+	void EnqueueTask(QueuedTask *task) throw();
 	
-#pragma mark -
+	/*!
+	 @method
+	 @abstract		Submit the receiver's processing job to the shared executor.
+	 @discussion	Only one processing job runs at a time, it is submitted when the first task is queued
+					and resubmitted when it gives up its worker with tasks still waiting.
+	 */
+	void SubmitProcessingJob() throw();
 	
 	/*!
 	 @method
-	 @abstract		The implementation of the processing thread.
-	 @discussion	This method processes tasks for task queues.
+	 @abstract		The implementation of the processing job.
+	 @discussion	This method runs the tasks of a task queue on an executor worker.
 	 */
-	static void *ProcessingThreadCallback(PKTaskQueue *self);
+	static void ProcessingJobCallback(PKTaskQueue *self);
 	
 public:
 #pragma mark -Public
@@ -165,8 +131,10 @@ public:
 	
 	/*!
 	 @abstract	The one and only constructor.
+	 @param		name	The name of the queue, used in its description.
+	 @param		lane	The lane of the shared executor the queue's tasks run in.
 	 */
-	PKTaskQueue(const char *name = "");
+	PKTaskQueue(const char *name = "", PKTaskExecutor::Lane lane = PKTaskExecutor::kLaneNormal);
 	
 	/*!
 	 @abstract	The destructor.
@@ -187,7 +155,7 @@ public:
 	 @param			proc		The function to execute asynchronously. May not be NULL.
 	 @param			userInfo	The value to pass as the function's parameter.
 	 @discussion	If this method is called and no other tasks have been queued in the receiver, the receiver's
-					worker thread will be fired as a side effect of the method invocation.
+					processing job will be submitted to the shared executor as a side effect of the method invocation.
 	 */
 	void Async(TaskProc proc, void *userInfo);
 	
@@ -196,7 +164,7 @@ public:
 	 @abstract		Queue up a task block for asynchronous execution
 	 @param			block		The block to execute asynchronously. May not be NULL.
 	 @discussion	If this method is called and no other tasks have been queued in the receiver, the receiver's
-					worker thread will be fired as a side effect of the method invocation.
+					processing job will be submitted to the shared executor as a side effect of the method invocation.
 	 */
 	void Async(TaskBlock block);
 	
@@ -205,19 +173,19 @@ public:
 	/*!
 	 @method
 	 @abstract		Queue up a task function for synchronous execution
-	 @param			proc		The function to execute on the receiver's worker thread. May not be NULL.
+	 @param			proc		The function to execute on one of the shared executor's workers. May not be NULL.
 	 @param			userInfo	The value to pass as the function's parameter.
-	 @discussion	If this method is called and no other tasks have been queued in the receiver, the receiver's
-					worker thread will be fired as a side effect of the method invocation.
+	 @discussion	This method blocks until the function has been applied. When it is called from one of the
+					receiver's own tasks the function is applied immediately, since waiting would never end.
 	 */
 	void Sync(TaskProc proc, void *userInfo);
 	
 	/*!
 	 @method
 	 @abstract		Queue up a task block for synchronous execution
-	 @param			proc		The block to execute on the receiver's worker thread. May not be NULL.
-	 @discussion	If this method is called and no other tasks have been queued in the receiver, the receiver's
-					worker thread will be fired as a side effect of the method invocation.
+	 @param			proc		The block to execute on one of the shared executor's workers. May not be NULL.
+	 @discussion	This method blocks until the block has been applied. When it is called from one of the
+					receiver's own tasks the block is applied immediately, since waiting would never end.
 	 */
 	void Sync(TaskBlock block);
 	
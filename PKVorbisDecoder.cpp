@@ -0,0 +1,134 @@
+/*
+ *  PKVorbisDecoder.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#include "PKVorbisDecoder.h"
+
+#if PK_ENABLE_OGG
+
+static const char kVorbisSignature[] = { 0x01, 'v', 'o', 'r', 'b', 'i', 's' };
+
+#pragma mark Lifetime
+
+PKVorbisDecoder::PKVorbisDecoder(PKByteSource *source) throw(RBException) :
+	PKOggDecoder("PKVorbisDecoder", source, kVorbisSignature, sizeof(kVorbisSignature)),
+	mNumberOfHeadersRead(0),
+	mSynthesisIsInitialized(false)
+{
+	vorbis_info_init(&mInfo);
+	vorbis_comment_init(&mComment);
+	
+	this->Open();
+}
+
+PKVorbisDecoder::~PKVorbisDecoder()
+{
+	if(mSynthesisIsInitialized)
+	{
+		vorbis_block_clear(&mBlock);
+		vorbis_dsp_clear(&mDSPState);
+		mSynthesisIsInitialized = false;
+	}
+	
+	vorbis_comment_clear(&mComment);
+	vorbis_info_clear(&mInfo);
+}
+
+#pragma mark -
+#pragma mark Subclass Hooks
+
+bool PKVorbisDecoder::ReadHeaderPacket(ogg_packet &packet) throw(RBException)
+{
+	//The identification, comment and setup headers come in that order.
+	RBAssert((vorbis_synthesis_headerin(&mInfo, &mComment, &packet) == 0),
+			 CFSTR("Vorbis header %ld is damaged."), mNumberOfHeadersRead);
+	
+	if(++mNumberOfHeadersRead < 3)
+		return false;
+	
+	RBAssert((vorbis_synthesis_init(&mDSPState, &mInfo) == 0), CFSTR("Could not initialize Vorbis synthesis."));
+	vorbis_block_init(&mDSPState, &mBlock);
+	mSynthesisIsInitialized = true;
+	
+	mStreamFormat.mSampleRate = Float64(mInfo.rate);
+	mNumberOfChannels = UInt32(mInfo.channels);
+	
+	return true;
+}
+
+void PKVorbisDecoder::DecodePacket(ogg_packet &packet) throw(RBException)
+{
+	//Damaged packets are skipped.
+	if(vorbis_synthesis(&mBlock, &packet) == 0)
+		vorbis_synthesis_blockin(&mDSPState, &mBlock);
+	
+	float **samples = NULL;
+	int numberOfFrames = 0;
+	while ((numberOfFrames = vorbis_synthesis_pcmout(&mDSPState, &samples)) > 0)
+	{
+		UInt32 index = this->AppendDecodedFrames(UInt32(numberOfFrames));
+		for (UInt32 channel = 0; channel < mNumberOfChannels; channel++)
+			memcpy(mDecodedBuffers[channel] + index, samples[channel], numberOfFrames * sizeof(Float32));
+		
+		vorbis_synthesis_read(&mDSPState, numberOfFrames);
+	}
+}
+
+void PKVorbisDecoder::ResetDecoder() throw(RBException)
+{
+	vorbis_synthesis_restart(&mDSPState);
+}
+
+SInt64 PKVorbisDecoder::GetFrameForGranulePosition(SInt64 granulePosition) const throw()
+{
+	return granulePosition;
+}
+
+UInt32 PKVorbisDecoder::GetSeekPreroll() const throw()
+{
+	//The first packet after a restart only primes the overlap, which can be as long as a long block.
+	return UInt32(vorbis_info_blocksize(const_cast<vorbis_info *>(&mInfo), 1));
+}
+
+SInt64 PKVorbisDecoder::GetInitialFrame() const throw()
+{
+	return 0;
+}
+
+#pragma mark -
+#pragma mark Description
+
+static bool CanDecode(CFURLRef fileLocation)
+{
+	return PKOggDecoder::ContainsStream(fileLocation, kVorbisSignature, sizeof(kVorbisSignature));
+}
+
+static PKDecoder::ProbeResult Probe(const UInt8 *header, UInt32 headerLength, CFStringRef pathExtension)
+{
+	return PKOggDecoder::ProbeHeader(header, headerLength, kVorbisSignature, sizeof(kVorbisSignature));
+}
+
+static CFArrayRef CopySupportedTypes()
+{
+	CFStringRef types[] = { CFSTR("org.xiph.ogg-vorbis"), CFSTR("org.xiph.oga") };
+	return CFArrayCreate(kCFAllocatorDefault, (const void **)types, 2, &kCFTypeArrayCallBacks);
+}
+
+static PKDecoder *CreateInstance(CFURLRef fileLocation) throw(RBException)
+{
+	return PKFileReader::CreateDecoder<PKVorbisDecoder>(fileLocation);
+}
+
+static PKDecoder *CreateInstanceWithByteSource(PKByteSource *source) throw(RBException)
+{
+	return new PKVorbisDecoder(source);
+}
+
+PKDecoder::Description PKVorbisDecoderDescription = { &CanDecode, &CopySupportedTypes, &CreateInstance, &Probe, &CreateInstanceWithByteSource };
+
+#endif /* PK_ENABLE_OGG */
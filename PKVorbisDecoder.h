@@ -0,0 +1,68 @@
+/*
+ *  PKVorbisDecoder.h
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+#ifndef PKVorbisDecoder_h
+#define PKVorbisDecoder_h 1
+
+#include "PKOggDecoder.h"
+
+#if PK_ENABLE_OGG
+
+#include <vorbis/codec.h>
+
+/*!
+ @class
+ @abstract		The PKVorbisDecoder class decodes Ogg Vorbis files with libvorbis.
+ @discussion	libvorbis synthesizes non-interleaved Float32 samples, which are copied across as is.
+ */
+class PK_VISIBILITY_HIDDEN PKVorbisDecoder : public PKOggDecoder
+{
+protected:
+	
+	/* n/a */	vorbis_info mInfo;
+	/* n/a */	vorbis_comment mComment;
+	/* n/a */	vorbis_dsp_state mDSPState;
+	/* n/a */	vorbis_block mBlock;
+	/* n/a */	UInt32 mNumberOfHeadersRead;
+	/* n/a */	bool mSynthesisIsInitialized;
+	
+#pragma mark -
+#pragma mark Subclass Hooks
+	
+	virtual bool ReadHeaderPacket(ogg_packet &packet) throw(RBException);
+	virtual void DecodePacket(ogg_packet &packet) throw(RBException);
+	virtual void ResetDecoder() throw(RBException);
+	virtual SInt64 GetFrameForGranulePosition(SInt64 granulePosition) const throw();
+	virtual UInt32 GetSeekPreroll() const throw();
+	virtual SInt64 GetInitialFrame() const throw();
+
+public:
+
+#pragma mark Lifetime
+	
+	/*!
+	 @abstract	Construct a Vorbis decoder reading from a specified byte source.
+	 */
+	explicit PKVorbisDecoder(PKByteSource *source) throw(RBException);
+	
+	/*!
+	 @abstract	Destruct the decoder.
+	 */
+	virtual ~PKVorbisDecoder();
+
+private:
+	PKVorbisDecoder(PKVorbisDecoder &decoder);
+	PKVorbisDecoder &operator=(PKVorbisDecoder &decoder);
+};
+
+extern PKDecoder::Description PKVorbisDecoderDescription;
+
+#endif /* PK_ENABLE_OGG */
+
+#endif /* PKVorbisDecoder_h */
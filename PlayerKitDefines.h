@@ -51,6 +51,19 @@
  */
 #define PK_FLAG_IS_SET(field, flag) ((flag & field) == flag)
 
+#pragma mark -
+#pragma mark Build Options
+
+/*!
+ @defined	PK_ENABLE_OGG
+ @abstract	Whether or not the Ogg Vorbis and Ogg Opus decoders are built.
+ @discussion	These decoders require libogg, libvorbis and libopus to be linked into PlayerKit,
+				so they are off unless PK_ENABLE_OGG is defined as 1 in the build settings.
+ */
+#ifndef PK_ENABLE_OGG
+#	define PK_ENABLE_OGG 0
+#endif /* PK_ENABLE_OGG */
+
 #pragma mark -
 #pragma mark Constants
 
@@ -8,7 +8,17 @@
  */
 
 #include "RBAtomic.h"
+
+#if defined(__APPLE__)
 #include <mach/mach_init.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+#include <algorithm>
 
 const RBAtomicBool RBAtomicBool::True(true);
 const RBAtomicBool RBAtomicBool::False(false);
@@ -17,58 +27,139 @@ const RBAtomicBool RBAtomicBool::False(false);
 
 #pragma mark Constructor/Destructor
 
-RBSemaphore::RBSemaphore(const char *name) : 
+RBSemaphore::RBSemaphore(const char *name, int32_t initialCount) : 
 	RBObject("RBSemaphore"),
-	mMachSemaphore(NULL),
-	mValue(0)
+	mCount(initialCount)
 {
+#if defined(__APPLE__)
+	mMachSemaphore = NULL;
+	
 	int errorCode = semaphore_create(mach_task_self(), &mMachSemaphore, SYNC_POLICY_FIFO, 0);
 	RBAssertNoErr(errorCode, CFSTR("semaphore_create failed with error %d"), errorCode);
+#elif defined(__linux__)
+	mNumberOfWakeups.store(0, std::memory_order_relaxed);
+#else
+	int errorCode = sem_init(&mPosixSemaphore, 0, 0);
+	RBAssertNoErr(errorCode, CFSTR("sem_init failed with error %d"), errno);
+#endif
 }
 
 RBSemaphore::~RBSemaphore()
 {
+#if defined(__APPLE__)
 	if(mMachSemaphore)
 	{
 		semaphore_destroy(mach_task_self(), mMachSemaphore);
 		mMachSemaphore = NULL;
 	}
+#elif !defined(__linux__)
+	sem_destroy(&mPosixSemaphore);
+#endif
 }
 
 #pragma mark -
-#pragma mark Signalling
+#pragma mark Sleeping
 
-void RBSemaphore::Wait() throw(RBException)
+void RBSemaphore::SleepInKernel() throw(RBException)
 {
-	mValue.Increment();
+#if defined(__APPLE__)
+	int errorCode = KERN_SUCCESS;
+	do {
+		errorCode = semaphore_wait(mMachSemaphore);
+	} while (errorCode == KERN_ABORTED);
 	
-	int errorCode = semaphore_wait(mMachSemaphore);
 	RBAssertNoErr(errorCode, CFSTR("semaphore_wait failed with error code %d"), errorCode);
+#elif defined(__linux__)
+	for (;;)
+	{
+		int32_t numberOfWakeups = mNumberOfWakeups.load(std::memory_order_acquire);
+		if(numberOfWakeups > 0)
+		{
+			if(mNumberOfWakeups.compare_exchange_weak(numberOfWakeups, numberOfWakeups - 1, std::memory_order_acquire))
+				return;
+			
+			continue;
+		}
+		
+		//The kernel only puts us to sleep if there are still no wake ups by the time it looks.
+		if((syscall(SYS_futex, (int32_t *)&mNumberOfWakeups, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0) == -1) && (errno != EAGAIN) && (errno != EINTR))
+			RBAssertNoErr(errno, CFSTR("futex wait failed with error code %d"), errno);
+	}
+#else
+	while (sem_wait(&mPosixSemaphore) == -1)
+	{
+		if(errno != EINTR)
+			RBAssertNoErr(errno, CFSTR("sem_wait failed with error code %d"), errno);
+	}
+#endif
 }
 
-void RBSemaphore::Signal() throw(RBException)
+void RBSemaphore::WakeInKernel(int32_t numberOfThreads) throw(RBException)
 {
-	mValue.Decrement();
+#if defined(__APPLE__)
+	for (int32_t index = 0; index < numberOfThreads; index++)
+	{
+		int errorCode = semaphore_signal(mMachSemaphore);
+		RBAssertNoErr(errorCode, CFSTR("semaphore_signal failed with error code %d"), errorCode);
+	}
+#elif defined(__linux__)
+	mNumberOfWakeups.fetch_add(numberOfThreads, std::memory_order_release);
 	
-	int errorCode = semaphore_signal(mMachSemaphore);
-	RBAssertNoErr(errorCode, CFSTR("semaphore_signal failed with error code %d"), errorCode);
+	if(syscall(SYS_futex, (int32_t *)&mNumberOfWakeups, FUTEX_WAKE_PRIVATE, numberOfThreads, NULL, NULL, 0) == -1)
+		RBAssertNoErr(errno, CFSTR("futex wake failed with error code %d"), errno);
+#else
+	for (int32_t index = 0; index < numberOfThreads; index++)
+	{
+		if(sem_post(&mPosixSemaphore) == -1)
+			RBAssertNoErr(errno, CFSTR("sem_post failed with error code %d"), errno);
+	}
+#endif
 }
 
-void RBSemaphore::SignalIf(bool(^predicate)(int value)) throw(RBException)
+#pragma mark -
+#pragma mark Signalling
+
+void RBSemaphore::Wait() throw(RBException)
 {
-	if(predicate(this->GetInstantaneousValue()))
-	   this->Signal();
+	//A signal that's on its way is much cheaper to wait for here than asleep.
+	for (int spin = 0; spin < kNumberOfSpins; spin++)
+	{
+		if(this->TryWait())
+			return;
+	}
+	
+	if(mCount.fetch_sub(1, std::memory_order_acquire) <= 0)
+		this->SleepInKernel();
 }
 
-#pragma mark -
-#pragma mark Properties
+bool RBSemaphore::TryWait() throw()
+{
+	int32_t count = mCount.load(std::memory_order_relaxed);
+	while (count > 0)
+	{
+		//A failed exchange puts the current count in `count`.
+		if(mCount.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return true;
+	}
+	
+	return false;
+}
 
-int RBSemaphore::GetInstantaneousValue() const throw(RBException)
+void RBSemaphore::Signal(int32_t count) throw(RBException)
 {
-	return mValue.GetValue();
+	if(count <= 0)
+		return;
+	
+	//Only the threads the count says are asleep need waking, the rest of the signal is left for future waits.
+	int32_t previousCount = mCount.fetch_add(count, std::memory_order_release);
+	if(previousCount < 0)
+		this->WakeInKernel(std::min(count, -previousCount));
 }
 
-semaphore_t RBSemaphore::GetMachSemaphore() const throw()
+#pragma mark -
+#pragma mark Properties
+
+int RBSemaphore::GetInstantaneousValue() const throw()
 {
-	return mMachSemaphore;
+	return mCount.load(std::memory_order_relaxed);
 }
@@ -11,10 +11,14 @@
 #define RBAtomic_h 1
 
 #include <CoreFoundation/CoreFoundation.h>
-#include <libKern/OSAtomic.h>
+#include <atomic>
 
+#if defined(__APPLE__)
 #include <mach/semaphore.h>
 #include <mach/task.h>
+#elif !defined(__linux__)
+#include <semaphore.h>
+#endif
 
 #include "RBObject.h"
 #include "RBLockableObject.h"
@@ -23,48 +27,49 @@
 /*!
  @class
  @abstract		This class represents a simple atomic counter.
- @discussion	This class is used to keep the number of active samples
-				synchronized between scheduled audio slices in PKAudioPlayerEngine.
+ @discussion	This class is used to keep the number of active samples synchronized between scheduled
+				audio slices in PKAudioPlayerEngine. Changes to the counter release, and reads of it acquire,
+				so work done before a change is visible to any thread that reads the changed value.
  */
-class RBAtomicCounter : public RBLockableObject
+class RBAtomicCounter : public RBObject
 {
-	int32_t mValue;
+	std::atomic<int32_t> mValue;
 public:
 	/*!
 	 @ctor
 	 @abstract	Create an atomic counter with a default value of 0.
 	 */
-	RBAtomicCounter(int value = 0) :
-		RBLockableObject("RBAtomicCounter"),
+	RBAtomicCounter(int32_t value = 0) :
+		RBObject("RBAtomicCounter"),
 		mValue(value)
 	{
 	}
 	
 	/*!
 	 @method
-	 @abstract	Increment the receiver.
+	 @abstract	Increment the receiver, returning its new value.
 	 */
-	void Increment()
+	int32_t Increment()
 	{
-		OSAtomicIncrement32Barrier(&mValue);
+		return mValue.fetch_add(1, std::memory_order_acq_rel) + 1;
 	}
 	
 	/*!
 	 @method
-	 @abstract	Decrement the receiver.
+	 @abstract	Decrement the receiver, returning its new value.
 	 */
-	void Decrement()
+	int32_t Decrement()
 	{
-		OSAtomicDecrement32Barrier(&mValue);
+		return mValue.fetch_sub(1, std::memory_order_acq_rel) - 1;
 	}
 	
 	/*!
 	 @method
-	 @abstract	Add n to the receiver.
+	 @abstract	Add n to the receiver, returning its new value.
 	 */
-	void Add(int32_t value)
+	int32_t Add(int32_t value)
 	{
-		OSAtomicAdd32Barrier(value, &mValue);
+		return mValue.fetch_add(value, std::memory_order_acq_rel) + value;
 	}
 	
 	/*!
@@ -73,7 +78,7 @@ public:
 	 */
 	void SetValue(int32_t value)
 	{
-		OSAtomicCompareAndSwap32Barrier(mValue, value, &mValue);
+		mValue.store(value, std::memory_order_release);
 	}
 	
 	/*!
@@ -82,8 +87,7 @@ public:
 	 */
 	int32_t GetValue() const
 	{
-		OSMemoryBarrier();
-		return mValue;
+		return mValue.load(std::memory_order_acquire);
 	}
 	
 	virtual bool IsEqualTo(RBAtomicCounter *other)
@@ -96,46 +100,39 @@ public:
 
 /*!
  @class
- @abstract	RBAtomicBool is a drop in replacement for the built-in C++ bool type
-			that uses atomic reads and writes.
+ @abstract		RBAtomicBool is a drop in replacement for the built-in C++ bool type
+				that uses atomic reads and writes.
+ @discussion	Writes release and reads acquire. An atomic bool is as small as a bool,
+				and is meant to be embedded by value.
  */
-class RBAtomicBool : public RBLockableObject
+class RBAtomicBool
 {
 protected:
-	int32_t mValue;
+	std::atomic<bool> mValue;
 	
 public:
 	//! @abstract	The default constructor.
 	RBAtomicBool(bool value = false) :
-		RBLockableObject("RBAtomicBool"),
-		mValue(value? 1 : 0)
+		mValue(value)
 	{
 	}
 	
 	//! @abstract	The copy constructor.
-	RBAtomicBool(RBAtomicBool &other) :
-		RBLockableObject("RBAtomicBool"),
-		mValue(other.GetValue()? 1 : 0)
+	RBAtomicBool(const RBAtomicBool &other) :
+		mValue(other.GetValue())
 	{
 	}
 	
 	//! @abstract	Set the value of an atomic bool.
 	void SetValue(bool value)
 	{
-		int32_t newValue = value? 1 : 0;
-		OSAtomicCompareAndSwap32Barrier(mValue, newValue, &mValue);
+		mValue.store(value, std::memory_order_release);
 	}
 	
 	//! @abstract	Get the value of an atomic bool.
 	bool GetValue() const
 	{
-		OSMemoryBarrier();
-		return (mValue == 1)? true : false;
-	}
-	
-	virtual bool IsEqualTo(RBAtomicBool *other)
-	{
-		return this->GetValue() == other->GetValue();
+		return mValue.load(std::memory_order_acquire);
 	}
 	
 #pragma mark -
@@ -154,22 +151,22 @@ public:
 	}
 	
 	//! @abstract	Assign a new value to an atomic bool.
-	RBAtomicBool &operator=(RBAtomicBool &value)
+	RBAtomicBool &operator=(const RBAtomicBool &value)
 	{
 		this->SetValue(value.GetValue());
 		return *this;
 	}
 	
 	//! @abstract	Whether or not the receiver is equal to another bool.
-	bool operator==(RBAtomicBool &other) const
+	bool operator==(const RBAtomicBool &other) const
 	{
 		return GetValue() == other.GetValue();
 	}
 	
 	//! @abstract	Whether or not the receiver is not equal to another bool.
-	bool operator!=(RBAtomicBool &other) const
+	bool operator!=(const RBAtomicBool &other) const
 	{
-		return GetValue() == other.GetValue();
+		return GetValue() != other.GetValue();
 	}
 	
 #pragma mark -
@@ -183,32 +180,147 @@ public:
 
 #pragma mark -
 
+/*!
+ @class
+ @abstract		RBSemaphore is a counting semaphore that only enters the kernel when a thread has to sleep, or be woken.
+ @discussion	The count is kept in user space, where a negative count is the number of threads waiting. Waiting
+				spins on the count for a little while before sleeping, and signalling a semaphore nobody is
+				waiting on is a single atomic add. Sleeping threads are parked on a futex on Linux, on a mach
+				semaphore on Darwin, and on a POSIX semaphore everywhere else.
+ */
 class RBSemaphore : public RBObject
 {
 protected:
 	
+	enum {
+		//The number of times Wait looks at the count before it goes to sleep.
+		kNumberOfSpins = 100,
+	};
+	
+	std::atomic<int32_t> mCount;
+	
+#if defined(__APPLE__)
 	semaphore_t mMachSemaphore;
-	RBAtomicCounter mValue;
+#elif defined(__linux__)
+	std::atomic<int32_t> mNumberOfWakeups;
+#else
+	sem_t mPosixSemaphore;
+#endif
+	
+	void SleepInKernel() throw(RBException);
+	void WakeInKernel(int32_t numberOfThreads) throw(RBException);
 	
 public:
 	
 #pragma mark Constructor/Destructor
 	
-	RBSemaphore(const char *name = "");
+	RBSemaphore(const char *name = "", int32_t initialCount = 0);
 	virtual ~RBSemaphore();
 	
 #pragma mark -
 #pragma mark Signalling
 	
+	//! @abstract	Take one from the count, sleeping until another thread signals if there is nothing to take.
 	void Wait() throw(RBException);
-	void Signal() throw(RBException);
-	void SignalIf(bool(^predicate)(int value)) throw(RBException);
+	
+	//! @abstract	Take one from the count if there is something to take, without waiting. Returns whether or not one was taken.
+	bool TryWait() throw();
+	
+	//! @abstract	Add a specified number to the count, waking up to that many waiting threads with one call into the kernel.
+	void Signal(int32_t count = 1) throw(RBException);
 	
 #pragma mark -
 #pragma mark Properties
 	
-	int GetInstantaneousValue() const throw(RBException);
-	semaphore_t GetMachSemaphore() const throw();
+	//! @abstract	Returns the count of the receiver. A negative count is the number of threads waiting.
+	int GetInstantaneousValue() const throw();
+	
+private:
+	RBSemaphore(RBSemaphore &semaphore);
+	RBSemaphore &operator=(RBSemaphore &semaphore);
+};
+
+#pragma mark -
+
+/*!
+ @class
+ @abstract		RBAtomicQueue is an intrusive FIFO queue that any number of threads can push onto without locking,
+				and that one thread at a time can pop from.
+ @discussion	Nodes are linked through their own `next` field, which must be a `std::atomic<Node *>`, so the
+				queue never allocates. A push is a single exchange followed by a store. While a push is half
+				way through, Pop can return NULL even though the queue is not empty; callers that need to know
+				how many nodes are waiting should count pushes themselves.
+ */
+template <typename Node>
+class RBAtomicQueue
+{
+protected:
+	Node mStub;
+	std::atomic<Node *> mNewest;
+	Node *mOldest;
+
+public:
+	//! @abstract	Construct an empty queue.
+	RBAtomicQueue() :
+		mStub(),
+		mNewest(&mStub),
+		mOldest(&mStub)
+	{
+		mStub.next.store(NULL, std::memory_order_relaxed);
+	}
+	
+	//! @abstract	Add a node to the back of the queue. Safe to call from any thread.
+	void Push(Node *node) throw()
+	{
+		node->next.store(NULL, std::memory_order_relaxed);
+		
+		Node *previous = mNewest.exchange(node, std::memory_order_acq_rel);
+		
+		//Until this store lands the node is in the queue, but can't be reached from the front of it.
+		previous->next.store(node, std::memory_order_release);
+	}
+	
+	//! @abstract	Remove the node at the front of the queue, returning NULL if there isn't one that can be reached yet.
+	//! @discussion	Only one thread may pop at a time.
+	Node *Pop() throw()
+	{
+		Node *oldest = mOldest;
+		Node *next = oldest->next.load(std::memory_order_acquire);
+		if(oldest == &mStub)
+		{
+			if(!next)
+				return NULL;
+			
+			mOldest = next;
+			oldest = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		
+		if(next)
+		{
+			mOldest = next;
+			return oldest;
+		}
+		
+		if(oldest != mNewest.load(std::memory_order_acquire))
+			return NULL;
+		
+		//The last node can only be taken once the stub is behind it, so the back of the queue is never empty.
+		this->Push(&mStub);
+		
+		next = oldest->next.load(std::memory_order_acquire);
+		if(next)
+		{
+			mOldest = next;
+			return oldest;
+		}
+		
+		return NULL;
+	}
+
+private:
+	RBAtomicQueue(RBAtomicQueue &queue);
+	RBAtomicQueue &operator=(RBAtomicQueue &queue);
 };
 
 #endif /* RBAtomic_h */
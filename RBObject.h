@@ -9,9 +9,13 @@
 #ifndef RBObject_h
 #define RBObject_h 1
 
+#if defined(__APPLE__)
 #include <CoreFoundation/CoreFoundation.h>
-#include <libKern/OSAtomic.h>
+#endif /* defined(__APPLE__) */
+#include <atomic>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
 
 #ifndef PK_FINAL
 #	define PK_FINAL
@@ -39,7 +43,7 @@ class RBObject
 {
 protected:
 	const char *mClassName;
-	mutable int32_t mRetainCount;
+	mutable std::atomic<int32_t> mRetainCount;
 	
 public:
 	/*!
@@ -51,8 +55,8 @@ public:
 	 appropriate description..
 	 */
 	RBObject(const char *className = "RBObject") :
-	mRetainCount(1),
-	mClassName(strdup(className))
+	mClassName(strdup(className)),
+	mRetainCount(1)
 	{
 		
 	}
@@ -72,7 +76,7 @@ public:
 	 @method
 	 @abstract	The retain count of the object.
 	 */
-	int32_t GetRetainCount() const { return mRetainCount; }
+	int32_t GetRetainCount() const { return mRetainCount.load(std::memory_order_relaxed); }
 	
 	/*!
 	 @method
@@ -80,7 +84,7 @@ public:
 	 */
 	void Retain() const
 	{
-		OSAtomicIncrement32((volatile int32_t *)&mRetainCount);
+		mRetainCount.fetch_add(1, std::memory_order_relaxed);
 	}
 	
 	/*!
@@ -89,13 +93,14 @@ public:
 	 */
 	void Release() const
 	{
-		OSAtomicDecrement32((volatile int32_t *)&mRetainCount);
-		if(mRetainCount == 0)
+		//Only the thread that drops the last reference may delete, and it must see every other thread's writes.
+		if(mRetainCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
 			delete this;
 	}
 	
 #pragma mark Describing
 	
+#if defined(__APPLE__)
 	/*!
 	 @method
 	 @abstract	Copy the description of the receiver.
@@ -104,6 +109,7 @@ public:
 	{
 		return CFStringCreateWithFormat(kCFAllocatorDefault, NULL, CFSTR("<%s:%p>"), mClassName, this);
 	}
+#endif /* defined(__APPLE__) */
 	
 	/*!
 	 @method
@@ -0,0 +1,526 @@
+/*
+ *  PKRenderCoreTests.cpp
+ *  PlayerKit
+ *
+ *  Created by Peter MacWhinnie on 10/16/11.
+ *  Copyright 2011 Roundabout Software. All rights reserved.
+ *
+ */
+
+//
+//	PlayerKitRenderCoreTests runs the portable half of the render path headless: a fixture is
+//	scheduled into a PKPullRenderCore slice by slice, converted, run through an effect, and
+//	pulled out into the null and WAV render sinks faster than real time.
+//
+//	usage: PlayerKitRenderCoreTests [scratch directory]
+//
+//	Nothing here needs Core Audio or Core Foundation, so these run on every build machine.
+//	The process exits with a non-zero status if any test fails.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "PKPullRenderCore.h"
+#include "PKRenderSink.h"
+
+#pragma mark Tools
+
+static int gNumberOfFailures = 0;
+
+#define PKTestAssert(condition, ...) ({ \
+	if(!(condition)) \
+	{ \
+		fprintf(stderr, "%s:%d: %s failed: ", __FILE__, __LINE__, __FUNCTION__); \
+		fprintf(stderr, __VA_ARGS__); \
+		fputc('\n', stderr); \
+		gNumberOfFailures++; \
+		return; \
+	} \
+})
+
+static Float64 const kSampleRate = 44100.0;
+static UInt32 const kNumberOfChannels = 2;
+static UInt32 const kFramesPerRenderCycle = 512;
+static UInt32 const kFramesPerSlice = 4096;
+static UInt32 const kNumberOfSlices = 4;
+
+static AudioStreamBasicDescription MakeFormat(UInt32 formatFlags, UInt32 bitsPerChannel, UInt32 numberOfChannels)
+{
+	AudioStreamBasicDescription format;
+	memset(&format, 0, sizeof(format));
+	
+	bool isNonInterleaved = ((formatFlags & kAudioFormatFlagIsNonInterleaved) != 0);
+	
+	format.mSampleRate = kSampleRate;
+	format.mFormatID = kAudioFormatLinearPCM;
+	format.mFormatFlags = formatFlags | kAudioFormatFlagIsPacked;
+	format.mBitsPerChannel = bitsPerChannel;
+	format.mChannelsPerFrame = numberOfChannels;
+	format.mFramesPerPacket = 1;
+	format.mBytesPerFrame = (bitsPerChannel / 8) * (isNonInterleaved? 1 : numberOfChannels);
+	format.mBytesPerPacket = format.mBytesPerFrame;
+	
+	return format;
+}
+
+//The format PlayerKit renders in.
+static AudioStreamBasicDescription MakeCanonicalFormat()
+{
+	return MakeFormat(kAudioFormatFlagIsFloat | kAudioFormatFlagIsNonInterleaved, 32, kNumberOfChannels);
+}
+
+static AudioBufferList *CreateBuffers(const AudioStreamBasicDescription &format, UInt32 numberOfFrames)
+{
+	bool isNonInterleaved = ((format.mFormatFlags & kAudioFormatFlagIsNonInterleaved) != 0);
+	UInt32 numberOfBuffers = isNonInterleaved? format.mChannelsPerFrame : 1;
+	
+	AudioBufferList *buffers = (AudioBufferList *)calloc(1, sizeof(AudioBufferList) + (sizeof(AudioBuffer) * numberOfBuffers));
+	buffers->mNumberBuffers = numberOfBuffers;
+	for (UInt32 index = 0; index < numberOfBuffers; index++)
+	{
+		buffers->mBuffers[index].mNumberChannels = isNonInterleaved? 1 : format.mChannelsPerFrame;
+		buffers->mBuffers[index].mDataByteSize = numberOfFrames * format.mBytesPerFrame;
+		buffers->mBuffers[index].mData = calloc(numberOfFrames, format.mBytesPerFrame);
+	}
+	
+	return buffers;
+}
+
+static void DestroyBuffers(AudioBufferList *buffers)
+{
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+		free(buffers->mBuffers[index].mData);
+	
+	free(buffers);
+}
+
+static void ResetBufferSizes(AudioBufferList *buffers, const AudioStreamBasicDescription &format, UInt32 numberOfFrames)
+{
+	for (UInt32 index = 0; index < buffers->mNumberBuffers; index++)
+		buffers->mBuffers[index].mDataByteSize = numberOfFrames * format.mBytesPerFrame;
+}
+
+static AudioTimeStamp MakeTimeStamp(Float64 sampleTime)
+{
+	AudioTimeStamp timeStamp;
+	memset(&timeStamp, 0, sizeof(timeStamp));
+	timeStamp.mSampleTime = sampleTime;
+	timeStamp.mFlags = kAudioTimeStampSampleTimeValid;
+	
+	return timeStamp;
+}
+
+#pragma mark -
+#pragma mark Fixture
+
+/*!
+ @abstract		The Fixture struct is a short stereo 16 bit interleaved recording, and the state of playing it through a render core.
+ @discussion	Slices are scheduled the way PKAudioPlayerEngine schedules them: a few at a time, each one refilled with
+				the next part of the fixture and scheduled again from its completion proc, on the render thread.
+ */
+struct Fixture {
+	AudioStreamBasicDescription format;
+	std::vector<SInt16> samples;
+	UInt32 numberOfFrames;
+	
+	PKRenderCore *renderCore;
+	ScheduledAudioSlice slices[kNumberOfSlices];
+	AudioBufferList *sliceBuffers[kNumberOfSlices];
+	UInt32 nextFrameToSchedule;
+	UInt32 numberOfFramesCompleted;
+	UInt32 numberOfLateSlices;
+	OSStatus scheduleErrorCode;
+};
+
+static void FixtureScheduleSlice(Fixture *fixture, ScheduledAudioSlice *slice);
+
+static void FixtureSliceDidComplete(void *userData, ScheduledAudioSlice *slice)
+{
+	Fixture *fixture = (Fixture *)userData;
+	fixture->numberOfFramesCompleted += slice->mNumberFrames;
+	if(slice->mFlags & kScheduledAudioSliceFlag_BeganToRenderLate)
+		fixture->numberOfLateSlices++;
+	
+	FixtureScheduleSlice(fixture, slice);
+}
+
+static void FixtureScheduleSlice(Fixture *fixture, ScheduledAudioSlice *slice)
+{
+	if(fixture->nextFrameToSchedule >= fixture->numberOfFrames)
+		return;
+	
+	UInt32 numberOfFrames = fixture->numberOfFrames - fixture->nextFrameToSchedule;
+	if(numberOfFrames > kFramesPerSlice)
+		numberOfFrames = kFramesPerSlice;
+	
+	memcpy(slice->mBufferList->mBuffers[0].mData,
+		   &fixture->samples[fixture->nextFrameToSchedule * kNumberOfChannels],
+		   numberOfFrames * fixture->format.mBytesPerFrame);
+	slice->mBufferList->mBuffers[0].mDataByteSize = numberOfFrames * fixture->format.mBytesPerFrame;
+	
+	slice->mTimeStamp = MakeTimeStamp(fixture->nextFrameToSchedule);
+	slice->mNumberFrames = numberOfFrames;
+	
+	fixture->nextFrameToSchedule += numberOfFrames;
+	
+	OSStatus errorCode = fixture->renderCore->ScheduleSlice(slice);
+	if(errorCode != noErr)
+		fixture->scheduleErrorCode = errorCode;
+}
+
+static void FixtureInitialize(Fixture *fixture, PKRenderCore *renderCore, UInt32 numberOfFrames)
+{
+	fixture->format = MakeFormat(kAudioFormatFlagIsSignedInteger, 16, kNumberOfChannels);
+	fixture->numberOfFrames = numberOfFrames;
+	fixture->samples.resize(numberOfFrames * kNumberOfChannels);
+	
+	//A different tone in each channel, so crossed channels are caught.
+	for (UInt32 frame = 0; frame < numberOfFrames; frame++)
+	{
+		fixture->samples[(frame * kNumberOfChannels) + 0] = SInt16(16000.0 * sin(2.0 * M_PI * 440.0 * frame / kSampleRate));
+		fixture->samples[(frame * kNumberOfChannels) + 1] = SInt16(-8000.0 * sin(2.0 * M_PI * 660.0 * frame / kSampleRate));
+	}
+	
+	fixture->renderCore = renderCore;
+	fixture->nextFrameToSchedule = 0;
+	fixture->numberOfFramesCompleted = 0;
+	fixture->numberOfLateSlices = 0;
+	fixture->scheduleErrorCode = noErr;
+	
+	for (UInt32 index = 0; index < kNumberOfSlices; index++)
+	{
+		memset(&fixture->slices[index], 0, sizeof(ScheduledAudioSlice));
+		fixture->sliceBuffers[index] = CreateBuffers(fixture->format, kFramesPerSlice);
+		fixture->slices[index].mBufferList = fixture->sliceBuffers[index];
+		fixture->slices[index].mCompletionProc = &FixtureSliceDidComplete;
+		fixture->slices[index].mCompletionProcUserData = fixture;
+	}
+}
+
+static void FixtureStart(Fixture *fixture)
+{
+	for (UInt32 index = 0; index < kNumberOfSlices; index++)
+		FixtureScheduleSlice(fixture, &fixture->slices[index]);
+	
+	fixture->renderCore->SetStartSampleTime(-1.0);
+}
+
+static void FixtureDestroy(Fixture *fixture)
+{
+	for (UInt32 index = 0; index < kNumberOfSlices; index++)
+		DestroyBuffers(fixture->sliceBuffers[index]);
+}
+
+//Returns the sample a channel of the fixture should be rendered as with a gain applied.
+static Float32 FixtureExpectedSample(const Fixture *fixture, UInt32 frame, UInt32 channel, Float32 gain)
+{
+	return (Float32(fixture->samples[(frame * kNumberOfChannels) + channel]) * (1.0f / 32768.0f)) * gain;
+}
+
+//Pull the whole fixture out of its render core into a sink, the way PKAudioPlayerEngine::RenderToSink does.
+static OSStatus FixtureRenderToSink(Fixture *fixture, PKRenderSink *sink, Float64 firstSampleTime)
+{
+	AudioStreamBasicDescription outputFormat = MakeCanonicalFormat();
+	OSStatus errorCode = sink->Open(outputFormat);
+	if(errorCode != noErr)
+		return errorCode;
+	
+	AudioBufferList *buffers = CreateBuffers(outputFormat, kFramesPerRenderCycle);
+	
+	Float64 sampleTime = firstSampleTime;
+	UInt32 numberOfFramesRendered = 0;
+	while (numberOfFramesRendered < fixture->numberOfFrames)
+	{
+		UInt32 numberOfFrames = fixture->numberOfFrames - numberOfFramesRendered;
+		if(numberOfFrames > kFramesPerRenderCycle)
+			numberOfFrames = kFramesPerRenderCycle;
+		
+		ResetBufferSizes(buffers, outputFormat, kFramesPerRenderCycle);
+		
+		AudioUnitRenderActionFlags actionFlags = 0;
+		AudioTimeStamp timeStamp = MakeTimeStamp(sampleTime);
+		errorCode = fixture->renderCore->Render(&actionFlags, &timeStamp, numberOfFrames, buffers);
+		if(errorCode != noErr)
+			break;
+		
+		errorCode = sink->Write(buffers, numberOfFrames);
+		if(errorCode != noErr)
+			break;
+		
+		sampleTime += numberOfFrames;
+		numberOfFramesRendered += numberOfFrames;
+	}
+	
+	DestroyBuffers(buffers);
+	
+	OSStatus closeErrorCode = sink->Close();
+	
+	return (errorCode != noErr)? errorCode : closeErrorCode;
+}
+
+static UInt32 ReadLittleEndian32(const UInt8 *source)
+{
+	return UInt32(source[0]) | (UInt32(source[1]) << 8) | (UInt32(source[2]) << 16) | (UInt32(source[3]) << 24);
+}
+
+static UInt16 ReadLittleEndian16(const UInt8 *source)
+{
+	return UInt16(source[0]) | UInt16(source[1] << 8);
+}
+
+#pragma mark -
+#pragma mark Tests
+
+static char const *gScratchDirectory = "/tmp";
+
+//The fixture is converted, run through a gain, and arrives in the null sink whole and on time.
+static void TestRenderFixtureToNullSink()
+{
+	PKPullRenderCore *renderCore = new PKPullRenderCore();
+	PKGainRenderProcessor *gain = new PKGainRenderProcessor(0.5f);
+	
+	Fixture fixture;
+	FixtureInitialize(&fixture, renderCore, 5 * kSampleRate);
+	
+	OSStatus errorCode = renderCore->SetStreamFormats(fixture.format, MakeCanonicalFormat());
+	PKTestAssert((errorCode == noErr), "SetStreamFormats returned %d", int(errorCode));
+	
+	errorCode = renderCore->AddProcessor(gain);
+	PKTestAssert((errorCode == noErr), "AddProcessor returned %d", int(errorCode));
+	
+	FixtureStart(&fixture);
+	
+	PKNullRenderSink *sink = new PKNullRenderSink();
+	errorCode = FixtureRenderToSink(&fixture, sink, 123456.0);
+	PKTestAssert((errorCode == noErr), "rendering returned %d", int(errorCode));
+	PKTestAssert((fixture.scheduleErrorCode == noErr), "ScheduleSlice returned %d", int(fixture.scheduleErrorCode));
+	
+	PKTestAssert((sink->GetNumberOfFramesWritten() == fixture.numberOfFrames),
+				 "%llu frames written, expected %u", (unsigned long long)sink->GetNumberOfFramesWritten(), fixture.numberOfFrames);
+	PKTestAssert((fixture.numberOfFramesCompleted == fixture.numberOfFrames),
+				 "%u frames completed, expected %u", fixture.numberOfFramesCompleted, fixture.numberOfFrames);
+	PKTestAssert((fixture.numberOfLateSlices == 0), "%u slices began to render late", fixture.numberOfLateSlices);
+	
+	AudioTimeStamp currentPlayTime;
+	renderCore->GetCurrentPlayTime(&currentPlayTime);
+	PKTestAssert((currentPlayTime.mSampleTime == fixture.numberOfFrames), "play time is %f", currentPlayTime.mSampleTime);
+	
+	sink->Release();
+	FixtureDestroy(&fixture);
+	gain->Release();
+	renderCore->Release();
+}
+
+//The WAV sink holds exactly the converted, processed fixture, behind a valid header.
+static void TestRenderFixtureToWAVFileSink()
+{
+	PKPullRenderCore *renderCore = new PKPullRenderCore();
+	PKGainRenderProcessor *gain = new PKGainRenderProcessor(0.5f);
+	
+	Fixture fixture;
+	FixtureInitialize(&fixture, renderCore, 48128);
+	
+	renderCore->SetStreamFormats(fixture.format, MakeCanonicalFormat());
+	renderCore->AddProcessor(gain);
+	FixtureStart(&fixture);
+	
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/PKRenderCoreTests-%d.wav", gScratchDirectory, int(getpid()));
+	
+	PKWAVFileRenderSink *sink = new PKWAVFileRenderSink(path);
+	OSStatus errorCode = FixtureRenderToSink(&fixture, sink, 0.0);
+	sink->Release();
+	PKTestAssert((errorCode == noErr), "rendering to %s returned %d", path, int(errorCode));
+	
+	FILE *file = fopen(path, "rb");
+	PKTestAssert((file != NULL), "could not open %s", path);
+	
+	std::vector<UInt8> contents;
+	UInt8 chunk[4096];
+	size_t numberOfBytesRead = 0;
+	while ((numberOfBytesRead = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		contents.insert(contents.end(), chunk, chunk + numberOfBytesRead);
+	
+	fclose(file);
+	unlink(path);
+	
+	UInt32 dataSize = fixture.numberOfFrames * kNumberOfChannels * sizeof(Float32);
+	PKTestAssert((contents.size() == (44 + dataSize)), "file is %lu bytes, expected %u", (unsigned long)contents.size(), 44 + dataSize);
+	
+	const UInt8 *header = &contents[0];
+	PKTestAssert((memcmp(header + 0, "RIFF", 4) == 0) && (memcmp(header + 8, "WAVE", 4) == 0), "missing RIFF WAVE header");
+	PKTestAssert((ReadLittleEndian32(header + 4) == (36 + dataSize)), "RIFF chunk size is %u", ReadLittleEndian32(header + 4));
+	PKTestAssert((memcmp(header + 12, "fmt ", 4) == 0), "missing fmt chunk");
+	PKTestAssert((ReadLittleEndian16(header + 20) == 3), "format is %u, expected IEEE float", ReadLittleEndian16(header + 20));
+	PKTestAssert((ReadLittleEndian16(header + 22) == kNumberOfChannels), "%u channels", ReadLittleEndian16(header + 22));
+	PKTestAssert((ReadLittleEndian32(header + 24) == UInt32(kSampleRate)), "sample rate is %u", ReadLittleEndian32(header + 24));
+	PKTestAssert((ReadLittleEndian16(header + 34) == 32), "%u bits per sample", ReadLittleEndian16(header + 34));
+	PKTestAssert((memcmp(header + 36, "data", 4) == 0) && (ReadLittleEndian32(header + 40) == dataSize), "bad data chunk");
+	
+	const UInt8 *samples = header + 44;
+	for (UInt32 frame = 0; frame < fixture.numberOfFrames; frame++)
+	{
+		for (UInt32 channel = 0; channel < kNumberOfChannels; channel++)
+		{
+			UInt32 bits = ReadLittleEndian32(samples + (((frame * kNumberOfChannels) + channel) * sizeof(Float32)));
+			Float32 sample;
+			memcpy(&sample, &bits, sizeof(sample));
+			
+			Float32 expectedSample = FixtureExpectedSample(&fixture, frame, channel, 0.5f);
+			PKTestAssert((fabsf(sample - expectedSample) < 1e-6f),
+						 "frame %u channel %u is %f, expected %f", frame, channel, sample, expectedSample);
+		}
+	}
+	
+	FixtureDestroy(&fixture);
+	gain->Release();
+	renderCore->Release();
+}
+
+//Mono slices play on every channel of an interleaved output, and a slice scheduled in the past is flagged late.
+static void TestConvertMonoAndLateSlices()
+{
+	PKPullRenderCore *renderCore = new PKPullRenderCore();
+	
+	AudioStreamBasicDescription sliceFormat = MakeFormat(kAudioFormatFlagIsFloat, 32, 1);
+	AudioStreamBasicDescription outputFormat = MakeFormat(kAudioFormatFlagIsFloat, 32, 2);
+	OSStatus errorCode = renderCore->SetStreamFormats(sliceFormat, outputFormat);
+	PKTestAssert((errorCode == noErr), "SetStreamFormats returned %d", int(errorCode));
+	
+	AudioBufferList *sliceBuffers = CreateBuffers(sliceFormat, kFramesPerRenderCycle);
+	Float32 *sliceSamples = (Float32 *)(sliceBuffers->mBuffers[0].mData);
+	for (UInt32 frame = 0; frame < kFramesPerRenderCycle; frame++)
+		sliceSamples[frame] = Float32(frame) / kFramesPerRenderCycle;
+	
+	ScheduledAudioSlice slice;
+	memset(&slice, 0, sizeof(slice));
+	slice.mTimeStamp = MakeTimeStamp(0.0);
+	slice.mNumberFrames = kFramesPerRenderCycle;
+	slice.mBufferList = sliceBuffers;
+	
+	AudioBufferList *outputBuffers = CreateBuffers(outputFormat, kFramesPerRenderCycle);
+	Float32 *outputSamples = (Float32 *)(outputBuffers->mBuffers[0].mData);
+	
+	//The time line starts halfway through the first slice, so its first half is never heard.
+	renderCore->SetStartSampleTime(1000.0 - (kFramesPerRenderCycle / 2));
+	renderCore->ScheduleSlice(&slice);
+	
+	AudioUnitRenderActionFlags actionFlags = 0;
+	AudioTimeStamp timeStamp = MakeTimeStamp(1000.0);
+	errorCode = renderCore->Render(&actionFlags, &timeStamp, kFramesPerRenderCycle, outputBuffers);
+	PKTestAssert((errorCode == noErr), "Render returned %d", int(errorCode));
+	
+	PKTestAssert((slice.mFlags & kScheduledAudioSliceFlag_Complete), "slice did not complete");
+	PKTestAssert((slice.mFlags & kScheduledAudioSliceFlag_BeganToRenderLate), "slice was not flagged late");
+	
+	for (UInt32 frame = 0; frame < kFramesPerRenderCycle; frame++)
+	{
+		Float32 expectedSample = (frame < (kFramesPerRenderCycle / 2))? sliceSamples[frame + (kFramesPerRenderCycle / 2)] : 0.0f;
+		PKTestAssert((outputSamples[(frame * 2) + 0] == expectedSample) && (outputSamples[(frame * 2) + 1] == expectedSample),
+					 "frame %u is %f/%f, expected %f", frame, outputSamples[(frame * 2) + 0], outputSamples[(frame * 2) + 1], expectedSample);
+	}
+	
+	DestroyBuffers(outputBuffers);
+	DestroyBuffers(sliceBuffers);
+	renderCore->Release();
+}
+
+//Resetting drops scheduled slices without handing them back, and stops the time line.
+static void TestReset()
+{
+	PKPullRenderCore *renderCore = new PKPullRenderCore();
+	
+	Fixture fixture;
+	FixtureInitialize(&fixture, renderCore, kFramesPerSlice * kNumberOfSlices);
+	
+	AudioStreamBasicDescription outputFormat = MakeCanonicalFormat();
+	renderCore->SetStreamFormats(fixture.format, outputFormat);
+	FixtureStart(&fixture);
+	
+	AudioBufferList *buffers = CreateBuffers(outputFormat, kFramesPerRenderCycle);
+	
+	AudioUnitRenderActionFlags actionFlags = 0;
+	AudioTimeStamp timeStamp = MakeTimeStamp(0.0);
+	renderCore->Render(&actionFlags, &timeStamp, kFramesPerRenderCycle, buffers);
+	
+	OSStatus errorCode = renderCore->Reset();
+	PKTestAssert((errorCode == noErr), "Reset returned %d", int(errorCode));
+	
+	AudioTimeStamp currentPlayTime;
+	renderCore->GetCurrentPlayTime(&currentPlayTime);
+	PKTestAssert((currentPlayTime.mSampleTime == -1.0), "play time is %f after reset", currentPlayTime.mSampleTime);
+	
+	//Even once started again, nothing scheduled before the reset is heard or handed back.
+	renderCore->SetStartSampleTime(-1.0);
+	
+	ResetBufferSizes(buffers, outputFormat, kFramesPerRenderCycle);
+	actionFlags = 0;
+	timeStamp = MakeTimeStamp(kFramesPerRenderCycle);
+	renderCore->Render(&actionFlags, &timeStamp, kFramesPerRenderCycle, buffers);
+	
+	PKTestAssert((actionFlags & kAudioUnitRenderAction_OutputIsSilence), "output is not silent after reset");
+	PKTestAssert((fixture.numberOfFramesCompleted == 0), "%u frames were handed back after reset", fixture.numberOfFramesCompleted);
+	
+	const Float32 *samples = (const Float32 *)(buffers->mBuffers[0].mData);
+	for (UInt32 frame = 0; frame < kFramesPerRenderCycle; frame++)
+		PKTestAssert((samples[frame] == 0.0f), "frame %u is %f after reset", frame, samples[frame]);
+	
+	DestroyBuffers(buffers);
+	FixtureDestroy(&fixture);
+	renderCore->Release();
+}
+
+//Formats the core can't convert between are refused up front.
+static void TestUnsupportedFormats()
+{
+	PKPullRenderCore *renderCore = new PKPullRenderCore();
+	
+	AudioStreamBasicDescription sliceFormat = MakeFormat(kAudioFormatFlagIsSignedInteger, 16, 2);
+	AudioStreamBasicDescription integerOutputFormat = MakeFormat(kAudioFormatFlagIsSignedInteger, 16, 2);
+	PKTestAssert((renderCore->SetStreamFormats(sliceFormat, integerOutputFormat) == kAudioUnitErr_FormatNotSupported),
+				 "integer output was accepted");
+	
+	AudioStreamBasicDescription resampledOutputFormat = MakeCanonicalFormat();
+	resampledOutputFormat.mSampleRate = 48000.0;
+	PKTestAssert((renderCore->SetStreamFormats(sliceFormat, resampledOutputFormat) == kAudioUnitErr_FormatNotSupported),
+				 "a sample rate change was accepted");
+	
+	ScheduledAudioSlice slice;
+	memset(&slice, 0, sizeof(slice));
+	AudioBufferList *sliceBuffers = CreateBuffers(sliceFormat, 16);
+	slice.mTimeStamp = MakeTimeStamp(0.0);
+	slice.mNumberFrames = 16;
+	slice.mBufferList = sliceBuffers;
+	PKTestAssert((renderCore->ScheduleSlice(&slice) == kAudioUnitErr_Uninitialized), "a slice was scheduled without formats");
+	
+	DestroyBuffers(sliceBuffers);
+	renderCore->Release();
+}
+
+#pragma mark -
+
+int main(int argc, const char *argv[])
+{
+	if(argc > 1)
+		gScratchDirectory = argv[1];
+	
+	TestRenderFixtureToNullSink();
+	TestRenderFixtureToWAVFileSink();
+	TestConvertMonoAndLateSlices();
+	TestReset();
+	TestUnsupportedFormats();
+	
+	if(gNumberOfFailures > 0)
+	{
+		fprintf(stderr, "%d render core test(s) failed.\n", gNumberOfFailures);
+		return EXIT_FAILURE;
+	}
+	
+	printf("All render core tests passed.\n");
+	return EXIT_SUCCESS;
+}